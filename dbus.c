@@ -7,10 +7,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <ev.h>
 #include <dbus/dbus.h>
 #include <linux/mrp_bridge.h>
 #include "utils.h"
 #include "state_machine.h"
+#include "loop.h"
 #include "dbus.h"
 
 static DBusConnection *conn;
@@ -23,11 +26,38 @@ static const char *port_states[] =
 	[BR_MRP_PORT_STATE_NOT_CONNECTED]	= "Unconnected",
 };
 
-static int dbus_send(char *type, char *text)
+/*
+ * The state changes are notified by the state machines, so they must never
+ * wait for DBus. They are queued into a single producer single consumer ring
+ * per thread and sent by a low priority watcher of the main loop, that
+ * coalesces all the changes of the same port into the last one. The ports of
+ * an instance are all handled by the same thread, so their order is kept.
+ */
+
+#define DBUS_RING_LEN		256	/* must be a power of 2 */
+#define DBUS_BATCH_LEN		64
+
+struct dbus_port_event {
+	char				ifname[IF_NAMESIZE];
+	enum br_mrp_port_state_type	state;
+};
+
+struct dbus_ring {
+	uint32_t			head;	/* written by the producer only */
+	uint32_t			tail;	/* written by the consumer only */
+	struct dbus_port_event		ev[DBUS_RING_LEN];
+};
+
+static struct dbus_ring rings[MRP_MAX_THREADS];
+static uint32_t ring_dropped;
+static ev_async dbus_watcher;
+
+static int dbus_send(const char *type, const char *text)
 {
 	DBusMessage *msg;
 	DBusMessageIter args;
 	dbus_uint32_t serial = 0;
+	int ret = -1;
 
 	/* Create a signal & check for errors */
 	msg = dbus_message_new_signal(MRP_DBUS_PATH, MRP_DBUS_IFACE, type);
@@ -40,85 +70,98 @@ static int dbus_send(char *type, char *text)
 	dbus_message_iter_init_append(msg, &args);
 	if (!dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &text)) {
 		pr_err("cannot append message text");
-		return -1;
+		goto unref;
 	}
 
-	/* Send the message and flush the connection */
+	/* Queue the message, the connection is flushed once per batch */
 	if (!dbus_connection_send(conn, msg, &serial)) {
 		pr_err("cannot send signal");
-		return -1;
+		goto unref;
 	}
-	dbus_connection_flush(conn);
+	ret = 0;
 
-	/* Free the message and close the connection */
+unref:
 	dbus_message_unref(msg);
 
-	return 0;
-
+	return ret;
 }
 
-static int dbus_message_valist(char *type,
-			       char *source, char *event, va_list args)
+static void dbus_flush(EV_P_ ev_async *w, int revents)
 {
-	va_list a;
-	char *s, *text;
-	size_t len;
-	int ret;
-
-	/* Compute how much bytes we need to hold the message */
-	va_copy(a, args);
-	len = strlen(source) + 1;
-	len += strlen(event) + 1;
-	while ((s = va_arg(a, char *)) != NULL)
-		len += strlen(s) + 1;
-	va_end(a);
-
-	/* Allocate the needed memory */
-	text = malloc(len + 1);
-	if (text == NULL) {
-		pr_err("cannot allocate memory");
-		return -1;
-	}
-	text[0] = '\0';
-
-	/* Build the message */
-	strcat(text, source);
-	strcat(text, ":");
-	strcat(text, event);
-	strcat(text, ":");
-	while ((s = va_arg(args, char *)) != NULL) {
-		strcat(text, s);
-		strcat(text, ":");
+	struct dbus_port_event batch[DBUS_BATCH_LEN];
+	struct dbus_port_event *e;
+	uint32_t head, tail, dropped;
+	char text[IF_NAMESIZE + 64];
+	struct dbus_ring *r;
+	int n = 0, i, t;
+
+	for (t = 0; t < MRP_MAX_THREADS; t++) {
+		r = &rings[t];
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+		/* Keep only the last state of each port */
+		for (tail = r->tail; tail != head; tail++) {
+			e = &r->ev[tail & (DBUS_RING_LEN - 1)];
+
+			for (i = 0; i < n; i++)
+				if (strcmp(batch[i].ifname, e->ifname) == 0)
+					break;
+			if (i == n) {
+				if (n == DBUS_BATCH_LEN)
+					break;
+				n++;
+			}
+			batch[i] = *e;
+		}
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+		/* The batch is full, go on at the next iteration */
+		if (tail != head) {
+			ev_async_send(EV_A_ w);
+			break;
+		}
 	}
-	text[len - 1] = '\0';	/* drop the last ':' */
-
-	/* Now send the message */
-	ret = dbus_send(type, text);
-
-	free(text);
-	return ret;
-}
 
-static int dbus_port_event(char *prt, char *event, ...)
-{
-        va_list args;
-        int ret;
+	dropped = __atomic_exchange_n(&ring_dropped, 0, __ATOMIC_RELAXED);
+	if (dropped)
+		pr_warn_ratelimit("dropped %u dbus notifications", dropped);
 
-        va_start(args, event);
-        ret = dbus_message_valist("PortEvent", prt, event, args);
-        va_end(args);
+	for (i = 0; i < n; i++) {
+		snprintf(text, sizeof(text), "%s:StateChanged:%s",
+			 batch[i].ifname, port_states[batch[i].state]);
+		dbus_send("PortEvent", text);
+	}
 
-        return ret;
+	if (n)
+		dbus_connection_flush(conn);
 }
 
 /*
  * Public functions
  */
 
-int dbus_port_state_changed(struct mrp_port *p, int state)
+int dbus_port_state_changed(struct mrp_port *p,
+			    enum br_mrp_port_state_type state)
 {
-	return dbus_port_event(p->ifname,
-		"StateChanged", port_states[state], NULL);
+	struct dbus_ring *r = &rings[mrp_thread_id()];
+	struct dbus_port_event *e;
+	uint32_t head, tail;
+
+	head = r->head;
+	tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	if (head - tail >= DBUS_RING_LEN) {
+		__atomic_add_fetch(&ring_dropped, 1, __ATOMIC_RELAXED);
+		return -ENOBUFS;
+	}
+
+	e = &r->ev[head & (DBUS_RING_LEN - 1)];
+	memcpy(e->ifname, p->ifname, IF_NAMESIZE);
+	e->state = state;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+	ev_async_send(EV_DEFAULT, &dbus_watcher);
+
+	return 0;
 }
 
 int dbus_init(void)
@@ -152,10 +195,14 @@ int dbus_init(void)
 		return -1;
 	}
 
+	ev_async_init(&dbus_watcher, dbus_flush);
+	ev_set_priority(&dbus_watcher, EV_MINPRI);
+	ev_async_start(EV_DEFAULT, &dbus_watcher);
+
 	return 0;
 }
 
 void dbus_uninit(void)
 {
-
+	ev_async_stop(EV_DEFAULT, &dbus_watcher);
 }
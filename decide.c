@@ -0,0 +1,353 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+
+#include "state_machine.h"
+#include "pdu.h"
+
+/* Check if the MRP frame needs to be dropped */
+static bool mrp_should_drop(const struct mrp_port *p,
+			    enum br_mrp_tlv_header_type type)
+{
+	/* All frames should be dropped if the state of the port is disabled */
+	if (p->state == BR_MRP_PORT_STATE_DISABLED)
+		return true;
+
+	/* If receiving a MRP frame on a port which is not in MRP ring
+	 * then the frame should be drop
+	 */
+	if (!mrp_is_mrp_port(p))
+		return true;
+
+	/* In case the port is in blocked state then the kernel
+	 * will drop all NON-MRP frames and it would send all
+	 * MRP frames to the upper layer. So here is needed to drop MRP frames
+	 * if the port is in blocked state.
+	 */
+	if (mrp_is_ring_port(p) && p->state == BR_MRP_PORT_STATE_BLOCKED &&
+	    type != BR_MRP_TLV_HEADER_RING_TOPO &&
+	    type != BR_MRP_TLV_HEADER_RING_TEST &&
+	    type != BR_MRP_TLV_HEADER_RING_LINK_UP &&
+	    type != BR_MRP_TLV_HEADER_RING_LINK_DOWN &&
+	    type != BR_MRP_TLV_HEADER_IN_TOPO &&
+	    type != BR_MRP_TLV_HEADER_IN_LINK_UP &&
+	    type != BR_MRP_TLV_HEADER_IN_LINK_DOWN &&
+	    type != BR_MRP_TLV_HEADER_OPTION)
+		return true;
+
+	if (mrp_is_in_port(p) && p->state == BR_MRP_PORT_STATE_BLOCKED &&
+	    type != BR_MRP_TLV_HEADER_IN_TEST &&
+	    type != BR_MRP_TLV_HEADER_IN_LINK_UP &&
+	    type != BR_MRP_TLV_HEADER_IN_LINK_DOWN &&
+	    type != BR_MRP_TLV_HEADER_IN_TOPO)
+		return true;
+
+	return false;
+}
+
+/* Check if the MRP frame needs to be process. It depends of the MRP instance
+ * role and the frame type if the frame needs to be processed or not.
+ */
+static bool mrp_should_process(const struct mrp_port *p,
+			       enum br_mrp_tlv_header_type type)
+{
+	struct mrp *mrp = p->mrp;
+
+	switch (type) {
+	case BR_MRP_TLV_HEADER_RING_TEST:
+		if (mrp->ring_role == BR_MRP_RING_ROLE_MRM ||
+		    (mrp->ring_role == BR_MRP_RING_ROLE_MRC && mrp->mra_support))
+			return true;
+		break;
+	case BR_MRP_TLV_HEADER_RING_LINK_DOWN:
+	case BR_MRP_TLV_HEADER_RING_LINK_UP:
+		if (mrp->ring_role == BR_MRP_RING_ROLE_MRM)
+			return true;
+		break;
+	case BR_MRP_TLV_HEADER_RING_TOPO:
+		if (mrp->ring_role == BR_MRP_RING_ROLE_MRC ||
+		    (mrp->ring_role == BR_MRP_RING_ROLE_MRM && mrp->mra_support))
+			return true;
+		break;
+	case BR_MRP_TLV_HEADER_OPTION:
+		if (mrp->mra_support)
+			return true;
+	case BR_MRP_TLV_HEADER_IN_TEST:
+		if (mrp->in_role == BR_MRP_IN_ROLE_MIM)
+			return true;
+		break;
+	case BR_MRP_TLV_HEADER_IN_TOPO:
+		if (mrp->in_role == BR_MRP_IN_ROLE_MIC ||
+		    mrp->in_role == BR_MRP_IN_ROLE_MIM ||
+		    mrp->ring_role == BR_MRP_RING_ROLE_MRM)
+			return true;
+		break;
+	case BR_MRP_TLV_HEADER_IN_LINK_UP:
+	case BR_MRP_TLV_HEADER_IN_LINK_DOWN:
+		if (mrp->in_role == BR_MRP_IN_ROLE_MIM)
+			return true;
+		break;
+	default:
+		break;
+	}
+
+	return false;
+}
+
+static bool mrp_is_ring_frame(enum br_mrp_tlv_header_type type)
+{
+        if (type == BR_MRP_TLV_HEADER_RING_TEST ||
+            type == BR_MRP_TLV_HEADER_RING_TOPO ||
+            type == BR_MRP_TLV_HEADER_RING_LINK_DOWN ||
+            type == BR_MRP_TLV_HEADER_RING_LINK_UP ||
+            type == BR_MRP_TLV_HEADER_OPTION)
+                return true;
+
+        return false;
+}
+
+static bool mrp_is_in_frame(enum br_mrp_tlv_header_type type)
+{
+        if (type == BR_MRP_TLV_HEADER_IN_TEST ||
+            type == BR_MRP_TLV_HEADER_IN_TOPO ||
+            type == BR_MRP_TLV_HEADER_IN_LINK_DOWN ||
+            type == BR_MRP_TLV_HEADER_IN_LINK_UP ||
+            type == BR_MRP_TLV_HEADER_IN_LINK_STATUS)
+                return true;
+
+        return false;
+}
+
+/* Returns the ports where the MRP frame needs to be forwarded.
+ *
+ * It depends of the MRP instance role and the frame type if the frame needs to
+ * be forwarded or not. The key tells if the in_id of an interconnection frame
+ * and its SA are the ones of this instance.
+ */
+static uint8_t mrp_forward_mask(const struct mrp_port *p,
+				enum br_mrp_tlv_header_type type, int key)
+{
+	struct mrp *mrp = p->mrp;
+	uint8_t fwd = 0;
+
+	/* Set the possible forwarding ways according to the receiving port */
+	if (p == mrp->p_port)
+		fwd = MRP_FWD_S | MRP_FWD_I;
+	else if (p == mrp->s_port)
+		fwd = MRP_FWD_P | MRP_FWD_I;
+	else if (p == mrp->i_port)
+		fwd = MRP_FWD_P | MRP_FWD_S;
+
+        if (mrp_is_ring_frame(type)) {
+		/* We should not forward ring frames received from the
+		 * interconnection port.
+		 */
+		if (p == mrp->i_port)
+			return 0;
+
+		/* If the frame is a ring frame then it should not be forwarded
+		 * to the interconnection port.
+		 */
+		fwd &= ~MRP_FWD_I;
+
+		switch (mrp->ring_role) {
+		case BR_MRP_RING_ROLE_MRM:
+			/* If the role is MRM then don't forward the frames */
+			return 0;
+
+		case BR_MRP_RING_ROLE_MRC:
+			/* If the role is MRC and MRA support is not enabled
+			 * then don't forward Header Option frames.
+			 */
+			if (type == BR_MRP_TLV_HEADER_OPTION &&
+			    !mrp->mra_support)
+				return 0;
+			return fwd;
+
+		default:
+			break;
+		}
+	}
+
+        if (mrp_is_in_frame(type)) {
+		switch (mrp->ring_role) {
+		case BR_MRP_RING_ROLE_MRM:
+			/* Nodes that behaves as MRM needs to stop forwarding
+			 * the frames in case the ring is closed, otherwise will			 * be a loop.
+			 * In this case the frame is no forward between the
+			 * ring ports, but the frame may still have a chance to
+			 * go to through the interconnection port!
+			 */
+			if ((mrp->p_port->state !=
+					BR_MRP_PORT_STATE_FORWARDING ||
+			     mrp->s_port->state !=
+					BR_MRP_PORT_STATE_FORWARDING) &&
+			    mrp_is_ring_port(p)) {
+				fwd &= ~(MRP_FWD_P | MRP_FWD_S);
+			}
+			break;
+
+		case BR_MRP_RING_ROLE_MRC:
+			/* A node that behaves as MRC should not forward
+			 * interconnect frames between its ring ports if
+			 * it has an interconnection roles (MIM or MIC)
+			 * that matches the frame interconnection ID.
+			 */
+			if ((mrp->in_role != BR_MRP_IN_ROLE_DISABLED) &&
+			    (key & MRP_KEY_IN_ID) &&
+			    mrp_is_ring_port(p)) {
+				fwd &= ~(MRP_FWD_P | MRP_FWD_S);
+			}
+			break;
+
+		default:
+			break;
+		}
+
+		switch (mrp->in_role) {
+		case BR_MRP_IN_ROLE_MIM:
+			if (type == BR_MRP_TLV_HEADER_IN_TEST) {
+                                /* MIM should not forward it's own InTest
+                                 * frames between its ports, but it should
+				 * forward others InTest frames between its
+				 * ring ports if they are not from the
+				 * interconnection port.
+                                 */
+				if (key & MRP_KEY_OWN_SA)
+					return 0;
+				else {
+	                                if (mrp_is_in_port(p))
+	                                        return 0;
+					else
+	                                        fwd &= ~MRP_FWD_I;
+				}
+			} else {
+                                /* MIM should forward IntLinkChange/Status and
+                                 * IntTopoChange between ring ports, but MIM
+                                 * should not forward IntLinkChange/Status and
+                                 * IntTopoChange if the frame was received at
+                                 * the interconnect port
+                                 */
+                                if (mrp_is_ring_port(p))
+                                        fwd &= ~MRP_FWD_I;
+
+                                if (mrp_is_in_port(p))
+                                        return 0;
+			}
+			break;
+
+		case BR_MRP_IN_ROLE_MIC:
+                        /* MIC should forward InTest frames on all ports
+                         * regardless of the received port
+                         */
+			if (type == BR_MRP_TLV_HEADER_IN_TEST)
+                                return fwd;
+
+                        /* MIC should forward IntLinkChange frames only if they
+                         * are received on ring ports to all the ports
+                         */
+			if ((type == BR_MRP_TLV_HEADER_IN_LINK_UP ||
+			     type == BR_MRP_TLV_HEADER_IN_LINK_DOWN) &&
+			    mrp_is_ring_port(p))
+				return fwd;
+
+                        /* MIC should forward IntLinkStatus frames only to
+                         * interconnect port if it was received on a ring port.
+                         * If it is received on interconnect port then, it
+                         * should be forward on both ring ports
+                         */
+			if (type == BR_MRP_TLV_HEADER_IN_LINK_STATUS &&
+			    mrp_is_ring_port(p)) {
+				fwd &= ~(MRP_FWD_P | MRP_FWD_S);
+				return fwd;
+			}
+
+                        /* Should forward the InTopo frames only between the
+                         * ring ports
+                         */
+			if (type == BR_MRP_TLV_HEADER_IN_TOPO) {
+				fwd &= ~MRP_FWD_I;
+				return fwd;
+			}
+
+			/* Otherwise don't forward the frames */
+			return 0;
+
+		default:
+			break;
+		}
+	}
+
+	return fwd;
+}
+
+/* Fills the decision table of the instance by evaluating the predicates
+ * above for each receiving port, TLV type and frame key. The table depends
+ * on the roles, on the ports and on their states so it is invalidated by
+ * mrp_changed().
+ */
+static void mrp_decide_build(struct mrp *mrp)
+{
+	struct mrp_port *ports[3] = { mrp->p_port, mrp->s_port, mrp->i_port };
+	enum br_mrp_tlv_header_type type;
+	struct mrp_decision *d;
+	uint8_t present = 0;
+	int i, idx, key;
+
+	/* Never forward to a missing port */
+	for (i = 0; i < COUNT_OF(ports); i++)
+		if (ports[i])
+			present |= 1 << i;
+
+	for (i = 0; i < COUNT_OF(ports); i++)
+		for (idx = 0; idx < MRP_TLV_IDX_MAX; idx++) {
+			if (idx == MRP_TLV_IDX_OPTION)
+				type = BR_MRP_TLV_HEADER_OPTION;
+			else if (idx == MRP_TLV_IDX_UNKNOWN)
+				type = 0xff;
+			else
+				type = idx;
+
+			for (key = 0; key < MRP_KEY_MAX; key++) {
+				d = &mrp->decide[i][idx][key];
+
+				if (!ports[i] || mrp_should_drop(ports[i], type)) {
+					d->flags = MRP_DECIDE_DROP;
+					d->fwd = 0;
+					continue;
+				}
+
+				d->flags = mrp_should_process(ports[i], type) ?
+					   MRP_DECIDE_PROCESS : 0;
+				d->fwd = mrp_forward_mask(ports[i], type, key) &
+					 present;
+			}
+		}
+
+	mrp->decide_valid = true;
+}
+
+/* Returns the decision for a frame received on the port p */
+const struct mrp_decision *mrp_decide(struct mrp_port *p,
+				      const struct mrp_frame *f)
+{
+	struct mrp *mrp = p->mrp;
+	int i, key = 0;
+
+	if (unlikely(!mrp->decide_valid))
+		mrp_decide_build(mrp);
+
+	i = p == mrp->p_port ? 0 : p == mrp->s_port ? 1 : 2;
+
+	if (f->type >= BR_MRP_TLV_HEADER_IN_TEST &&
+	    f->type <= BR_MRP_TLV_HEADER_IN_LINK_STATUS) {
+		if (f->in_id == mrp->in_id)
+			key |= MRP_KEY_IN_ID;
+		if (ether_addr_equal(f->sa, mrp->macaddr))
+			key |= MRP_KEY_OWN_SA;
+	}
+
+	return &mrp->decide[i][mrp_tlv_idx(f->type)][key];
+}
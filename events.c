@@ -0,0 +1,290 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <errno.h>
+#include <ev.h>
+
+#include "events.h"
+#include "utils.h"
+#include "loop.h"
+
+#define MRP_EVENT_MAX_SUBSCRIBERS	8
+#define MRP_EVENT_QUEUE_LEN		256	/* must be a power of 2 */
+#define MRP_EVENT_RETRY_DELAY		0.02	/* s */
+
+/* Events are added at head by one thread and moved from tail to the
+ * subscribers by the main loop, so the data plane never waits for it.
+ */
+struct mrp_event_ring {
+	uint32_t		head;
+	uint32_t		tail;
+	uint32_t		dropped;
+	struct mrp_event	queue[MRP_EVENT_QUEUE_LEN];
+};
+
+/* The subscribers are handled by the main loop only */
+struct mrp_subscriber {
+	bool			active;
+	struct sockaddr_un	sa;
+	socklen_t		salen;
+
+	uint32_t		head;
+	uint32_t		tail;
+	uint32_t		dropped;
+	struct mrp_event	queue[MRP_EVENT_QUEUE_LEN];
+};
+
+int mrp_event_subscribers;
+
+static struct mrp_event_ring rings[MRP_MAX_THREADS];
+static struct mrp_subscriber subscribers[MRP_EVENT_MAX_SUBSCRIBERS];
+static ev_async post_watcher;
+static ev_idle flush_watcher;
+static ev_timer retry_watcher;
+static int fd = -1;
+
+static struct mrp_subscriber *mrp_events_find(struct sockaddr_un *sa,
+					      socklen_t salen)
+{
+	int i;
+
+	for (i = 0; i < MRP_EVENT_MAX_SUBSCRIBERS; i++) {
+		struct mrp_subscriber *s = &subscribers[i];
+
+		if (s->active && s->salen == salen &&
+		    memcmp(&s->sa, sa, salen) == 0)
+			return s;
+	}
+
+	return NULL;
+}
+
+static void mrp_events_remove(struct mrp_subscriber *s)
+{
+	s->active = false;
+	mrp_event_subscribers--;
+}
+
+/* Sends the queued events of a subscriber. Returns false if the subscriber
+ * cannot accept more events right now.
+ */
+static bool mrp_events_flush_one(struct mrp_subscriber *s)
+{
+	struct ctl_msg_hdr mhdr;
+	struct iovec iov[2];
+	struct msghdr msg;
+	int l;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &s->sa;
+	msg.msg_namelen = s->salen;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	mhdr.cmd = CMD_CODE_event;
+	mhdr.lin = 0;
+	mhdr.lout = sizeof(struct mrp_event);
+	mhdr.res = 0;
+	iov[0].iov_base = &mhdr;
+	iov[0].iov_len = sizeof(mhdr);
+	iov[1].iov_len = sizeof(struct mrp_event);
+
+	while (s->tail != s->head) {
+		iov[1].iov_base = &s->queue[s->tail & (MRP_EVENT_QUEUE_LEN - 1)];
+
+		l = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (l < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return false;
+
+			/* The subscriber has gone away */
+			pr_debug("removing subscriber: %m");
+			mrp_events_remove(s);
+			return true;
+		}
+
+		s->tail++;
+	}
+
+	return true;
+}
+
+static void mrp_events_flush(EV_P_ ev_idle *w, int revents)
+{
+	bool retry = false;
+	int i;
+
+	for (i = 0; i < MRP_EVENT_MAX_SUBSCRIBERS; i++) {
+		struct mrp_subscriber *s = &subscribers[i];
+
+		if (!s->active)
+			continue;
+
+		if (!mrp_events_flush_one(s))
+			retry = true;
+	}
+
+	ev_idle_stop(EV_A_ w);
+
+	/* Slow subscribers are retried later in order to not spin */
+	if (retry)
+		ev_timer_again(EV_A_ &retry_watcher);
+}
+
+static void mrp_events_retry(EV_P_ ev_timer *w, int revents)
+{
+	ev_timer_stop(EV_A_ w);
+	ev_idle_start(EV_A_ &flush_watcher);
+}
+
+static void mrp_events_queue(struct mrp_subscriber *s,
+			     const struct mrp_event *e)
+{
+	struct mrp_event *q;
+
+	if (s->head - s->tail >= MRP_EVENT_QUEUE_LEN) {
+		s->dropped++;
+		return;
+	}
+
+	q = &s->queue[s->head & (MRP_EVENT_QUEUE_LEN - 1)];
+	*q = *e;
+	q->dropped = s->dropped;
+	s->head++;
+}
+
+/* Moves the posted events to the queues of the subscribers */
+static void mrp_events_collect(void)
+{
+	struct mrp_event_ring *r;
+	uint32_t head, tail, dropped;
+	struct mrp_event *e;
+	int i, j;
+
+	for (i = 0; i < MRP_MAX_THREADS; i++) {
+		r = &rings[i];
+
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		dropped = __atomic_exchange_n(&r->dropped, 0, __ATOMIC_RELAXED);
+
+		for (j = 0; j < MRP_EVENT_MAX_SUBSCRIBERS; j++)
+			if (subscribers[j].active)
+				subscribers[j].dropped += dropped;
+
+		for (tail = r->tail; tail != head; tail++) {
+			e = &r->queue[tail & (MRP_EVENT_QUEUE_LEN - 1)];
+
+			for (j = 0; j < MRP_EVENT_MAX_SUBSCRIBERS; j++)
+				if (subscribers[j].active)
+					mrp_events_queue(&subscribers[j], e);
+		}
+
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	}
+}
+
+/* Events are sent when the main loop has nothing else to do */
+static void mrp_events_posted(EV_P_ ev_async *w, int revents)
+{
+	mrp_events_collect();
+
+	if (!ev_is_active(&retry_watcher))
+		ev_idle_start(EV_A_ &flush_watcher);
+}
+
+void __mrp_event_post(struct mrp *mrp, struct mrp_port *p,
+		      enum mrp_event_type type, uint32_t value)
+{
+	struct mrp_event_ring *r = &rings[mrp_thread_id()];
+	struct mrp_event *e;
+	struct timespec t;
+	uint32_t head;
+
+	head = r->head;
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >=
+	    MRP_EVENT_QUEUE_LEN) {
+		__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	e = &r->queue[head & (MRP_EVENT_QUEUE_LEN - 1)];
+	e->ts = (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+	e->type = type;
+	e->br = mrp->ifindex;
+	e->ring_nr = mrp->ring_nr;
+	e->port = p ? p->ifindex : 0;
+	e->value = value;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+	ev_async_send(EV_DEFAULT, &post_watcher);
+}
+
+int mrp_events_subscribe(struct sockaddr_un *sa, socklen_t salen)
+{
+	struct mrp_subscriber *s;
+	int i;
+
+	if (salen > sizeof(*sa))
+		return -EINVAL;
+
+	if (mrp_events_find(sa, salen))
+		return 0;
+
+	for (i = 0; i < MRP_EVENT_MAX_SUBSCRIBERS; i++) {
+		s = &subscribers[i];
+		if (s->active)
+			continue;
+
+		memset(s, 0, sizeof(*s));
+		memcpy(&s->sa, sa, salen);
+		s->salen = salen;
+		s->active = true;
+		mrp_event_subscribers++;
+
+		return 0;
+	}
+
+	pr_err("too many event subscribers");
+	return -ENOSPC;
+}
+
+int mrp_events_unsubscribe(struct sockaddr_un *sa, socklen_t salen)
+{
+	struct mrp_subscriber *s;
+
+	s = mrp_events_find(sa, salen);
+	if (!s)
+		return -ENOENT;
+
+	mrp_events_remove(s);
+
+	return 0;
+}
+
+int mrp_events_init(int ctl_fd)
+{
+	fd = ctl_fd;
+
+	ev_async_init(&post_watcher, mrp_events_posted);
+	ev_async_start(EV_DEFAULT, &post_watcher);
+	ev_idle_init(&flush_watcher, mrp_events_flush);
+	/* Events must not delay any other activity */
+	ev_set_priority(&flush_watcher, EV_MINPRI);
+	ev_init(&retry_watcher, mrp_events_retry);
+	retry_watcher.repeat = MRP_EVENT_RETRY_DELAY;
+
+	return 0;
+}
+
+void mrp_events_cleanup(void)
+{
+	ev_async_stop(EV_DEFAULT, &post_watcher);
+	ev_idle_stop(EV_DEFAULT, &flush_watcher);
+	ev_timer_stop(EV_DEFAULT, &retry_watcher);
+	mrp_event_subscribers = 0;
+}
@@ -0,0 +1,33 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <sys/un.h>
+
+#include "state_machine.h"
+
+extern int mrp_event_subscribers;
+
+void __mrp_event_post(struct mrp *mrp, struct mrp_port *p,
+		      enum mrp_event_type type, uint32_t value);
+
+/* Queue an event for all the subscribers. It never blocks and it costs
+ * nothing when there are no subscribers.
+ */
+static inline void mrp_event_post(struct mrp *mrp, struct mrp_port *p,
+				  enum mrp_event_type type, uint32_t value)
+{
+	if (likely(!mrp_event_subscribers))
+		return;
+
+	__mrp_event_post(mrp, p, type, value);
+}
+
+int mrp_events_subscribe(struct sockaddr_un *sa, socklen_t salen);
+int mrp_events_unsubscribe(struct sockaddr_un *sa, socklen_t salen);
+int mrp_events_init(int fd);
+void mrp_events_cleanup(void);
+
+#endif /* EVENTS_H */
@@ -0,0 +1,251 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ev.h>
+
+#include "flight.h"
+#include "state_machine.h"
+
+/* A history taken on a slow recovery, dumped later by the main loop */
+struct mrp_flight_snap {
+	struct mrp_flight_snap	*next;
+	char			ifname[IF_NAMESIZE];
+	uint32_t		ring_nr;
+	bool			in;
+	uint64_t		elapsed;	/* ns */
+	uint64_t		budget;		/* ns */
+	int			n;
+	struct mrp_flight_entry	entries[MRP_FLIGHT_LEN];
+};
+
+/* Pushed by any shard, taken all at once by the main loop */
+static struct mrp_flight_snap *snaps;
+static ev_async snap_watcher;
+
+static const char *timer_names[] = {
+	[MRP_FLIGHT_TIMER_CLEAR_FDB]		= "clear_fdb",
+	[MRP_FLIGHT_TIMER_RING_TEST]		= "ring_test (missed)",
+	[MRP_FLIGHT_TIMER_RING_TOPO]		= "ring_topo",
+	[MRP_FLIGHT_TIMER_RING_LINK_UP]		= "ring_link_up",
+	[MRP_FLIGHT_TIMER_RING_LINK_DOWN]	= "ring_link_down",
+	[MRP_FLIGHT_TIMER_IN_TEST]		= "in_test (missed)",
+	[MRP_FLIGHT_TIMER_IN_TOPO]		= "in_topo",
+	[MRP_FLIGHT_TIMER_IN_LINK_UP]		= "in_link_up",
+	[MRP_FLIGHT_TIMER_IN_LINK_DOWN]		= "in_link_down",
+	[MRP_FLIGHT_TIMER_IN_LINK_STATUS]	= "in_link_status",
+};
+
+/* Copies the entries, the oldest first, and returns their number */
+int mrp_flight_get(struct mrp_flight *f, struct mrp_flight_entry *entries)
+{
+	uint32_t i, n;
+
+	n = f->head < MRP_FLIGHT_LEN ? f->head : MRP_FLIGHT_LEN;
+	for (i = 0; i < n; i++)
+		entries[i] = f->entries[(f->head - n + i) % MRP_FLIGHT_LEN];
+
+	return n;
+}
+
+static void mrp_flight_print(FILE *stream, struct mrp_flight_entry *e)
+{
+	char ifname[IF_NAMESIZE] = "";
+
+	fprintf(stream, "%llu.%09llu ", (unsigned long long)e->ts / 1000000000,
+		(unsigned long long)e->ts % 1000000000);
+
+	if (e->port)
+		if_indextoname(e->port, ifname);
+
+	switch (e->type) {
+	case MRP_FLIGHT_MRM_STATE:
+		fprintf(stream, "mrm_state: %s\n",
+			mrp_get_mrm_state(e->value));
+		break;
+	case MRP_FLIGHT_MRC_STATE:
+		fprintf(stream, "mrc_state: %s\n",
+			mrp_get_mrc_state(e->value));
+		break;
+	case MRP_FLIGHT_MIM_STATE:
+		fprintf(stream, "mim_state: %s\n",
+			mrp_get_mim_state(e->value));
+		break;
+	case MRP_FLIGHT_MIC_STATE:
+		fprintf(stream, "mic_state: %s\n",
+			mrp_get_mic_state(e->value));
+		break;
+	case MRP_FLIGHT_PORT_STATE:
+		fprintf(stream, "port: %s state: %d\n", ifname, e->value);
+		break;
+	case MRP_FLIGHT_RX_TOPO:
+		fprintf(stream, "port: %s rx topo_change: %d ms\n",
+			ifname, e->value);
+		break;
+	case MRP_FLIGHT_RX_LINK:
+		fprintf(stream, "port: %s rx link_%s\n", ifname,
+			e->value == BR_MRP_TLV_HEADER_RING_LINK_UP ?
+			"up" : "down");
+		break;
+	case MRP_FLIGHT_RX_IN_TOPO:
+		fprintf(stream, "port: %s rx in_topo_change: %d ms\n",
+			ifname, e->value);
+		break;
+	case MRP_FLIGHT_RX_IN_LINK:
+		fprintf(stream, "port: %s rx in_link_%s\n", ifname,
+			e->value == BR_MRP_TLV_HEADER_IN_LINK_UP ?
+			"up" : "down");
+		break;
+	case MRP_FLIGHT_TIMER:
+		fprintf(stream, "timer: %s expired\n",
+			e->value < COUNT_OF(timer_names) ?
+			timer_names[e->value] : "unknown");
+		break;
+	default:
+		fprintf(stream, "unknown entry %d\n", e->type);
+		break;
+	}
+}
+
+static void mrp_flight_print_all(FILE *stream, const char *ifname,
+				 uint32_t ring_nr,
+				 struct mrp_flight_entry *entries, int n)
+{
+	int i;
+
+	fprintf(stream, "--- flight recorder: bridge %s ring_nr %d ---\n",
+		ifname, ring_nr);
+	for (i = 0; i < n; i++)
+		mrp_flight_print(stream, &entries[i]);
+	fflush(stream);
+}
+
+void mrp_flight_dump(struct mrp *mrp, FILE *stream)
+{
+	struct mrp_flight_entry entries[MRP_FLIGHT_LEN];
+	int n;
+
+	n = mrp_flight_get(&mrp->flight, entries);
+	mrp_flight_print_all(stream, mrp->ifname, mrp->ring_nr, entries, n);
+}
+
+void mrp_flight_dump_all(FILE *stream)
+{
+	struct mrp *mrp = NULL;
+	uint32_t id = 0;
+
+	while ((mrp = mrp_find_next(id))) {
+		mrp_flight_dump(mrp, stream);
+
+		id = mrp->id;
+	}
+}
+
+static uint64_t mrp_budget_ns(struct mrp *mrp, bool in)
+{
+	/* The custom timings are already scaled by the time factor: the
+	 * budget is the time to detect the failure plus the one to notify it.
+	 */
+	if (in && mrp->in_recv == MRP_IN_RECOVERY_CUSTOM)
+		return ((uint64_t)mrp->in_test_conf_interval *
+			mrp->in_test_conf_max +
+			(uint64_t)mrp->in_topo_conf_interval *
+			mrp->in_topo_conf_max) * 1000 / time_factor;
+	if (in)
+		return mrp->in_recv == MRP_IN_RECOVERY_200 ?
+			200000000ULL : 500000000ULL;
+
+	switch (mrp->ring_recv) {
+	case MRP_RING_RECOVERY_500: return 500000000ULL;
+	case MRP_RING_RECOVERY_200: return 200000000ULL;
+	case MRP_RING_RECOVERY_30: return 30000000ULL;
+	case MRP_RING_RECOVERY_10: return 10000000ULL;
+	case MRP_RING_RECOVERY_CUSTOM:
+		return ((uint64_t)mrp->ring_test_conf_interval *
+			mrp->ring_test_conf_max +
+			(uint64_t)mrp->ring_topo_conf_interval *
+			mrp->ring_topo_conf_max) * 1000 / time_factor;
+	default: return 500000000ULL;
+	}
+}
+
+/* Called when the MRM (or the MIM if in is set) detects the ring (or the
+ * interconnection) open: the recovery started when the last test frame was
+ * received. If it took longer than the recovery profile allows, the
+ * history is dumped by the main loop.
+ */
+void mrp_flight_check_recovery(struct mrp *mrp, bool in)
+{
+	uint64_t last_rx, elapsed, budget;
+	struct mrp_flight_snap *snap;
+
+	last_rx = in ? mrp->in_test_rx_ts : mrp->ring_test_rx_ts;
+	if (!last_rx)
+		return;
+
+	elapsed = mrp_time_us() * 1000 - last_rx;
+	budget = mrp_budget_ns(mrp, in) * time_factor;
+	if (elapsed <= budget)
+		return;
+
+	/* Writing the history would delay the recovery itself */
+	snap = malloc(sizeof(*snap));
+	if (!snap)
+		return;
+
+	snprintf(snap->ifname, sizeof(snap->ifname), "%s", mrp->ifname);
+	snap->ring_nr = mrp->ring_nr;
+	snap->in = in;
+	snap->elapsed = elapsed;
+	snap->budget = budget;
+	snap->n = mrp_flight_get(&mrp->flight, snap->entries);
+
+	snap->next = __atomic_load_n(&snaps, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&snaps, &snap->next, snap, true,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+		;
+	ev_async_send(EV_DEFAULT, &snap_watcher);
+}
+
+static void mrp_flight_snap_dump(EV_P_ ev_async *w, int revents)
+{
+	struct mrp_flight_snap *snap, *prev = NULL, *next;
+
+	snap = __atomic_exchange_n(&snaps, NULL, __ATOMIC_ACQUIRE);
+
+	/* The oldest first */
+	for (; snap; snap = next) {
+		next = snap->next;
+		snap->next = prev;
+		prev = snap;
+	}
+
+	for (snap = prev; snap; snap = next) {
+		next = snap->next;
+
+		pr_warn("bridge: %s, ring_nr: %d, %s recovery took %llu ms (budget %llu ms)",
+			snap->ifname, snap->ring_nr,
+			snap->in ? "interconnection" : "ring",
+			(unsigned long long)snap->elapsed / 1000000,
+			(unsigned long long)snap->budget / 1000000);
+		mrp_flight_print_all(stderr, snap->ifname, snap->ring_nr,
+				     snap->entries, snap->n);
+		free(snap);
+	}
+}
+
+void mrp_flight_init(void)
+{
+	ev_async_init(&snap_watcher, mrp_flight_snap_dump);
+	ev_async_start(EV_DEFAULT, &snap_watcher);
+}
+
+/* Called once the shard threads are stopped */
+void mrp_flight_cleanup(void)
+{
+	mrp_flight_snap_dump(EV_DEFAULT, &snap_watcher, 0);
+	ev_async_stop(EV_DEFAULT, &snap_watcher);
+}
@@ -0,0 +1,42 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "utils.h"
+
+struct mrp;
+
+struct mrp_flight {
+	uint32_t		head;
+	struct mrp_flight_entry	entries[MRP_FLIGHT_LEN];
+};
+
+static inline void mrp_flight_record(struct mrp_flight *f,
+				     enum mrp_flight_type type,
+				     uint32_t port, uint16_t value)
+{
+	struct mrp_flight_entry *e = &f->entries[f->head++ % MRP_FLIGHT_LEN];
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	e->ts = (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+	e->port = port;
+	e->type = type;
+	e->value = value;
+}
+
+int mrp_flight_get(struct mrp_flight *f, struct mrp_flight_entry *entries);
+void mrp_flight_dump(struct mrp *mrp, FILE *stream);
+void mrp_flight_dump_all(FILE *stream);
+void mrp_flight_check_recovery(struct mrp *mrp, bool in);
+void mrp_flight_init(void);
+void mrp_flight_cleanup(void);
+
+#endif /* FLIGHT_H */
@@ -235,6 +235,22 @@ int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
 	return 0;
 }
 
+/* Sets the receive buffer size, beyond rmem_max if we are allowed to */
+int rtnl_set_rcvbuf(struct rtnl_handle *rth, int size)
+{
+	if (setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		       &size, sizeof(size)) == 0)
+		return 0;
+
+	if (setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF,
+		       &size, sizeof(size)) < 0) {
+		perror("SO_RCVBUF");
+		return -1;
+	}
+
+	return 0;
+}
+
 int rtnl_open(struct rtnl_handle *rth, unsigned int subscriptions)
 {
 	return rtnl_open_byproto(rth, subscriptions, NETLINK_ROUTE);
@@ -835,7 +851,7 @@ skip_it:
 		}
 		if (msglen) {
 			fprintf(stderr, "!!!Remnant of size %d\n", msglen);
-			exit(1);
+			return -EBADMSG;
 		}
 	}
 }
@@ -1048,7 +1064,7 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 		.msg_iov = &iov,
 		.msg_iovlen = 1,
 	};
-	char   buf[16384];
+	char   buf[32768];
 	char   cmsgbuf[BUFSIZ];
 
 	if (rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
@@ -1067,10 +1083,15 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 		if (status < 0) {
 			if (errno == EINTR || errno == EAGAIN)
 				break;
+			/* Some notifications have been lost, the caller
+			 * has to resynchronize its state.
+			 */
+			if (errno == ENOBUFS) {
+				rtnl->enobufs++;
+				return -ENOBUFS;
+			}
 			fprintf(stderr, "netlink receive error %s (%d)\n",
 				strerror(errno), errno);
-			if (errno == ENOBUFS)
-				break;
 			return -1;
 		}
 		if (status == 0) {
@@ -1081,7 +1102,7 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 			fprintf(stderr,
 				"Sender address length == %d\n",
 				msg.msg_namelen);
-			exit(1);
+			return -EBADMSG;
 		}
 
 		if (rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID) {
@@ -1111,7 +1132,7 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 				fprintf(stderr,
 					"!!!malformed message: len=%d\n",
 					len);
-				exit(1);
+				return -EBADMSG;
 			}
 
 			err = handler(&ctrl, h, jarg);
@@ -1127,7 +1148,7 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 		}
 		if (status) {
 			fprintf(stderr, "!!!Remnant of size %d\n", status);
-			exit(1);
+			return -EBADMSG;
 		}
 	}
 
@@ -25,6 +25,7 @@ struct rtnl_handle {
 #define RTNL_HANDLE_F_SUPPRESS_NLERR		0x02
 #define RTNL_HANDLE_F_STRICT_CHK		0x04
 	int			flags;
+	__u32			enobufs;
 };
 
 struct nlmsg_list {
@@ -48,6 +49,7 @@ int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
 int rtnl_add_nl_group(struct rtnl_handle *rth, unsigned int group)
 	__attribute__((warn_unused_result));
 void rtnl_close(struct rtnl_handle *rth);
+int rtnl_set_rcvbuf(struct rtnl_handle *rth, int size);
 void rtnl_set_strict_dump(struct rtnl_handle *rth);
 
 typedef int (*req_filter_fn_t)(struct nlmsghdr *nlh, int reqlen);
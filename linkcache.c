@@ -0,0 +1,200 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "libnetlink.h"
+#include "linkcache.h"
+#include "utils.h"
+
+#define LINKCACHE_BUCKETS	64	/* power of 2 */
+
+static struct hlist_head linkcache[LINKCACHE_BUCKETS];
+
+/* Written by the main loop, read by the shards */
+static pthread_rwlock_t linkcache_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static struct hlist_head *linkcache_bucket(int ifindex)
+{
+	return &linkcache[ifindex & (LINKCACHE_BUCKETS - 1)];
+}
+
+struct link_info *linkcache_get(int ifindex)
+{
+	struct link_info *li;
+	struct hlist_node *pos;
+
+	/* hlist_for_each_entry() needs prefetch(), which list.h lacks */
+	for (pos = linkcache_bucket(ifindex)->first; pos; pos = pos->next) {
+		li = hlist_entry(pos, struct link_info, node);
+		if (li->ifindex == ifindex)
+			return li;
+	}
+
+	return NULL;
+}
+
+static void linkcache_del(int ifindex)
+{
+	struct link_info *li;
+
+	li = linkcache_get(ifindex);
+	if (!li)
+		return;
+
+	hlist_del(&li->node);
+	free(li);
+}
+
+/* Updates the cache from an RTM_NEWLINK or RTM_DELLINK message. Only the
+ * attributes present in the message are changed, the AF_BRIDGE messages
+ * for the bridge ports carry a subset of them.
+ */
+void linkcache_update(struct nlmsghdr *n)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX + 1];
+	int len = n->nlmsg_len;
+	struct link_info *li;
+
+	if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
+		return;
+
+	len -= NLMSG_LENGTH(sizeof(*ifi));
+	if (len < 0)
+		return;
+
+	if (n->nlmsg_type == RTM_DELLINK) {
+		/* A port leaving a bridge is notified as an AF_BRIDGE
+		 * RTM_DELLINK, the interface itself still exists.
+		 */
+		if (ifi->ifi_family == AF_UNSPEC) {
+			pthread_rwlock_wrlock(&linkcache_lock);
+			linkcache_del(ifi->ifi_index);
+			pthread_rwlock_unlock(&linkcache_lock);
+		}
+		return;
+	}
+
+	pthread_rwlock_wrlock(&linkcache_lock);
+
+	li = linkcache_get(ifi->ifi_index);
+	if (!li) {
+		li = calloc(1, sizeof(*li));
+		if (!li)
+			goto out;
+
+		li->ifindex = ifi->ifi_index;
+		hlist_add_head(&li->node, linkcache_bucket(li->ifindex));
+	}
+
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
+
+	li->flags = ifi->ifi_flags;
+	if (tb[IFLA_IFNAME])
+		strncpy(li->ifname, rta_getattr_str(tb[IFLA_IFNAME]),
+			IF_NAMESIZE - 1);
+	if (tb[IFLA_ADDRESS] && RTA_PAYLOAD(tb[IFLA_ADDRESS]) == ETH_ALEN)
+		memcpy(li->macaddr, RTA_DATA(tb[IFLA_ADDRESS]), ETH_ALEN);
+	if (tb[IFLA_OPERSTATE])
+		li->operstate = rta_getattr_u8(tb[IFLA_OPERSTATE]);
+
+	/* Only the AF_UNSPEC messages are complete */
+	if (ifi->ifi_family == AF_UNSPEC)
+		li->master = tb[IFLA_MASTER] ?
+			     rta_getattr_u32(tb[IFLA_MASTER]) : 0;
+
+out:
+	pthread_rwlock_unlock(&linkcache_lock);
+}
+
+char *linkcache_get_name(int ifindex, char *ifname)
+{
+	struct link_info *li;
+	bool found = false;
+
+	pthread_rwlock_rdlock(&linkcache_lock);
+	li = linkcache_get(ifindex);
+	if (li && li->ifname[0]) {
+		strcpy(ifname, li->ifname);
+		found = true;
+	}
+	pthread_rwlock_unlock(&linkcache_lock);
+
+	if (!found)
+		return if_indextoname(ifindex, ifname);
+
+	return ifname;
+}
+
+int linkcache_get_mac(int ifindex, unsigned char *mac)
+{
+	struct link_info *li;
+
+	pthread_rwlock_rdlock(&linkcache_lock);
+	li = linkcache_get(ifindex);
+	if (li)
+		memcpy(mac, li->macaddr, ETH_ALEN);
+	pthread_rwlock_unlock(&linkcache_lock);
+
+	if (!li)
+		return if_get_mac(ifindex, mac);
+
+	return 0;
+}
+
+int linkcache_get_link(int ifindex)
+{
+	struct link_info *li;
+	int link = 0;
+
+	pthread_rwlock_rdlock(&linkcache_lock);
+	li = linkcache_get(ifindex);
+	if (li)
+		link = li->flags & IFF_RUNNING;
+	pthread_rwlock_unlock(&linkcache_lock);
+
+	if (!li)
+		return if_get_link(ifindex);
+
+	return link;
+}
+
+/* Drops the interfaces not in ifindexes: their notifications are filtered
+ * out, so their entries would go stale.
+ */
+void linkcache_retain(const int *ifindexes, int n)
+{
+	struct hlist_node *pos, *tmp;
+	struct link_info *li;
+	int i, j;
+
+	pthread_rwlock_wrlock(&linkcache_lock);
+	for (i = 0; i < LINKCACHE_BUCKETS; i++)
+		hlist_for_each_entry_safe(li, pos, tmp, &linkcache[i], node) {
+			for (j = 0; j < n; j++)
+				if (ifindexes[j] == li->ifindex)
+					break;
+			if (j < n)
+				continue;
+
+			hlist_del(&li->node);
+			free(li);
+		}
+	pthread_rwlock_unlock(&linkcache_lock);
+}
+
+void linkcache_cleanup(void)
+{
+	struct hlist_node *pos, *tmp;
+	struct link_info *li;
+	int i;
+
+	for (i = 0; i < LINKCACHE_BUCKETS; i++)
+		hlist_for_each_entry_safe(li, pos, tmp, &linkcache[i], node) {
+			hlist_del(&li->node);
+			free(li);
+		}
+}
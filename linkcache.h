@@ -0,0 +1,42 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef LINKCACHE_H
+#define LINKCACHE_H
+
+#include <stdint.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/netlink.h>
+
+#include "list.h"
+
+/* A network interface as seen by the last RTM_NEWLINK message */
+struct link_info {
+	struct hlist_node	node;
+
+	int			ifindex;
+	char			ifname[IF_NAMESIZE];
+	unsigned char		macaddr[ETH_ALEN];
+	unsigned int		flags;		/* IFF_* */
+	uint8_t			operstate;	/* IF_OPER_* */
+	int			master;		/* 0 if none */
+};
+
+/* The entries change on the main loop only, which is the only one that
+ * can use linkcache_get(). The other helpers are for any shard.
+ */
+struct link_info *linkcache_get(int ifindex);
+void linkcache_update(struct nlmsghdr *n);
+void linkcache_retain(const int *ifindexes, int n);
+
+/* These fall back to the ioctl() based helpers when the interface is not
+ * in the cache yet.
+ */
+char *linkcache_get_name(int ifindex, char *ifname);
+int linkcache_get_mac(int ifindex, unsigned char *mac);
+int linkcache_get_link(int ifindex);
+
+void linkcache_cleanup(void);
+
+#endif
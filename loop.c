@@ -0,0 +1,246 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+
+#include "loop.h"
+#include "utils.h"
+
+struct mrp_shard mrp_shards[MRP_MAX_SHARDS];
+int mrp_nr_shards = 1;
+
+__thread struct mrp_shard *mrp_shard = &mrp_shards[0];
+
+pthread_mutex_t mrp_driver_lock;
+
+static __thread bool on_shard;
+static bool threaded;
+static int loop_prio;
+
+void mrp_mutex_init(pthread_mutex_t *m)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(m, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+int mrp_thread_id(void)
+{
+	return on_shard ? mrp_shard->id : MRP_MAX_SHARDS;
+}
+
+static void mrp_shard_call_cb(EV_P_ ev_async *w, int revents)
+{
+	struct mrp_shard *s = container_of(w, struct mrp_shard, call_watcher);
+
+	s->call_ret = s->call_fn(s->call_arg);
+	sem_post(&s->call_done);
+}
+
+int mrp_shard_call(struct mrp_shard *s, int (*fn)(void *arg), void *arg)
+{
+	int ret;
+
+	if (!threaded || (on_shard && mrp_shard == s))
+		return fn(arg);
+
+	pthread_mutex_lock(&s->call_lock);
+	s->call_fn = fn;
+	s->call_arg = arg;
+	ev_async_send(s->loop, &s->call_watcher);
+
+	while (sem_wait(&s->call_done) < 0 && errno == EINTR)
+		;
+	ret = s->call_ret;
+	pthread_mutex_unlock(&s->call_lock);
+
+	return ret;
+}
+
+struct mrp_shard *mrp_shard_of(int br_ifindex, int ring_nr)
+{
+	uint32_t h = (uint32_t)br_ifindex * 0x9e3779b1 + (uint32_t)ring_nr;
+
+	return &mrp_shards[(h >> 16) % mrp_nr_shards];
+}
+
+static void *mrp_loop_thread(void *arg)
+{
+	mrp_shard = arg;
+	on_shard = true;
+
+	ev_run(mrp_shard->loop, 0);
+
+	return NULL;
+}
+
+static int mrp_loop_break(void *arg)
+{
+	ev_break(mrp_loop, EVBREAK_ALL);
+
+	return 0;
+}
+
+/* Creates one shard loop per CPU, or a single shard on the main loop if
+ * there are no CPUs. The threads are started by mrp_loop_start() once the
+ * watchers are set up.
+ */
+int mrp_loop_init(const int *cpus, int n, int prio)
+{
+	struct mrp_shard *s;
+	int i;
+
+	mrp_mutex_init(&mrp_driver_lock);
+
+	for (i = 0; i < MRP_MAX_SHARDS; i++) {
+		s = &mrp_shards[i];
+		s->id = i;
+		s->cpu = -1;
+		INIT_LIST_HEAD(&s->instances);
+	}
+
+	if (n <= 0) {
+		mrp_nr_shards = 1;
+		mrp_shards[0].loop = EV_DEFAULT;
+		return 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		s = &mrp_shards[i];
+
+		s->loop = ev_loop_new(EVFLAG_AUTO);
+		if (!s->loop) {
+			pr_err("cannot create the data plane loop %d", i);
+			goto destroy;
+		}
+		s->cpu = cpus[i];
+
+		mrp_mutex_init(&s->call_lock);
+		sem_init(&s->call_done, 0, 0);
+		ev_async_init(&s->call_watcher, mrp_shard_call_cb);
+		ev_set_priority(&s->call_watcher, EV_MINPRI);
+		ev_async_start(s->loop, &s->call_watcher);
+	}
+	mrp_nr_shards = n;
+	loop_prio = prio;
+
+	return 0;
+
+destroy:
+	mrp_nr_shards = i;
+	mrp_loop_cleanup();
+	return -1;
+}
+
+static int mrp_loop_create(struct mrp_shard *s)
+{
+	struct sched_param param = { .sched_priority = loop_prio };
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int err;
+
+	pthread_attr_init(&attr);
+	CPU_ZERO(&cpus);
+	CPU_SET(s->cpu, &cpus);
+	pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &param);
+
+	err = pthread_create(&s->thread, &attr, mrp_loop_thread, s);
+	if (err == EPERM) {
+		pr_warn("cannot use SCHED_FIFO, the data plane thread %d keeps "
+			"the default policy", s->id);
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+		err = pthread_create(&s->thread, &attr, mrp_loop_thread, s);
+	}
+
+	pthread_attr_destroy(&attr);
+
+	if (err) {
+		pr_err("cannot start the data plane thread %d: %s",
+		       s->id, strerror(err));
+		return -1;
+	}
+
+	pr_debug("data plane %d on cpu %d, SCHED_FIFO priority %d",
+		 s->id, s->cpu, loop_prio);
+
+	return 0;
+}
+
+int mrp_loop_start(void)
+{
+	sigset_t all, old;
+	int i, err = 0;
+
+	if (mrp_shards[0].cpu < 0)
+		return 0;
+
+	/* The signals are handled by the main loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	for (i = 0; i < mrp_nr_shards; i++) {
+		err = mrp_loop_create(&mrp_shards[i]);
+		if (err)
+			break;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err) {
+		threaded = true;
+		while (--i >= 0) {
+			mrp_shard_call(&mrp_shards[i], mrp_loop_break, NULL);
+			pthread_join(mrp_shards[i].thread, NULL);
+		}
+		threaded = false;
+		return -1;
+	}
+	threaded = true;
+
+	return 0;
+}
+
+/* Stops the data plane threads, the loops can be used by the main thread
+ * afterwards.
+ */
+void mrp_loop_stop(void)
+{
+	int i;
+
+	if (!threaded)
+		return;
+
+	for (i = 0; i < mrp_nr_shards; i++) {
+		mrp_shard_call(&mrp_shards[i], mrp_loop_break, NULL);
+		pthread_join(mrp_shards[i].thread, NULL);
+	}
+	threaded = false;
+}
+
+void mrp_loop_cleanup(void)
+{
+	struct mrp_shard *s;
+	int i;
+
+	for (i = 0; i < mrp_nr_shards; i++) {
+		s = &mrp_shards[i];
+		if (s->cpu < 0)
+			continue;
+
+		ev_async_stop(s->loop, &s->call_watcher);
+		ev_loop_destroy(s->loop);
+		sem_destroy(&s->call_done);
+		pthread_mutex_destroy(&s->call_lock);
+		s->cpu = -1;
+	}
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <ev.h>
+
+#include "list.h"
+
+/*
+ * Data plane shards
+ *
+ * The packet I/O and the MRP timers run on the shard loops. By default
+ * there is one shard running on the main loop; otherwise each shard runs
+ * on its own SCHED_FIFO thread pinned to a CPU, while the control socket,
+ * the link notifications, the metrics, the events and DBus stay on the
+ * main loop.
+ *
+ * Each MRP instance is owned by one shard, chosen by its (bridge, ring_nr)
+ * pair, and it is accessed only from that shard: the main loop reaches it
+ * through mrp_shard_call(), which also forwards the link notifications to
+ * the owners.
+ */
+
+#define MRP_LOOP_DEFAULT_PRIO	50
+#define MRP_MAX_SHARDS		16
+#define MRP_MAX_THREADS		(MRP_MAX_SHARDS + 1)	/* and the main one */
+
+struct mrp_shard {
+	int			id;
+	int			cpu;
+	struct ev_loop		*loop;
+	pthread_t		thread;
+
+	/* The MRP instances owned by the shard */
+	struct list_head	instances;
+
+	/* Only one call at a time is pending since the callers take turns */
+	pthread_mutex_t		call_lock;
+	int			(*call_fn)(void *arg);
+	void			*call_arg;
+	int			call_ret;
+	ev_async		call_watcher;
+	sem_t			call_done;
+};
+
+extern struct mrp_shard mrp_shards[MRP_MAX_SHARDS];
+extern int mrp_nr_shards;
+
+/* The shard of the running thread, the first one for the main thread */
+extern __thread struct mrp_shard *mrp_shard;
+
+#define mrp_loop	(mrp_shard->loop)
+
+/* Serializes the interface drivers and the CFM offload, which share
+ * their kernel sockets among the shards.
+ */
+extern pthread_mutex_t mrp_driver_lock;
+
+/* Initializes a mutex taken by both the main loop and the data plane
+ * threads, its holder inherits the priority of the waiters.
+ */
+void mrp_mutex_init(pthread_mutex_t *m);
+
+/* Returns the index of the running thread, below MRP_MAX_THREADS, so that
+ * the queues filled by several threads can have one producer each.
+ */
+int mrp_thread_id(void);
+
+int mrp_loop_init(const int *cpus, int n, int prio);
+int mrp_loop_start(void);
+void mrp_loop_stop(void);
+void mrp_loop_cleanup(void);
+
+struct mrp_shard *mrp_shard_of(int br_ifindex, int ring_nr);
+
+/* Runs fn(arg) on the shard and returns its result, the caller waits for
+ * it. It must be called from the main loop.
+ */
+int mrp_shard_call(struct mrp_shard *s, int (*fn)(void *arg), void *arg);
+
+#endif
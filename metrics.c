@@ -0,0 +1,893 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <ev.h>
+
+#include "metrics.h"
+#include "state_machine.h"
+#include "server_cmds.h"
+#include "packet.h"
+#include "utils.h"
+#include "loop.h"
+#include "tc.h"
+
+/*
+ * OpenMetrics exporter
+ *
+ * The metrics are served over HTTP on a Unix socket or on a loopback TCP
+ * port. In order to never delay the MRP timers all the watchers have the
+ * lowest priority, the sockets are non-blocking and each write callback
+ * renders at most one metric family of one MRP instance.
+ */
+
+#define METRICS_MAX_CLIENTS	4
+#define METRICS_BUF_LEN		16384
+
+struct mrp_hist ifdriver_latency[MRP_IFDRIVER_OP_MAX];
+struct mrp_hist rx_queue_latency[MRP_TLV_IDX_MAX];
+struct mrp_hist rx_process_latency[MRP_TLV_IDX_MAX];
+struct mrp_hist tx_queue_latency[MRP_TLV_IDX_MAX];
+struct mrp_hist tx_latency[MRP_TLV_IDX_MAX];
+struct mrp_hist rx_wakeup_latency[MRP_RX_MODE_MAX];
+
+static const char *rx_mode_names[MRP_RX_MODE_MAX] = {
+	[MRP_RX_EPOLL]		= "epoll",
+	[MRP_RX_BUSY_POLL]	= "busy_poll",
+};
+
+struct metrics_buf {
+	char	*buf;
+	size_t	len;
+	size_t	pos;
+};
+
+struct metrics_family {
+	const char *name;
+	const char *type;
+	const char *help;
+	/* If mrp is NULL the family is global and it is rendered once */
+	void (*render)(struct metrics_buf *b, const char *name,
+		       struct mrp *mrp);
+	bool global;
+};
+
+struct metrics_client {
+	ev_io		io;
+	bool		active;
+	bool		header;		/* HTTP header already sent */
+	int		family;		/* current metric family */
+	int		shard;		/* current shard */
+	uint32_t	cursor;		/* last rendered MRP instance id */
+	size_t		len;
+	size_t		off;
+	char		buf[METRICS_BUF_LEN];
+};
+
+static struct metrics_client clients[METRICS_MAX_CLIENTS];
+static ev_io listen_watcher;
+static int listen_fd = -1;
+static char unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+static const char *rl_names[MRP_RL_MAX] = {
+	"test", "control", "other",
+};
+
+static const char *ifdriver_op_names[MRP_IFDRIVER_OP_MAX] = {
+	"port_state", "ring_role", "in_role", "flush",
+};
+
+static void out(struct metrics_buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (b->pos >= b->len)
+		return;
+
+	va_start(ap, fmt);
+	n = vsnprintf(b->buf + b->pos, b->len - b->pos, fmt, ap);
+	va_end(ap);
+
+	if (n > 0)
+		b->pos = b->pos + n < b->len ? b->pos + n : b->len;
+}
+
+#define LABELS		"bridge=\"%s\",ring_nr=\"%u\""
+#define LABELS_ARGS(mrp) (mrp)->ifname, (mrp)->ring_nr
+
+static void render_hist(struct metrics_buf *b, const char *name,
+			const char *labels, struct mrp_hist *h)
+{
+	uint64_t cum = 0;
+	int i;
+
+	for (i = 0; i < MRP_HIST_BUCKETS - 1; i++) {
+		cum += h->bucket[i];
+		out(b, "%s_bucket{%s,le=\"%g\"} %" PRIu64 "\n",
+		    name, labels, (double)(1ULL << i) / 1000000, cum);
+	}
+	out(b, "%s_bucket{%s,le=\"+Inf\"} %" PRIu64 "\n",
+	    name, labels, h->count);
+	out(b, "%s_count{%s} %" PRIu64 "\n", name, labels, h->count);
+	out(b, "%s_sum{%s} %g\n", name, labels, (double)h->sum / 1000000);
+}
+
+static struct mrp_port *mrp_port_nr(struct mrp *mrp, int i)
+{
+	switch (i) {
+	case 0: return mrp->p_port;
+	case 1: return mrp->s_port;
+	case 2: return mrp->i_port;
+	}
+
+	return NULL;
+}
+
+static void render_ring_state(struct metrics_buf *b, const char *name,
+			      struct mrp *mrp)
+{
+	if (mrp->ring_role == BR_MRP_RING_ROLE_MRM)
+		out(b, "%s{" LABELS ",role=\"mrm\"} %d\n", name,
+		    LABELS_ARGS(mrp), mrp->mrm_state);
+	else
+		out(b, "%s{" LABELS ",role=\"mrc\"} %d\n", name,
+		    LABELS_ARGS(mrp), mrp->mrc_state);
+}
+
+static void render_in_state(struct metrics_buf *b, const char *name,
+			    struct mrp *mrp)
+{
+	if (mrp->in_role == BR_MRP_IN_ROLE_MIM)
+		out(b, "%s{" LABELS ",role=\"mim\"} %d\n", name,
+		    LABELS_ARGS(mrp), mrp->mim_state);
+	else if (mrp->in_role == BR_MRP_IN_ROLE_MIC)
+		out(b, "%s{" LABELS ",role=\"mic\"} %d\n", name,
+		    LABELS_ARGS(mrp), mrp->mic_state);
+}
+
+static void render_ring_transitions(struct metrics_buf *b, const char *name,
+				    struct mrp *mrp)
+{
+	out(b, "%s_total{" LABELS "} %u\n", name, LABELS_ARGS(mrp),
+	    mrp->ring_transitions);
+}
+
+static void render_in_transitions(struct metrics_buf *b, const char *name,
+				  struct mrp *mrp)
+{
+	if (mrp->in_role == BR_MRP_IN_ROLE_DISABLED)
+		return;
+
+	out(b, "%s_total{" LABELS "} %u\n", name, LABELS_ARGS(mrp),
+	    mrp->in_transitions);
+}
+
+static void render_port_state(struct metrics_buf *b, const char *name,
+			      struct mrp *mrp)
+{
+	struct mrp_port *p;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		p = mrp_port_nr(mrp, i);
+		if (p)
+			out(b, "%s{" LABELS ",port=\"%s\"} %d\n", name,
+			    LABELS_ARGS(mrp), p->ifname, p->state);
+	}
+}
+
+static void render_frames(struct metrics_buf *b, const char *name,
+			  struct mrp *mrp, bool rx)
+{
+	struct mrp_port *p;
+	uint64_t *cnt;
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		p = mrp_port_nr(mrp, i);
+		if (!p)
+			continue;
+
+		cnt = rx ? p->cnt.rx : p->cnt.tx;
+		for (j = 0; j < MRP_TLV_IDX_MAX; j++)
+			out(b, "%s_total{" LABELS ",port=\"%s\",tlv=\"%s\"} %"
+			    PRIu64 "\n", name, LABELS_ARGS(mrp), p->ifname,
+			    tlv_idx_str(j), cnt[j]);
+	}
+}
+
+static void render_rx_frames(struct metrics_buf *b, const char *name,
+			     struct mrp *mrp)
+{
+	render_frames(b, name, mrp, true);
+}
+
+static void render_tx_frames(struct metrics_buf *b, const char *name,
+			     struct mrp *mrp)
+{
+	render_frames(b, name, mrp, false);
+}
+
+static void render_rx_dropped(struct metrics_buf *b, const char *name,
+			      struct mrp *mrp)
+{
+	struct mrp_port *p;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		p = mrp_port_nr(mrp, i);
+		if (p)
+			out(b, "%s_total{" LABELS ",port=\"%s\"} %" PRIu64 "\n",
+			    name, LABELS_ARGS(mrp), p->ifname,
+			    p->cnt.rx_dropped);
+	}
+}
+
+static void render_rx_malformed(struct metrics_buf *b, const char *name,
+				struct mrp *mrp)
+{
+	struct mrp_port *p;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		p = mrp_port_nr(mrp, i);
+		if (p)
+			out(b, "%s_total{" LABELS ",port=\"%s\"} %" PRIu64 "\n",
+			    name, LABELS_ARGS(mrp), p->ifname,
+			    p->cnt.rx_malformed);
+	}
+}
+
+static void render_rx_duplicate(struct metrics_buf *b, const char *name,
+				struct mrp *mrp)
+{
+	struct mrp_port *p;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		p = mrp_port_nr(mrp, i);
+		if (p)
+			out(b, "%s_total{" LABELS ",port=\"%s\"} %" PRIu64 "\n",
+			    name, LABELS_ARGS(mrp), p->ifname,
+			    p->cnt.rx_duplicate);
+	}
+}
+
+static void render_rx_limited(struct metrics_buf *b, const char *name,
+			      struct mrp *mrp)
+{
+	struct mrp_port *p;
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		p = mrp_port_nr(mrp, i);
+		if (!p)
+			continue;
+
+		for (j = 0; j < MRP_RL_MAX; j++)
+			out(b, "%s_total{" LABELS ",port=\"%s\",class=\"%s\"} %"
+			    PRIu64 "\n", name, LABELS_ARGS(mrp), p->ifname,
+			    rl_names[j], p->cnt.rx_limited[j]);
+	}
+}
+
+static void render_forwarded(struct metrics_buf *b, const char *name,
+			     struct mrp *mrp)
+{
+	struct mrp_port *p;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		p = mrp_port_nr(mrp, i);
+		if (p)
+			out(b, "%s_total{" LABELS ",port=\"%s\"} %" PRIu64 "\n",
+			    name, LABELS_ARGS(mrp), p->ifname,
+			    p->cnt.forwarded);
+	}
+}
+
+/* The ports with the qdiscs of tc.h, collected on the shards. Bounded to
+ * keep the family within the buffer.
+ */
+#define METRICS_TC_MAX_PORTS	32
+
+struct metrics_tc_port {
+	char			bridge[IF_NAMESIZE];
+	uint32_t		ring_nr;
+	char			ifname[IF_NAMESIZE];
+	int			ifindex;
+	bool			txtime;
+};
+
+struct metrics_tc_ports {
+	int			n;
+	struct metrics_tc_port	p[METRICS_TC_MAX_PORTS];
+};
+
+static int metrics_tc_collect(void *arg)
+{
+	struct metrics_tc_ports *c = arg;
+	struct metrics_tc_port *t;
+	struct mrp_port *p;
+	struct mrp *mrp;
+	uint32_t id = 0;
+	int i;
+
+	while ((mrp = mrp_find_next(id))) {
+		for (i = 0; i < 3; i++) {
+			p = mrp_port_nr(mrp, i);
+			if (!p || !p->tc || c->n == METRICS_TC_MAX_PORTS)
+				continue;
+
+			t = &c->p[c->n++];
+			memcpy(t->bridge, mrp->ifname, IF_NAMESIZE);
+			t->ring_nr = mrp->ring_nr;
+			memcpy(t->ifname, p->ifname, IF_NAMESIZE);
+			t->ifindex = p->ifindex;
+			t->txtime = p->txtime;
+		}
+
+		id = mrp->id;
+	}
+
+	return 0;
+}
+
+/* Read from the kernel on the main loop, so the shards never wait for the
+ * class dumps
+ */
+static void render_queue_dropped(struct metrics_buf *b, const char *name,
+				 struct mrp *mrp)
+{
+	static struct metrics_tc_ports c;
+	struct metrics_tc_port *t;
+	struct tc_mrp_stats st;
+	int i;
+
+	c.n = 0;
+	for (i = 0; i < mrp_nr_shards; i++)
+		mrp_shard_call(&mrp_shards[i], metrics_tc_collect, &c);
+
+	for (i = 0; i < c.n; i++) {
+		t = &c.p[i];
+		if (tc_mrp_stats(t->ifindex, &st) < 0)
+			continue;
+
+		out(b, "%s_total{" LABELS ",port=\"%s\",queue=\"mrp\"} %u\n",
+		    name, t->bridge, t->ring_nr, t->ifname, st.mrp_drops);
+		if (t->txtime)
+			out(b, "%s_total{" LABELS ",port=\"%s\","
+			    "queue=\"txtime\"} %u\n",
+			    name, t->bridge, t->ring_nr, t->ifname,
+			    st.txtime_drops);
+	}
+}
+
+static void render_link_suppressed(struct metrics_buf *b, const char *name,
+				   struct mrp *mrp)
+{
+	struct mrp_port *p;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		p = mrp_port_nr(mrp, i);
+		if (p)
+			out(b, "%s_total{" LABELS ",port=\"%s\"} %" PRIu64 "\n",
+			    name, LABELS_ARGS(mrp), p->ifname,
+			    p->cnt.link_suppressed);
+	}
+}
+
+static void render_test_missed(struct metrics_buf *b, const char *name,
+			       struct mrp *mrp)
+{
+	out(b, "%s_total{" LABELS ",type=\"ring\"} %" PRIu64 "\n", name,
+	    LABELS_ARGS(mrp), mrp->cnt.ring_test_missed);
+	out(b, "%s_total{" LABELS ",type=\"in\"} %" PRIu64 "\n", name,
+	    LABELS_ARGS(mrp), mrp->cnt.in_test_missed);
+}
+
+static void render_test_lateness(struct metrics_buf *b, const char *name,
+				 struct mrp *mrp)
+{
+	char labels[64];
+
+	snprintf(labels, sizeof(labels), LABELS, LABELS_ARGS(mrp));
+	render_hist(b, name, labels, &mrp->test_lateness);
+}
+
+static void render_ring_rtt(struct metrics_buf *b, const char *name,
+			    struct mrp *mrp)
+{
+	char labels[96];
+	struct mrp_port *p;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		p = mrp_port_nr(mrp, i);
+		if (!p || !mrp->ring_rtt[i].sent)
+			continue;
+
+		snprintf(labels, sizeof(labels), LABELS ",port=\"%s\"",
+			 LABELS_ARGS(mrp), p->ifname);
+		render_hist(b, name, labels, &mrp->ring_rtt[i].hist);
+	}
+}
+
+static void render_ring_test_lost(struct metrics_buf *b, const char *name,
+				  struct mrp *mrp)
+{
+	struct mrp_port *p;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		p = mrp_port_nr(mrp, i);
+		if (p && mrp->ring_rtt[i].sent)
+			out(b, "%s_total{" LABELS ",port=\"%s\"} %" PRIu64 "\n",
+			    name, LABELS_ARGS(mrp), p->ifname,
+			    mrp->ring_rtt[i].lost);
+	}
+}
+
+static void render_ring_test_reordered(struct metrics_buf *b,
+				       const char *name, struct mrp *mrp)
+{
+	struct mrp_port *p;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		p = mrp_port_nr(mrp, i);
+		if (p && mrp->ring_rtt[i].sent)
+			out(b, "%s_total{" LABELS ",port=\"%s\"} %" PRIu64 "\n",
+			    name, LABELS_ARGS(mrp), p->ifname,
+			    mrp->ring_rtt[i].reordered);
+	}
+}
+
+static void render_socket_stats(struct metrics_buf *b, const char *name,
+				struct mrp *mrp)
+{
+	struct mrp_socket_stats sock;
+
+	mrp_socket_stats_get(&sock);
+
+	out(b, "%s_total{socket=\"packet\",reason=\"kernel\"} %" PRIu64 "\n",
+	    name, sock.packet_drops);
+	out(b, "%s_total{socket=\"packet\",reason=\"no_port\"} %" PRIu64 "\n",
+	    name, sock.rx_no_port);
+	out(b, "%s_total{socket=\"netlink\",reason=\"enobufs\"} %" PRIu64 "\n",
+	    name, sock.netlink_enobufs);
+}
+
+static void render_netlink_resyncs(struct metrics_buf *b, const char *name,
+				   struct mrp *mrp)
+{
+	struct mrp_socket_stats sock;
+
+	mrp_socket_stats_get(&sock);
+
+	out(b, "%s_total %" PRIu64 "\n", name, sock.netlink_resyncs);
+}
+
+static void render_ifdriver_latency(struct metrics_buf *b, const char *name,
+				    struct mrp *mrp)
+{
+	char labels[32];
+	int i;
+
+	for (i = 0; i < MRP_IFDRIVER_OP_MAX; i++) {
+		snprintf(labels, sizeof(labels), "op=\"%s\"",
+			 ifdriver_op_names[i]);
+		render_hist(b, name, labels, &ifdriver_latency[i]);
+	}
+}
+
+/* Only the TLV types seen so far, to keep the family within the buffer */
+static void render_tlv_latency(struct metrics_buf *b, const char *name,
+			       struct mrp_hist *hists)
+{
+	char labels[32];
+	int i;
+
+	for (i = 0; i < MRP_TLV_IDX_MAX; i++) {
+		if (!hists[i].count)
+			continue;
+
+		snprintf(labels, sizeof(labels), "type=\"%s\"",
+			 tlv_idx_str(i));
+		render_hist(b, name, labels, &hists[i]);
+	}
+}
+
+static void render_rx_queue_latency(struct metrics_buf *b, const char *name,
+				    struct mrp *mrp)
+{
+	render_tlv_latency(b, name, rx_queue_latency);
+}
+
+static void render_rx_process_latency(struct metrics_buf *b,
+				      const char *name, struct mrp *mrp)
+{
+	render_tlv_latency(b, name, rx_process_latency);
+}
+
+static void render_tx_queue_latency(struct metrics_buf *b, const char *name,
+				    struct mrp *mrp)
+{
+	render_tlv_latency(b, name, tx_queue_latency);
+}
+
+static void render_tx_latency(struct metrics_buf *b, const char *name,
+			      struct mrp *mrp)
+{
+	render_tlv_latency(b, name, tx_latency);
+}
+
+static void render_rx_wakeup_latency(struct metrics_buf *b,
+				     const char *name, struct mrp *mrp)
+{
+	char labels[32];
+	int i;
+
+	for (i = 0; i < MRP_RX_MODE_MAX; i++) {
+		if (!rx_wakeup_latency[i].count)
+			continue;
+
+		snprintf(labels, sizeof(labels), "mode=\"%s\"",
+			 rx_mode_names[i]);
+		render_hist(b, name, labels, &rx_wakeup_latency[i]);
+	}
+}
+
+static void render_busy_poll(struct metrics_buf *b, const char *name,
+			     struct mrp *mrp)
+{
+	out(b, "%s_total %g\n", name, (double)packet_busy_poll_us() / 1000000);
+}
+
+static void render_txtime_dropped(struct metrics_buf *b, const char *name,
+				  struct mrp *mrp)
+{
+	out(b, "%s_total %" PRIu64 "\n", name, packet_txtime_drops());
+}
+
+static const struct metrics_family families[] = {
+	{ "mrp_ring_state", "gauge",
+	  "Ring state machine state", render_ring_state },
+	{ "mrp_in_state", "gauge",
+	  "Interconnection state machine state", render_in_state },
+	{ "mrp_ring_transitions", "counter",
+	  "Ring open transitions", render_ring_transitions },
+	{ "mrp_in_transitions", "counter",
+	  "Interconnection open transitions", render_in_transitions },
+	{ "mrp_port_state", "gauge",
+	  "Port state", render_port_state },
+	{ "mrp_rx_frames", "counter",
+	  "MRP frames received per TLV type", render_rx_frames },
+	{ "mrp_tx_frames", "counter",
+	  "MRP frames sent per TLV type", render_tx_frames },
+	{ "mrp_rx_dropped_frames", "counter",
+	  "MRP frames dropped on reception", render_rx_dropped },
+	{ "mrp_rx_malformed_frames", "counter",
+	  "Malformed MRP frames rejected on reception", render_rx_malformed },
+	{ "mrp_rx_duplicate_frames", "counter",
+	  "Duplicate topology and link changes not processed again",
+	  render_rx_duplicate },
+	{ "mrp_rx_limited_frames", "counter",
+	  "MRP frames dropped over the ingress rate", render_rx_limited },
+	{ "mrp_forwarded_frames", "counter",
+	  "MRP frames forwarded", render_forwarded },
+	{ "mrp_queue_dropped_frames", "counter",
+	  "MRP frames dropped by the egress qdiscs of a port",
+	  render_queue_dropped, true },
+	{ "mrp_link_notifications_suppressed", "counter",
+	  "Duplicated or superseded link notifications",
+	  render_link_suppressed },
+	{ "mrp_test_missed", "counter",
+	  "Test frames not received in time", render_test_missed },
+	{ "mrp_test_timer_lateness_seconds", "histogram",
+	  "Lateness of the test frame timers", render_test_lateness },
+	{ "mrp_ring_rtt_seconds", "histogram",
+	  "Round trip of the test frames sent on a port",
+	  render_ring_rtt },
+	{ "mrp_ring_test_lost", "counter",
+	  "Test frames sent on a port and never received back",
+	  render_ring_test_lost },
+	{ "mrp_ring_test_reordered", "counter",
+	  "Test frames received back out of order",
+	  render_ring_test_reordered },
+	{ "mrp_socket_dropped_frames", "counter",
+	  "Frames or notifications lost by the sockets",
+	  render_socket_stats, true },
+	{ "mrp_netlink_resyncs", "counter",
+	  "Link dumps done after lost netlink notifications",
+	  render_netlink_resyncs, true },
+	{ "mrp_ifdriver_latency_seconds", "histogram",
+	  "Latency of the network driver operations",
+	  render_ifdriver_latency, true },
+	{ "mrp_rx_queue_latency_seconds", "histogram",
+	  "Time from the arrival of a frame to its processing",
+	  render_rx_queue_latency, true },
+	{ "mrp_rx_process_latency_seconds", "histogram",
+	  "Time to process a received frame",
+	  render_rx_process_latency, true },
+	{ "mrp_tx_queue_latency_seconds", "histogram",
+	  "Time from the send of a frame to its transmission",
+	  render_tx_queue_latency, true },
+	{ "mrp_tx_latency_seconds", "histogram",
+	  "Time from a received frame or a test timer expiration to the "
+	  "transmission of the frame sent for it",
+	  render_tx_latency, true },
+	{ "mrp_rx_wakeup_latency_seconds", "histogram",
+	  "Time from the arrival of a frame to its read, by receive mode",
+	  render_rx_wakeup_latency, true },
+	{ "mrp_busy_poll_seconds", "counter",
+	  "CPU time spent spinning on the packet sockets",
+	  render_busy_poll, true },
+	{ "mrp_txtime_dropped_frames", "counter",
+	  "Test frames dropped by the ETF qdisc past their launch time",
+	  render_txtime_dropped, true },
+};
+
+static void metrics_client_close(struct metrics_client *c)
+{
+	ev_io_stop(EV_DEFAULT, &c->io);
+	close(c->io.fd);
+	c->active = false;
+}
+
+/* Renders a family for the next instance of the running shard */
+struct metrics_instance {
+	struct metrics_buf		*b;
+	const struct metrics_family	*f;
+	uint32_t			cursor;
+};
+
+static int metrics_render_instance(void *arg)
+{
+	struct metrics_instance *r = arg;
+	struct mrp *mrp;
+
+	mrp = mrp_find_next(r->cursor);
+	if (!mrp)
+		return 0;
+
+	r->f->render(r->b, r->f->name, mrp);
+	r->cursor = mrp->id;
+
+	return 1;
+}
+
+/* Renders the next chunk of the reply. Returns 0 when everything has been
+ * rendered. The instances are rendered by the shards owning them.
+ */
+static int metrics_render(struct metrics_client *c)
+{
+	struct metrics_buf b = { .buf = c->buf, .len = sizeof(c->buf) };
+	struct metrics_instance r = { .b = &b };
+	const struct metrics_family *f;
+
+	if (!c->header) {
+		out(&b, "HTTP/1.0 200 OK\r\n"
+			"Content-Type: application/openmetrics-text; "
+			"version=1.0.0; charset=utf-8\r\n"
+			"Connection: close\r\n\r\n");
+		c->header = true;
+	}
+
+	while (c->family < COUNT_OF(families) && b.pos == 0) {
+		f = &families[c->family];
+
+		if (c->shard == 0 && c->cursor == 0) {
+			out(&b, "# TYPE %s %s\n", f->name, f->type);
+			out(&b, "# HELP %s %s\n", f->name, f->help);
+		}
+
+		if (f->global) {
+			f->render(&b, f->name, NULL);
+			c->family++;
+			continue;
+		}
+
+		r.f = f;
+		r.cursor = c->cursor;
+		if (!mrp_shard_call(&mrp_shards[c->shard],
+				    metrics_render_instance, &r)) {
+			c->cursor = 0;
+			if (++c->shard == mrp_nr_shards) {
+				c->shard = 0;
+				c->family++;
+			}
+			continue;
+		}
+
+		c->cursor = r.cursor;
+	}
+
+	if (c->family == COUNT_OF(families) && b.pos < b.len) {
+		out(&b, "# EOF\n");
+		c->family++;
+	}
+
+	c->off = 0;
+	c->len = b.pos;
+
+	return c->len > 0;
+}
+
+static void metrics_client_cb(EV_P_ ev_io *w, int revents)
+{
+	struct metrics_client *c = container_of(w, struct metrics_client, io);
+	char req[1024];
+	int l;
+
+	if (revents & EV_READ) {
+		/* The request content doesn't matter, any request gets the
+		 * metrics
+		 */
+		l = read(w->fd, req, sizeof(req));
+		if (l < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (l <= 0) {
+			metrics_client_close(c);
+			return;
+		}
+
+		ev_io_stop(EV_A_ w);
+		ev_io_set(w, w->fd, EV_WRITE);
+		ev_io_start(EV_A_ w);
+		return;
+	}
+
+	if (c->off == c->len && !metrics_render(c)) {
+		metrics_client_close(c);
+		return;
+	}
+
+	l = write(w->fd, c->buf + c->off, c->len - c->off);
+	if (l < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return;
+
+		pr_debug("metrics client write failed: %m");
+		metrics_client_close(c);
+		return;
+	}
+
+	c->off += l;
+}
+
+static void metrics_accept_cb(EV_P_ ev_io *w, int revents)
+{
+	struct metrics_client *c = NULL;
+	int fd, i;
+
+	fd = accept4(w->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			pr_err("metrics accept failed: %m");
+		return;
+	}
+
+	for (i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		if (!clients[i].active) {
+			c = &clients[i];
+			break;
+		}
+	}
+	if (!c) {
+		pr_warn_ratelimit("too many metrics clients");
+		close(fd);
+		return;
+	}
+
+	memset(c, 0, offsetof(struct metrics_client, buf));
+	c->active = true;
+
+	ev_io_init(&c->io, metrics_client_cb, fd, EV_READ);
+	ev_set_priority(&c->io, EV_MINPRI);
+	ev_io_start(EV_A_ &c->io);
+}
+
+/* The address is either the path of a Unix socket or a TCP port number
+ * on the loopback interface.
+ */
+int metrics_init(const char *addr)
+{
+	struct sockaddr_un sun;
+	struct sockaddr_in sin;
+	struct sockaddr *sa;
+	socklen_t salen;
+	int one = 1;
+	int s;
+
+	if (addr[0] == '/') {
+		if (strlen(addr) >= sizeof(sun.sun_path)) {
+			pr_err("metrics socket path too long");
+			return -1;
+		}
+
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		strcpy(sun.sun_path, addr);
+		unlink(addr);
+		strcpy(unix_path, addr);
+
+		sa = (struct sockaddr *)&sun;
+		salen = sizeof(sun);
+		s = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+			   SOCK_CLOEXEC, 0);
+	} else {
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_port = htons(atoi(addr));
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (!sin.sin_port) {
+			pr_err("invalid metrics port %s", addr);
+			return -1;
+		}
+
+		sa = (struct sockaddr *)&sin;
+		salen = sizeof(sin);
+		s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK |
+			   SOCK_CLOEXEC, 0);
+		if (s >= 0)
+			setsockopt(s, SOL_SOCKET, SO_REUSEADDR,
+				   &one, sizeof(one));
+	}
+	if (s < 0) {
+		pr_err("metrics socket failed: %m");
+		return -1;
+	}
+
+	if (bind(s, sa, salen) < 0) {
+		pr_err("metrics bind failed: %m");
+		goto close;
+	}
+
+	if (listen(s, METRICS_MAX_CLIENTS) < 0) {
+		pr_err("metrics listen failed: %m");
+		goto close;
+	}
+
+	listen_fd = s;
+	ev_io_init(&listen_watcher, metrics_accept_cb, listen_fd, EV_READ);
+	ev_set_priority(&listen_watcher, EV_MINPRI);
+	ev_io_start(EV_DEFAULT, &listen_watcher);
+
+	return 0;
+
+close:
+	close(s);
+	return -1;
+}
+
+void metrics_cleanup(void)
+{
+	int i;
+
+	if (listen_fd < 0)
+		return;
+
+	for (i = 0; i < METRICS_MAX_CLIENTS; i++)
+		if (clients[i].active)
+			metrics_client_close(&clients[i]);
+
+	ev_io_stop(EV_DEFAULT, &listen_watcher);
+	close(listen_fd);
+	listen_fd = -1;
+
+	if (unix_path[0])
+		unlink(unix_path);
+}
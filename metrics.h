@@ -0,0 +1,107 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "utils.h"
+#include "loop.h"
+
+/* Histograms with log2 buckets: bucket i counts the values up to 2^i us,
+ * the last one counts everything else.
+ */
+#define MRP_HIST_BUCKETS	18
+
+struct mrp_hist {
+	uint64_t bucket[MRP_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum;		/* us */
+};
+
+static inline void mrp_hist_add(struct mrp_hist *h, uint64_t us)
+{
+	int i = 0;
+
+	if (us > 1)
+		i = 64 - __builtin_clzll(us - 1);
+	if (i >= MRP_HIST_BUCKETS)
+		i = MRP_HIST_BUCKETS - 1;
+
+	/* The global histograms are shared by the shards */
+	__atomic_fetch_add(&h->bucket[i], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, us, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t mrp_time_us(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+/* The kernel socket timestamps are taken with CLOCK_REALTIME */
+static inline uint64_t mrp_time_real_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_REALTIME, &t);
+
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+enum mrp_ifdriver_op {
+	MRP_IFDRIVER_PORT_STATE,
+	MRP_IFDRIVER_RING_ROLE,
+	MRP_IFDRIVER_IN_ROLE,
+	MRP_IFDRIVER_FLUSH,
+	MRP_IFDRIVER_OP_MAX,
+};
+
+extern struct mrp_hist ifdriver_latency[MRP_IFDRIVER_OP_MAX];
+
+/* Latencies per TLV type, from the kernel socket timestamps:
+ * rx_queue:   arrival of a frame -> mrp_recv() starts
+ * rx_process: mrp_recv() starts -> its frames are sent and its ifdriver
+ *             calls are done
+ * tx_queue:   packet_send() -> the frame leaves the host
+ * tx:         the received frame or the test timer expiration the frame
+ *             is sent for -> the frame leaves the host
+ */
+extern struct mrp_hist rx_queue_latency[MRP_TLV_IDX_MAX];
+extern struct mrp_hist rx_process_latency[MRP_TLV_IDX_MAX];
+extern struct mrp_hist tx_queue_latency[MRP_TLV_IDX_MAX];
+extern struct mrp_hist tx_latency[MRP_TLV_IDX_MAX];
+
+/* Arrival of a frame -> read from the packet socket, by the way the socket
+ * was waited on. Accounted only when busy polling is enabled.
+ */
+enum mrp_rx_mode {
+	MRP_RX_EPOLL,
+	MRP_RX_BUSY_POLL,
+	MRP_RX_MODE_MAX,
+};
+
+extern struct mrp_hist rx_wakeup_latency[MRP_RX_MODE_MAX];
+
+/* Calls an ifdriver function and accounts its latency */
+#define IFDRIVER_TIMED(op, call) ({					\
+	uint64_t __t;							\
+	int __ret;							\
+	pthread_mutex_lock(&mrp_driver_lock);				\
+	__t = mrp_time_us();						\
+	__ret = (call);							\
+	mrp_hist_add(&ifdriver_latency[op], mrp_time_us() - __t);	\
+	pthread_mutex_unlock(&mrp_driver_lock);				\
+	__ret;								\
+})
+
+int metrics_init(const char *addr);
+void metrics_cleanup(void);
+
+#endif /* METRICS_H */
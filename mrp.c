@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <net/if.h>
+#include <inttypes.h>
 
 #include "utils.h"
 #include "linux.h"
@@ -128,6 +129,7 @@ static char* ring_recv_str(enum mrp_ring_recovery_type ring_recv)
 	case MRP_RING_RECOVERY_200: return "200";
 	case MRP_RING_RECOVERY_30: return "30";
 	case MRP_RING_RECOVERY_10: return "10";
+	case MRP_RING_RECOVERY_CUSTOM: return "custom";
 	default:
 		return "Unknown ring recovery";
 	}
@@ -155,6 +157,7 @@ static char* in_recv_str(enum mrp_in_recovery_type in_recv)
 	switch (in_recv) {
 	case MRP_IN_RECOVERY_500: return "500";
 	case MRP_IN_RECOVERY_200: return "200";
+	case MRP_IN_RECOVERY_CUSTOM: return "custom";
 	default:
 		return "Unknown interconnect recovery";
 	}
@@ -207,6 +210,18 @@ static char *mic_state_str(int mic_state)
 	}
 }
 
+static char *port_state_str(int port_state)
+{
+	switch (port_state) {
+	case BR_MRP_PORT_STATE_DISABLED: return "DISABLED";
+	case BR_MRP_PORT_STATE_BLOCKED: return "BLOCKED";
+	case BR_MRP_PORT_STATE_FORWARDING: return "FORWARDING";
+	case BR_MRP_PORT_STATE_NOT_CONNECTED: return "NOT_CONNECTED";
+	default:
+		return "Unknown port_state";
+	}
+}
+
 static void cfm_dmac_get(char *argv, char *dmac)
 {
 	int values[ETH_ALEN];
@@ -350,7 +365,8 @@ static int client_send_message(int cmd, void *inbuf, int lin, void *outbuf,
 	return 0;
 }
 
-static int cmd_addmrp(int argc, char *const *argv)
+/* Parses the addmrp arguments into in */
+static int addmrp_parse(int argc, char *const *argv, struct addmrp_IN *in)
 {
 	int br = 0, pport = 0, sport = 0, ring_nr = 0, ring_role = 0;
 	uint16_t prio = MRP_DEFAULT_PRIO;
@@ -362,8 +378,9 @@ static int cmd_addmrp(int argc, char *const *argv)
 	int in_mode = MRP_IN_MODE_RC;
 	uint16_t in_id = 0;
 	uint32_t cfm_level = 0, cfm_mepid = 0, cfm_peer_mepid = 0, cfm_instance = 0;
-	char cfm_dmac[ETH_ALEN];
-	char cfm_maid[CFM_MAID_LENGTH];
+	char cfm_dmac[ETH_ALEN] = { 0 };
+	char cfm_maid[CFM_MAID_LENGTH] = { 0 };
+	struct mrp_recovery_custom custom = { 0 }, *recv_custom = &custom;
 
 	/* skip the command */
 	argv++;
@@ -441,6 +458,33 @@ static int cmd_addmrp(int argc, char *const *argv)
 		} else if (strcmp(*argv, "cfm_dmac") == 0) {
 			NEXT_ARG();
 			cfm_dmac_get(*argv, cfm_dmac);
+		} else if (strcmp(*argv, "test_interval") == 0) {
+			NEXT_ARG();
+			custom.test_interval = atoi(*argv);
+		} else if (strcmp(*argv, "test_short") == 0) {
+			NEXT_ARG();
+			custom.test_short = atoi(*argv);
+		} else if (strcmp(*argv, "test_max") == 0) {
+			NEXT_ARG();
+			custom.test_max = atoi(*argv);
+		} else if (strcmp(*argv, "test_ext_max") == 0) {
+			NEXT_ARG();
+			custom.test_ext_max = atoi(*argv);
+		} else if (strcmp(*argv, "topo_interval") == 0) {
+			NEXT_ARG();
+			custom.topo_interval = atoi(*argv);
+		} else if (strcmp(*argv, "topo_max") == 0) {
+			NEXT_ARG();
+			custom.topo_max = atoi(*argv);
+		} else if (strcmp(*argv, "link_interval") == 0) {
+			NEXT_ARG();
+			custom.link_interval = atoi(*argv);
+		} else if (strcmp(*argv, "link_max") == 0) {
+			NEXT_ARG();
+			custom.link_max = atoi(*argv);
+		} else if (strcmp(*argv, "in_test_interval") == 0) {
+			NEXT_ARG();
+			custom.in_test_interval = atoi(*argv);
 		}
 
 		argc--; argv++;
@@ -453,11 +497,24 @@ static int cmd_addmrp(int argc, char *const *argv)
 	if (ring_role == BR_MRP_RING_ROLE_MRA && prio_set == false)
 		prio = MRP_MRA_PRIO;
 
-	return CTL_addmrp(br, ring_nr, pport, sport, ring_role, prio,
-			  ring_recv, react_on_link_change, in_role,
-			  in_id, iport, in_mode, in_recv, cfm_instance,
-			  cfm_level, cfm_mepid, cfm_peer_mepid, cfm_maid,
-			  cfm_dmac);
+	addmrp_COPY_IN;
+
+	return 0;
+}
+
+static int cmd_addmrp(int argc, char *const *argv)
+{
+	struct addmrp_IN in;
+
+	if (addmrp_parse(argc, argv, &in))
+		return -1;
+
+	return CTL_addmrp(in.br, in.ring_nr, in.pport, in.sport, in.ring_role,
+			  in.prio, in.ring_recv, in.react_on_link_change,
+			  in.in_role, in.in_id, in.iport, in.in_mode,
+			  in.in_recv, in.cfm_instance, in.cfm_level,
+			  in.cfm_mepid, in.cfm_peer_mepid, in.cfm_maid,
+			  in.cfm_dmac, &in.recv_custom);
 }
 
 static int cmd_delmrp(int argc, char *const *argv)
@@ -486,45 +543,426 @@ static int cmd_delmrp(int argc, char *const *argv)
 	return CTL_delmrp(br, ring_nr);
 }
 
-static int cmd_getmrp(int argc, char *const *argv)
+static void print_status(struct mrp_status *status)
 {
-	struct mrp_status status[MAX_MRP_INSTANCES];
 	char ifname[IF_NAMESIZE];
-	int count = 0;
+
+	memset(ifname, 0, IF_NAMESIZE);
+
+	printf("bridge: %s ", if_indextoname(status->br, ifname));
+	printf("ring_nr: %d ", status->ring_nr);
+	printf("pport: %s ", if_indextoname(status->pport, ifname));
+	printf("sport: %s ", if_indextoname(status->sport, ifname));
+	printf("mra_support: %d ", status->mra_support);
+	printf("ring_role: %s ", ring_role_str(status->ring_role));
+	printf("prio: %d ", status->prio);
+	printf("ring_recv: %s \n", ring_recv_str(status->ring_recv));
+	printf("react_on_link_change: %d ", status->react_on_link_change);
+	if (status->ring_role == BR_MRP_RING_ROLE_MRM)
+		printf("ring_state: %s \n", mrm_state_str(status->ring_state));
+	if (status->ring_role == BR_MRP_RING_ROLE_MRC)
+		printf("ring_state: %s \n", mrc_state_str(status->ring_state));
+
+	if (status->in_role == BR_MRP_IN_ROLE_DISABLED)
+		return;
+
+	printf("iport: %s ", if_indextoname(status->iport, ifname));
+	printf("in_id: %d ", status->in_id);
+	printf("in_role: %s ", in_role_str(status->in_role));
+	printf("in_recv: %s \n", in_recv_str(status->in_recv));
+	printf("in_mode: %s ", in_mode_str(status->in_mode));
+	if (status->in_role == BR_MRP_IN_ROLE_MIM)
+		printf("in_state: %s \n", mim_state_str(status->in_state));
+	if (status->in_role == BR_MRP_IN_ROLE_MIC)
+		printf("in_state: %s \n", mic_state_str(status->in_state));
+}
+
+static int cmd_getmrp(int argc, char *const *argv)
+{
+	struct mrp_status status[MRP_STATUS_PAGE_LEN];
+	uint32_t cursor = 0, since = 0, generation = 0;
+	bool show_gen = false;
+	int count, total;
 	int i;
 
+	/* skip the command */
+	argv++;
+	argc -= 1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "since") == 0) {
+			NEXT_ARG();
+			since = strtoul(*argv, NULL, 0);
+			show_gen = true;
+		}
+
+		argc--; argv++;
+	}
+
+	do {
+		if (CTL_listmrp(cursor, since, &count, &cursor, &generation,
+				&total, status))
+			return -1;
+
+		for (i = 0; i < count; ++i)
+			print_status(&status[i]);
+	} while (cursor);
+
+	if (show_gen)
+		printf("generation: %u total: %d\n", generation, total);
+
+	return 0;
+}
+
+static void print_stats(struct mrp_stats *stats)
+{
+	char ifname[IF_NAMESIZE];
+	int i, j;
+
 	memset(ifname, 0, IF_NAMESIZE);
 
-	if (CTL_getmrp(&count, status))
+	printf("ring_test_missed: %" PRIu64 " ", stats->mrp.ring_test_missed);
+	printf("in_test_missed: %" PRIu64 " ", stats->mrp.in_test_missed);
+	printf("processed: %" PRIu64 "\n", stats->mrp.processed);
+
+	for (i = 0; i < 3; i++) {
+		struct mrp_port_counters *cnt = &stats->port_cnt[i];
+
+		if (!stats->port[i])
+			continue;
+
+		printf("port: %s ", if_indextoname(stats->port[i], ifname));
+		printf("rx_dropped: %" PRIu64 " ", cnt->rx_dropped);
+		printf("rx_malformed: %" PRIu64 " ", cnt->rx_malformed);
+		printf("rx_duplicate: %" PRIu64 " ", cnt->rx_duplicate);
+		printf("rx_limited: %" PRIu64 "/%" PRIu64 "/%" PRIu64 " ",
+		       cnt->rx_limited[MRP_RL_TEST],
+		       cnt->rx_limited[MRP_RL_CTRL],
+		       cnt->rx_limited[MRP_RL_OTHER]);
+		printf("forwarded: %" PRIu64 " ", cnt->forwarded);
+		printf("link_suppressed: %" PRIu64 "\n", cnt->link_suppressed);
+		for (j = 0; j < MRP_TLV_IDX_MAX; j++) {
+			if (!cnt->rx[j] && !cnt->tx[j])
+				continue;
+			printf("  %-16s rx: %" PRIu64 " tx: %" PRIu64 "\n",
+			       tlv_idx_str(j), cnt->rx[j], cnt->tx[j]);
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		struct mrp_rtt_stats *rtt = &stats->rtt[i];
+
+		if (!rtt->sent)
+			continue;
+
+		printf("ring_rtt: %s ", if_indextoname(stats->port[i], ifname));
+		printf("sent: %" PRIu64 " ", rtt->sent);
+		printf("received: %" PRIu64 " ", rtt->received);
+		printf("lost: %" PRIu64 " (%.2f%%) ", rtt->lost,
+		       rtt->lost * 100.0 / rtt->sent);
+		printf("reordered: %" PRIu64 "\n", rtt->reordered);
+		printf("  min: %u us avg: %u us p99: %u us max: %u us\n",
+		       rtt->min, rtt->avg, rtt->p99, rtt->max);
+	}
+
+	printf("packet_rx: %" PRIu64 " ", stats->sock.packet_rx);
+	printf("packet_drops: %" PRIu64 " ", stats->sock.packet_drops);
+	printf("rx_no_port: %" PRIu64 " ", stats->sock.rx_no_port);
+	printf("netlink_enobufs: %" PRIu64 " ", stats->sock.netlink_enobufs);
+	printf("netlink_resyncs: %" PRIu64 "\n", stats->sock.netlink_resyncs);
+}
+
+static void print_stats_json(struct mrp_stats *stats)
+{
+	char ifname[IF_NAMESIZE];
+	int i, j;
+
+	memset(ifname, 0, IF_NAMESIZE);
+
+	printf("{\"ring_test_missed\":%" PRIu64 ",", stats->mrp.ring_test_missed);
+	printf("\"in_test_missed\":%" PRIu64 ",", stats->mrp.in_test_missed);
+	printf("\"processed\":%" PRIu64 ",", stats->mrp.processed);
+	printf("\"ports\":[");
+	for (i = 0; i < 3; i++) {
+		struct mrp_port_counters *cnt = &stats->port_cnt[i];
+
+		if (!stats->port[i])
+			continue;
+
+		printf("%s{\"port\":\"%s\",", i ? "," : "",
+		       if_indextoname(stats->port[i], ifname));
+		printf("\"rx_dropped\":%" PRIu64 ",", cnt->rx_dropped);
+		printf("\"rx_malformed\":%" PRIu64 ",", cnt->rx_malformed);
+		printf("\"rx_duplicate\":%" PRIu64 ",", cnt->rx_duplicate);
+		printf("\"rx_limited\":{\"test\":%" PRIu64 ",\"control\":%"
+		       PRIu64 ",\"other\":%" PRIu64 "},",
+		       cnt->rx_limited[MRP_RL_TEST],
+		       cnt->rx_limited[MRP_RL_CTRL],
+		       cnt->rx_limited[MRP_RL_OTHER]);
+		printf("\"forwarded\":%" PRIu64 ",", cnt->forwarded);
+		printf("\"link_suppressed\":%" PRIu64 ",",
+		       cnt->link_suppressed);
+		printf("\"rx\":{");
+		for (j = 0; j < MRP_TLV_IDX_MAX; j++)
+			printf("%s\"%s\":%" PRIu64, j ? "," : "",
+			       tlv_idx_str(j), cnt->rx[j]);
+		printf("},\"tx\":{");
+		for (j = 0; j < MRP_TLV_IDX_MAX; j++)
+			printf("%s\"%s\":%" PRIu64, j ? "," : "",
+			       tlv_idx_str(j), cnt->tx[j]);
+		printf("}}");
+	}
+	printf("],");
+	printf("\"ring_rtt\":[");
+	for (i = 0, j = 0; i < 2; i++) {
+		struct mrp_rtt_stats *rtt = &stats->rtt[i];
+
+		if (!rtt->sent)
+			continue;
+
+		printf("%s{\"port\":\"%s\",", j++ ? "," : "",
+		       if_indextoname(stats->port[i], ifname));
+		printf("\"sent\":%" PRIu64 ",", rtt->sent);
+		printf("\"received\":%" PRIu64 ",", rtt->received);
+		printf("\"lost\":%" PRIu64 ",", rtt->lost);
+		printf("\"loss_rate\":%g,", (double)rtt->lost / rtt->sent);
+		printf("\"reordered\":%" PRIu64 ",", rtt->reordered);
+		printf("\"min_us\":%u,\"avg_us\":%u,", rtt->min, rtt->avg);
+		printf("\"p99_us\":%u,\"max_us\":%u}", rtt->p99, rtt->max);
+	}
+	printf("],");
+	printf("\"packet_rx\":%" PRIu64 ",", stats->sock.packet_rx);
+	printf("\"packet_drops\":%" PRIu64 ",", stats->sock.packet_drops);
+	printf("\"rx_no_port\":%" PRIu64 ",", stats->sock.rx_no_port);
+	printf("\"netlink_enobufs\":%" PRIu64 ",",
+	       stats->sock.netlink_enobufs);
+	printf("\"netlink_resyncs\":%" PRIu64 "}\n",
+	       stats->sock.netlink_resyncs);
+}
+
+static int cmd_getstats(int argc, char *const *argv)
+{
+	int br = 0, ring_nr = 0;
+	struct mrp_stats stats;
+	bool json = false;
+
+	/* skip the command */
+	argv++;
+	argc -= 1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "bridge") == 0) {
+			NEXT_ARG();
+			br = if_nametoindex(*argv);
+		} else if (strcmp(*argv, "ring_nr") == 0) {
+			NEXT_ARG();
+			ring_nr = atoi(*argv);
+		} else if (strcmp(*argv, "json") == 0) {
+			json = true;
+		}
+
+		argc--; argv++;
+	}
+
+	if (br == 0 || ring_nr == 0)
+		return -1;
+
+	if (CTL_getstats(br, ring_nr, &stats))
 		return -1;
 
-	for (i = 0; i < count; ++i) {
-		printf("bridge: %s ", if_indextoname(status[i].br, ifname));
-		printf("ring_nr: %d ", status[i].ring_nr);
-		printf("pport: %s ", if_indextoname(status[i].pport, ifname));
-		printf("sport: %s ", if_indextoname(status[i].sport, ifname));
-		printf("mra_support: %d ", status[i].mra_support);
-		printf("ring_role: %s ", ring_role_str(status[i].ring_role));
-		printf("prio: %d ", status[i].prio);
-		printf("ring_recv: %s \n", ring_recv_str(status[i].ring_recv));
-		printf("react_on_link_change: %d ", status[i].react_on_link_change);
-		if (status[i].ring_role == BR_MRP_RING_ROLE_MRM)
-			printf("ring_state: %s \n", mrm_state_str(status[i].ring_state));
-		if (status[i].ring_role == BR_MRP_RING_ROLE_MRC)
-			printf("ring_state: %s \n", mrc_state_str(status[i].ring_state));
-
-		if (status[i].in_role == BR_MRP_IN_ROLE_DISABLED)
+	if (json)
+		print_stats_json(&stats);
+	else
+		print_stats(&stats);
+
+	return 0;
+}
+
+static const char *flight_timer_names[] = {
+	[MRP_FLIGHT_TIMER_CLEAR_FDB]		= "clear_fdb",
+	[MRP_FLIGHT_TIMER_RING_TEST]		= "ring_test (missed)",
+	[MRP_FLIGHT_TIMER_RING_TOPO]		= "ring_topo",
+	[MRP_FLIGHT_TIMER_RING_LINK_UP]		= "ring_link_up",
+	[MRP_FLIGHT_TIMER_RING_LINK_DOWN]	= "ring_link_down",
+	[MRP_FLIGHT_TIMER_IN_TEST]		= "in_test (missed)",
+	[MRP_FLIGHT_TIMER_IN_TOPO]		= "in_topo",
+	[MRP_FLIGHT_TIMER_IN_LINK_UP]		= "in_link_up",
+	[MRP_FLIGHT_TIMER_IN_LINK_DOWN]		= "in_link_down",
+	[MRP_FLIGHT_TIMER_IN_LINK_STATUS]	= "in_link_status",
+};
+
+static void print_flight(struct mrp_flight_entry *e)
+{
+	char ifname[IF_NAMESIZE] = "";
+
+	printf("[%llu.%06llu] ", (unsigned long long)e->ts / 1000000000,
+	       (unsigned long long)(e->ts % 1000000000) / 1000);
+
+	if (e->port)
+		if_indextoname(e->port, ifname);
+
+	switch (e->type) {
+	case MRP_FLIGHT_MRM_STATE:
+		printf("ring_state: %s\n", mrm_state_str(e->value));
+		break;
+	case MRP_FLIGHT_MRC_STATE:
+		printf("ring_state: %s\n", mrc_state_str(e->value));
+		break;
+	case MRP_FLIGHT_MIM_STATE:
+		printf("in_state: %s\n", mim_state_str(e->value));
+		break;
+	case MRP_FLIGHT_MIC_STATE:
+		printf("in_state: %s\n", mic_state_str(e->value));
+		break;
+	case MRP_FLIGHT_PORT_STATE:
+		printf("port: %s port_state: %s\n", ifname,
+		       port_state_str(e->value));
+		break;
+	case MRP_FLIGHT_RX_TOPO:
+		printf("port: %s rx topo_change: %u ms\n", ifname, e->value);
+		break;
+	case MRP_FLIGHT_RX_LINK:
+		printf("port: %s rx link_%s\n", ifname,
+		       e->value == BR_MRP_TLV_HEADER_RING_LINK_UP ?
+		       "up" : "down");
+		break;
+	case MRP_FLIGHT_RX_IN_TOPO:
+		printf("port: %s rx in_topo_change: %u ms\n", ifname,
+		       e->value);
+		break;
+	case MRP_FLIGHT_RX_IN_LINK:
+		printf("port: %s rx in_link_%s\n", ifname,
+		       e->value == BR_MRP_TLV_HEADER_IN_LINK_UP ?
+		       "up" : "down");
+		break;
+	case MRP_FLIGHT_TIMER:
+		printf("timer: %s expired\n",
+		       e->value < COUNT_OF(flight_timer_names) ?
+		       flight_timer_names[e->value] : "unknown");
+		break;
+	default:
+		printf("unknown entry %u\n", e->type);
+		break;
+	}
+}
+
+static int cmd_getflight(int argc, char *const *argv)
+{
+	struct mrp_flight_entry entries[MRP_FLIGHT_LEN];
+	int br = 0, ring_nr = 0;
+	int count, i;
+
+	/* skip the command */
+	argv++;
+	argc -= 1;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "bridge") == 0) {
+			NEXT_ARG();
+			br = if_nametoindex(*argv);
+		} else if (strcmp(*argv, "ring_nr") == 0) {
+			NEXT_ARG();
+			ring_nr = atoi(*argv);
+		}
+
+		argc--; argv++;
+	}
+
+	if (br == 0 || ring_nr == 0)
+		return -1;
+
+	if (CTL_getflight(br, ring_nr, &count, entries))
+		return -1;
+
+	for (i = 0; i < count; i++)
+		print_flight(&entries[i]);
+
+	return 0;
+}
+
+static void print_event(struct mrp_event *e)
+{
+	char ifname[IF_NAMESIZE];
+
+	memset(ifname, 0, IF_NAMESIZE);
+
+	printf("[%llu.%06llu] ", (unsigned long long)e->ts / 1000000000,
+	       (unsigned long long)(e->ts % 1000000000) / 1000);
+	printf("bridge: %s ", if_indextoname(e->br, ifname));
+	printf("ring_nr: %d ", e->ring_nr);
+
+	switch (e->type) {
+	case MRP_EVENT_PORT_STATE:
+		printf("port: %s ", if_indextoname(e->port, ifname));
+		printf("port_state: %s", port_state_str(e->value));
+		break;
+	case MRP_EVENT_MRM_STATE:
+		printf("ring_state: %s", mrm_state_str(e->value));
+		break;
+	case MRP_EVENT_MRC_STATE:
+		printf("ring_state: %s", mrc_state_str(e->value));
+		break;
+	case MRP_EVENT_MIM_STATE:
+		printf("in_state: %s", mim_state_str(e->value));
+		break;
+	case MRP_EVENT_MIC_STATE:
+		printf("in_state: %s", mic_state_str(e->value));
+		break;
+	case MRP_EVENT_RING_TRANSITION:
+		printf("ring_transitions: %u", e->value);
+		break;
+	case MRP_EVENT_IN_TRANSITION:
+		printf("in_transitions: %u", e->value);
+		break;
+	case MRP_EVENT_TOPO_CHANGE:
+	case MRP_EVENT_IN_TOPO_CHANGE:
+		if (e->port)
+			printf("port: %s ", if_indextoname(e->port, ifname));
+		printf("%s: %u us", e->type == MRP_EVENT_TOPO_CHANGE ?
+		       "topo_change" : "in_topo_change", e->value);
+		break;
+	default:
+		printf("unknown event %u", e->type);
+		break;
+	}
+
+	if (e->dropped)
+		printf(" (dropped: %u)", e->dropped);
+	printf("\n");
+}
+
+static int cmd_monitor(int argc, char *const *argv)
+{
+	struct ctl_msg_hdr mhdr;
+	struct mrp_event e;
+	struct iovec iov[2];
+	struct msghdr msg;
+	int l;
+
+	if (CTL_subscribe())
+		return -1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	iov[0].iov_base = &mhdr;
+	iov[0].iov_len = sizeof(mhdr);
+	iov[1].iov_base = &e;
+	iov[1].iov_len = sizeof(e);
+
+	while (1) {
+		l = recvmsg(fd, &msg, 0);
+		if (l < 0) {
+			printf("Error getting event from server: %m\n");
+			return -1;
+		}
+
+		if (l != sizeof(mhdr) + sizeof(e) ||
+		    mhdr.cmd != CMD_CODE_event)
 			continue;
 
-		printf("iport: %s ", if_indextoname(status[i].iport, ifname));
-		printf("in_id: %d ", status[i].in_id);
-		printf("in_role: %s ", in_role_str(status[i].in_role));
-		printf("in_recv: %s \n", in_recv_str(status[i].in_recv));
-		printf("in_mode: %s ", in_mode_str(status[i].in_mode));
-		if (status[i].in_role == BR_MRP_IN_ROLE_MIM)
-			printf("in_state: %s \n", mim_state_str(status[i].in_state));
-		if (status[i].in_role == BR_MRP_IN_ROLE_MIC)
-			printf("in_state: %s \n", mic_state_str(status[i].in_state));
+		print_event(&e);
+		fflush(stdout);
 	}
 
 	return 0;
@@ -536,11 +974,17 @@ struct command
 	int (*func) (int argc, char *const *argv);
 };
 
+static int cmd_apply(int argc, char *const *argv);
+
 static const struct command commands[] =
 {
 	{"addmrp", cmd_addmrp},
 	{"delmrp", cmd_delmrp},
+	{"apply", cmd_apply},
 	{"getmrp", cmd_getmrp},
+	{"monitor", cmd_monitor},
+	{"getstats", cmd_getstats},
+	{"getflight", cmd_getflight},
 };
 
 static void help(void)
@@ -548,6 +992,7 @@ static void help(void)
 	printf("Usage: mrp [options] [commands]\n"
 		"options:\n"
 		"  -h | --help              Show this help text\n"
+		"  -b | --batch <file>      Add the instances listed in file\n"
 		"commands:\n\n"
 		"addmrp: Create MRP instance\n"
 		"Mandatory arguments:\n"
@@ -570,12 +1015,38 @@ static void help(void)
 		"  cfm_mepid       [mepid]       CFM mepid\n"
 		"  cfm_peer_mepid  [peer_mepid]  CFM peer mepid\n"
 		"  cfm_maid        [maid]        CFM maid\n"
-		"  cfm_dmac        [dmac]        CFM destination MAC\n\n"
+		"  cfm_dmac        [dmac]        CFM destination MAC\n"
+		"Custom recovery timings (override the ones of ring_recv/in_recv):\n"
+		"  test_interval   [us]          Test frames interval\n"
+		"  test_short      [us]          Test frames short interval\n"
+		"  test_max        [count]       Test frames missed before ring open\n"
+		"  test_ext_max    [count]       Test frames missed, extended (MRA)\n"
+		"  topo_interval   [us]          Topology change frames interval\n"
+		"  topo_max        [count]       Topology change frames sent\n"
+		"  link_interval   [us]          Link change frames interval\n"
+		"  link_max        [count]       Link change frames sent\n"
+		"  in_test_interval [us]         Interconnect test frames interval\n\n"
 		"delmrp: Delete MRP instance\n"
 		"Mandatory arguments:\n"
 		"  bridge          [bridge]    Bridge name on which the MRP instance exists\n"
 		"  ring_nr         [id]        The ID of MRP instance\n\n"
-		"getmrp: Show MRP instance\n\n");
+		"apply: Add all the MRP instances listed in a file, or none of them\n"
+		"Mandatory arguments:\n"
+		"  [file]                      One addmrp command per line (- for stdin)\n\n"
+		"getmrp: Show MRP instance\n"
+		"Optional arguments:\n"
+		"  since           [generation]  Show only instances changed after generation\n\n"
+		"monitor: Show MRP events as they happen\n\n"
+		"getstats: Show MRP instance counters\n"
+		"Mandatory arguments:\n"
+		"  bridge          [bridge]    Bridge name on which the MRP instance exists\n"
+		"  ring_nr         [id]        The ID of MRP instance\n"
+		"Optional arguments:\n"
+		"  json                        Print the counters in JSON format\n\n"
+		"getflight: Show the flight recorder of an MRP instance\n"
+		"Mandatory arguments:\n"
+		"  bridge          [bridge]    Bridge name on which the MRP instance exists\n"
+		"  ring_nr         [id]        The ID of MRP instance\n\n");
 }
 
 static const struct command *command_lookup(const char *cmd)
@@ -611,23 +1082,117 @@ static const struct command *command_lookup_and_validate(int argc,
 	return cmd;
 }
 
+#define APPLY_MAX_ARGS 64
+
+/* Reads the addmrp commands from a file and sends them all in one message:
+ * the server adds all the instances or none of them.
+ */
+static int apply_file(const char *path)
+{
+	static struct addmrp_IN entries[MRP_BATCH_LEN];
+	int lines[MRP_BATCH_LEN];
+	char *args[APPLY_MAX_ARGS];
+	const struct command *cmd;
+	int count = 0, line_num = 0;
+	int err, failed, n;
+	char buf[1024], *p;
+	FILE *f;
+
+	f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!f) {
+		printf("Cannot open %s: %m\n", path);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		line_num++;
+
+		n = 0;
+		for (p = strtok(buf, " \t\r\n"); p && n < APPLY_MAX_ARGS;
+		     p = strtok(NULL, " \t\r\n"))
+			args[n++] = p;
+		if (n == 0 || args[0][0] == '#')
+			continue;
+
+		cmd = command_lookup_and_validate(n, args, line_num);
+		if (!cmd)
+			goto error;
+		if (cmd->func != cmd_addmrp) {
+			printf("Error on line %d:\n"
+			       "Only addmrp can be used in a batch\n", line_num);
+			goto error;
+		}
+		if (count >= MRP_BATCH_LEN) {
+			printf("Error on line %d:\n"
+			       "Too many instances, at most %d are allowed\n",
+			       line_num, MRP_BATCH_LEN);
+			goto error;
+		}
+
+		if (addmrp_parse(n, args, &entries[count])) {
+			printf("Error on line %d:\nInvalid addmrp arguments\n",
+			       line_num);
+			goto error;
+		}
+		lines[count++] = line_num;
+	}
+
+	if (f != stdin)
+		fclose(f);
+
+	if (count == 0)
+		return 0;
+
+	if (CTL_addmrps(count, entries, &err, &failed))
+		return -1;
+
+	if (err) {
+		printf("Error on line %d: %s\nNo instance has been added\n",
+		       failed < count ? lines[failed] : 0, strerror(-err));
+		return err;
+	}
+
+	return 0;
+
+error:
+	if (f != stdin)
+		fclose(f);
+	return -1;
+}
+
+static int cmd_apply(int argc, char *const *argv)
+{
+	if (argc < 2) {
+		incomplete_command();
+		return -1;
+	}
+
+	return apply_file(argv[1]);
+}
+
 int main (int argc, char *const *argv)
 {
 	const struct command *cmd;
 	int f;
 	int ret;
 
+	const char *batch = NULL;
+
 	static const struct option options[] =
 	{
 		{.name = "help",	.val = 'h'},
+		{.name = "batch",	.has_arg = 1, .val = 'b'},
 		{0}
 	};
 
-	while (EOF != (f = getopt_long(argc, argv, "h", options, NULL))) {
+	while (EOF != (f = getopt_long(argc, argv, "hb:", options, NULL))) {
 		switch (f) {
 		case 'h':
 			help();
 			return 0;
+		case 'b':
+			batch = optarg;
+			break;
 		}
 	}
 
@@ -639,6 +1204,12 @@ int main (int argc, char *const *argv)
 	argc -= optind;
 	argv += optind;
 
+	if (batch) {
+		ret = apply_file(batch);
+		client_cleanup();
+		return ret;
+	}
+
 	if (argc == 0) {
 		help();
 		return 1;
@@ -655,4 +1226,8 @@ int main (int argc, char *const *argv)
 
 CLIENT_SIDE_FUNCTION(addmrp);
 CLIENT_SIDE_FUNCTION(delmrp);
-CLIENT_SIDE_FUNCTION(getmrp);
+CLIENT_SIDE_FUNCTION(addmrps);
+CLIENT_SIDE_FUNCTION(listmrp);
+CLIENT_SIDE_FUNCTION(subscribe);
+CLIENT_SIDE_FUNCTION(getstats);
+CLIENT_SIDE_FUNCTION(getflight);
@@ -5,14 +5,22 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <netlink/genl/genl.h>
 #include <netlink/genl/ctrl.h>
 #include <ev.h>
 #include <unistd.h>
+#include <sched.h>
 
 #include "server_socket.h"
 #include "utils.h"
 #include "packet.h"
+#include "metrics.h"
+#include "trace.h"
+#include "flight.h"
+#include "state_machine.h"
+#include "loop.h"
+#include "tc.h"
 
 int __debug_level;
 volatile bool quit = false;
@@ -24,8 +32,26 @@ static void usage(void)
 	       " -h        print this message and exit\n"
 	       " -v        print server version and exit\n"
 	       " -d        increase debugging level\n"
+	       " -t        enable the binary trace buffer\n"
+	       " -m <addr> serve OpenMetrics on <addr> (a Unix socket path " \
+			"or a loopback TCP port)\n"
 	       " -T <val>  use <val> as time factor to increase MRP timings " \
-			"(for debugging ONLY!)\n");
+			"(for debugging ONLY!)\n"
+	       " -c <cpus> run packets and timers on SCHED_FIFO threads " \
+			"pinned to the comma separated <cpus>,\n" \
+	       "           one per CPU, sharing out the MRP instances\n"
+	       " -p <prio> SCHED_FIFO priority of the threads (default %d)\n"
+	       " -b <us>   busy poll the packet sockets for <us> while a " \
+			"ring with the\n" \
+	       "           10 or 30 ms recovery profile is closed " \
+			"(at most %d)\n"
+	       " -L <us>   submit the MRP_Test frames <us> ahead with a " \
+			"launch time, adding an\n" \
+	       "           ETF qdisc to the ring ports\n"
+	       " -q        add to the MRP ports a qdisc and a filter " \
+			"queueing the MRP frames\n" \
+	       "           ahead of the data\n",
+	       MRP_LOOP_DEFAULT_PRIO, PACKET_BUSY_POLL_MAX);
 }
 
 static void pr_version(void)
@@ -38,6 +64,24 @@ static void handle_signal(int sig)
 	ev_break(EV_DEFAULT, EVBREAK_ALL);;
 }
 
+static ev_signal dump_watcher;
+
+static int flight_dump(void *arg)
+{
+	mrp_flight_dump_all(stderr);
+
+	return 0;
+}
+
+static void handle_dump(EV_P_ ev_signal *w, int revents)
+{
+	int i;
+
+	for (i = 0; i < mrp_nr_shards; i++)
+		mrp_shard_call(&mrp_shards[i], flight_dump, NULL);
+	trace_dump(stderr);
+}
+
 int signal_init(void)
 {
 	struct sigaction sa;
@@ -58,10 +102,18 @@ int signal_init(void)
 
 int main(int argc, char *argv[])
 {
+	int loop_prio = MRP_LOOP_DEFAULT_PRIO;
+	int loop_cpus[MRP_MAX_SHARDS];
+	char *metrics_addr = NULL;
+	int nr_cpus = 0;
+	int busy_poll = 0;
+	int txtime_lead = 0;
+	bool qos = false;
+	char *cpu, *end;
 	int c;
 	int ret;
 
-	while ((c = getopt(argc, argv, "hvdT:")) != -1) {
+	while ((c = getopt(argc, argv, "hvdtm:T:c:p:b:L:q")) != -1) {
 		switch (c) {
 		case 'T':
 			time_factor = atoi(optarg);
@@ -73,6 +125,57 @@ int main(int argc, char *argv[])
 		case 'd':
 			__debug_level++;
 			break;
+		case 't':
+			if (trace_init(TRACE_DEFAULT_LEN)) {
+				pr_err("unable to init trace buffer");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'm':
+			metrics_addr = optarg;
+			break;
+		case 'c':
+			nr_cpus = 0;
+			for (cpu = strtok(optarg, ","); cpu;
+			     cpu = strtok(NULL, ",")) {
+				if (nr_cpus == MRP_MAX_SHARDS) {
+					pr_err("at most %d CPUs for -c option",
+					       MRP_MAX_SHARDS);
+					exit(EXIT_FAILURE);
+				}
+				loop_cpus[nr_cpus] = strtol(cpu, &end, 10);
+				if (*end || loop_cpus[nr_cpus] < 0) {
+					pr_err("invalid value for -c option argument");
+					exit(EXIT_FAILURE);
+				}
+				nr_cpus++;
+			}
+			break;
+		case 'p':
+			loop_prio = atoi(optarg);
+			if (loop_prio < sched_get_priority_min(SCHED_FIFO) ||
+			    loop_prio > sched_get_priority_max(SCHED_FIFO)) {
+				pr_err("invalid value for -p option argument");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'b':
+			busy_poll = atoi(optarg);
+			if (busy_poll <= 0 || busy_poll > PACKET_BUSY_POLL_MAX) {
+				pr_err("invalid value for -b option argument");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'L':
+			txtime_lead = atoi(optarg);
+			if (txtime_lead <= 0) {
+				pr_err("invalid value for -L option argument");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'q':
+			qos = true;
+			break;
 		case 'v':
 			pr_version();
 			return 0;
@@ -86,22 +189,64 @@ int main(int argc, char *argv[])
 	}
 	pr_debug("time_factor: %d", time_factor);
 
+	ret = mrp_loop_init(loop_cpus, nr_cpus, loop_prio);
+	if (ret < 0) {
+		pr_err("unable to init the data plane loop");
+		exit(EXIT_FAILURE);
+	}
+
+	if ((txtime_lead || qos) && tc_init(qos) < 0) {
+		pr_warn("launch time and MRP qdiscs disabled");
+		txtime_lead = 0;
+	}
+
 	ret = ctl_socket_init();
 	if (ret < 0) {
 		pr_err("unable to init CTL socket layer");
 		exit(EXIT_FAILURE);
 	}
+	packet_busy_poll_init(busy_poll);
+	packet_txtime_init(txtime_lead);
 	ret = packet_socket_init();
 	if (ret < 0) {
 		pr_err("unable to init PACKET socket layer");
 		exit(EXIT_FAILURE);
 	}
 
+	if (metrics_addr) {
+		ret = metrics_init(metrics_addr);
+		if (ret < 0) {
+			pr_err("unable to init metrics layer");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	mrp_flight_init();
+
+	/* Dumps are done from the main loop, not from a signal handler */
+	ev_signal_init(&dump_watcher, handle_dump, SIGUSR1);
+	ev_signal_start(EV_DEFAULT, &dump_watcher);
+
+	ret = mrp_loop_start();
+	if (ret < 0) {
+		pr_err("unable to start the data plane thread");
+		exit(EXIT_FAILURE);
+	}
+
+	mrp_timer_calibrate();
+
 	pr_version();
 	ev_run(EV_DEFAULT, 0);
 
+	mrp_loop_stop();
+
+	metrics_cleanup();
 	packet_socket_cleanup();
+	trace_cleanup();
 	ctl_socket_cleanup();
+	mrp_flight_cleanup();
+	tc_cleanup();
+	mrp_loop_cleanup();
 
 	return 0;
 }
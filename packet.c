@@ -14,16 +14,106 @@
 #include <asm/byteorder.h>
 #include <net/if.h>
 #include <linux/if_ether.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 #include <errno.h>
+#include <time.h>
 
 #include "state_machine.h"
+#include "packet.h"
+#include "metrics.h"
 #include "utils.h"
+#include "loop.h"
+#include "tc.h"
 
-static ev_io packet_watcher;
-static int fd;
+/* Frames sent and waiting for their transmit timestamp, by key */
+#define PACKET_TX_PENDING	256	/* power of 2 */
 
-void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len)
+struct packet_tx {
+	uint32_t	key;
+	bool		pending;
+	int		type;		/* TLV index */
+	uint64_t	sent;		/* ns, CLOCK_REALTIME */
+	uint64_t	origin;		/* ns, CLOCK_REALTIME */
+};
+
+/* While busy polling the socket is spun on for a window, then the loop
+ * blocks for long enough to keep the spinning within this share of the CPU
+ */
+#define PACKET_BUSY_POLL_DUTY	50	/* % */
+
+/* The loop is given back at least this often while spinning, so that the
+ * timers expired meanwhile are not held off for the whole window
+ */
+#define PACKET_BUSY_POLL_SLICE	20	/* us */
+
+/* Each shard has its own socket, the received frames are steered to the
+ * shard owning the port by a fanout group.
+ */
+struct packet_sock {
+	ev_io			watcher;
+	int			fd;
+
+	/* Busy polling, see packet_busy_poll() */
+	ev_idle			spin;
+	ev_timer		rest;
+	int			busy_users;
+	uint64_t		busy_us;
+	uint64_t		spin_start;	/* us, 0 if resting */
+
+	uint32_t		tx_key;
+	struct packet_tx	tx_pending[PACKET_TX_PENDING];
+
+	/* Sends the frames with a launch time, -1 if none */
+	ev_io			txtime_watcher;
+	int			txtime_fd;
+	uint64_t		txtime_drops;
+
+	/* The kernel resets its statistics on each read so accumulate
+	 * them here
+	 */
+	uint64_t		rx;
+	uint64_t		drops;
+};
+
+static struct packet_sock socks[MRP_MAX_SHARDS];
+static int nsocks;
+static bool tx_timestamping;
+static int busy_poll_us;	/* 0 if disabled */
+static uint64_t txtime_lead;	/* ns, 0 if disabled */
+
+/* CLOCK_TAI - CLOCK_REALTIME, in whole seconds */
+static int64_t packet_tai_offset(void)
+{
+	struct timespec rt, tai;
+	int64_t d;
+
+	clock_gettime(CLOCK_REALTIME, &rt);
+	clock_gettime(CLOCK_TAI, &tai);
+
+	d = (int64_t)(tai.tv_sec - rt.tv_sec) * 1000000000 +
+	    tai.tv_nsec - rt.tv_nsec;
+
+	return (d + 500000000) / 1000000000 * 1000000000;
+}
+
+/* The type (TLV index) and the origin (the time of the event the frame is
+ * sent for, 0 if unknown) are used to account the transmit latency. If
+ * txtime (ns, CLOCK_REALTIME) is not 0 the frame is held back by the ETF
+ * qdisc of the port until then, see packet_txtime_launch().
+ */
+void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len,
+		 int type, uint64_t origin, uint64_t txtime)
 {
+	struct packet_sock *ps = &socks[mrp_shard->id];
+	union {
+		char buf[CMSG_SPACE(sizeof(uint64_t))];
+		struct cmsghdr align;
+	} control;
+	struct packet_tx *tx;
+	struct cmsghdr *cmsg;
+	uint64_t sent = 0;
+	int fd = ps->fd;
 	int l;
 
 	struct sockaddr_ll sl =
@@ -48,32 +138,467 @@ void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len)
 		.msg_flags = 0,
 	};
 
+	/* The launch time socket has no transmit timestamps */
+	if (txtime && ps->txtime_fd >= 0) {
+		fd = ps->txtime_fd;
+		txtime += packet_tai_offset();
+
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_TXTIME;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(txtime));
+		memcpy(CMSG_DATA(cmsg), &txtime, sizeof(txtime));
+	} else if (tx_timestamping) {
+		sent = mrp_time_real_ns();
+	}
+
 	l = sendmsg(fd, &msg, 0);
 
 	if (l < 0) {
 		if(errno != EWOULDBLOCK)
 			pr_err("send failed: %m");
-	} else {
-		if (l != len)
-			pr_err("short write in sendto: %d instead of %d",
-			       l, len);
+		return;
+	}
+	if (l != len)
+		pr_err("short write in sendto: %d instead of %d", l, len);
+
+	/* The kernel gives a key to each frame sent, in order */
+	if (sent) {
+		tx = &ps->tx_pending[ps->tx_key & (PACKET_TX_PENDING - 1)];
+		tx->key = ps->tx_key++;
+		tx->pending = true;
+		tx->type = type;
+		tx->sent = sent;
+		tx->origin = origin;
 	}
 }
 
-static void packet_rcv(EV_P_ ev_io *w, int revents)
+static void packet_tx_done(struct packet_sock *ps, uint32_t key,
+			   const struct timespec *ts)
+{
+	struct packet_tx *tx = &ps->tx_pending[key & (PACKET_TX_PENDING - 1)];
+	uint64_t t = (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+
+	if (!tx->pending || tx->key != key)
+		return;
+	tx->pending = false;
+
+	if (t > tx->sent)
+		mrp_hist_add(&tx_queue_latency[tx->type],
+			     (t - tx->sent) / 1000);
+	if (tx->origin && t > tx->origin)
+		mrp_hist_add(&tx_latency[tx->type], (t - tx->origin) / 1000);
+}
+
+/* Reads the transmit timestamps from the error queue */
+static void packet_rcv_errqueue(struct packet_sock *ps)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+			 CMSG_SPACE(sizeof(struct sock_extended_err))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = { 0 };
+	struct sock_extended_err *serr;
+	struct scm_timestamping *tss;
+	struct cmsghdr *cmsg;
+
+	while (1) {
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		if (recvmsg(ps->fd, &msg, MSG_ERRQUEUE) < 0)
+			return;
+
+		tss = NULL;
+		serr = NULL;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SCM_TIMESTAMPING)
+				tss = (struct scm_timestamping *)CMSG_DATA(cmsg);
+			else if (cmsg->cmsg_level == SOL_PACKET &&
+				 cmsg->cmsg_type == PACKET_TX_TIMESTAMP)
+				serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+		}
+
+		if (tss && serr && serr->ee_errno == ENOMSG &&
+		    serr->ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+			packet_tx_done(ps, serr->ee_data, &tss->ts[0]);
+	}
+}
+
+/* Reads and processes one frame, returns false if there was none */
+static bool packet_read(struct packet_sock *ps, enum mrp_rx_mode mode)
 {
 	int cc;
 	unsigned char buf[2048];
+	union {
+		char buf[CMSG_SPACE(sizeof(struct scm_timestamping))];
+		struct cmsghdr align;
+	} control;
 	struct sockaddr_ll sl;
-	socklen_t salen = sizeof sl;
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+	struct msghdr msg = {
+		.msg_name = &sl,
+		.msg_namelen = sizeof(sl),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+	struct scm_timestamping *tss;
+	struct timespec *ts = NULL;
+	struct cmsghdr *cmsg;
+	uint64_t t, now;
 
-	cc = recvfrom(fd, &buf, sizeof(buf), 0, (struct sockaddr *) &sl, &salen);
+	cc = recvmsg(ps->fd, &msg, 0);
 	if (cc <= 0) {
+		if (cc < 0 && errno == EAGAIN)
+			return false;
 		pr_err("recvfrom failed: %m");
+		return false;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_TIMESTAMPING)
+			continue;
+
+		/* The software timestamp is the first one */
+		tss = (struct scm_timestamping *)CMSG_DATA(cmsg);
+		if (tss->ts[0].tv_sec || tss->ts[0].tv_nsec)
+			ts = &tss->ts[0];
+	}
+
+	if (busy_poll_us && ts) {
+		t = (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+		now = mrp_time_real_ns();
+		if (now > t)
+			mrp_hist_add(&rx_wakeup_latency[mode], (now - t) / 1000);
+	}
+
+	mrp_recv(buf, cc, &sl, msg.msg_namelen, ts);
+
+	return true;
+}
+
+static void packet_rcv(EV_P_ ev_io *w, int revents)
+{
+	struct packet_sock *ps = container_of(w, struct packet_sock, watcher);
+
+	/* The socket is readable also when only the error queue is not
+	 * empty
+	 */
+	if (tx_timestamping)
+		packet_rcv_errqueue(ps);
+
+	packet_read(ps, MRP_RX_EPOLL);
+}
+
+/* Spins on the socket for a window, then rests so that the loop blocks
+ * in epoll for the rest of the duty cycle. The window is made of slices,
+ * between them the loop runs the expired timers.
+ */
+static void packet_spin(EV_P_ ev_idle *w, int revents)
+{
+	struct packet_sock *ps = container_of(w, struct packet_sock, spin);
+	uint64_t start = mrp_time_us(), now;
+
+	if (!ps->spin_start)
+		ps->spin_start = start;
+
+	do {
+		packet_read(ps, MRP_RX_BUSY_POLL);
+		now = mrp_time_us();
+	} while (now - start < PACKET_BUSY_POLL_SLICE &&
+		 now - ps->spin_start < busy_poll_us && ps->busy_users);
+
+	__atomic_fetch_add(&ps->busy_us, now - start, __ATOMIC_RELAXED);
+
+	if (ps->busy_users && now - ps->spin_start < busy_poll_us)
+		return;
+
+	ps->spin_start = 0;
+	ev_idle_stop(EV_A_ w);
+	if (!ps->busy_users)
 		return;
+
+	ev_timer_set(&ps->rest, (ev_tstamp)busy_poll_us *
+		     (100 - PACKET_BUSY_POLL_DUTY) / PACKET_BUSY_POLL_DUTY /
+		     1000000, 0.);
+	ev_timer_start(EV_A_ &ps->rest);
+}
+
+static void packet_rest(EV_P_ ev_timer *w, int revents)
+{
+	struct packet_sock *ps = container_of(w, struct packet_sock, rest);
+
+	if (ps->busy_users)
+		ev_idle_start(EV_A_ &ps->spin);
+}
+
+/* Called by the instances of the running shard entering (on) and leaving
+ * a latency critical state: the socket is spun on while there is any.
+ */
+void packet_busy_poll(bool on)
+{
+	struct packet_sock *ps = &socks[mrp_shard->id];
+
+	if (!busy_poll_us)
+		return;
+
+	if (on) {
+		if (ps->busy_users++ == 0)
+			ev_idle_start(mrp_loop, &ps->spin);
+		return;
+	}
+
+	if (--ps->busy_users == 0) {
+		ev_idle_stop(mrp_loop, &ps->spin);
+		ev_timer_stop(mrp_loop, &ps->rest);
+		ps->spin_start = 0;
 	}
+}
+
+uint64_t packet_busy_poll_us(void)
+{
+	uint64_t us = 0;
+	int i;
 
-	mrp_recv(buf, cc, &sl, salen);
+	for (i = 0; i < nsocks; i++)
+		us += __atomic_load_n(&socks[i].busy_us, __ATOMIC_RELAXED);
+
+	return us;
+}
+
+/* Enables busy polling, to be called before packet_socket_init(). The
+ * kernel polls the device queue for up to us microseconds on each read.
+ */
+void packet_busy_poll_init(int us)
+{
+	busy_poll_us = us;
+}
+
+static void packet_busy_poll_sock(int s)
+{
+	int prefer = 1;
+
+	if (setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us,
+		       sizeof(busy_poll_us)) < 0)
+		pr_warn("setsockopt busy poll failed: %m");
+	if (setsockopt(s, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer,
+		       sizeof(prefer)) < 0)
+		pr_warn("setsockopt prefer busy poll failed: %m");
+}
+
+/* Enables the launch time of the MRP_Test frames, to be called before
+ * packet_socket_init(). The frames are submitted lead_us ahead.
+ */
+void packet_txtime_init(int lead_us)
+{
+	txtime_lead = (uint64_t)lead_us * 1000;
+}
+
+/* ns, 0 if the launch time is disabled */
+uint64_t packet_txtime_lead(void)
+{
+	return txtime_lead;
+}
+
+/* Returns the launch time (ns, CLOCK_REALTIME) of a frame due at due, or
+ * now if 0. The lead absorbs the lateness of the daemon; when that is not
+ * enough the frame is launched as soon as the ETF qdisc accepts it, half
+ * the lead from now. delay is set to the time from now to the release of
+ * the frame by the qdisc.
+ */
+uint64_t packet_txtime_launch(uint64_t due, uint64_t *delay)
+{
+	uint64_t now = mrp_time_real_ns();
+	uint64_t launch = (due ? due : now) + txtime_lead;
+
+	if (launch < now + txtime_lead / 2)
+		launch = now + txtime_lead / 2;
+	*delay = launch - txtime_lead / 2 - now;
+
+	return launch;
+}
+
+uint64_t packet_txtime_drops(void)
+{
+	uint64_t drops = 0;
+	int i;
+
+	for (i = 0; i < nsocks; i++)
+		drops += __atomic_load_n(&socks[i].txtime_drops,
+					 __ATOMIC_RELAXED);
+
+	return drops;
+}
+
+/* The ETF qdisc reports on the error queue the frames it dropped since
+ * their launch time was invalid or already past.
+ */
+static void packet_txtime_rcv(EV_P_ ev_io *w, int revents)
+{
+	struct packet_sock *ps = container_of(w, struct packet_sock,
+					      txtime_watcher);
+	union {
+		char buf[CMSG_SPACE(sizeof(struct sock_extended_err))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = { 0 };
+	struct sock_extended_err *serr;
+	struct cmsghdr *cmsg;
+
+	while (1) {
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		if (recvmsg(ps->txtime_fd, &msg, MSG_ERRQUEUE) < 0)
+			return;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_PACKET ||
+			    cmsg->cmsg_type != PACKET_TX_TIMESTAMP)
+				continue;
+
+			serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			if (serr->ee_origin != SO_EE_ORIGIN_TXTIME)
+				continue;
+
+			__atomic_add_fetch(&ps->txtime_drops, 1,
+					   __ATOMIC_RELAXED);
+			pr_debug("launch time frame dropped: %s",
+				 serr->ee_code == SO_EE_CODE_TXTIME_MISSED ?
+				 "missed" : "invalid");
+		}
+	}
+}
+
+/* A send only socket: its priority leads the frames to the ETF qdisc */
+static int packet_txtime_open(struct packet_sock *ps, struct ev_loop *loop)
+{
+	struct sock_txtime st = {
+		.clockid = CLOCK_TAI,
+		.flags = SOF_TXTIME_REPORT_ERRORS,
+	};
+	int prio = TC_MRP_TXTIME_CLASS;
+	int s;
+
+	s = socket(PF_PACKET, SOCK_RAW, 0);
+	if (s < 0) {
+		pr_err("socket failed: %m");
+		return -1;
+	}
+
+	if (setsockopt(s, SOL_SOCKET, SO_TXTIME, &st, sizeof(st)) < 0) {
+		pr_warn("setsockopt txtime failed: %m");
+	} else if (setsockopt(s, SOL_SOCKET, SO_PRIORITY, &prio,
+			      sizeof(prio)) < 0) {
+		pr_warn("setsockopt txtime priority failed: %m");
+	} else if (fcntl(s, F_SETFL, O_NONBLOCK) < 0) {
+		pr_err("fcntl set nonblock failed: %m");
+	} else {
+		ps->txtime_fd = s;
+		ev_io_init(&ps->txtime_watcher, packet_txtime_rcv, s, EV_READ);
+		ev_io_start(loop, &ps->txtime_watcher);
+		return 0;
+	}
+
+	close(s);
+	return -1;
+}
+
+void packet_get_stats(uint64_t *rx, uint64_t *drops)
+{
+	struct tpacket_stats st;
+	struct packet_sock *ps;
+	socklen_t len;
+	int i;
+
+	*rx = 0;
+	*drops = 0;
+
+	for (i = 0; i < nsocks; i++) {
+		ps = &socks[i];
+
+		len = sizeof(st);
+		if (getsockopt(ps->fd, SOL_PACKET, PACKET_STATISTICS, &st,
+			       &len) < 0) {
+			pr_warn("getsockopt packet statistics failed: %m");
+		} else {
+			ps->rx += st.tp_packets;
+			ps->drops += st.tp_drops;
+		}
+
+		*rx += ps->rx;
+		*drops += ps->drops;
+	}
+}
+
+/* Steers the frames received on ifindexes[i] to the socket of shards[i],
+ * the other frames go to the first shard.
+ */
+int packet_fanout_update(const int *ifindexes, const int *shards, int n)
+{
+	struct sock_filter *filter;
+	struct sock_fprog prog;
+	int i, len = 0, err;
+
+	if (nsocks < 2)
+		return 0;
+
+	filter = malloc((2 + 2 * n) * sizeof(*filter));
+	if (!filter)
+		return -ENOMEM;
+
+	filter[len++] = (struct sock_filter)
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX);
+	for (i = 0; i < n; i++) {
+		filter[len++] = (struct sock_filter)
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ifindexes[i], 0, 1);
+		filter[len++] = (struct sock_filter)
+			BPF_STMT(BPF_RET | BPF_K, shards[i]);
+	}
+	filter[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+	prog.len = len;
+	prog.filter = filter;
+	err = setsockopt(socks[0].fd, SOL_PACKET, PACKET_FANOUT_DATA,
+			 &prog, sizeof(prog));
+	free(filter);
+
+	if (err)
+		pr_err("cannot set the packet fanout program: %m");
+
+	return err;
+}
+
+/* Software timestamps of the received frames and, if the kernel supports
+ * them on packet sockets, of the sent ones. They are used for statistics
+ * only so a failure is not fatal.
+ */
+static void packet_timestamping_init(int s)
+{
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	int tx_flags = SOF_TIMESTAMPING_TX_SOFTWARE |
+		       SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+	flags |= tx_flags;
+	if (setsockopt(s, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+		       sizeof(flags)) == 0) {
+		tx_timestamping = true;
+		return;
+	}
+
+	flags &= ~tx_flags;
+	if (setsockopt(s, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+		       sizeof(flags)) < 0)
+		pr_warn("setsockopt timestamping failed: %m");
 }
 
 static struct sock_filter mrp_filter[] = {
@@ -86,10 +611,11 @@ static struct sock_filter mrp_filter[] = {
 /*
  * Open up a raw packet socket to catch all MRP packets
  */
-int packet_socket_init(void)
+static int packet_sock_open(struct packet_sock *ps, struct ev_loop *loop)
 {
 	int optval = 7;
 	int ignore_out = 1;
+	int fanout;
 
 	struct sock_fprog prog =
 	{
@@ -98,12 +624,19 @@ int packet_socket_init(void)
 	};
 	int s;
 
+	ps->txtime_fd = -1;
+
 	s = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
 	if(s < 0) {
 		pr_err("socket failed: %m");
 		return -1;
 	}
 
+	/* The group index of each socket is its shard id, as they join in
+	 * order
+	 */
+	fanout = (getpid() & 0xffff) | (PACKET_FANOUT_CBPF << 16);
+
 	if (setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
 		pr_err("setsockopt packet filter failed: %m");
 	} else if (setsockopt(s, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore_out, sizeof(ignore_out)) < 0) {
@@ -112,10 +645,29 @@ int packet_socket_init(void)
 		pr_err("setsockopt priority failed: %m");
 	} else if (fcntl(s, F_SETFL, O_NONBLOCK) < 0) {
 		pr_err("fcntl set nonblock failed: %m");
+	} else if (mrp_nr_shards > 1 &&
+		   setsockopt(s, SOL_PACKET, PACKET_FANOUT, &fanout,
+			      sizeof(fanout)) < 0) {
+		pr_err("setsockopt packet fanout failed: %m");
 	} else {
-		fd = s;
-		ev_io_init(&packet_watcher, packet_rcv, fd, EV_READ);
-		ev_io_start(EV_DEFAULT, &packet_watcher);
+		packet_timestamping_init(s);
+		if (busy_poll_us)
+			packet_busy_poll_sock(s);
+
+		ps->fd = s;
+		ev_io_init(&ps->watcher, packet_rcv, ps->fd, EV_READ);
+		ev_io_start(loop, &ps->watcher);
+
+		/* Spins only when nothing else is pending */
+		ev_idle_init(&ps->spin, packet_spin);
+		ev_set_priority(&ps->spin, EV_MINPRI);
+		ev_init(&ps->rest, packet_rest);
+
+		/* The frames are sent at once without it */
+		if (txtime_lead && packet_txtime_open(ps, loop)) {
+			pr_warn("launch time disabled");
+			txtime_lead = 0;
+		}
 
 		return 0;
 	}
@@ -124,8 +676,34 @@ int packet_socket_init(void)
 	return -1;
 }
 
+int packet_socket_init(void)
+{
+	for (nsocks = 0; nsocks < mrp_nr_shards; nsocks++) {
+		if (packet_sock_open(&socks[nsocks],
+				     mrp_shards[nsocks].loop)) {
+			packet_socket_cleanup();
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Called once the shard threads are stopped */
 void packet_socket_cleanup(void)
 {
-	ev_io_stop(EV_DEFAULT, &packet_watcher);
-	close(fd);
+	int i;
+
+	for (i = 0; i < nsocks; i++) {
+		ev_idle_stop(mrp_shards[i].loop, &socks[i].spin);
+		ev_timer_stop(mrp_shards[i].loop, &socks[i].rest);
+		ev_io_stop(mrp_shards[i].loop, &socks[i].watcher);
+		close(socks[i].fd);
+		if (socks[i].txtime_fd >= 0) {
+			ev_io_stop(mrp_shards[i].loop,
+				   &socks[i].txtime_watcher);
+			close(socks[i].txtime_fd);
+		}
+	}
+	nsocks = 0;
 }
@@ -5,8 +5,25 @@
 #define PACKET_H
 
 #include <sys/uio.h>
+#include <stdint.h>
+#include <stdbool.h>
 
-void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len);
+void packet_send(int ifindex, const struct iovec *iov, int iov_count, int len,
+		 int type, uint64_t origin, uint64_t txtime);
+void packet_get_stats(uint64_t *rx, uint64_t *drops);
+int packet_fanout_update(const int *ifindexes, const int *shards, int n);
+/* Longest busy poll window, well below the 1 ms of the shortest test
+ * interval
+ */
+#define PACKET_BUSY_POLL_MAX	200	/* us */
+
+void packet_busy_poll_init(int us);
+void packet_busy_poll(bool on);
+uint64_t packet_busy_poll_us(void);
+void packet_txtime_init(int lead_us);
+uint64_t packet_txtime_lead(void);
+uint64_t packet_txtime_launch(uint64_t due, uint64_t *delay);
+uint64_t packet_txtime_drops(void);
 int packet_socket_init(void);
 void packet_socket_cleanup(void);
 
@@ -0,0 +1,207 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <asm/byteorder.h>
+
+#include "pdu.h"
+#include "utils.h"
+
+/* Minimum length of the value of the known TLV types */
+static const uint8_t mrp_tlv_min_len[] = {
+	[BR_MRP_TLV_HEADER_COMMON]	  = sizeof(struct br_mrp_common_hdr),
+	[BR_MRP_TLV_HEADER_RING_TEST]	  = sizeof(struct br_mrp_ring_test_hdr),
+	[BR_MRP_TLV_HEADER_RING_TOPO]	  = sizeof(struct br_mrp_ring_topo_hdr),
+	[BR_MRP_TLV_HEADER_RING_LINK_DOWN] = sizeof(struct br_mrp_ring_link_hdr),
+	[BR_MRP_TLV_HEADER_RING_LINK_UP]  = sizeof(struct br_mrp_ring_link_hdr),
+	[BR_MRP_TLV_HEADER_IN_TEST]	  = sizeof(struct br_mrp_in_test_hdr),
+	[BR_MRP_TLV_HEADER_IN_TOPO]	  = sizeof(struct br_mrp_in_topo_hdr),
+	[BR_MRP_TLV_HEADER_IN_LINK_DOWN]  = sizeof(struct br_mrp_in_link_hdr),
+	[BR_MRP_TLV_HEADER_IN_LINK_UP]	  = sizeof(struct br_mrp_in_link_hdr),
+	[BR_MRP_TLV_HEADER_IN_LINK_STATUS] =
+				sizeof(struct br_mrp_in_link_status_hdr),
+};
+
+/* Returns the TLV at buf, or NULL if its header or its value do not fit
+ * into the frame or its value is too short for its type.
+ */
+static const struct br_mrp_tlv_hdr *mrp_tlv(const unsigned char *buf,
+					    const unsigned char *end)
+{
+	const struct br_mrp_tlv_hdr *tlv = (const void *)buf;
+
+	if (buf + sizeof(*tlv) > end || buf + sizeof(*tlv) + tlv->length > end)
+		return NULL;
+	if (tlv->type < COUNT_OF(mrp_tlv_min_len) &&
+	    tlv->length < mrp_tlv_min_len[tlv->type])
+		return NULL;
+
+	return tlv;
+}
+
+/* Walks the sub-TLVs of an Option TLV and returns the end of the last one.
+ * Our own sub-TLVs count 2 padding bytes not counted by the Option TLV so
+ * they may end after it, the sub-TLVs are bound by the frame only.
+ */
+static const unsigned char *mrp_parse_option(const unsigned char *buf,
+					     const unsigned char *opt_end,
+					     const unsigned char *end,
+					     struct mrp_frame *f)
+{
+	const struct br_mrp_test_mgr_nack_hdr *nack;
+	const struct br_mrp_test_prop_hdr *prop;
+	const struct br_mrp_sub_tlv_hdr *sub;
+
+	buf += sizeof(struct br_mrp_oui_hdr) + sizeof(struct br_mrp_sub_opt_hdr);
+	if (buf > opt_end)
+		return NULL;
+
+	while (buf < opt_end) {
+		sub = (const void *)buf;
+		if (buf + sizeof(*sub) > end ||
+		    buf + sizeof(*sub) + sub->length > end)
+			return NULL;
+		buf += sizeof(*sub);
+
+		/* Only the first known sub-TLV is decoded */
+		switch (f->sub_type ? 0 : sub->type) {
+		case BR_MRP_SUB_TLV_HEADER_TEST_MGR_NACK:
+			if (sub->length < sizeof(*nack))
+				return NULL;
+			nack = (const void *)buf;
+			f->sub_type = sub->type;
+			f->prio = __be16_to_cpu(nack->prio);
+			memcpy(f->sa, nack->sa, ETH_ALEN);
+			f->other_prio = __be16_to_cpu(nack->other_prio);
+			memcpy(f->other_sa, nack->other_sa, ETH_ALEN);
+			break;
+		case BR_MRP_SUB_TLV_HEADER_TEST_PROPAGATE:
+			if (sub->length < sizeof(*prop))
+				return NULL;
+			prop = (const void *)buf;
+			f->sub_type = sub->type;
+			f->prio = __be16_to_cpu(prop->prio);
+			memcpy(f->sa, prop->sa, ETH_ALEN);
+			f->other_prio = __be16_to_cpu(prop->other_prio);
+			memcpy(f->other_sa, prop->other_sa, ETH_ALEN);
+			break;
+		default:
+			break;
+		}
+
+		buf += sub->length;
+	}
+
+	return buf;
+}
+
+/* Decodes, in a single pass, the MRP PDU of a frame (the ethernet header
+ * is already removed): Version, the TLV of the frame type, the Option
+ * sub-TLVs and the Common TLV. Returns 0 or -EBADMSG if the frame is
+ * malformed.
+ */
+int mrp_parse_frame(const unsigned char *buf, int len, struct mrp_frame *f)
+{
+	const unsigned char *end = buf + len;
+	const struct br_mrp_in_link_status_hdr *in_link_status;
+	const struct br_mrp_ring_test_hdr *ring_test;
+	const struct br_mrp_ring_topo_hdr *ring_topo;
+	const struct br_mrp_ring_link_hdr *ring_link;
+	const struct br_mrp_in_test_hdr *in_test;
+	const struct br_mrp_in_topo_hdr *in_topo;
+	const struct br_mrp_in_link_hdr *in_link;
+	const struct br_mrp_common_hdr *common;
+	const struct br_mrp_tlv_hdr *tlv;
+	const unsigned char *value, *next;
+
+	memset(f, 0, sizeof(*f));
+
+	/* Skip the version */
+	if (len < sizeof(uint16_t))
+		return -EBADMSG;
+	buf += sizeof(uint16_t);
+
+	tlv = mrp_tlv(buf, end);
+	if (!tlv)
+		return -EBADMSG;
+	value = buf + sizeof(*tlv);
+	next = value + tlv->length;
+
+	f->type = tlv->type;
+	switch (tlv->type) {
+	case BR_MRP_TLV_HEADER_RING_TEST:
+		ring_test = (const void *)value;
+		f->prio = __be16_to_cpu(ring_test->prio);
+		memcpy(f->sa, ring_test->sa, ETH_ALEN);
+		f->port_role = __be16_to_cpu(ring_test->port_role);
+		break;
+	case BR_MRP_TLV_HEADER_RING_TOPO:
+		ring_topo = (const void *)value;
+		f->prio = __be16_to_cpu(ring_topo->prio);
+		memcpy(f->sa, ring_topo->sa, ETH_ALEN);
+		f->interval = __be16_to_cpu(ring_topo->interval);
+		break;
+	case BR_MRP_TLV_HEADER_RING_LINK_DOWN:
+	case BR_MRP_TLV_HEADER_RING_LINK_UP:
+		ring_link = (const void *)value;
+		memcpy(f->sa, ring_link->sa, ETH_ALEN);
+		f->port_role = __be16_to_cpu(ring_link->port_role);
+		f->interval = __be16_to_cpu(ring_link->interval);
+		break;
+	case BR_MRP_TLV_HEADER_IN_TEST:
+		in_test = (const void *)value;
+		f->in_id = __be16_to_cpu(in_test->id);
+		memcpy(f->sa, in_test->sa, ETH_ALEN);
+		f->port_role = __be16_to_cpu(in_test->port_role);
+		break;
+	case BR_MRP_TLV_HEADER_IN_TOPO:
+		in_topo = (const void *)value;
+		memcpy(f->sa, in_topo->sa, ETH_ALEN);
+		f->in_id = __be16_to_cpu(in_topo->id);
+		f->interval = __be16_to_cpu(in_topo->interval);
+		break;
+	case BR_MRP_TLV_HEADER_IN_LINK_DOWN:
+	case BR_MRP_TLV_HEADER_IN_LINK_UP:
+		in_link = (const void *)value;
+		memcpy(f->sa, in_link->sa, ETH_ALEN);
+		f->port_role = __be16_to_cpu(in_link->port_role);
+		f->in_id = __be16_to_cpu(in_link->id);
+		f->interval = __be16_to_cpu(in_link->interval);
+		break;
+	case BR_MRP_TLV_HEADER_IN_LINK_STATUS:
+		in_link_status = (const void *)value;
+		memcpy(f->sa, in_link_status->sa, ETH_ALEN);
+		f->port_role = __be16_to_cpu(in_link_status->port_role);
+		f->in_id = __be16_to_cpu(in_link_status->id);
+		break;
+	case BR_MRP_TLV_HEADER_OPTION:
+		buf = mrp_parse_option(value, next, end, f);
+		if (!buf)
+			return -EBADMSG;
+		if (buf > next)
+			next = buf;
+		break;
+	default:
+		/* Unknown types are just forwarded */
+		return 0;
+	}
+
+	/* The Common TLV is optional, a truncated one is not */
+	if (next + sizeof(*tlv) > end ||
+	    ((const struct br_mrp_tlv_hdr *)next)->type !=
+	    BR_MRP_TLV_HEADER_COMMON)
+		return 0;
+
+	tlv = mrp_tlv(next, end);
+	if (!tlv)
+		return -EBADMSG;
+
+	common = (const void *)(next + sizeof(*tlv));
+	f->has_common = true;
+	f->seq_id = __be16_to_cpu(common->seq_id);
+	memcpy(f->domain, common->domain, MRP_DOMAIN_UUID_LENGTH);
+
+	return 0;
+}
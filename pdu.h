@@ -4,6 +4,8 @@
 #ifndef PDU_H
 #define PDU_H
 
+#include <stdint.h>
+#include <stdbool.h>
 #include <linux/mrp_bridge.h>
 
 struct br_mrp_tlv_hdr {
@@ -98,4 +100,28 @@ struct br_mrp_in_link_status_hdr {
 	__be16 id;
 };
 
+/* A received MRP PDU decoded by mrp_parse_frame(), values in host order.
+ * The fields not carried by the frame type are zero.
+ */
+struct mrp_frame {
+	uint8_t		type;		/* TLV type */
+	uint8_t		sub_type;	/* Option sub-TLV type */
+	uint16_t	prio;
+	uint8_t		sa[ETH_ALEN];
+	uint16_t	port_role;
+	uint16_t	interval;	/* ms */
+	uint16_t	in_id;
+
+	/* Option sub-TLVs */
+	uint16_t	other_prio;
+	uint8_t		other_sa[ETH_ALEN];
+
+	/* Common TLV */
+	bool		has_common;
+	uint16_t	seq_id;
+	uint8_t		domain[MRP_DOMAIN_UUID_LENGTH];
+};
+
+int mrp_parse_frame(const unsigned char *buf, int len, struct mrp_frame *f);
+
 #endif
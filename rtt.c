@@ -0,0 +1,83 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtt.h"
+
+/* The slot of a frame is reused MRP_RTT_SLOTS sequence numbers later: if
+ * the frame is still pending by then it is lost.
+ */
+void mrp_rtt_sent(struct mrp_rtt *rtt, uint16_t seq, uint64_t ts)
+{
+	typeof(rtt->slot[0]) *s = &rtt->slot[seq & (MRP_RTT_SLOTS - 1)];
+
+	if (s->pending)
+		rtt->lost++;
+
+	s->ts = ts;
+	s->seq = seq;
+	s->pending = true;
+	rtt->sent++;
+}
+
+void mrp_rtt_recv(struct mrp_rtt *rtt, uint16_t seq, uint64_t ts)
+{
+	typeof(rtt->slot[0]) *s = &rtt->slot[seq & (MRP_RTT_SLOTS - 1)];
+	uint32_t us;
+
+	/* Duplicated, or so late that it has been already accounted lost */
+	if (!s->pending || s->seq != seq)
+		return;
+	s->pending = false;
+
+	if (rtt->seen && (int16_t)(seq - rtt->last_seq) < 0)
+		rtt->reordered++;
+	else
+		rtt->last_seq = seq;
+	rtt->seen = true;
+
+	us = (ts - s->ts) / 1000;
+
+	if (!rtt->received || us < rtt->min)
+		rtt->min = us;
+	if (us > rtt->max)
+		rtt->max = us;
+	rtt->sum += us;
+	rtt->received++;
+
+	rtt->window[rtt->samples++ % MRP_RTT_WINDOW] = us;
+	mrp_hist_add(&rtt->hist, us);
+}
+
+static int mrp_rtt_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+void mrp_rtt_get(struct mrp_rtt *rtt, struct mrp_rtt_stats *stats)
+{
+	uint32_t window[MRP_RTT_WINDOW];
+	uint32_t n;
+
+	memset(stats, 0, sizeof(*stats));
+
+	stats->sent = rtt->sent;
+	stats->received = rtt->received;
+	stats->lost = rtt->lost;
+	stats->reordered = rtt->reordered;
+	if (!rtt->received)
+		return;
+
+	stats->min = rtt->min;
+	stats->max = rtt->max;
+	stats->avg = rtt->sum / rtt->received;
+
+	n = rtt->samples < MRP_RTT_WINDOW ? rtt->samples : MRP_RTT_WINDOW;
+	memcpy(window, rtt->window, n * sizeof(window[0]));
+	qsort(window, n, sizeof(window[0]), mrp_rtt_cmp);
+	stats->p99 = window[(n * 99 - 1) / 100];
+}
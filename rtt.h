@@ -0,0 +1,45 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef RTT_H
+#define RTT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "utils.h"
+#include "metrics.h"
+
+#define MRP_RTT_SLOTS		64	/* frames in flight, power of 2 */
+#define MRP_RTT_WINDOW		128	/* last samples used for the p99 */
+
+/* Round trip of the MRP_Test frames sent by the MRM on one ring port */
+struct mrp_rtt {
+	struct {
+		uint64_t	ts;	/* ns */
+		uint16_t	seq;
+		bool		pending;
+	} slot[MRP_RTT_SLOTS];
+
+	uint32_t		window[MRP_RTT_WINDOW];	/* us */
+	uint32_t		samples;
+
+	uint16_t		last_seq;
+	bool			seen;
+
+	uint64_t		sent;
+	uint64_t		received;
+	uint64_t		lost;
+	uint64_t		reordered;
+	uint32_t		min;	/* us */
+	uint32_t		max;	/* us */
+	uint64_t		sum;	/* us */
+	struct mrp_hist		hist;
+};
+
+void mrp_rtt_sent(struct mrp_rtt *rtt, uint16_t seq, uint64_t ts);
+void mrp_rtt_recv(struct mrp_rtt *rtt, uint16_t seq, uint64_t ts);
+void mrp_rtt_get(struct mrp_rtt *rtt, struct mrp_rtt_stats *stats);
+
+#endif /* RTT_H */
@@ -16,38 +16,732 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <linux/filter.h>
 
 #include "libnetlink.h"
 #include "server_cmds.h"
 #include "state_machine.h"
 #include "list.h"
 #include "ifdriver.h"
+#include "packet.h"
 #include "cfm_netlink.h"
 #include "dbus.h"
+#include "linkcache.h"
+#include "loop.h"
+#include "tc.h"
+
+/* The netlink receive buffer has to hold the notifications of a link
+ * storm while the state machines are running.
+ */
+#define NETLINK_RCVBUF	(4 * 1024 * 1024)
+
+/* Bridges and ports whose link notifications reach the daemon */
+#define NETLINK_MAX_MEMBERS	1024
 
 static struct rtnl_handle rth;
+static struct rtnl_handle rth_dump;
 static ev_io netlink_watcher;
+static uint64_t netlink_resyncs;
+static bool netlink_dumping;
+
+/* Bridges and ports of the MRP instances along with the shards owning
+ * them, rebuilt by mrp_shards_update() whenever the instances change. The
+ * link notifications are routed by looking the owners up here.
+ */
+struct mrp_member {
+	int		ifindex;
+	bool		port;
+	uint32_t	shards;		/* bitmask of the owners */
+};
+
+static struct mrp_member members[NETLINK_MAX_MEMBERS];
+static int nmembers;		/* -1 when they do not fit */
+static pthread_mutex_t members_lock;
+static ev_async update_watcher;
+
+struct mrp_members {
+	struct mrp_member	m[NETLINK_MAX_MEMBERS];
+	int			n;
+};
+
+static void mrp_member_add(struct mrp_members *c, int ifindex, bool port)
+{
+	int i;
+
+	if (c->n < 0)
+		return;
+
+	for (i = 0; i < c->n; i++)
+		if (c->m[i].ifindex == ifindex)
+			break;
+
+	if (i == c->n) {
+		if (c->n == NETLINK_MAX_MEMBERS) {
+			c->n = -1;
+			return;
+		}
+		c->m[c->n++] = (struct mrp_member){ ifindex, port, 0 };
+	}
+	c->m[i].shards |= 1u << mrp_shard->id;
+}
+
+/* Runs on each shard, adds the bridges and the ports of its instances */
+static int mrp_members_collect(void *arg)
+{
+	struct mrp_members *c = arg;
+	struct mrp *mrp;
+	uint32_t id = 0;
+
+	while ((mrp = mrp_find_next(id))) {
+		mrp_member_add(c, mrp->ifindex, false);
+		if (mrp->p_port)
+			mrp_member_add(c, mrp->p_port->ifindex, true);
+		if (mrp->s_port)
+			mrp_member_add(c, mrp->s_port->ifindex, true);
+		if (mrp->i_port)
+			mrp_member_add(c, mrp->i_port->ifindex, true);
+
+		id = mrp->id;
+	}
+
+	return 0;
+}
+
+/* Returns the shards owning ifindex and whether it is a port. When the
+ * members do not fit all the shards are returned.
+ */
+static uint32_t mrp_members_owners(int ifindex, bool *port)
+{
+	uint32_t shards = 0;
+	int i;
+
+	*port = false;
+
+	pthread_mutex_lock(&members_lock);
+	if (nmembers < 0) {
+		shards = (1u << mrp_nr_shards) - 1;
+		*port = true;
+	}
+	for (i = 0; i < nmembers; i++) {
+		if (members[i].ifindex == ifindex) {
+			shards = members[i].shards;
+			*port = members[i].port;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&members_lock);
+
+	return shards;
+}
+
+static void mrp_members_call(uint32_t shards, int (*fn)(void *arg), void *arg)
+{
+	int i;
+
+	for (i = 0; i < mrp_nr_shards; i++)
+		if (shards & (1u << i))
+			mrp_shard_call(&mrp_shards[i], fn, arg);
+}
+
+/* Called on the main loop when the MRP instances change: rebuilds the
+ * owners, the steering of the received frames and the netlink filter.
+ */
+static void mrp_shards_update(void)
+{
+	static struct mrp_members c;
+	static int ifindexes[NETLINK_MAX_MEMBERS];
+	static int shards[NETLINK_MAX_MEMBERS];
+	int i, n = 0;
+
+	c.n = 0;
+	for (i = 0; i < mrp_nr_shards; i++)
+		mrp_shard_call(&mrp_shards[i], mrp_members_collect, &c);
+
+	pthread_mutex_lock(&members_lock);
+	if (c.n > 0)
+		memcpy(members, c.m, c.n * sizeof(c.m[0]));
+	nmembers = c.n;
+	pthread_mutex_unlock(&members_lock);
+
+	/* The frames of a port are received by the shard owning it */
+	for (i = 0; i < c.n; i++) {
+		if (!c.m[i].port)
+			continue;
+
+		ifindexes[n] = c.m[i].ifindex;
+		shards[n++] = __builtin_ctz(c.m[i].shards);
+	}
+	if (c.n < 0)
+		pr_warn("too many MRP interfaces, frames steering disabled");
+	packet_fanout_update(ifindexes, shards, n);
+
+	netlink_filter_update();
+}
+
+/* The owner shard asks the main loop to update when a port leaves */
+static void mrp_shards_update_cb(EV_P_ ev_async *w, int revents)
+{
+	mrp_shards_update();
+}
+
+/* The qdiscs of the ports are set up on the main loop before the instance
+ * is added to its shard, and released once it is gone, see tc.h.
+ */
+static void ctl_tc_get(int pport, int sport, int iport)
+{
+	uint32_t delta = packet_txtime_lead() / 2;
+
+	if (!delta && !tc_qos_enabled())
+		return;
+
+	/* The launch time is for the MRP_Test frames, sent on the ring */
+	tc_port_get(pport, delta);
+	tc_port_get(sport, delta);
+	if (iport > 0)
+		tc_port_get(iport, 0);
+}
+
+static void ctl_tc_put(int pport, int sport, int iport)
+{
+	tc_port_put(pport);
+	tc_port_put(sport);
+	if (iport > 0)
+		tc_port_put(iport);
+}
+
+/* Called on the shard, before the instance is destroyed */
+static void ctl_ports_of(struct mrp *mrp, int *ports)
+{
+	ports[0] = mrp && mrp->p_port ? mrp->p_port->ifindex : 0;
+	ports[1] = mrp && mrp->s_port ? mrp->s_port->ifindex : 0;
+	ports[2] = mrp && mrp->i_port ? mrp->i_port->ifindex : 0;
+}
+
+static int ctl_add(void *arg)
+{
+	struct addmrp_IN *e = arg;
+
+	return mrp_add(e->br, e->ring_nr, e->pport, e->sport, e->ring_role,
+		       e->prio, e->ring_recv, e->react_on_link_change,
+		       e->in_role, e->in_id, e->iport, e->in_mode, e->in_recv,
+		       e->cfm_instance, e->cfm_level, e->cfm_mepid,
+		       e->cfm_peer_mepid, e->cfm_maid, e->cfm_dmac,
+		       &e->recv_custom);
+}
+
+/* Arguments of the commands addressing one instance */
+struct ctl_instance {
+	int				br;
+	int				ring_nr;
+	int				*count;
+	struct mrp_stats		*stats;
+	struct mrp_flight_entry		*entries;
+	int				ports[3];
+};
+
+static int ctl_del(void *arg)
+{
+	struct ctl_instance *c = arg;
+
+	ctl_ports_of(mrp_find(c->br, c->ring_nr), c->ports);
+
+	return mrp_del(c->br, c->ring_nr);
+}
+
+static int ctl_find(void *arg)
+{
+	struct ctl_instance *c = arg;
+
+	return !!mrp_find(c->br, c->ring_nr);
+}
+
+static int ctl_get_stats(void *arg)
+{
+	struct ctl_instance *c = arg;
+
+	return mrp_get_stats(c->br, c->ring_nr, c->stats);
+}
+
+static int ctl_get_flight(void *arg)
+{
+	struct ctl_instance *c = arg;
+
+	return mrp_get_flight(c->br, c->ring_nr, c->count, c->entries);
+}
 
 int CTL_addmrp(int br_index, int ring_nr, int pport, int sport, int ring_role,
 	       uint16_t prio, uint8_t ring_recv, uint8_t react_on_link_change,
 	       int in_role, uint16_t in_id, int iport, int in_mode,
 	       uint8_t in_recv, int cfm_instance, int cfm_level, int cfm_mepid,
-	       int cfm_peer_mepid, char *cfm_maid, char *cfm_dmac)
+	       int cfm_peer_mepid, char *cfm_maid, char *cfm_dmac,
+	       struct mrp_recovery_custom *recv_custom)
 {
-	return mrp_add(br_index, ring_nr, pport, sport, ring_role, prio,
-		       ring_recv, react_on_link_change, in_role, in_id,
-		       iport, in_mode, in_recv, cfm_instance, cfm_level,
-		       cfm_mepid, cfm_peer_mepid, cfm_maid, cfm_dmac);
+	struct addmrp_IN e = {
+		.br = br_index,
+		.ring_nr = ring_nr,
+		.pport = pport,
+		.sport = sport,
+		.ring_role = ring_role,
+		.prio = prio,
+		.ring_recv = ring_recv,
+		.react_on_link_change = react_on_link_change,
+		.in_role = in_role,
+		.in_id = in_id,
+		.iport = iport,
+		.in_mode = in_mode,
+		.in_recv = in_recv,
+		.cfm_instance = cfm_instance,
+		.cfm_level = cfm_level,
+		.cfm_mepid = cfm_mepid,
+		.cfm_peer_mepid = cfm_peer_mepid,
+		.recv_custom = *recv_custom,
+	};
+	int err;
+
+	memcpy(e.cfm_maid, cfm_maid, sizeof(e.cfm_maid));
+	memcpy(e.cfm_dmac, cfm_dmac, sizeof(e.cfm_dmac));
+
+	ctl_tc_get(pport, sport, iport);
+	err = mrp_shard_call(mrp_shard_of(br_index, ring_nr), ctl_add, &e);
+	if (err) {
+		ctl_tc_put(pport, sport, iport);
+		return err;
+	}
+
+	mrp_shards_update();
+
+	return 0;
 }
 
 int CTL_delmrp(int br_index, int ring_nr)
 {
-	return mrp_del(br_index, ring_nr);
+	struct ctl_instance c = { .br = br_index, .ring_nr = ring_nr };
+	int err;
+
+	err = mrp_shard_call(mrp_shard_of(br_index, ring_nr), ctl_del, &c);
+	if (err)
+		return err;
+
+	ctl_tc_put(c.ports[0], c.ports[1], c.ports[2]);
+	mrp_shards_update();
+
+	return 0;
+}
+
+static int ctl_get_port(void *arg)
+{
+	int *ifindex = arg;
+
+	return !!mrp_get_port(*ifindex);
+}
+
+static bool ctl_port_busy(int ifindex)
+{
+	uint32_t shards;
+	bool port;
+	int i;
+
+	shards = mrp_members_owners(ifindex, &port);
+	if (!port)
+		return false;
+
+	for (i = 0; i < mrp_nr_shards; i++)
+		if ((shards & (1u << i)) &&
+		    mrp_shard_call(&mrp_shards[i], ctl_get_port, &ifindex))
+			return true;
+
+	return false;
+}
+/* Checks an addmrp entry against the existing instances and the entries
+ * before it in the batch.
+ */
+static int ctl_batch_check(struct addmrp_IN *entries, int i)
+{
+	struct addmrp_IN *e = &entries[i], *o;
+	struct ctl_instance c = { .br = e->br, .ring_nr = e->ring_nr };
+	int j;
+
+	if (!e->br || !e->ring_nr || !e->pport || !e->sport ||
+	    e->pport == e->sport)
+		return -EINVAL;
+	if (e->ring_role != BR_MRP_RING_ROLE_MRM &&
+	    e->ring_role != BR_MRP_RING_ROLE_MRC &&
+	    e->ring_role != BR_MRP_RING_ROLE_MRA)
+		return -EINVAL;
+	if (e->in_role != BR_MRP_IN_ROLE_DISABLED &&
+	    (e->iport <= 0 || e->iport == e->pport || e->iport == e->sport))
+		return -EINVAL;
+
+	if (mrp_check_recovery(&e->recv_custom))
+		return -ERANGE;
+
+	if (mrp_shard_call(mrp_shard_of(e->br, e->ring_nr), ctl_find, &c))
+		return -EEXIST;
+	if (ctl_port_busy(e->pport) || ctl_port_busy(e->sport) ||
+	    (e->iport > 0 && ctl_port_busy(e->iport)))
+		return -EBUSY;
+
+	for (j = 0; j < i; j++) {
+		o = &entries[j];
+
+		if (o->br == e->br && o->ring_nr == e->ring_nr)
+			return -EEXIST;
+		if (o->pport == e->pport || o->pport == e->sport ||
+		    o->sport == e->pport || o->sport == e->sport)
+			return -EBUSY;
+		if (e->iport > 0 &&
+		    (o->pport == e->iport || o->sport == e->iport ||
+		     o->iport == e->iport))
+			return -EBUSY;
+		if (o->iport > 0 &&
+		    (o->iport == e->pport || o->iport == e->sport))
+			return -EBUSY;
+	}
+
+	return 0;
+}
+
+/* Adds all the instances or none of them */
+static int ctl_add_batch(int count, struct addmrp_IN *entries, int *failed)
+{
+	struct ctl_instance c;
+	struct addmrp_IN *e;
+	int err, i;
+
+	*failed = 0;
+	if (count <= 0 || count > MRP_BATCH_LEN)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		err = ctl_batch_check(entries, i);
+		if (err) {
+			pr_err("batch entry %d: bridge %d, ring_nr %d is invalid",
+			       i, entries[i].br, entries[i].ring_nr);
+			*failed = i;
+			return err;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		e = &entries[i];
+
+		ctl_tc_get(e->pport, e->sport, e->iport);
+		err = mrp_shard_call(mrp_shard_of(e->br, e->ring_nr), ctl_add,
+				     e);
+		if (err) {
+			ctl_tc_put(e->pport, e->sport, e->iport);
+			goto rollback;
+		}
+	}
+
+	return 0;
+
+rollback:
+	pr_err("batch entry %d: cannot add bridge %d, ring_nr %d",
+	       i, entries[i].br, entries[i].ring_nr);
+	*failed = i;
+
+	while (--i >= 0) {
+		c.br = entries[i].br;
+		c.ring_nr = entries[i].ring_nr;
+		if (!mrp_shard_call(mrp_shard_of(c.br, c.ring_nr), ctl_del, &c))
+			ctl_tc_put(c.ports[0], c.ports[1], c.ports[2]);
+	}
+
+	return err;
+}
+
+int CTL_addmrps(int count, struct addmrp_IN *entries, int *err, int *failed)
+{
+	*err = ctl_add_batch(count, entries, failed);
+	mrp_shards_update();
+
+	return 0;
+}
+
+struct ctl_get {
+	int			max;
+	int			count;
+	struct mrp_status	*status;
+};
+
+static int ctl_get(void *arg)
+{
+	struct ctl_get *c = arg;
+	int n;
+
+	mrp_get(c->max - c->count, &n, c->status + c->count);
+	c->count += n;
+
+	return 0;
 }
 
 int CTL_getmrp(int *count, struct mrp_status *status)
 {
-	return mrp_get(count, status);
+	struct ctl_get c = { .max = MAX_MRP_INSTANCES, .status = status };
+	int i;
+
+	for (i = 0; i < mrp_nr_shards; i++)
+		mrp_shard_call(&mrp_shards[i], ctl_get, &c);
+
+	*count = c.count;
+
+	return 0;
+}
+
+/* The page of one shard, see mrp_get_page() */
+struct ctl_page {
+	uint32_t		cursor;
+	uint32_t		since;
+	int			count;
+	uint32_t		ids[MRP_STATUS_PAGE_LEN];
+	uint32_t		last;
+	int			total;
+	struct mrp_status	status[MRP_STATUS_PAGE_LEN];
+};
+
+static int ctl_get_page(void *arg)
+{
+	struct ctl_page *p = arg;
+
+	return mrp_get_page(p->cursor, p->since, &p->count, p->ids, &p->last,
+			    &p->total, p->status);
+}
+
+/* Merges the pages of the shards by id, the instances with the lowest ids
+ * make the page.
+ */
+int CTL_listmrp(uint32_t cursor, uint32_t since, int *count, uint32_t *next,
+		uint32_t *generation, int *total, struct mrp_status *status)
+{
+	static struct ctl_page pages[MRP_MAX_SHARDS];
+	int pos[MRP_MAX_SHARDS] = { 0 };
+	uint32_t last = 0, id = 0;
+	struct ctl_page *p;
+	int i, n = 0, best;
+
+	/* Read before the pages: a change racing with them is reported
+	 * again by the next poll.
+	 */
+	*generation = mrp_get_generation();
+	*total = 0;
+
+	for (i = 0; i < mrp_nr_shards; i++) {
+		p = &pages[i];
+		p->cursor = cursor;
+		p->since = since;
+		mrp_shard_call(&mrp_shards[i], ctl_get_page, p);
+
+		*total += p->total;
+		if (p->last > last)
+			last = p->last;
+	}
+
+	while (n < MRP_STATUS_PAGE_LEN) {
+		best = -1;
+		for (i = 0; i < mrp_nr_shards; i++) {
+			p = &pages[i];
+			if (pos[i] < p->count &&
+			    (best < 0 || p->ids[pos[i]] <
+					 pages[best].ids[pos[best]]))
+				best = i;
+		}
+		if (best < 0)
+			break;
+
+		id = pages[best].ids[pos[best]];
+		status[n++] = pages[best].status[pos[best]++];
+	}
+
+	*count = n;
+	*next = 0;
+	if (n == MRP_STATUS_PAGE_LEN && last > id)
+		*next = id;
+
+	return 0;
+}
+
+void mrp_socket_stats_get(struct mrp_socket_stats *sock)
+{
+	packet_get_stats(&sock->packet_rx, &sock->packet_drops);
+	sock->rx_no_port = mrp_rx_no_port();
+	sock->netlink_enobufs = rth.enobufs;
+	sock->netlink_resyncs = netlink_resyncs;
+}
+
+int CTL_getstats(int br_index, int ring_nr, struct mrp_stats *stats)
+{
+	struct ctl_instance c = {
+		.br = br_index,
+		.ring_nr = ring_nr,
+		.stats = stats,
+	};
+	int err;
+
+	err = mrp_shard_call(mrp_shard_of(br_index, ring_nr), ctl_get_stats,
+			     &c);
+	if (err)
+		return err;
+
+	mrp_socket_stats_get(&stats->sock);
+
+	return 0;
+}
+
+int CTL_getflight(int br_index, int ring_nr, int *count,
+		  struct mrp_flight_entry *entries)
+{
+	struct ctl_instance c = {
+		.br = br_index,
+		.ring_nr = ring_nr,
+		.count = count,
+		.entries = entries,
+	};
+
+	return mrp_shard_call(mrp_shard_of(br_index, ring_nr), ctl_get_flight,
+			      &c);
+}
+
+/* Operstates received in the current batch of notifications, the port
+ * state machine runs only once the batch has been drained.
+ */
+struct netlink_operstate {
+	int	ifindex;
+	__u8	state;
+	int	suppressed;
+};
+
+static struct netlink_operstate netlink_pending[NETLINK_MAX_MEMBERS];
+static int netlink_npending;
+
+static __u8 netlink_operstate(__u8 state)
+{
+	switch (state) {
+	case IF_OPER_NOTPRESENT:
+	case IF_OPER_DOWN:
+	case IF_OPER_LOWERLAYERDOWN:
+	case IF_OPER_TESTING:
+	case IF_OPER_DORMANT:
+		return IF_OPER_DOWN;
+	default:
+		return IF_OPER_UP;
+	}
+}
+
+/* Runs on the shard owning the port */
+static int netlink_apply_operstate(void *arg)
+{
+	struct netlink_operstate *o = arg;
+	struct mrp_port *port;
+
+	/* The port may have left the bridge meanwhile */
+	port = mrp_get_port(o->ifindex);
+	if (!port)
+		return 0;
+
+	pr_debug("port: %s, curr state: %d, new state: %d",
+		 port->ifname, port->operstate, o->state);
+
+	port->cnt.link_suppressed += o->suppressed;
+	if (port->operstate == o->state) {
+		port->cnt.link_suppressed++;
+		return 0;
+	}
+
+	port->operstate = o->state;
+	mrp_port_link_change(port, o->state == IF_OPER_UP);
+
+	return 0;
+}
+
+static void netlink_queue_operstate(int ifindex, uint32_t shards, __u8 state)
+{
+	struct netlink_operstate o;
+	int i;
+
+	state = netlink_operstate(state);
+
+	for (i = 0; i < netlink_npending; i++)
+		if (netlink_pending[i].ifindex == ifindex)
+			break;
+
+	if (i < netlink_npending) {
+		/* A duplicate, or it supersedes the pending one */
+		netlink_pending[i].suppressed++;
+		netlink_pending[i].state = state;
+		return;
+	}
+
+	if (netlink_npending == NETLINK_MAX_MEMBERS) {
+		o = (struct netlink_operstate){ ifindex, state, 0 };
+		mrp_members_call(shards, netlink_apply_operstate, &o);
+		return;
+	}
+
+	netlink_pending[netlink_npending++] =
+		(struct netlink_operstate){ ifindex, state, 0 };
+}
+
+static void netlink_flush_operstate(void)
+{
+	struct netlink_operstate *o;
+	uint32_t shards;
+	bool port;
+	int i;
+
+	for (i = 0; i < netlink_npending; i++) {
+		o = &netlink_pending[i];
+		shards = mrp_members_owners(o->ifindex, &port);
+		if (port)
+			mrp_members_call(shards, netlink_apply_operstate, o);
+	}
+
+	netlink_npending = 0;
+}
+
+struct netlink_change {
+	int		ifindex;
+	__u8		*mac;
+	uint32_t	peer_mepid;
+	uint32_t	defect;
+	int		ports[3];	/* of the instance destroyed */
+};
+
+static int netlink_mac_change(void *arg)
+{
+	struct netlink_change *c = arg;
+
+	mrp_mac_change(c->ifindex, c->mac);
+
+	return 0;
+}
+
+static int netlink_cfm_link_change(void *arg)
+{
+	struct netlink_change *c = arg;
+
+	mrp_cfm_link_change(c->ifindex, c->peer_mepid, c->defect);
+
+	return 0;
+}
+
+/* The port is no more enslaved to the bridge */
+static int netlink_port_leave(void *arg)
+{
+	struct netlink_change *c = arg;
+	struct mrp_port *port;
+
+	port = mrp_get_port(c->ifindex);
+	if (!port)
+		return 0;
+
+	ctl_ports_of(port->mrp, c->ports);
+	mrp_destroy(port->mrp->ifindex, port->mrp->ring_nr, false);
+	ev_async_send(EV_DEFAULT, &update_watcher);
+
+	return 0;
 }
 
 static int netlink_listen(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
@@ -57,22 +751,28 @@ static int netlink_listen(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
 	struct rtattr *aftb[IFLA_BRIDGE_MAX + 1];
 	struct ifinfomsg *ifi = NLMSG_DATA(n);
 	struct rtattr * tb[IFLA_MAX + 1];
-	struct mrp_port *port;
+	struct netlink_change c;
 	int len = n->nlmsg_len;
 	int af_family;
 	int rem, instance;
 	struct rtattr *i, *list;
+	uint32_t shards;
+	bool port;
 
 	if (n->nlmsg_type == NLMSG_DONE)
 		return 0;
 
+	linkcache_update(n);
+
 	len -= NLMSG_LENGTH(sizeof(*ifi));
 	if (len < 0)
 		return -1;
 
 	af_family = ifi->ifi_family;
 
-	port = mrp_get_port(ifi->ifi_index);
+	/* The notifications are handled by the shards owning the link */
+	shards = mrp_members_owners(ifi->ifi_index, &port);
+	c.ifindex = ifi->ifi_index;
 
 	if (af_family != AF_BRIDGE && af_family != AF_UNSPEC)
 		return 0;
@@ -88,8 +788,8 @@ static int netlink_listen(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
 	}
 
 	if (tb[IFLA_ADDRESS]) {
-		mrp_mac_change(ifi->ifi_index,
-			       (__u8*)RTA_DATA(tb[IFLA_ADDRESS]));
+		c.mac = (__u8*)RTA_DATA(tb[IFLA_ADDRESS]);
+		mrp_members_call(shards, netlink_mac_change, &c);
 	}
 
 	if (tb[IFLA_AF_SPEC]) {
@@ -114,8 +814,9 @@ static int netlink_listen(struct rtnl_ctrl_data *who, struct nlmsghdr *n,
 				instance = rta_getattr_u32(infotb[IFLA_BRIDGE_CFM_CC_PEER_STATUS_INSTANCE]);
 			}
 
-			mrp_cfm_link_change(ifi->ifi_index, rta_getattr_u32(infotb[IFLA_BRIDGE_CFM_CC_PEER_STATUS_PEER_MEPID]),
-					    rta_getattr_u32(infotb[IFLA_BRIDGE_CFM_CC_PEER_STATUS_CCM_DEFECT]));
+			c.peer_mepid = rta_getattr_u32(infotb[IFLA_BRIDGE_CFM_CC_PEER_STATUS_PEER_MEPID]);
+			c.defect = rta_getattr_u32(infotb[IFLA_BRIDGE_CFM_CC_PEER_STATUS_CCM_DEFECT]);
+			mrp_members_call(shards, netlink_cfm_link_change, &c);
 		}
 	}
 
@@ -123,42 +824,185 @@ mrp_process:
 	if (!port)
 		return 0;
 
-	if (tb[IFLA_OPERSTATE]) {
-		__u8 state = *(__u8*)RTA_DATA(tb[IFLA_OPERSTATE]);
-		pr_debug("port: %s, curr state: %d, new state: %d",
-			port->ifname, port->operstate, state);
-		if (port->operstate != state) {
-			port->operstate = state;
-
-			switch (state) {
-			case IF_OPER_NOTPRESENT:
-			case IF_OPER_DOWN:
-			case IF_OPER_LOWERLAYERDOWN:
-			case IF_OPER_TESTING:
-			case IF_OPER_DORMANT:
-				mrp_port_link_change(port, false);
-				break;
-
-			case IF_OPER_UNKNOWN:
-				port->operstate = IF_OPER_UP;
-				fallthrough;
-			case IF_OPER_UP:
-				mrp_port_link_change(port, true);
-				break;
-			}
-		}
-	}
+	if (tb[IFLA_OPERSTATE])
+		netlink_queue_operstate(ifi->ifi_index, shards,
+					*(__u8*)RTA_DATA(tb[IFLA_OPERSTATE]));
 
 	if (!tb[IFLA_MASTER]) {
-		mrp_destroy(port->mrp->ifindex, port->mrp->ring_nr, false);
+		memset(c.ports, 0, sizeof(c.ports));
+		mrp_members_call(shards, netlink_port_leave, &c);
+		ctl_tc_put(c.ports[0], c.ports[1], c.ports[2]);
 	}
 
 	return 0;
 }
 
+static int netlink_dump(struct nlmsghdr *n, void *arg)
+{
+	/* A bad message must not stop the dump */
+	netlink_listen(NULL, n, arg);
+
+	return 0;
+}
+
+/* Dumps all the links through netlink_listen(): it fills the link cache
+ * and brings the operstate of the MRP ports in line with the kernel.
+ */
+static int netlink_resync(void)
+{
+	int err;
+
+	err = rtnl_linkdump_req(&rth_dump, AF_UNSPEC);
+	if (err < 0)
+		return err;
+
+	netlink_dumping = true;
+	err = rtnl_dump_filter(&rth_dump, netlink_dump, NULL);
+	netlink_dumping = false;
+
+	netlink_flush_operstate();
+
+	return err;
+}
+
+static int netlink_members(int *ifindexes)
+{
+	int i, n;
+
+	pthread_mutex_lock(&members_lock);
+	n = nmembers;
+	for (i = 0; i < n; i++)
+		ifindexes[i] = members[i].ifindex;
+	pthread_mutex_unlock(&members_lock);
+
+	/* Too many to be filtered */
+	return n;
+}
+
+/* Drops in the kernel the link notifications of the interfaces that are
+ * not bridges or ports of an MRP instance. The other notifications are
+ * accepted.
+ */
+static int netlink_set_filter(const int *ifindexes, int n)
+{
+	struct sock_filter *filter;
+	struct sock_fprog prog;
+	int i, len = 0, err;
+
+	filter = malloc((6 + 2 * n) * sizeof(*filter));
+	if (!filter)
+		return -ENOMEM;
+
+	/* The loads are big endian, the netlink messages are not */
+	filter[len++] = (struct sock_filter)
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS,
+			 offsetof(struct nlmsghdr, nlmsg_type));
+	filter[len++] = (struct sock_filter)
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htons(RTM_NEWLINK), 2, 0);
+	filter[len++] = (struct sock_filter)
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htons(RTM_DELLINK), 1, 0);
+	filter[len++] = (struct sock_filter)
+		BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	filter[len++] = (struct sock_filter)
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+			 NLMSG_LENGTH(offsetof(struct ifinfomsg, ifi_index)));
+	for (i = 0; i < n; i++) {
+		filter[len++] = (struct sock_filter)
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htonl(ifindexes[i]),
+				 0, 1);
+		filter[len++] = (struct sock_filter)
+			BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	}
+	filter[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+	prog.len = len;
+	prog.filter = filter;
+	err = setsockopt(rth.fd, SOL_SOCKET, SO_ATTACH_FILTER,
+			 &prog, sizeof(prog));
+	free(filter);
+
+	return err;
+}
+
+static int netlink_getlink(int ifindex)
+{
+	struct {
+		struct nlmsghdr		n;
+		struct ifinfomsg	i;
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = RTM_GETLINK,
+		.i.ifi_family = AF_UNSPEC,
+		.i.ifi_index = ifindex,
+	};
+	struct nlmsghdr *answer;
+
+	if (rtnl_talk(&rth_dump, &req.n, &answer) < 0)
+		return -1;
+
+	linkcache_update(answer);
+	free(answer);
+
+	return 0;
+}
+
+/* Called on the main loop when the MRP instances change: rebuilds the
+ * filter and keeps the link cache only for the interfaces whose
+ * notifications are received.
+ */
+void netlink_filter_update(void)
+{
+	static int ifindexes[NETLINK_MAX_MEMBERS];
+	int i, n;
+
+	/* During a dump it is called again once the dump is done */
+	if (rth.fd < 0 || netlink_dumping)
+		return;
+
+	n = netlink_members(ifindexes);
+	if (n < 0) {
+		pr_warn("too many MRP interfaces, netlink filter disabled");
+		setsockopt(rth.fd, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+		return;
+	}
+
+	if (netlink_set_filter(ifindexes, n)) {
+		pr_err("cannot set the netlink filter: %m");
+		return;
+	}
+
+	linkcache_retain(ifindexes, n);
+	for (i = 0; i < n; i++)
+		if (!linkcache_get(ifindexes[i]))
+			netlink_getlink(ifindexes[i]);
+}
+
 static void netlink_rcv(EV_P_ ev_io *w, int revents)
 {
-	rtnl_listen(&rth, netlink_listen, stdout);
+	bool resync = false;
+	int err;
+
+	/* On overflow keep draining the socket, the dump must be newer than
+	 * all the notifications already queued.
+	 */
+	do {
+		err = rtnl_listen(&rth, netlink_listen, stdout);
+		if (err == -ENOBUFS || err == -EBADMSG)
+			resync = true;
+	} while (err == -ENOBUFS || err == -EBADMSG);
+
+	/* Only the last operstate of each port counts */
+	netlink_flush_operstate();
+
+	if (!resync)
+		return;
+
+	netlink_resyncs++;
+	pr_warn("netlink notifications lost, resynchronizing the links");
+	if (netlink_resync() < 0)
+		pr_err("netlink resync failed");
+	netlink_filter_update();
 }
 
 static int netlink_init(void)
@@ -169,8 +1013,20 @@ static int netlink_init(void)
 	if (err)
 		return err;
 
+	/* NETLINK_NO_ENOBUFS is left off: an overflow must be reported,
+	 * otherwise a lost port down would never be noticed.
+	 */
+	if (rtnl_set_rcvbuf(&rth, NETLINK_RCVBUF))
+		pr_warn("cannot set the netlink receive buffer");
+
 	fcntl(rth.fd, F_SETFL, O_NONBLOCK);
 
+	err = rtnl_open(&rth_dump, 0);
+	if (err) {
+		rtnl_close(&rth);
+		return err;
+	}
+
 	ev_io_init(&netlink_watcher, netlink_rcv, rth.fd, EV_READ);
 	ev_io_start(EV_DEFAULT, &netlink_watcher);
 
@@ -180,11 +1036,14 @@ static int netlink_init(void)
 static void netlink_uninit(void)
 {
 	ev_io_stop(EV_DEFAULT, &netlink_watcher);
+	rtnl_close(&rth_dump);
 	rtnl_close(&rth);
 }
 
 int CTL_init(void)
 {
+	mrp_mutex_init(&members_lock);
+
 	if (dbus_init()) {
 		pr_err("dbus init failed!");
                 return -1;
@@ -200,6 +1059,15 @@ int CTL_init(void)
 		return -1;
 	}
 
+	if (netlink_resync() < 0) {
+		pr_err("link dump failed");
+		return -1;
+	}
+	mrp_shards_update();
+
+	ev_async_init(&update_watcher, mrp_shards_update_cb);
+	ev_async_start(EV_DEFAULT, &update_watcher);
+
 	if (ifdriver_init()) {
 		pr_err("ifdriver init failed");
 		return -1;
@@ -213,10 +1081,22 @@ int CTL_init(void)
 	return 0;
 }
 
+/* Called once the shard threads are stopped */
 void CTL_cleanup(void)
 {
+	int i;
+
+	ev_async_stop(EV_DEFAULT, &update_watcher);
 	dbus_uninit();
 	ifdriver_uninit();
 	netlink_uninit();
-	mrp_uninit();
+
+	/* The instances are destroyed as their own shard */
+	for (i = 0; i < mrp_nr_shards; i++) {
+		mrp_shard = &mrp_shards[i];
+		mrp_uninit();
+	}
+	mrp_shard = &mrp_shards[0];
+
+	linkcache_cleanup();
 }
@@ -21,9 +21,19 @@ int CTL_addmrp(int br_index, int ring_nr, int pport, int sport, int ring_role,
 	       uint16_t prio, uint8_t ring_recv, uint8_t react_on_link_change,
 	       int in_role, uint16_t in_id, int iport, int in_mode,
 	       uint8_t in_recv, int cfm_instance, int cfm_level, int cfm_mepid,
-	       int cfm_peer_mepid, char *cfm_maid, char *cfm_dmac);
+	       int cfm_peer_mepid, char *cfm_maid, char *cfm_dmac,
+	       struct mrp_recovery_custom *recv_custom);
 int CTL_delmrp(int br_index, int ring_nr);
+int CTL_addmrps(int count, struct addmrp_IN *entries, int *err, int *failed);
 int CTL_getmrp(int *count, struct mrp_status *status);
+int CTL_listmrp(uint32_t cursor, uint32_t since, int *count, uint32_t *next,
+		uint32_t *generation, int *total, struct mrp_status *status);
+int CTL_getstats(int br_index, int ring_nr, struct mrp_stats *stats);
+int CTL_getflight(int br_index, int ring_nr, int *count,
+		  struct mrp_flight_entry *entries);
+
+void mrp_socket_stats_get(struct mrp_socket_stats *sock);
+void netlink_filter_update(void);
 
 int CTL_init(void);
 void CTL_cleanup(void);
@@ -11,6 +11,7 @@
 #include <ev.h>
 
 #include "server_cmds.h"
+#include "events.h"
 #include "utils.h"
 
 static EV_P;
@@ -44,13 +45,17 @@ static int handle_message(int cmd, void *inbuf, int lin,
 	switch(cmd) {
 	SERVER_MESSAGE_CASE(addmrp);
 	SERVER_MESSAGE_CASE(delmrp);
+	SERVER_MESSAGE_CASE(addmrps);
 	SERVER_MESSAGE_CASE(getmrp);
+	SERVER_MESSAGE_CASE(listmrp);
+	SERVER_MESSAGE_CASE(getstats);
+	SERVER_MESSAGE_CASE(getflight);
 	default:
 		return -1;
 	}
 }
 
-#define MSG_BUF_LEN 10000
+#define MSG_BUF_LEN 16384
 static unsigned char msg_inbuf[MSG_BUF_LEN];
 static unsigned char msg_outbuf[MSG_BUF_LEN];
 
@@ -83,8 +88,15 @@ static void ctl_rcv_handler(EV_P_ ev_io *w, int revents)
 		return;
 	}
 
-	mhdr.res = handle_message(mhdr.cmd, msg_inbuf, mhdr.lin,
-				  msg_outbuf, mhdr.lout);
+	/* The subscriptions are bound to the sender address */
+	if (mhdr.cmd == CMD_CODE_subscribe)
+		mhdr.res = mrp_events_subscribe(&sa, msg.msg_namelen);
+	else if (mhdr.cmd == CMD_CODE_unsubscribe)
+		mhdr.res = mrp_events_unsubscribe(&sa, msg.msg_namelen);
+	else
+		/* The commands reach the shards owning the instances */
+		mhdr.res = handle_message(mhdr.cmd, msg_inbuf, mhdr.lin,
+					  msg_outbuf, mhdr.lout);
 
 	if(0 > mhdr.res)
 		memset(msg_outbuf, 0, mhdr.lout);
@@ -113,10 +125,14 @@ int ctl_socket_init(void)
 	ev_io_init(&client_watcher, ctl_rcv_handler, fd, EV_READ);
 	ev_io_start(loop, &client_watcher);
 
+	mrp_events_init(fd);
+
 	ret = CTL_init();
 	if (ret == 0)
 		return 0;
 
+	mrp_events_cleanup();
+
 	ev_io_stop(loop, &client_watcher);
 	close(fd);
 
@@ -126,6 +142,7 @@ int ctl_socket_init(void)
 void ctl_socket_cleanup(void)
 {
 	CTL_cleanup();
+	mrp_events_cleanup();
 
 	ev_io_stop(loop, &client_watcher);
 	close(fd);
@@ -16,8 +16,20 @@
 #include "pdu.h"
 #include "cfm_netlink.h"
 #include "dbus.h"
+#include "events.h"
+#include "trace.h"
+#include "linkcache.h"
+#include "tc.h"
 
-static LIST_HEAD(mrp_instances);
+/* The instances of the running shard, see loop.h. The ids and the
+ * generation numbers are shared by all the shards.
+ */
+#define mrp_instances	(mrp_shard->instances)
+static uint32_t mrp_last_id;
+static uint32_t mrp_generation;
+
+__thread uint64_t mrp_tx_origin;
+__thread uint64_t mrp_tx_launch;
 
 const uint8_t mrp_test_dmac[ETH_ALEN] = { 0x1, 0x15, 0x4e, 0x0, 0x0, 0x1 };
 const uint8_t mrp_control_dmac[ETH_ALEN] = { 0x1, 0x15, 0x4e, 0x0, 0x0, 0x2 };
@@ -53,44 +65,54 @@ static struct mrp *mrp_get_mrp(uint32_t ifindex, uint32_t peer_mepid)
 	return NULL;
 }
 
+/* Marks the MRP instance as changed for status queries */
+static void mrp_changed(struct mrp *mrp)
+{
+	mrp->generation = __atomic_add_fetch(&mrp_generation, 1,
+					     __ATOMIC_RELAXED);
+	mrp->decide_valid = false;
+}
+
 int mrp_port_set_state(struct mrp_port *p, enum br_mrp_port_state_type state)
 {
 	int ret;
 
         p->state = state;
+	mrp_changed(p->mrp);
+	trace("port: %u, state: %d", p->ifindex, state);
+	mrp_flight_record(&p->mrp->flight, MRP_FLIGHT_PORT_STATE, p->ifindex,
+			  state);
 
-        ret = ifdriver_port_set_state(p, state);
+        ret = IFDRIVER_TIMED(MRP_IFDRIVER_PORT_STATE,
+			     ifdriver_port_set_state(p, state));
 	if (ret)
 		pr_warn("cannot set state %d for port %s", state, p->ifname);
 
 	dbus_port_state_changed(p, state);
+	mrp_event_post(p->mrp, p, MRP_EVENT_PORT_STATE, state);
 
 	return ret;
 }
 
 static bool mrp_is_port_up(const struct mrp_port *p)
 {
-	return if_get_link(p->ifindex);
-}
-
-static bool mrp_is_ring_port(const struct mrp_port *p)
-{
-	return p->role == BR_MRP_PORT_ROLE_PRIMARY ||
-	       p->role == BR_MRP_PORT_ROLE_SECONDARY;
+	return linkcache_get_link(p->ifindex);
 }
 
-static bool mrp_is_in_port(const struct mrp_port *p)
+/* With the tightest profiles the wake up latency is a large part of the
+ * budget, so the socket is spun on while the ring is closed.
+ */
+static void mrp_busy_poll_update(struct mrp *mrp)
 {
-	return p->role == BR_MRP_PORT_ROLE_INTER;
-}
+	bool on = mrp->mrm_state == MRP_MRM_STATE_CHK_RC &&
+		  (mrp->ring_recv == MRP_RING_RECOVERY_10 ||
+		   mrp->ring_recv == MRP_RING_RECOVERY_30);
 
-/* Determins if a port is part of a MRP instance */
-static bool mrp_is_mrp_port(const struct mrp_port *p)
-{
-	if (!p->mrp)
-		return false;
+	if (on == mrp->busy_poll)
+		return;
 
-	return true;
+	mrp->busy_poll = on;
+	packet_busy_poll(on);
 }
 
 static void mrp_reset_ring_state(struct mrp *mrp)
@@ -98,6 +120,7 @@ static void mrp_reset_ring_state(struct mrp *mrp)
 	mrp_timer_stop(mrp);
 	mrp->mrm_state = MRP_MRM_STATE_AC_STAT1;
 	mrp->mrc_state = MRP_MRC_STATE_AC_STAT1;
+	mrp_busy_poll_update(mrp);
 }
 
 char *mrp_get_mrm_state(enum mrp_mrm_state_type state)
@@ -148,8 +171,10 @@ int mrp_set_ring_role(struct mrp *mrp, enum br_mrp_ring_role_type role)
 	int ret;
 
         mrp->ring_role = role;
+	mrp_changed(mrp);
 
-        ret = ifdriver_set_ring_role(mrp, role);
+        ret = IFDRIVER_TIMED(MRP_IFDRIVER_RING_ROLE,
+			     ifdriver_set_ring_role(mrp, role));
 	if (ret)
 		pr_warn("cannot set state %d for bridge %s", role, mrp->ifname);
 	pr_debug("role: %s", ring_role_str(role));
@@ -160,8 +185,10 @@ int mrp_set_in_role(struct mrp *mrp, enum br_mrp_in_role_type role)
 	int ret;
 
 	mrp->in_role = role;
+	mrp_changed(mrp);
 
-        ret = ifdriver_set_in_role(mrp, role);
+        ret = IFDRIVER_TIMED(MRP_IFDRIVER_IN_ROLE,
+			     ifdriver_set_in_role(mrp, role));
 	if (ret)
 		pr_warn("cannot set state %d for bridge %s", role, mrp->ifname);
 	pr_debug("role: %s", in_role_str(role));
@@ -185,7 +212,14 @@ void mrp_set_mrm_state(struct mrp *mrp, enum mrp_mrm_state_type state)
 {
 	pr_debug("bridge: %s, mrm_state: %s", mrp->ifname,
 						mrp_get_mrm_state(state));
+	if (mrp->mrm_state == MRP_MRM_STATE_CHK_RC &&
+	    state == MRP_MRM_STATE_CHK_RO)
+		mrp_flight_check_recovery(mrp, false);
 	mrp->mrm_state = state;
+	mrp_busy_poll_update(mrp);
+	mrp_changed(mrp);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_MRM_STATE, 0, state);
+	mrp_event_post(mrp, NULL, MRP_EVENT_MRM_STATE, state);
 	mrp->no_tc = false;
 }
 
@@ -194,13 +228,22 @@ void mrp_set_mrc_state(struct mrp *mrp, enum mrp_mrc_state_type state)
 	pr_debug("bridge: %s, mrc_state: %s", mrp->ifname,
 						mrp_get_mrc_state(state));
 	mrp->mrc_state = state;
+	mrp_changed(mrp);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_MRC_STATE, 0, state);
+	mrp_event_post(mrp, NULL, MRP_EVENT_MRC_STATE, state);
 }
 
 void mrp_set_mim_state(struct mrp *mrp, enum mrp_mim_state_type state)
 {
 	pr_debug("bridge: %s, mim_state: %s", mrp->ifname,
 						mrp_get_mim_state(state));
+	if (mrp->mim_state == MRP_MIM_STATE_CHK_IC &&
+	    state == MRP_MIM_STATE_CHK_IO)
+		mrp_flight_check_recovery(mrp, true);
 	mrp->mim_state = state;
+	mrp_changed(mrp);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_MIM_STATE, 0, state);
+	mrp_event_post(mrp, NULL, MRP_EVENT_MIM_STATE, state);
 }
 
 void mrp_set_mic_state(struct mrp *mrp, enum mrp_mic_state_type state)
@@ -208,6 +251,23 @@ void mrp_set_mic_state(struct mrp *mrp, enum mrp_mic_state_type state)
 	pr_debug("bridge: %s, mic_state: %s", mrp->ifname,
 						mrp_get_mic_state(state));
 	mrp->mic_state = state;
+	mrp_changed(mrp);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_MIC_STATE, 0, state);
+	mrp_event_post(mrp, NULL, MRP_EVENT_MIC_STATE, state);
+}
+
+void mrp_ring_transition(struct mrp *mrp)
+{
+	mrp->ring_transitions++;
+	mrp_event_post(mrp, NULL, MRP_EVENT_RING_TRANSITION,
+		       mrp->ring_transitions);
+}
+
+void mrp_in_transition(struct mrp *mrp)
+{
+	mrp->in_transitions++;
+	mrp_event_post(mrp, NULL, MRP_EVENT_IN_TRANSITION,
+		       mrp->in_transitions);
 }
 
 static int mrp_set_mra_role(struct mrp *mrp)
@@ -221,6 +281,7 @@ static int mrp_set_mra_role(struct mrp *mrp)
 		return -EINVAL;
 
 	mrp->mra_support = true;
+	mrp->decide_valid = false;
 
 	/* When changing the role everything is reset */
 	mrp_reset_ring_state(mrp);
@@ -366,7 +427,9 @@ static int mrp_set_mic_role(struct mrp *mrp)
 }
 
 /* According to the standard each frame has a different sequence number. If it
- * is MRP_Test, MRP_TopologyChange or MRP_LinkChange
+ * is MRP_Test, MRP_TopologyChange or MRP_LinkChange. The copies of the same
+ * frame sent on several ports share it, so the receivers can tell them apart
+ * from a new frame.
  */
 static uint16_t mrp_next_seq(struct mrp *mrp)
 {
@@ -383,14 +446,6 @@ static struct br_mrp_tlv_hdr *mrp_get_tlv_hdr(unsigned char *buf)
 	return (struct br_mrp_tlv_hdr *) (buf + sizeof(uint16_t));
 }
 
-/* Returns the MRP_InTestHeader */
-static struct br_mrp_in_test_hdr *mrp_get_in_test_hdr(unsigned char *buf)
-{
-	/* Remove MRP version, tlv header and get InTest header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	return (struct br_mrp_in_test_hdr *) buf;
-}
-
 /* Allocates MRP frame and set head part of the frames. This is the ethernet
  * and the MRP version
  */
@@ -445,17 +500,28 @@ static void mrp_fb_sub_tlv(struct frame_buf *fb,
 	hdr->length = length;
 }
 
-static void mrp_fb_common(struct frame_buf *fb, struct mrp_port *p)
+static void mrp_fb_common_seq(struct frame_buf *fb, struct mrp_port *p,
+			      uint16_t seq)
 {
 	struct br_mrp_common_hdr *hdr;
 
 	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_COMMON, sizeof(*hdr));
 
 	hdr = fb_put(fb, sizeof(*hdr));
-	hdr->seq_id = __cpu_to_be16(mrp_next_seq(p->mrp));
+	hdr->seq_id = __cpu_to_be16(seq);
 	memcpy(hdr->domain, p->mrp->domain, MRP_DOMAIN_UUID_LENGTH);
 }
 
+/* Returns the sequence number of the frame */
+static uint16_t mrp_fb_common(struct frame_buf *fb, struct mrp_port *p)
+{
+	uint16_t seq = mrp_next_seq(p->mrp);
+
+	mrp_fb_common_seq(fb, p, seq);
+
+	return seq;
+}
+
 static void mrp_forward(struct mrp_port *p, struct frame_buf *fb)
 {
 	if (fb->size < 60)
@@ -466,11 +532,18 @@ static void mrp_forward(struct mrp_port *p, struct frame_buf *fb)
 		{ .iov_base = fb->start, .iov_len = fb->size }
 	};
 
-	if (p->operstate == IF_OPER_UP)
-		packet_send(p->ifindex, iov, 1, fb->size);
+	if (p->operstate == IF_OPER_UP) {
+		packet_send(p->ifindex, iov, 1, fb->size,
+			    mrp_tlv_idx(mrp_get_tlv_hdr(fb->start +
+					sizeof(struct ethhdr))->type),
+			    mrp_tx_origin, 0);
+		p->cnt.forwarded++;
+	}
 }
 
-static void mrp_send(struct mrp_port *p, struct ethhdr *h, struct frame_buf *fb)
+/* txtime is the launch time of the frame, 0 to send it at once */
+static void mrp_send_at(struct mrp_port *p, struct ethhdr *h,
+			struct frame_buf *fb, uint64_t txtime)
 {
 	if (sizeof(*h) + fb->size < 60)
 		fb->size += 60 - fb->size - sizeof(*h);
@@ -481,8 +554,18 @@ static void mrp_send(struct mrp_port *p, struct ethhdr *h, struct frame_buf *fb)
 		{ .iov_base = fb->start, .iov_len = fb->size }
 	};
 
-	if (p->operstate == IF_OPER_UP)
-		packet_send(p->ifindex, iov, 2, sizeof(*h) + fb->size);
+	int idx = mrp_tlv_idx(mrp_get_tlv_hdr(fb->start)->type);
+
+	if (p->operstate == IF_OPER_UP) {
+		packet_send(p->ifindex, iov, 2, sizeof(*h) + fb->size, idx,
+			    mrp_tx_origin, txtime);
+		p->cnt.tx[idx]++;
+	}
+}
+
+static void mrp_send(struct mrp_port *p, struct ethhdr *h, struct frame_buf *fb)
+{
+	mrp_send_at(p, h, fb, 0);
 }
 
 /* Compose MRP_Test frame and forward the frame to the port p.
@@ -496,11 +579,21 @@ static void mrp_send_ring_test(struct mrp_port *p)
 	struct frame_buf *fb = NULL;
 	struct mrp *mrp = p->mrp;
 	struct ethhdr *h = NULL;
+	uint64_t launch = 0, delay = 0;
 	struct timespec t;
+	uint64_t sent;
 	uint32_t time_ms;
+	uint16_t seq;
+
+	/* The frames of a test leave together, spaced by the test interval
+	 * whatever the lateness of the daemon
+	 */
+	if (p->txtime)
+		launch = packet_txtime_launch(mrp_tx_launch, &delay);
 
 	clock_gettime(CLOCK_MONOTONIC, &t);
-	time_ms = t.tv_sec * 1000 + t.tv_nsec / 1000000;
+	sent = (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec + delay;
+	time_ms = sent / 1000000;
 
 	fb = mrp_fb_alloc();
 	if (!fb)
@@ -517,14 +610,18 @@ static void mrp_send_ring_test(struct mrp_port *p)
 	hdr->transitions = __cpu_to_be16(mrp->ring_transitions);
 	hdr->timestamp = __cpu_to_be32(time_ms);
 
-	mrp_fb_common(fb, p);
+	seq = mrp_fb_common(fb, p);
 	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_END, 0x0);
 
 	h = mrp_eth_alloc(p->macaddr, mrp_test_dmac);
 	if (!h)
 		goto out;
 
-	mrp_send(p, h, fb);
+	mrp_send_at(p, h, fb, launch);
+
+	/* The timestamp field has only a ms resolution, keep our own */
+	if (p->operstate == IF_OPER_UP && mrp_is_ring_port(p))
+		mrp_rtt_sent(&mrp->ring_rtt[p->role], seq, sent);
 
 	free(h);
 out:
@@ -551,7 +648,8 @@ void mrp_ring_test_req(struct mrp *mrp, uint32_t interval)
  * The MRP_TopologyChange frame has the following format:
  * MRP_Version, MRP_TLVHeader, MRP_Prio, MRP_SA, MRP_Interval
  */
-static void mrp_send_ring_topo(struct mrp_port *p, uint32_t interval)
+static void mrp_send_ring_topo(struct mrp_port *p, uint32_t interval,
+			       uint16_t seq)
 {
 	struct br_mrp_ring_topo_hdr *hdr = NULL;
 	struct frame_buf *fb = NULL;
@@ -569,7 +667,7 @@ static void mrp_send_ring_topo(struct mrp_port *p, uint32_t interval)
 	ether_addr_copy(hdr->sa, mrp->macaddr);
 	hdr->interval = interval == 0 ? 0 : __cpu_to_be16(interval / 1000);
 
-	mrp_fb_common(fb, p);
+	mrp_fb_common_seq(fb, p, seq);
 	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_END, 0x0);
 
 	h = mrp_eth_alloc(p->macaddr, mrp_control_dmac);
@@ -586,8 +684,10 @@ out:
 
 void mrp_ring_topo_send(struct mrp *mrp, uint32_t time)
 {
-	mrp_send_ring_topo(mrp->p_port, time);
-	mrp_send_ring_topo(mrp->s_port, time);
+	uint16_t seq = mrp_next_seq(mrp);
+
+	mrp_send_ring_topo(mrp->p_port, time, seq);
+	mrp_send_ring_topo(mrp->s_port, time, seq);
 }
 
 /* Send MRP_TopologyChange frames on both MRP ports and start a timer to send
@@ -599,10 +699,12 @@ void mrp_ring_topo_req(struct mrp *mrp, uint32_t time)
 {
 	pr_debug("time: %d", time);
 
+	mrp_event_post(mrp, NULL, MRP_EVENT_TOPO_CHANGE, time);
+
 	mrp_ring_topo_send(mrp, time * mrp->ring_topo_conf_max);
 
 	if (!time) {
-		ifdriver_flush(mrp);
+		IFDRIVER_TIMED(MRP_IFDRIVER_FLUSH, ifdriver_flush(mrp));
 	} else {
 		uint32_t delay = mrp->ring_topo_conf_interval;
 
@@ -659,7 +761,8 @@ void mrp_ring_link_req(struct mrp_port *p, bool up, uint32_t interval)
 	mrp_send_ring_link(p, up, interval);
 }
 
-static void mrp_send_test_mgr_nack(struct mrp_port *p, uint8_t sa[ETH_ALEN])
+static void mrp_send_test_mgr_nack(struct mrp_port *p,
+				   const uint8_t sa[ETH_ALEN])
 {
 	struct br_mrp_test_mgr_nack_hdr *nack_hdr = NULL;
 	struct br_mrp_sub_opt_hdr *sub_opt_hdr = NULL;
@@ -712,7 +815,8 @@ out:
 	free(fb);
 }
 
-static void mrp_test_mgr_nack_req(struct mrp *mrp, uint8_t sa[ETH_ALEN])
+static void mrp_test_mgr_nack_req(struct mrp *mrp,
+				  const uint8_t sa[ETH_ALEN])
 {
 	mrp_send_test_mgr_nack(mrp->p_port, sa);
 	mrp_send_test_mgr_nack(mrp->s_port, sa);
@@ -842,7 +946,8 @@ void mrp_in_test_req(struct mrp *mrp, uint32_t interval)
  * The MRP_IntTopologyChange frame has the following format:
  * MRP_Version, MRP_TLVHeader, MRP_SA, MRP_IntId, MRP_Interval
  */
-static void mrp_send_in_topo(struct mrp_port *p, uint32_t interval)
+static void mrp_send_in_topo(struct mrp_port *p, uint32_t interval,
+			     uint16_t seq)
 {
 	struct br_mrp_in_topo_hdr *hdr = NULL;
 	struct frame_buf *fb = NULL;
@@ -860,7 +965,7 @@ static void mrp_send_in_topo(struct mrp_port *p, uint32_t interval)
 	hdr->id = __cpu_to_be16(mrp->in_id);
 	hdr->interval = interval == 0 ? 0 : __cpu_to_be16(interval / 1000);
 
-	mrp_fb_common(fb, p);
+	mrp_fb_common_seq(fb, p, seq);
 	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_END, 0x0);
 
 	h = mrp_eth_alloc(p->macaddr, mrp_icontrol_dmac);
@@ -877,9 +982,11 @@ out:
 
 void mrp_in_topo_send(struct mrp *mrp, uint32_t interval)
 {
-	mrp_send_in_topo(mrp->p_port, interval);
-	mrp_send_in_topo(mrp->s_port, interval);
-	mrp_send_in_topo(mrp->i_port, interval);
+	uint16_t seq = mrp_next_seq(mrp);
+
+	mrp_send_in_topo(mrp->p_port, interval, seq);
+	mrp_send_in_topo(mrp->s_port, interval, seq);
+	mrp_send_in_topo(mrp->i_port, interval, seq);
 }
 
 /* Send MRP_IntTopologyChange frames on all MRP ports and start a timer to send
@@ -891,10 +998,12 @@ void mrp_in_topo_req(struct mrp *mrp, uint32_t time)
 {
 	pr_debug("time: %d", time);
 
+	mrp_event_post(mrp, NULL, MRP_EVENT_IN_TOPO_CHANGE, time);
+
 	mrp_in_topo_send(mrp, time * mrp->in_topo_conf_max);
 
 	if (!time) {
-		ifdriver_flush(mrp);
+		IFDRIVER_TIMED(MRP_IFDRIVER_FLUSH, ifdriver_flush(mrp));
 	} else {
 		uint32_t delay = mrp->in_topo_conf_interval;
 
@@ -906,7 +1015,8 @@ void mrp_in_topo_req(struct mrp *mrp, uint32_t time)
  * The MRP_LinkChange frame has the following format:
  * MRP_Version, MRP_TLVHeader, MRP_SA, MRP_IntId,  MRP_PortRole, MRP_Interval
  */
-static void mrp_send_in_link(struct mrp_port *p, bool up, uint32_t interval)
+static void mrp_send_in_link(struct mrp_port *p, bool up, uint32_t interval,
+			     uint16_t seq)
 {
 	struct br_mrp_in_link_hdr *hdr = NULL;
 	struct frame_buf *fb = NULL;
@@ -927,7 +1037,7 @@ static void mrp_send_in_link(struct mrp_port *p, bool up, uint32_t interval)
 	hdr->id = __cpu_to_be16(mrp->in_id);
 	hdr->interval = interval == 0 ? 0 : __cpu_to_be16(interval / 1000);
 
-	mrp_fb_common(fb, p);
+	mrp_fb_common_seq(fb, p, seq);
 	mrp_fb_tlv(fb, BR_MRP_TLV_HEADER_END, 0x0);
 
 	h = mrp_eth_alloc(p->macaddr, mrp_icontrol_dmac);
@@ -945,11 +1055,13 @@ out:
 /* Send MRP_IntLinkChange frames on all MRP ports */
 void mrp_in_link_req(struct mrp *mrp, bool up, uint32_t  interval)
 {
+	uint16_t seq = mrp_next_seq(mrp);
+
 	pr_debug("up:%d, interval: %d", up, interval);
 
-	mrp_send_in_link(mrp->p_port, up, interval);
-	mrp_send_in_link(mrp->s_port, up, interval);
-	mrp_send_in_link(mrp->i_port, up, interval);
+	mrp_send_in_link(mrp->p_port, up, interval, seq);
+	mrp_send_in_link(mrp->s_port, up, interval, seq);
+	mrp_send_in_link(mrp->i_port, up, interval, seq);
 }
 
 /* Compose MRP_LinkStatusPoll frame and send the frame to the port p.
@@ -1001,106 +1113,58 @@ void mrp_in_link_status_req(struct mrp *mrp, uint32_t interval)
 		mrp_in_link_status_start(mrp, delay);
 }
 
-/* Represents the state machine for when a MRP_Test frame was received on one
- * of the MRP ports and the MRP instance has the role MRM.
- */
-static void mrp_mrm_recv_ring_test(struct mrp *mrp)
-{
-	uint32_t topo_interval = mrp->ring_topo_conf_interval;
-
-	switch (mrp->mrm_state) {
-	case MRP_MRM_STATE_AC_STAT1:
-		/* Ignore */
-		break;
-	case MRP_MRM_STATE_PRM_UP:
-		mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-		mrp->ring_test_curr = 0;
-		mrp->no_tc = false;
-
-		mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-
-		mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RC);
-		break;
-	case MRP_MRM_STATE_CHK_RO:
-		mrp_port_set_state(mrp->s_port,
-					   BR_MRP_PORT_STATE_BLOCKED);
-
-		mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-		mrp->ring_test_curr = 0;
-		mrp->no_tc = false;
-
-		mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-
-		topo_interval = mrp->react_on_link_change ? 0 : topo_interval;
-		mrp_ring_topo_req(mrp, topo_interval);
-
-		mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RC);
-		break;
-	case MRP_MRM_STATE_CHK_RC:
-		mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-		mrp->ring_test_curr = 0;
-		mrp->no_tc = false;
-
-		break;
-	}
-}
-
-static bool mrp_better_than_own(struct mrp *mrp,
-				struct br_mrp_ring_test_hdr *hdr)
+static bool mrp_better_than_own(struct mrp *mrp, const struct mrp_frame *f)
 {
-	uint16_t prio = __be16_to_cpu(hdr->prio);
-
-	if (prio < mrp->prio ||
-	    (prio == mrp->prio &&
-	    ether_addr_to_u64(hdr->sa) < ether_addr_to_u64(mrp->macaddr)))
+	if (f->prio < mrp->prio ||
+	    (f->prio == mrp->prio &&
+	    ether_addr_to_u64(f->sa) < ether_addr_to_u64(mrp->macaddr)))
 		return true;
 
 	return false;
 }
 
-static void mrp_mra_recv_ring_test(struct mrp *mrp,
-				   struct br_mrp_ring_test_hdr *hdr)
+static void mrp_mra_recv_ring_test(struct mrp *mrp, const struct mrp_frame *f)
 {
 	if (mrp->ring_role == BR_MRP_RING_ROLE_MRM) {
-		if (!mrp_better_than_own(mrp, hdr))
-			mrp_test_mgr_nack_req(mrp, hdr->sa);
+		if (!mrp_better_than_own(mrp, f))
+			mrp_test_mgr_nack_req(mrp, f->sa);
 
 		return;
 	}
 
 	if (mrp->ring_role == BR_MRP_RING_ROLE_MRC) {
-		if (ether_addr_equal(hdr->sa, mrp->ring_mac))
+		if (ether_addr_equal(f->sa, mrp->ring_mac))
 			return;
 
-		if (mrp_better_than_own(mrp, hdr))
+		if (mrp_better_than_own(mrp, f))
 			mrp->ring_mon_curr = 0;
 
-		mrp->ring_prio = hdr->prio;
+		mrp->ring_prio = f->prio;
 	}
 }
 
-static void mrp_recv_ring_test(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_ring_test(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_ring_test_hdr *hdr;
 	struct mrp *mrp = p->mrp;
 
-	/* remove MRP version, tlv and get test header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_ring_test_hdr*)buf;
-
 	/* If the MRP_Test frames was not send by this instance process it
 	 * if MRA support is enabled. Otherwise it's an error!
 	 */
-	if (!ether_addr_equal(hdr->sa, mrp->macaddr)) {
+	if (!ether_addr_equal(f->sa, mrp->macaddr)) {
 		if (!mrp->mra_support) {
 			pr_warn_ratelimit("Received unexpected MRP Test frame");
 			return;
 		}
 
-		mrp_mra_recv_ring_test(mrp, hdr);
+		mrp_mra_recv_ring_test(mrp, f);
 		return;
 	}
 
+	if (f->has_common && (f->port_role == BR_MRP_PORT_ROLE_PRIMARY ||
+			      f->port_role == BR_MRP_PORT_ROLE_SECONDARY))
+		mrp_rtt_recv(&mrp->ring_rtt[f->port_role], f->seq_id,
+			     mrp_time_us() * 1000);
+
 	mrp_mrm_recv_ring_test(mrp);
 }
 
@@ -1108,94 +1172,46 @@ static void mrp_recv_ring_test(struct mrp_port *p, unsigned char *buf)
  * received on one of the MRP ports and the MRP instance has the role MRM and
  * has MRA support;
  */
-static void mrp_mra_recv_ring_topo(struct mrp_port *p, unsigned char *buf)
+static void mrp_mra_recv_ring_topo(struct mrp_port *p,
+				   const struct mrp_frame *f)
 {
-	struct br_mrp_ring_topo_hdr *hdr;
 	struct mrp *mrp = p->mrp;
 
-	pr_debug_v("mrm state: %s", mrp_get_mrm_state(mrp->mrm_state));
+	trace("mrm state: %s", mrp_get_mrm_state(mrp->mrm_state));
 
-	/* remove MRP version, tlv and get ring topo header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_ring_topo_hdr *)buf;
-
-	if (ether_addr_equal(hdr->sa, mrp->macaddr))
+	if (ether_addr_equal(f->sa, mrp->macaddr))
 		return;
 
-
-	mrp_clear_fdb_start(mrp, ntohs(hdr->interval) * 1000);
+	mrp_clear_fdb_start(mrp, f->interval * 1000);
 }
 
-/* Represents the state machine for when a MRP_TopologyChange frame was
- * received on one of the MRP ports and the MRP instance has the role MRC
- */
-static void mrp_mrc_recv_ring_topo(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_ring_topo(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_ring_topo_hdr *hdr;
 	struct mrp *mrp = p->mrp;
 
-	pr_debug_v("port: %s, mrc state: %s", p->ifname,
-	        mrp_get_mrc_state(mrp->mrc_state));
-
-	/* remove MRP version, tlv and get ring topo header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_ring_topo_hdr *)buf;
-
-	switch (mrp->mrc_state) {
-	case MRP_MRC_STATE_AC_STAT1:
-		/* Ignore */
-		break;
-	case MRP_MRC_STATE_DE_IDLE:
-		mrp_clear_fdb_start(mrp, ntohs(hdr->interval) * 1000);
-		break;
-	case MRP_MRC_STATE_PT:
-		mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-		mrp_ring_link_up_stop(mrp);
-		mrp_port_set_state(mrp->s_port,
-					   BR_MRP_PORT_STATE_FORWARDING);
-		mrp_clear_fdb_start(mrp, ntohs(hdr->interval) * 1000);
-		mrp_set_mrc_state(mrp, MRP_MRC_STATE_PT_IDLE);
-		break;
-	case MRP_MRC_STATE_DE:
-		mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-		mrp_ring_link_down_stop(mrp);
-		mrp_clear_fdb_start(mrp, ntohs(hdr->interval) * 1000);
-		mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE_IDLE);
-		break;
-	case MRP_MRC_STATE_PT_IDLE:
-		mrp_clear_fdb_start(mrp, ntohs(hdr->interval) * 1000);
-		break;
-	}
-}
-
-static void mrp_recv_ring_topo(struct mrp_port *p, unsigned char *buf)
-{
-	struct mrp *mrp = p->mrp;
+	mrp_event_post(mrp, p, MRP_EVENT_TOPO_CHANGE, f->interval * 1000);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_RX_TOPO, p->ifindex,
+			  f->interval);
 
 	if (mrp->mra_support && mrp->ring_role == BR_MRP_RING_ROLE_MRM)
-		return mrp_mra_recv_ring_topo(p, buf);
+		return mrp_mra_recv_ring_topo(p, f);
 
-	return mrp_mrc_recv_ring_topo(p, buf);
+	return mrp_mrc_recv_ring_topo(p, f);
 }
 
 /* Represents the state machine for when a MRP_LinkChange frame was
  * received on one of the MRP ports and the MRP instance has the role MRM. When
  * MRP instance has the role MRC it doesn't need to process the frame.
  */
-static void mrp_recv_ring_link(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_ring_link(struct mrp_port *p, const struct mrp_frame *f)
 {
-	enum br_mrp_tlv_header_type type;
+	enum br_mrp_tlv_header_type type = f->type;
 	struct mrp *mrp = p->mrp;
-	struct br_mrp_tlv_hdr *tlv;
-
-	pr_debug_v("port: %s, mrm state: %s",
-	        p->ifname, mrp_get_mrm_state(mrp->mrm_state));
 
-	/* remove MRP version to get the tlv */
-	buf += sizeof(uint16_t);
-	tlv = (struct br_mrp_tlv_hdr *)buf;
+	trace("port: %u, mrm state: %s",
+	      p->ifindex, mrp_get_mrm_state(mrp->mrm_state));
 
-	type = tlv->type;
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_RX_LINK, p->ifindex, type);
 
 	switch (mrp->mrm_state) {
 	case MRP_MRM_STATE_AC_STAT1:
@@ -1276,7 +1292,7 @@ static void mrp_recv_ring_link(struct mrp_port *p, unsigned char *buf)
 		    mrp->react_on_link_change) {
 			mrp_port_set_state(mrp->s_port,
 						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp->ring_transitions++;
+			mrp_ring_transition(mrp);
 			mrp_ring_topo_req(mrp, 0);
 			mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RO);
 			break;
@@ -1297,39 +1313,32 @@ static void mrp_recv_ring_link(struct mrp_port *p, unsigned char *buf)
 	}
 }
 
-static bool mrp_better_than_host(struct mrp *mrp,
-				 struct br_mrp_test_mgr_nack_hdr *hdr)
+static bool mrp_better_than_host(struct mrp *mrp, const struct mrp_frame *f)
 {
-	uint16_t prio = __be16_to_cpu(hdr->prio);
-
-	if (prio < mrp->ring_prio ||
-	    (prio == mrp->ring_prio &&
-	    ether_addr_to_u64(hdr->sa) < ether_addr_to_u64(mrp->ring_mac)))
+	if (f->prio < mrp->ring_prio ||
+	    (f->prio == mrp->ring_prio &&
+	    ether_addr_to_u64(f->sa) < ether_addr_to_u64(mrp->ring_mac)))
 		return true;
 
 	return false;
 }
 
-static void mrp_recv_nack(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_nack(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_test_mgr_nack_hdr *hdr;
 	struct mrp *mrp = p->mrp;
 
-	buf += sizeof(struct br_mrp_sub_tlv_hdr);
-	hdr = (struct br_mrp_test_mgr_nack_hdr *)buf;
-
 	if (mrp->ring_role == BR_MRP_RING_ROLE_MRC)
 		return;
 
-	if (ether_addr_equal(hdr->sa, mrp->macaddr))
+	if (ether_addr_equal(f->sa, mrp->macaddr))
 		return;
 
-	if (!ether_addr_equal(hdr->other_sa, mrp->macaddr))
+	if (!ether_addr_equal(f->other_sa, mrp->macaddr))
 		return;
 
-	if (mrp_better_than_host(mrp, hdr)) {
-		mrp->ring_prio = __be16_to_cpu(hdr->prio);
-		memcpy(mrp->ring_mac, hdr->sa, ETH_ALEN);
+	if (mrp_better_than_host(mrp, f)) {
+		mrp->ring_prio = f->prio;
+		memcpy(mrp->ring_mac, f->sa, ETH_ALEN);
 	}
 
 	if (mrp->mrm_state == MRP_MRM_STATE_CHK_RC)
@@ -1358,57 +1367,44 @@ static void mrp_recv_nack(struct mrp_port *p, unsigned char *buf)
 	}
 }
 
-static void mrp_recv_propagate(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_propagate(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_test_prop_hdr *hdr;
-	struct mrp *mrp;
-
-	buf += sizeof(struct br_mrp_sub_tlv_hdr);
-	mrp = p->mrp;
-
-	hdr = (struct br_mrp_test_prop_hdr *)buf;
+	struct mrp *mrp = p->mrp;
 
 	if (mrp->ring_role == BR_MRP_RING_ROLE_MRM)
 		return;
 
-	if (!ether_addr_equal(hdr->sa, mrp->macaddr))
+	if (!ether_addr_equal(f->sa, mrp->macaddr))
 		return;
 
-	if (hdr->other_prio != hdr->prio)
+	if (f->other_prio != f->prio)
 		return;
 
-	mrp->ring_prio = __be16_to_cpu(hdr->other_prio);
-	memcpy(mrp->ring_mac, hdr->other_sa, ETH_ALEN);
+	mrp->ring_prio = f->other_prio;
+	memcpy(mrp->ring_mac, f->other_sa, ETH_ALEN);
 	mrp->ring_mon_curr = 0;
 }
 
 /* Represents the state machine for when a MRP_Option frame was
  * received on one of the MRP ports.
  */
-static void mrp_recv_option(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_option(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_sub_tlv_hdr *sub_tlv;
 	struct mrp *mrp = p->mrp;
 
-	pr_debug_v("port %s, mrm state: %s", p->ifname,
-	        mrp_get_mrm_state(mrp->mrm_state));
-
-	/* remove MRP version to get the tlv */
-	buf += sizeof(uint16_t);
-	/* remove also the tlv_hdr, mrp_oui, and sub_opt */
-	buf += sizeof(struct br_mrp_tlv_hdr) +
-	       sizeof(struct br_mrp_oui_hdr) +
-	       sizeof(struct br_mrp_sub_opt_hdr);
+	trace("port %u, mrm state: %s", p->ifindex,
+	      mrp_get_mrm_state(mrp->mrm_state));
 
-	sub_tlv = (struct br_mrp_sub_tlv_hdr *)buf;
-	if (sub_tlv->type == BR_MRP_SUB_TLV_HEADER_TEST_MGR_NACK)
-		return mrp_recv_nack(p, buf);
-	if (sub_tlv->type == BR_MRP_SUB_TLV_HEADER_TEST_PROPAGATE)
-		return mrp_recv_propagate(p, buf);
+	if (f->sub_type == BR_MRP_SUB_TLV_HEADER_TEST_MGR_NACK)
+		return mrp_recv_nack(p, f);
+	if (f->sub_type == BR_MRP_SUB_TLV_HEADER_TEST_PROPAGATE)
+		return mrp_recv_propagate(p, f);
 }
 
 static void mrp_mim_recv_in_test(struct mrp *mrp)
 {
+	mrp->in_test_rx_ts = mrp_time_us() * 1000;
+
 	switch (mrp->mim_state) {
 	case MRP_MIM_STATE_AC_STAT1:
 		mrp_port_set_state(mrp->i_port,
@@ -1443,16 +1439,11 @@ static void mrp_mim_recv_in_test(struct mrp *mrp)
 	}
 }
 
-static void mrp_recv_in_test(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_in_test(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_in_test_hdr *hdr;
 	struct mrp *mrp = p->mrp;
 
-	/* remove MRP version, tlv and get int test header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_in_test_hdr*)buf;
-
-	if (mrp->in_id != ntohs(hdr->id))
+	if (mrp->in_id != f->in_id)
 		return;
 
 	mrp_mim_recv_in_test(mrp);
@@ -1461,37 +1452,36 @@ static void mrp_recv_in_test(struct mrp_port *p, unsigned char *buf)
 /* Represents the state machine for when a MRP_IntTopologyChange frame was
  * received on one of the MRP ports.
  */
-static void mrp_recv_in_topo(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_in_topo(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct br_mrp_in_topo_hdr *hdr;
 	struct mrp *mrp = p->mrp;
 
-	/* remove MRP version, tlv and get int topo change header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_in_topo_hdr *)buf;
+	mrp_event_post(mrp, p, MRP_EVENT_IN_TOPO_CHANGE, f->interval * 1000);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_RX_IN_TOPO, p->ifindex,
+			  f->interval);
 
 	if (mrp->ring_role == BR_MRP_RING_ROLE_MRM) {
-		pr_debug_v("mrm state: %s", mrp_get_mrm_state(mrp->mrm_state));
+		trace("mrm state: %s", mrp_get_mrm_state(mrp->mrm_state));
 		if (mrp->ring_topo_running == false)
-			mrp_ring_topo_req(mrp, ntohs(hdr->interval) * 1000);
+			mrp_ring_topo_req(mrp, f->interval * 1000);
 	}
 
 	if (mrp->in_role == BR_MRP_IN_ROLE_MIM) {
-		pr_debug_v("mim state: %s", mrp_get_mim_state(mrp->mim_state));
+		trace("mim state: %s", mrp_get_mim_state(mrp->mim_state));
 
 		/* If MRP_SA == MRP_TS_SA ignore */
-		if (ether_addr_equal(hdr->sa, mrp->macaddr))
+		if (ether_addr_equal(f->sa, mrp->macaddr))
 			return;
 
-		mrp_clear_fdb_start(mrp, ntohs(hdr->interval) * 1000);
+		mrp_clear_fdb_start(mrp, f->interval * 1000);
 	}
 
 	if (mrp->in_role == BR_MRP_IN_ROLE_MIC) {
-		pr_debug_v("mic state: %s", mrp_get_mic_state(mrp->mic_state));
+		trace("mic state: %s", mrp_get_mic_state(mrp->mic_state));
 
 		switch (mrp->mic_state) {
 		case MRP_MIC_STATE_AC_STAT1:
-			if (ntohs(hdr->id) == mrp->in_id)
+			if (f->in_id == mrp->in_id)
 				mrp_in_link_down_stop(mrp);
 			break;
 		case MRP_MIC_STATE_PT:
@@ -1511,40 +1501,32 @@ static void mrp_recv_in_topo(struct mrp_port *p, unsigned char *buf)
 /* Represents the state machine for when a MRP_IntLinkChange frame was
  * received on one of the MRP ports.
  */
-static void mrp_recv_in_link(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_in_link(struct mrp_port *p, const struct mrp_frame *f)
 {
-	enum br_mrp_tlv_header_type type;
-	struct br_mrp_in_link_hdr *hdr;
-	struct br_mrp_tlv_hdr *tlv;
+	enum br_mrp_tlv_header_type type = f->type;
 	struct mrp *mrp = p->mrp;
 
-	pr_debug_v("mim state: %s", mrp_get_mim_state(mrp->mim_state));
-
-	/* remove MRP version to get the tlv */
-	buf += sizeof(int16_t);
-	tlv = (struct br_mrp_tlv_hdr *)buf;
-
-	type = tlv->type;
+	trace("mim state: %s", mrp_get_mim_state(mrp->mim_state));
 
-	buf += sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_in_link_hdr *)buf;
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_RX_IN_LINK, p->ifindex,
+			  type);
 
 	switch (mrp->mim_state) {
 	case MRP_MIM_STATE_AC_STAT1:
 		/* Ignore */
 		break;
 	case MRP_MIM_STATE_CHK_IO:
-		if (ntohs(hdr->id) == mrp->in_id &&
+		if (f->in_id == mrp->in_id &&
 		    type == BR_MRP_TLV_HEADER_IN_LINK_UP)
 			mrp_in_test_req(mrp, mrp->in_test_conf_interval);
 		break;
 	case MRP_MIM_STATE_CHK_IC:
-		if (ntohs(hdr->id) == mrp->in_id &&
+		if (f->in_id == mrp->in_id &&
 		    type == BR_MRP_TLV_HEADER_IN_LINK_UP) {
 			mrp->in_test_curr_max = mrp->in_test_conf_max;
 			mrp_in_topo_req(mrp, mrp->in_topo_conf_interval);
 		}
-		if (ntohs(hdr->id) == mrp->in_id &&
+		if (f->in_id == mrp->in_id &&
 		    type == BR_MRP_TLV_HEADER_IN_LINK_DOWN) {
 			mrp_port_set_state(mrp->i_port,
 						   BR_MRP_PORT_STATE_FORWARDING);
@@ -1558,9 +1540,9 @@ static void mrp_recv_in_link(struct mrp_port *p, unsigned char *buf)
 /* Represents the state machine for when a MRP_IntLinkStatus frame was
  * received on one of the MRP ports.
  */
-static void mrp_recv_in_link_status(struct mrp_port *p, unsigned char *buf)
+static void mrp_recv_in_link_status(struct mrp_port *p,
+				    const struct mrp_frame *f)
 {
-	struct br_mrp_in_link_status_hdr *hdr;
 	struct mrp *mrp = p->mrp;
 
 	if (mrp->in_role != BR_MRP_IN_ROLE_MIC)
@@ -1569,13 +1551,9 @@ static void mrp_recv_in_link_status(struct mrp_port *p, unsigned char *buf)
 	if (mrp->in_mode != MRP_IN_MODE_LC)
 		return;
 
-	pr_debug_v("mic state: %s", mrp_get_mic_state(mrp->mic_state));
+	trace("mic state: %s", mrp_get_mic_state(mrp->mic_state));
 
-	/* remove MRP version, tlv and get in link status header */
-	buf += sizeof(int16_t) + sizeof(struct br_mrp_tlv_hdr);
-	hdr = (struct br_mrp_in_link_status_hdr *)buf;
-
-	if (ntohs(hdr->id) != mrp->in_id)
+	if (f->in_id != mrp->in_id)
 		return;
 
 	switch (mrp->mic_state) {
@@ -1591,374 +1569,224 @@ static void mrp_recv_in_link_status(struct mrp_port *p, unsigned char *buf)
 	}
 }
 
-/* Check if the MRP frame needs to be dropped */
-static bool mrp_should_drop(const struct mrp_port *p,
-			    enum br_mrp_tlv_header_type type)
+/* Returns true if the same (SA, type, seq_id) was processed recently,
+ * otherwise remembers it. Only the frames which restart timers or flush the
+ * FDB are tracked, the test frames are always processed. The copies sent on
+ * the ports of the source share the seq_id, so the one coming from the other
+ * side of the ring is caught; each repetition has its own one.
+ */
+static bool mrp_dedup_seen(struct mrp *mrp, const struct mrp_frame *f)
 {
-	/* All frames should be dropped if the state of the port is disabled */
-	if (p->state == BR_MRP_PORT_STATE_DISABLED)
-		return true;
+	struct mrp_dedup *e;
+	uint64_t now;
+	int i;
 
-	/* If receiving a MRP frame on a port which is not in MRP ring
-	 * then the frame should be drop
-	 */
-	if (!mrp_is_mrp_port(p))
-		return true;
+	switch (f->type) {
+	case BR_MRP_TLV_HEADER_RING_TOPO:
+	case BR_MRP_TLV_HEADER_RING_LINK_DOWN:
+	case BR_MRP_TLV_HEADER_RING_LINK_UP:
+	case BR_MRP_TLV_HEADER_IN_TOPO:
+	case BR_MRP_TLV_HEADER_IN_LINK_DOWN:
+	case BR_MRP_TLV_HEADER_IN_LINK_UP:
+		break;
+	default:
+		return false;
+	}
 
-	/* In case the port is in blocked state then the kernel
-	 * will drop all NON-MRP frames and it would send all
-	 * MRP frames to the upper layer. So here is needed to drop MRP frames
-	 * if the port is in blocked state.
-	 */
-	if (mrp_is_ring_port(p) && p->state == BR_MRP_PORT_STATE_BLOCKED &&
-	    type != BR_MRP_TLV_HEADER_RING_TOPO &&
-	    type != BR_MRP_TLV_HEADER_RING_TEST &&
-	    type != BR_MRP_TLV_HEADER_RING_LINK_UP &&
-	    type != BR_MRP_TLV_HEADER_RING_LINK_DOWN &&
-	    type != BR_MRP_TLV_HEADER_IN_TOPO &&
-	    type != BR_MRP_TLV_HEADER_IN_LINK_UP &&
-	    type != BR_MRP_TLV_HEADER_IN_LINK_DOWN &&
-	    type != BR_MRP_TLV_HEADER_OPTION)
-		return true;
+	if (!f->has_common)
+		return false;
 
-	if (mrp_is_in_port(p) && p->state == BR_MRP_PORT_STATE_BLOCKED &&
-	    type != BR_MRP_TLV_HEADER_IN_TEST &&
-	    type != BR_MRP_TLV_HEADER_IN_LINK_UP &&
-	    type != BR_MRP_TLV_HEADER_IN_LINK_DOWN &&
-	    type != BR_MRP_TLV_HEADER_IN_TOPO)
-		return true;
+	now = mrp_time_us();
+	for (i = 0; i < MRP_DEDUP_LEN; i++) {
+		e = &mrp->dedup[i];
+		if (e->ts && now - e->ts < MRP_DEDUP_AGE_US &&
+		    e->type == f->type && e->seq_id == f->seq_id &&
+		    ether_addr_equal(e->sa, f->sa))
+			return true;
+	}
+
+	e = &mrp->dedup[mrp->dedup_head++ % MRP_DEDUP_LEN];
+	e->ts = now;
+	ether_addr_copy(e->sa, f->sa);
+	e->type = f->type;
+	e->seq_id = f->seq_id;
 
 	return false;
 }
 
-/* Check if the MRP frame needs to be process. It depends of the MRP instance
- * role and the frame type if the frame needs to be processed or not.
- */
-static bool mrp_should_process(const struct mrp_port *p,
-			       enum br_mrp_tlv_header_type type)
+static void mrp_check_and_forward(struct mrp *mrp, struct frame_buf *fb,
+				  uint8_t fwd)
 {
-	struct mrp *mrp = p->mrp;
+	if (fwd & MRP_FWD_P)
+		mrp_forward(mrp->p_port, fb);
+	if (fwd & MRP_FWD_S)
+		mrp_forward(mrp->s_port, fb);
+	if (fwd & MRP_FWD_I)
+		mrp_forward(mrp->i_port, fb);
+}
 
-	switch (type) {
+static void mrp_process(struct mrp_port *p, const struct mrp_frame *f)
+{
+	switch (f->type) {
 	case BR_MRP_TLV_HEADER_RING_TEST:
-		if (mrp->ring_role == BR_MRP_RING_ROLE_MRM ||
-		    (mrp->ring_role == BR_MRP_RING_ROLE_MRC && mrp->mra_support))
-			return true;
+		mrp_recv_ring_test(p, f);
+		break;
+	case BR_MRP_TLV_HEADER_RING_TOPO:
+		mrp_recv_ring_topo(p, f);
 		break;
 	case BR_MRP_TLV_HEADER_RING_LINK_DOWN:
 	case BR_MRP_TLV_HEADER_RING_LINK_UP:
-		if (mrp->ring_role == BR_MRP_RING_ROLE_MRM)
-			return true;
-		break;
-	case BR_MRP_TLV_HEADER_RING_TOPO:
-		if (mrp->ring_role == BR_MRP_RING_ROLE_MRC ||
-		    (mrp->ring_role == BR_MRP_RING_ROLE_MRM && mrp->mra_support))
-			return true;
+		mrp_recv_ring_link(p, f);
 		break;
 	case BR_MRP_TLV_HEADER_OPTION:
-		if (mrp->mra_support)
-			return true;
+		mrp_recv_option(p, f);
+		break;
 	case BR_MRP_TLV_HEADER_IN_TEST:
-		if (mrp->in_role == BR_MRP_IN_ROLE_MIM)
-			return true;
+		mrp_recv_in_test(p, f);
 		break;
 	case BR_MRP_TLV_HEADER_IN_TOPO:
-		if (mrp->in_role == BR_MRP_IN_ROLE_MIC ||
-		    mrp->in_role == BR_MRP_IN_ROLE_MIM ||
-		    mrp->ring_role == BR_MRP_RING_ROLE_MRM)
-			return true;
+		mrp_recv_in_topo(p, f);
 		break;
-	case BR_MRP_TLV_HEADER_IN_LINK_UP:
 	case BR_MRP_TLV_HEADER_IN_LINK_DOWN:
-		if (mrp->in_role == BR_MRP_IN_ROLE_MIM)
-			return true;
+	case BR_MRP_TLV_HEADER_IN_LINK_UP:
+		mrp_recv_in_link(p, f);
 		break;
-	default:
+	case BR_MRP_TLV_HEADER_IN_LINK_STATUS:
+		mrp_recv_in_link_status(p, f);
 		break;
+	default:
+		pr_err("Unknown type: %d", f->type);
 	}
-
-	return false;
-}
-
-static bool mrp_is_ring_frame(enum br_mrp_tlv_header_type type)
-{
-        if (type == BR_MRP_TLV_HEADER_RING_TEST ||
-            type == BR_MRP_TLV_HEADER_RING_TOPO ||
-            type == BR_MRP_TLV_HEADER_RING_LINK_DOWN ||
-            type == BR_MRP_TLV_HEADER_RING_LINK_UP ||
-            type == BR_MRP_TLV_HEADER_OPTION)
-                return true;
-
-        return false;
-}
-
-static bool mrp_is_in_frame(enum br_mrp_tlv_header_type type)
-{
-        if (type == BR_MRP_TLV_HEADER_IN_TEST ||
-            type == BR_MRP_TLV_HEADER_IN_TOPO ||
-            type == BR_MRP_TLV_HEADER_IN_LINK_DOWN ||
-            type == BR_MRP_TLV_HEADER_IN_LINK_UP ||
-            type == BR_MRP_TLV_HEADER_IN_LINK_STATUS)
-                return true;
-
-        return false;
 }
 
-/* Check if the MRP frame needs to be forwarded and, if so, forward the frame.
- *
- * It depends of the MRP instance role and the frame type if the frame needs to
- * be forwarded or not.
+/* All received MRP frames are added to a list of skbs and this function
+ * pops the frame and process them. It decides if the MRP instance needs to
+ * process it, forward it or dropp it
  */
-static void mrp_check_and_forward(const struct mrp_port *p,
-				  struct frame_buf *fb,
-				  enum br_mrp_tlv_header_type type)
+static void mrp_process_frame(struct mrp_port *port, struct frame_buf *fb,
+			      const struct mrp_frame *f)
 {
-	struct mrp *mrp = p->mrp;
-	struct mrp_port *forward_p_port = NULL;
-	struct mrp_port *forward_s_port = NULL;
-	struct mrp_port *forward_i_port = NULL;
-
-	/* Set the possible forwarding ways according to the receiving port */
-	if (p == mrp->p_port) {
-		forward_s_port = mrp->s_port;
-		forward_i_port = mrp->i_port;
-	} else if (p == mrp->s_port) {
-		forward_p_port = mrp->p_port;
-		forward_i_port = mrp->i_port;
-	} else if (p == mrp->i_port) {
-		forward_p_port = mrp->p_port;
-		forward_s_port = mrp->s_port;
-	}
-
-        if (mrp_is_ring_frame(type)) {
-		/* We should not forward ring frames received from the
-		 * interconnection port.
-		 */
-		if (p == mrp->i_port)
-			return;
-
-		/* If the frame is a ring frame then it should not be forwarded
-		 * to the interconnection port.
-		 */
-		forward_i_port = NULL;
-
-		switch (mrp->ring_role) {
-		case BR_MRP_RING_ROLE_MRM:
-			/* If the role is MRM then don't forward the frames */
-			return;
-
-		case BR_MRP_RING_ROLE_MRC:
-			/* If the role is MRC and MRA support is not enabled
-			 * then don't forward Header Option frames.
-			 */
-			if (type == BR_MRP_TLV_HEADER_OPTION &&
-			    !mrp->mra_support)
-				return;
-			goto forward;
+	const struct mrp_decision *d;
+	struct mrp *mrp = port->mrp;
 
-		default:
-			break;
-		}
+	d = mrp_decide(port, f);
+	if (d->flags & MRP_DECIDE_DROP) {
+		port->cnt.rx_dropped++;
+		return;
 	}
 
-        if (mrp_is_in_frame(type)) {
-		struct br_mrp_in_test_hdr *hdr = mrp_get_in_test_hdr(fb->data);
-
-		switch (mrp->ring_role) {
-		case BR_MRP_RING_ROLE_MRM:
-			/* Nodes that behaves as MRM needs to stop forwarding
-			 * the frames in case the ring is closed, otherwise will			 * be a loop.
-			 * In this case the frame is no forward between the
-			 * ring ports, but the frame may still have a chance to
-			 * go to through the interconnection port!
-			 */
-			if ((mrp->p_port->state !=
-					BR_MRP_PORT_STATE_FORWARDING ||
-			     mrp->s_port->state !=
-					BR_MRP_PORT_STATE_FORWARDING) &&
-			    mrp_is_ring_port(p)) {
-				forward_p_port = NULL;
-				forward_s_port = NULL;
-			}
-			break;
-
-		case BR_MRP_RING_ROLE_MRC:
-			/* A node that behaves as MRC should not forward
-			 * interconnect frames between its ring ports if
-			 * it has an interconnection roles (MIM or MIC)
-			 * that matches the frame interconnection ID.
-			 */
-			if ((mrp->in_role != BR_MRP_IN_ROLE_DISABLED) &&
-			    (mrp->in_id == ntohs(hdr->id)) &&
-			    mrp_is_ring_port(p)) {
-				forward_p_port = NULL;
-				forward_s_port = NULL;
-			}
-			break;
+	mrp_check_and_forward(mrp, fb, d->fwd);
 
-		default:
-			break;
+	/* The frame is processed from its descriptor, the buffer is left
+	 * untouched for the forwarding
+	 */
+	if (d->flags & MRP_DECIDE_PROCESS) {
+		if (mrp_dedup_seen(mrp, f)) {
+			port->cnt.rx_duplicate++;
+			return;
 		}
 
-		switch (mrp->in_role) {
-		case BR_MRP_IN_ROLE_MIM:
-			if (type == BR_MRP_TLV_HEADER_IN_TEST) {
-                                /* MIM should not forward it's own InTest
-                                 * frames between its ports, but it should
-				 * forward others InTest frames between its
-				 * ring ports if they are not from the
-				 * interconnection port.
-                                 */
-				if (ether_addr_equal(hdr->sa, mrp->macaddr))
-					return;
-				else {
-	                                if (mrp_is_in_port(p))
-	                                        return;
-					else
-	                                        forward_i_port = NULL;
-				}
-			} else {
-                                /* MIM should forward IntLinkChange/Status and
-                                 * IntTopoChange between ring ports, but MIM
-                                 * should not forward IntLinkChange/Status and
-                                 * IntTopoChange if the frame was received at
-                                 * the interconnect port
-                                 */
-                                if (mrp_is_ring_port(p))
-                                        forward_i_port = NULL;
-
-                                if (mrp_is_in_port(p))
-                                        return;
-			}
-			break;
-
-		case BR_MRP_IN_ROLE_MIC:
-                        /* MIC should forward InTest frames on all ports
-                         * regardless of the received port
-                         */
-			if (type == BR_MRP_TLV_HEADER_IN_TEST)
-                                goto forward;
-
-                        /* MIC should forward IntLinkChange frames only if they
-                         * are received on ring ports to all the ports
-                         */
-			if ((type == BR_MRP_TLV_HEADER_IN_LINK_UP ||
-			     type == BR_MRP_TLV_HEADER_IN_LINK_DOWN) &&
-			    mrp_is_ring_port(p))
-				goto forward;
-
-                        /* MIC should forward IntLinkStatus frames only to
-                         * interconnect port if it was received on a ring port.
-                         * If it is received on interconnect port then, it
-                         * should be forward on both ring ports
-                         */
-			if (type == BR_MRP_TLV_HEADER_IN_LINK_STATUS &&
-			    mrp_is_ring_port(p)) {
-				forward_p_port = NULL;
-				forward_s_port = NULL;
-				goto forward;
-			}
+		mrp->cnt.processed++;
+		mrp_process(port, f);
+	}
+}
 
-                        /* Should forward the InTopo frames only between the
-                         * ring ports
-                         */
-			if (type == BR_MRP_TLV_HEADER_IN_TOPO) {
-				forward_i_port = NULL;
-				goto forward;
-			}
+/* Frames received on ports not belonging to any MRP instance */
+static uint64_t rx_no_port;
 
-			/* Otherwise don't forward the frames */
-			return;
+uint64_t mrp_rx_no_port(void)
+{
+	return __atomic_load_n(&rx_no_port, __ATOMIC_RELAXED);
+}
 
-		default:
-			break;
-		}
-	}
+/* Ingress rate and burst by class, per port. The test frames are sent every
+ * millisecond at most by each MRM and MIM, the topology and link changes
+ * are a few repetitions per event.
+ */
+static const struct {
+	uint32_t	rate;		/* frames/s */
+	uint32_t	burst;		/* frames */
+} mrp_rl_conf[MRP_RL_MAX] = {
+	[MRP_RL_TEST]	= { 10000, 1000 },
+	[MRP_RL_CTRL]	= { 1000, 100 },
+	[MRP_RL_OTHER]	= { 1000, 100 },
+};
 
-forward:
-	if (forward_p_port)
-		mrp_forward(forward_p_port, fb);
-	if (forward_s_port)
-		mrp_forward(forward_s_port, fb);
-	if (forward_i_port)
-		mrp_forward(forward_i_port, fb);
-}
+static const char *mrp_rl_names[MRP_RL_MAX] = {
+	"test", "control", "other",
+};
 
-static void mrp_process(struct mrp_port *p, unsigned char *buf,
-			enum br_mrp_tlv_header_type type)
+static int mrp_rl_class(uint8_t type)
 {
 	switch (type) {
 	case BR_MRP_TLV_HEADER_RING_TEST:
-		mrp_recv_ring_test(p, buf);
-		break;
+	case BR_MRP_TLV_HEADER_IN_TEST:
+		return MRP_RL_TEST;
 	case BR_MRP_TLV_HEADER_RING_TOPO:
-		mrp_recv_ring_topo(p, buf);
-		break;
 	case BR_MRP_TLV_HEADER_RING_LINK_DOWN:
 	case BR_MRP_TLV_HEADER_RING_LINK_UP:
-		mrp_recv_ring_link(p, buf);
-		break;
-	case BR_MRP_TLV_HEADER_OPTION:
-		mrp_recv_option(p, buf);
-		break;
-	case BR_MRP_TLV_HEADER_IN_TEST:
-		mrp_recv_in_test(p, buf);
-		break;
 	case BR_MRP_TLV_HEADER_IN_TOPO:
-		mrp_recv_in_topo(p, buf);
-		break;
 	case BR_MRP_TLV_HEADER_IN_LINK_DOWN:
 	case BR_MRP_TLV_HEADER_IN_LINK_UP:
-		mrp_recv_in_link(p, buf);
-		break;
 	case BR_MRP_TLV_HEADER_IN_LINK_STATUS:
-		mrp_recv_in_link_status(p, buf);
-		break;
+		return MRP_RL_CTRL;
 	default:
-		pr_err("Unknown type: %d", type);
+		return MRP_RL_OTHER;
 	}
 }
 
-/* All received MRP frames are added to a list of skbs and this function
- * pops the frame and process them. It decides if the MRP instance needs to
- * process it, forward it or dropp it
+/* Returns true if the frame exceeds the ingress rate of its class on the
+ * port. Our own test frames are never limited, otherwise a flood could
+ * open the ring.
  */
-static void mrp_process_frame(struct mrp_port *port, struct frame_buf *fb,
-			      enum br_mrp_tlv_header_type type)
+static bool mrp_rate_limited(struct mrp_port *p, const struct mrp_frame *f)
 {
-	struct mrp *mrp = port->mrp;
+	int c = mrp_rl_class(f->type);
+	struct mrp_bucket *b = &p->rl[c];
+	uint64_t now, elapsed, max;
 
-	pthread_mutex_lock(&mrp->lock);
-
-	mrp_check_and_forward(port, fb, type);
+	if (c == MRP_RL_TEST && ether_addr_equal(f->sa, p->mrp->macaddr))
+		return false;
 
-	if (mrp_should_process(port, type)) {
-		unsigned char nbuf[2048];
+	now = mrp_time_us();
+	elapsed = now - b->ts;
+	if (!b->ts || elapsed > 1000000)
+		elapsed = 1000000;
+	b->ts = now;
 
-		/* Because there are cases when a frame needs to be
-		 * proccesed and also forward, it is required to clone
-		 * the frame for processing not to alter the original
-		 * one.
-		 */
-		memcpy(nbuf, fb->data, fb->size - sizeof(struct ethhdr));
+	max = (uint64_t)mrp_rl_conf[c].burst * 1000000;
+	b->credit += elapsed * mrp_rl_conf[c].rate;
+	if (b->credit > max)
+		b->credit = max;
 
-		mrp_process(port, nbuf, type);
+	if (b->credit >= 1000000) {
+		b->credit -= 1000000;
+		return false;
 	}
 
-	pthread_mutex_unlock(&mrp->lock);
+	p->cnt.rx_limited[c]++;
+	pr_warn_ratelimit("port: %s, %s frames over %u/s, dropped",
+			  p->ifname, mrp_rl_names[c], mrp_rl_conf[c].rate);
+	return true;
 }
 
-/* Receives all MRP frames and add them in a queue to be processed */
+/* Receives all MRP frames and add them in a queue to be processed. The
+ * ts is the kernel arrival time of the frame, if known.
+ */
 int mrp_recv(unsigned char *buf, int buf_len, struct sockaddr_ll *sl,
-	     socklen_t salen)
+	     socklen_t salen, const struct timespec *ts)
 {
+	uint64_t start = mrp_time_us(), now;
 	struct mrp_port *port;
 	struct frame_buf fb;
-	struct br_mrp_tlv_hdr *hdr;
+	struct mrp_frame f;
+	int idx;
 
 	port = mrp_get_port(sl->sll_ifindex);
-	if (!port)
+	if (!port) {
+		__atomic_fetch_add(&rx_no_port, 1, __ATOMIC_RELAXED);
 		goto out;
+	}
 
 	/* The buf contains also the link layer information. It is not possible
 	 * to get rid completely of this because it is possible to forward the
@@ -1970,414 +1798,51 @@ int mrp_recv(unsigned char *buf, int buf_len, struct sockaddr_ll *sl,
 	fb.size = buf_len;
 	fb.data += sizeof(struct ethhdr);
 
-	hdr = mrp_get_tlv_hdr(fb.data);
+	/* Malformed frames are neither processed nor forwarded */
+	if (buf_len < sizeof(struct ethhdr) ||
+	    mrp_parse_frame(fb.data, buf_len - sizeof(struct ethhdr), &f)) {
+		port->cnt.rx_malformed++;
+		goto out;
+	}
+	idx = mrp_tlv_idx(f.type);
+
+	port->cnt.rx[idx]++;
+	trace("port: %u, type: %u", port->ifindex, f.type);
 
-	if (mrp_should_drop(port, hdr->type))
+	/* Limited frames are neither processed nor forwarded, so that a flood
+	 * does not starve the timers nor propagate along the ring
+	 */
+	if (mrp_rate_limited(port, &f))
 		goto out;
 
-	mrp_process_frame(port, &fb, hdr->type);
+	now = mrp_time_real_ns();
+	mrp_tx_origin = now;
+	if (ts) {
+		mrp_tx_origin = (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+		if (now > mrp_tx_origin)
+			mrp_hist_add(&rx_queue_latency[idx],
+				     (now - mrp_tx_origin) / 1000);
+	}
+
+	mrp_process_frame(port, &fb, &f);
+
+	mrp_tx_origin = 0;
+	mrp_hist_add(&rx_process_latency[idx], mrp_time_us() - start);
 
 out:
 	return 0;
 }
 
-/* Represents the state machine for when MRP instance has the role MRM and the
- * link of one of the MRP ports is changed.
- */
-static void mrp_mrm_port_link(struct mrp_port *p, bool up)
+/* Whenever the port link changes, this function is called */
+void mrp_port_link_change(struct mrp_port *p, bool up)
 {
-	struct mrp *mrp = p->mrp;
-	uint32_t topo_interval = mrp->ring_topo_conf_interval;
+	struct mrp *mrp;
 
-	pr_debug("port: %s, up: %d, mrm_state: %s",
-	        p->ifname, up, mrp_get_mrm_state(mrp->mrm_state));
-
-	switch (mrp->mrm_state) {
-	case MRP_MRM_STATE_AC_STAT1:
-		if (up && p == mrp->p_port) {
-			mrp_port_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
-		}
-		if (up && p != mrp->p_port) {
-			mrp->s_port = mrp->p_port;
-			mrp->p_port = p;
-			mrp_port_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
-		}
-		break;
-	case MRP_MRM_STATE_PRM_UP:
-		if (!up && p == mrp->p_port) {
-			mrp_ring_test_stop(mrp);
-			mrp_port_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_AC_STAT1);
-		}
-		if (up && p != mrp->p_port) {
-			mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-			mrp->ring_test_curr = 0;
-			mrp->no_tc = true;
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RC);
-		}
-		break;
-	case MRP_MRM_STATE_CHK_RO:
-		if (!up && p == mrp->p_port) {
-			mrp->p_port = mrp->s_port;
-			mrp->s_port = p;
-			mrp_port_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-			mrp_ring_topo_req(mrp, topo_interval);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
-			break;
-		}
-		if (!up && p != mrp->p_port) {
-			mrp_port_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
-		}
-		break;
-	case MRP_MRM_STATE_CHK_RC:
-		if (!up && p == mrp->p_port) {
-			mrp->p_port = mrp->s_port;
-			mrp->s_port = p;
-			mrp_port_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_port_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-			mrp_ring_topo_req(mrp, topo_interval);
-			mrp->ring_transitions++;
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
-			break;
-		}
-		if (!up && p != mrp->p_port) {
-			mrp->ring_transitions++;
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
-			break;
-		}
-
-		break;
-	}
-}
-
-/* Represents the state machine for when MRP instance has the role MRC and the
- * link of one of the MRP ports is changed.
- */
-static void mrp_mrc_port_link(struct mrp_port *p, bool up)
-{
-	struct mrp *mrp = p->mrp;
-
-	pr_debug("port: %s up: %d, mrc_state: %s",
-	        p->ifname, up, mrp_get_mrc_state(mrp->mrc_state));
-
-	switch (mrp->mrc_state) {
-	case MRP_MRC_STATE_AC_STAT1:
-		if (up && p == mrp->p_port) {
-			mrp_port_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE_IDLE);
-		}
-		if (up && p != mrp->p_port) {
-			mrp->s_port = mrp->p_port;
-			mrp->p_port = p;
-			mrp_port_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE_IDLE);
-		}
-		break;
-	case MRP_MRC_STATE_DE_IDLE:
-		if (up && p != mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp_ring_link_up_start(mrp,
-					       mrp->ring_link_conf_interval);
-			mrp_ring_link_req(mrp->p_port, up,
-					  mrp->ring_link_curr_max *
-					  mrp->ring_link_conf_interval);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_PT);
-		}
-		if (!up && p == mrp->p_port) {
-			mrp_port_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_AC_STAT1);
-		}
-		break;
-	case MRP_MRC_STATE_PT:
-		if (!up && p != mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp_ring_link_up_stop(mrp);
-			mrp_port_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_ring_link_down_start(mrp,
-						 mrp->ring_link_conf_interval);
-			mrp_ring_link_req(mrp->p_port, up,
-					  mrp->ring_link_curr_max *
-					  mrp->ring_link_conf_interval);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE);
-			break;
-		}
-		if (!up && p == mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp_ring_link_up_stop(mrp);
-			mrp->p_port = mrp->s_port;
-			mrp->s_port = p;
-			mrp_port_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_FORWARDING);
-			mrp_port_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_ring_link_down_start(mrp,
-						 mrp->ring_link_conf_interval);
-			mrp_ring_link_req(mrp->p_port, up,
-					  mrp->ring_link_curr_max *
-					  mrp->ring_link_conf_interval);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE);
-		}
-		break;
-	case MRP_MRC_STATE_DE:
-		if (up && p != mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp_ring_link_down_stop(mrp);
-			mrp_ring_link_up_start(mrp,
-					       mrp->ring_link_conf_interval);
-			mrp_ring_link_req(mrp->p_port, up,
-					  mrp->ring_link_curr_max *
-					  mrp->ring_link_conf_interval);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_PT);
-		}
-		if (!up && p == mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp_port_set_state(mrp->p_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_ring_link_down_stop(mrp);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_AC_STAT1);
-		}
-		break;
-	case MRP_MRC_STATE_PT_IDLE:
-		if (!up && p != mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp_port_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_ring_link_down_start(mrp,
-						 mrp->ring_link_conf_interval);
-			mrp_ring_link_req(mrp->p_port, up,
-					  mrp->ring_link_curr_max *
-					  mrp->ring_link_conf_interval);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE);
-		}
-		if (!up && p == mrp->p_port) {
-			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
-			mrp->p_port = mrp->s_port;
-			mrp->s_port = p;
-			mrp_port_set_state(mrp->s_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_ring_link_down_start(mrp,
-						 mrp->ring_link_conf_interval);
-			mrp_ring_link_req(mrp->p_port, up,
-					  mrp->ring_link_curr_max *
-					  mrp->ring_link_conf_interval);
-			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE);
-		}
-		break;
-	}
-}
-
-/* Represents the state machine for when MRP instance has the role MIM and the
- * link of one of the MRP ports is changed.
- */
-static void mrp_mim_port_link(struct mrp_port *p, bool up)
-{
-	struct mrp *mrp = p->mrp;
-
-	pr_debug("up: %d, mim_state: %s",
-	        up, mrp_get_mim_state(mrp->mim_state));
-
-	if (up && mrp->in_mode == MRP_IN_MODE_RC) {
-		switch (mrp->mim_state) {
-		case MRP_MIM_STATE_AC_STAT1:
-			mrp_port_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp->in_test_curr_max = mrp->in_test_conf_max - 1;
-			mrp->in_test_curr = 0;
-			mrp_in_test_req(mrp, mrp->in_test_conf_interval);
-			mrp_set_mim_state(mrp, MRP_MIM_STATE_CHK_IC);
-			break;
-		case MRP_MIM_STATE_CHK_IO:
-			/* Ignore */
-			break;
-		case MRP_MIM_STATE_CHK_IC:
-			/* Ignore */
-			break;
-		}
-	}
-
-	if (!up && mrp->in_mode == MRP_IN_MODE_RC) {
-		switch (mrp->mim_state) {
-		case MRP_MIM_STATE_AC_STAT1:
-			/* Ignore */
-			break;
-		case MRP_MIM_STATE_CHK_IO: /* fallthrough */
-		case MRP_MIM_STATE_CHK_IC:
-			mrp_port_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_in_topo_req(mrp, mrp->in_topo_conf_interval);
-			mrp_in_test_req(mrp, mrp->in_test_conf_interval);
-			mrp_set_mim_state(mrp, MRP_MIM_STATE_AC_STAT1);
-			break;
-		}
-	}
-
-	if (up && mrp->in_mode == MRP_IN_MODE_LC) {
-		switch (mrp->mim_state) {
-		case MRP_MIM_STATE_AC_STAT1:
-			mrp->in_link_status_curr_max = mrp->in_link_status_conf_max;
-			mrp_port_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_in_link_status_req(mrp,
-					       mrp->in_link_status_conf_interval);
-			mrp_set_mim_state(mrp, MRP_MIM_STATE_CHK_IC);
-			break;
-		case MRP_MIM_STATE_CHK_IO:
-			/* Ignore */
-			break;
-		case MRP_MIM_STATE_CHK_IC:
-			/* Ignore */
-			break;
-		}
-	}
-
-	if (!up && mrp->in_mode == MRP_IN_MODE_LC) {
-		switch (mrp->mim_state) {
-		case MRP_MIM_STATE_AC_STAT1:
-			/* Ignore */
-			break;
-		case MRP_MIM_STATE_CHK_IO:
-			mrp_port_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_in_link_status_stop(mrp);
-			mrp_set_mim_state(mrp, MRP_MIM_STATE_AC_STAT1);
-			break;
-		case MRP_MIM_STATE_CHK_IC:
-			mrp_port_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_set_mim_state(mrp, MRP_MIM_STATE_AC_STAT1);
-			break;
-		}
-	}
-
-
-	pr_debug("new mim_state: %s", mrp_get_mim_state(mrp->mim_state));
-}
-
-/* Represents the state machine for when MRP instance has the role MIC and the
- * link of one of the MRP ports is changed.
- */
-static void mrp_mic_port_link(struct mrp_port *p, bool up)
-{
-	struct mrp *mrp = p->mrp;
-
-	pr_debug_v("up: %d, mic_state: %s",
-	        up, mrp_get_mic_state(mrp->mic_state));
-
-	if (up && mrp->in_mode == MRP_IN_MODE_RC) {
-		switch (mrp->mic_state) {
-		case MRP_MIC_STATE_AC_STAT1:
-			mrp->in_link_curr_max = mrp->in_link_conf_max;
-			mrp_in_link_down_stop(mrp);
-			mrp_in_link_up_start(mrp, mrp->in_link_conf_interval);
-			mrp_in_link_req(mrp, up, mrp->in_link_conf_max *
-					mrp->in_link_conf_interval);
-			mrp_set_mic_state(mrp, MRP_MIC_STATE_PT);
-			break;
-		case MRP_MIC_STATE_PT: /* Fallthrough */
-		case MRP_MIC_STATE_IP_IDLE:
-			/* Ignore */
-			break;
-		}
-	}
-
-	if (!up && mrp->in_mode == MRP_IN_MODE_RC) {
-		switch (mrp->mic_state) {
-		case MRP_MIC_STATE_AC_STAT1:
-			/* Ignore */
-			break;
-		case MRP_MIC_STATE_PT:
-			mrp->in_link_curr_max = mrp->in_link_conf_max;
-			mrp_in_link_up_stop(mrp);
-			mrp_port_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_in_link_down_start(mrp, mrp->in_link_conf_interval);
-			mrp_in_link_req(mrp, up, mrp->in_link_conf_max *
-					mrp->in_link_conf_interval);
-			mrp_set_mic_state(mrp, MRP_MIC_STATE_AC_STAT1);
-			break;
-		case MRP_MIC_STATE_IP_IDLE:
-			mrp->in_link_curr_max = mrp->in_link_conf_max;
-			mrp_port_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_in_link_down_start(mrp, mrp->in_link_conf_interval);
-			mrp_in_link_req(mrp, up, mrp->in_link_conf_max *
-					mrp->in_link_conf_interval);
-			mrp_set_mic_state(mrp, MRP_MIC_STATE_AC_STAT1);
-			break;
-		}
-	}
-
-	if (up && mrp->in_mode == MRP_IN_MODE_LC) {
-		switch (mrp->mic_state) {
-		case MRP_MIC_STATE_AC_STAT1:
-			mrp->in_link_curr_max = mrp->in_link_conf_max;
-			mrp_in_link_down_stop(mrp);
-			mrp_in_link_up_start(mrp, mrp->in_link_conf_interval);
-			mrp_in_link_req(mrp, up,
-					mrp->in_link_conf_max *
-					mrp->in_link_conf_interval);
-			mrp_set_mic_state(mrp, MRP_MIC_STATE_PT);
-			break;
-		case MRP_MIC_STATE_PT: /* Fallthrough */
-		case MRP_MIC_STATE_IP_IDLE:
-			/* Ignore */
-			break;
-		}
-	}
-
-	if (!up && mrp->in_mode == MRP_IN_MODE_LC) {
-		switch (mrp->mic_state) {
-		case MRP_MIC_STATE_AC_STAT1:
-			/* Ignore */
-			break;
-		case MRP_MIC_STATE_PT: /* Fallthrough */
-		case MRP_MIC_STATE_IP_IDLE:
-			mrp->in_link_curr_max = mrp->in_link_conf_max;
-			mrp_in_link_up_stop(mrp);
-			mrp_port_set_state(mrp->i_port,
-						   BR_MRP_PORT_STATE_BLOCKED);
-			mrp_in_link_down_start(mrp,
-					       mrp->in_link_conf_interval);
-			mrp_in_link_req(mrp, up,
-					mrp->in_link_conf_max *
-					mrp->in_link_conf_interval);
-			mrp_set_mic_state(mrp, MRP_MIC_STATE_AC_STAT1);
-			break;
-		}
-	}
-
-	pr_debug("new mic_state: %s", mrp_get_mic_state(mrp->mic_state));
-}
-
-/* Whenever the port link changes, this function is called */
-void mrp_port_link_change(struct mrp_port *p, bool up)
-{
-	struct mrp *mrp;
-
-	/* If the port which changed its status is not a ring port then
-	 * nothing to do
-	 */
-	if (!mrp_is_mrp_port(p))
-		return;
+	/* If the port which changed its status is not a ring port then
+	 * nothing to do
+	 */
+	if (!mrp_is_mrp_port(p))
+		return;
 
 	mrp = p->mrp;
 
@@ -2459,9 +1924,50 @@ void mrp_mac_change(uint32_t ifindex, unsigned char *mac)
 #define __us(v)		(v)
 #define __ms(v)		__us(v) * 1000
 #define __s(v)		__ms(v) * 1000
+/* The timers are not reliable below a few times the loop resolution */
+#define MRP_TIMER_MIN_RATIO	4
+
+/* Checks the custom timings against the timer resolution measured at
+ * startup.
+ */
+int mrp_check_recovery(struct mrp_recovery_custom *c)
+{
+	uint32_t min = mrp_timer_resolution * MRP_TIMER_MIN_RATIO;
+	uint32_t intervals[5];
+	int i;
+
+	if (!c)
+		return 0;
+
+	intervals[0] = c->test_interval;
+	intervals[1] = c->test_short;
+	intervals[2] = c->topo_interval;
+	intervals[3] = c->link_interval;
+	intervals[4] = c->in_test_interval;
+
+	for (i = 0; i < COUNT_OF(intervals); i++) {
+		if (intervals[i] &&
+		    (uint64_t)intervals[i] * time_factor < min) {
+			pr_err("interval %uus is below %uus, %d times the timer resolution",
+			       intervals[i], min, MRP_TIMER_MIN_RATIO);
+			return -ERANGE;
+		}
+	}
+
+	if (c->test_short && c->test_interval &&
+	    c->test_short > c->test_interval)
+		return -EINVAL;
+	if (c->test_max && c->test_ext_max &&
+	    c->test_ext_max < c->test_max)
+		return -EINVAL;
+
+	return 0;
+}
+
 static void mrp_update_recovery(struct mrp *mrp,
 				enum mrp_ring_recovery_type ring_recv,
-				enum mrp_in_recovery_type in_recv)
+				enum mrp_in_recovery_type in_recv,
+				struct mrp_recovery_custom *c)
 {
 	mrp->ring_recv = ring_recv;
 	mrp->in_recv = in_recv;
@@ -2526,6 +2032,32 @@ static void mrp_update_recovery(struct mrp *mrp,
 	default:
 		break;
 	}
+	if (c && (c->test_interval || c->test_short || c->test_max ||
+		  c->test_ext_max || c->topo_interval || c->topo_max ||
+		  c->link_interval || c->link_max)) {
+		if (c->test_interval)
+			mrp->ring_test_conf_interval = c->test_interval;
+		if (c->test_short)
+			mrp->ring_test_conf_short = c->test_short;
+		if (c->test_max) {
+			mrp->ring_test_conf_max = c->test_max;
+			mrp->ring_test_curr_max = c->test_max;
+			mrp->ring_mon_curr_max = c->test_max;
+		}
+		if (c->test_ext_max)
+			mrp->ring_test_conf_ext_max = c->test_ext_max;
+		if (c->topo_interval)
+			mrp->ring_topo_conf_interval = c->topo_interval;
+		if (c->topo_max) {
+			mrp->ring_topo_conf_max = c->topo_max;
+			mrp->ring_topo_curr_max = c->topo_max - 1;
+		}
+		if (c->link_interval)
+			mrp->ring_link_conf_interval = c->link_interval;
+		if (c->link_max)
+			mrp->ring_link_conf_max = c->link_max;
+		mrp->ring_recv = MRP_RING_RECOVERY_CUSTOM;
+	}
 	mrp->ring_topo_conf_interval *= time_factor;
 	mrp->ring_test_conf_short *= time_factor;
 	mrp->ring_test_conf_interval *= time_factor;
@@ -2573,6 +2105,10 @@ static void mrp_update_recovery(struct mrp *mrp,
 	default:
 		break;
 	}
+	if (c && c->in_test_interval) {
+		mrp->in_test_conf_interval = c->in_test_interval;
+		mrp->in_recv = MRP_IN_RECOVERY_CUSTOM;
+	}
 	mrp->in_topo_conf_interval *= time_factor;
 	mrp->in_test_conf_interval *= time_factor;
 	mrp->in_link_conf_interval *= time_factor;
@@ -2599,6 +2135,32 @@ struct mrp *mrp_find(uint32_t br_ifindex, uint32_t ring_nr)
 	return NULL;
 }
 
+/* Returns the instance with the lowest id greater than id */
+struct mrp *mrp_find_next(uint32_t id)
+{
+	struct mrp *mrp;
+
+	/* The list is sorted by id, see mrp_get_page() */
+	list_for_each_entry(mrp, &mrp_instances, list) {
+		if (mrp->id > id)
+			return mrp;
+	}
+
+	return NULL;
+}
+
+/* The egress qdiscs of a port have been set up by the main loop before the
+ * instance was added, see ctl_tc_get(). Without them the frames share the
+ * queues with the data and are sent at once.
+ */
+static void mrp_port_tc_init(struct mrp_port *p)
+{
+	if (!packet_txtime_lead() && !tc_qos_enabled())
+		return;
+
+	p->tc = tc_port_lookup(p->ifindex, &p->txtime);
+}
+
 /* Initialize an MRP port */
 static int mrp_port_init(uint32_t p_ifindex, struct mrp *mrp,
 			 enum br_mrp_port_role_type role)
@@ -2613,10 +2175,10 @@ static int mrp_port_init(uint32_t p_ifindex, struct mrp *mrp,
 
 	port->mrp = mrp;
 	port->ifindex = p_ifindex;
-	if_indextoname(port->ifindex, port->ifname);
+	linkcache_get_name(port->ifindex, port->ifname);
 	BUG_ON(!port->ifname);
 	port->role = role;
-	if_get_mac(port->ifindex, port->macaddr);
+	linkcache_get_mac(port->ifindex, port->macaddr);
 
 	if (role == BR_MRP_PORT_ROLE_PRIMARY)
 		mrp->p_port = port;
@@ -2624,6 +2186,9 @@ static int mrp_port_init(uint32_t p_ifindex, struct mrp *mrp,
 		mrp->s_port = port;
 	if (role == BR_MRP_PORT_ROLE_INTER)
 		mrp->i_port = port;
+	mrp->decide_valid = false;
+
+	mrp_port_tc_init(port);
 
 	return 0;
 }
@@ -2631,20 +2196,12 @@ static int mrp_port_init(uint32_t p_ifindex, struct mrp *mrp,
 /* Uninitialize MRP port */
 static void mrp_port_uninit(struct mrp_port *port)
 {
-	struct mrp *mrp;
-
 	if (!port || !port->mrp)
 		return;
 
-	mrp = port->mrp;
-
-	pthread_mutex_lock(&mrp->lock);
-
 	port->mrp = NULL;
 
 	free(port);
-
-	pthread_mutex_unlock(&mrp->lock);
 }
 
 /* Creates an MRP instance and initialize it */
@@ -2658,14 +2215,14 @@ static int mrp_create(uint32_t br_ifindex, uint32_t ring_nr, uint16_t in_id)
 
 	memset(mrp, 0x0, sizeof(struct mrp));
 
-	pthread_mutex_init(&mrp->lock, NULL);
-
 	mrp->ifindex = br_ifindex;
 	mrp->p_port = NULL;
 	mrp->s_port = NULL;
 	mrp->i_port = NULL;
 	mrp->ring_nr = ring_nr;
 	mrp->in_id = in_id;
+	mrp->id = __atomic_add_fetch(&mrp_last_id, 1, __ATOMIC_RELAXED);
+	mrp_changed(mrp);
 
 	mrp->ring_role = BR_MRP_RING_ROLE_MRC;
 	mrp->in_role = BR_MRP_IN_ROLE_DISABLED;
@@ -2676,7 +2233,8 @@ static int mrp_create(uint32_t br_ifindex, uint32_t ring_nr, uint16_t in_id)
 	mrp->prio = MRP_DEFAULT_PRIO;
 	memset(mrp->domain, 0xFF, MRP_DOMAIN_UUID_LENGTH);
 
-	mrp_update_recovery(mrp, MRP_RING_RECOVERY_500, MRP_IN_RECOVERY_500);
+	mrp_update_recovery(mrp, MRP_RING_RECOVERY_500, MRP_IN_RECOVERY_500,
+			    NULL);
 
 	mrp->blocked = 1;
 	mrp->react_on_link_change = 1;
@@ -2690,7 +2248,9 @@ static int mrp_create(uint32_t br_ifindex, uint32_t ring_nr, uint16_t in_id)
 
 static void mrp_delete_cfm(struct mrp *mrp)
 {
+	pthread_mutex_lock(&mrp_driver_lock);
 	cfm_offload_mep_delete(mrp->ifindex, mrp->cfm_instance);
+	pthread_mutex_unlock(&mrp_driver_lock);
 }
 
 /* Uninitialize MRP instance and remove it */
@@ -2701,72 +2261,161 @@ void mrp_destroy(uint32_t br_ifindex, uint32_t ring_nr, bool offload)
 	if (!mrp)
 		return;
 
-	pthread_mutex_lock(&mrp->lock);
-
 	mrp_reset_ring_state(mrp);
 
 	if (mrp->in_mode == MRP_IN_MODE_LC)
 		mrp_delete_cfm(mrp);
 
-	if (mrp->p_port)
-		free(mrp->p_port);
+	mrp_port_uninit(mrp->p_port);
+	mrp_port_uninit(mrp->s_port);
+	mrp_port_uninit(mrp->i_port);
+
+	list_del(&mrp->list);
+	free(mrp);
+
+	/* Let pollers know that an instance has gone */
+	__atomic_add_fetch(&mrp_generation, 1, __ATOMIC_RELAXED);
+}
+
+static void mrp_fill_status(struct mrp *mrp, struct mrp_status *status)
+{
+	memset(status, 0, sizeof(*status));
 
+	status->br = mrp->ifindex;
+	status->ring_nr = mrp->ring_nr;
+	if (mrp->p_port)
+		status->pport = mrp->p_port->ifindex;
 	if (mrp->s_port)
-		free(mrp->s_port);
+		status->sport = mrp->s_port->ifindex;
+	status->ring_role = mrp->ring_role;
+	status->mra_support = mrp->mra_support;
+	status->prio = mrp->prio;
+	status->ring_recv = mrp->ring_recv;
+	status->react_on_link_change = mrp->react_on_link_change;
+
+	if (mrp->ring_role == BR_MRP_RING_ROLE_MRM)
+		status->ring_state = mrp->mrm_state;
+	if (mrp->ring_role == BR_MRP_RING_ROLE_MRC)
+		status->ring_state = mrp->mrc_state;
 
 	if (mrp->i_port)
-		free(mrp->i_port);
+		status->iport = mrp->i_port->ifindex;
+	status->in_id = mrp->in_id;
+	status->in_role = mrp->in_role;
+	status->in_mode = mrp->in_mode;
+	status->in_recv = mrp->in_recv;
+	if (status->in_role == BR_MRP_IN_ROLE_MIM)
+		status->in_state = mrp->mim_state;
+	if (status->in_role == BR_MRP_IN_ROLE_MIC)
+		status->in_state = mrp->mic_state;
+	if (status->in_role == BR_MRP_IN_ROLE_DISABLED)
+		status->in_state = -1;
+}
+
+/* Fills up to max entries with the instances of the running shard */
+int mrp_get(int max, int *count, struct mrp_status *status)
+{
+	struct mrp *mrp;
+	int i = 0;
 
-	pthread_mutex_unlock(&mrp->lock);
+	list_for_each_entry(mrp, &mrp_instances, list) {
+		/* The reply can hold only MAX_MRP_INSTANCES entries, the
+		 * others can be read by using mrp_get_page()
+		 */
+		if (i >= max)
+			break;
 
-	list_del(&mrp->list);
-	free(mrp);
+		mrp_fill_status(mrp, &status[i++]);
+	}
+
+	*count = i;
+
+	return 0;
 }
 
-int mrp_get(int *count, struct mrp_status *status)
+/* Returns up to MRP_STATUS_PAGE_LEN instances of the running shard with id
+ * greater than cursor and changed after generation since, along with their
+ * ids. On return last holds the highest id of the shard (0 when it has no
+ * instances) and total its number of instances. The pages of the shards are
+ * merged by the caller.
+ */
+int mrp_get_page(uint32_t cursor, uint32_t since, int *count, uint32_t *ids,
+		 uint32_t *last, int *total, struct mrp_status *status)
 {
 	struct mrp *mrp;
-	int i = 0;
+	int i = 0, n = 0;
+
+	*last = 0;
 
+	/* Instances are added at the tail with increasing ids, so the list is
+	 * already sorted by id.
+	 */
 	list_for_each_entry(mrp, &mrp_instances, list) {
-		pthread_mutex_lock(&mrp->lock);
-
-		status[i].br = mrp->ifindex;
-		status[i].ring_nr = mrp->ring_nr;
-		if (mrp->p_port)
-			status[i].pport = mrp->p_port->ifindex;
-		if (mrp->s_port)
-			status[i].sport = mrp->s_port->ifindex;
-		status[i].ring_role = mrp->ring_role;
-		status[i].mra_support = mrp->mra_support;
-		status[i].prio = mrp->prio;
-		status[i].ring_recv = mrp->ring_recv;
-		status[i].react_on_link_change = mrp->react_on_link_change;
+		n++;
+		*last = mrp->id;
 
-		if (mrp->ring_role == BR_MRP_RING_ROLE_MRM)
-			status[i].ring_state = mrp->mrm_state;
-		if (mrp->ring_role == BR_MRP_RING_ROLE_MRC)
-			status[i].ring_state = mrp->mrc_state;
-
-		if (mrp->i_port)
-			status[i].iport = mrp->i_port->ifindex;
-		status[i].in_id = mrp->in_id;
-		status[i].in_role = mrp->in_role;
-		status[i].in_mode = mrp->in_mode;
-		status[i].in_recv = mrp->in_recv;
-		if (status[i].in_role == BR_MRP_IN_ROLE_MIM)
-			status[i].in_state = mrp->mim_state;
-		if (status[i].in_role == BR_MRP_IN_ROLE_MIC)
-			status[i].in_state = mrp->mic_state;
-		if (status[i].in_role == BR_MRP_IN_ROLE_DISABLED)
-			status[i].in_state = -1;
-
-		++i;
-
-		pthread_mutex_unlock(&mrp->lock);
+		if (mrp->id <= cursor || i >= MRP_STATUS_PAGE_LEN)
+			continue;
+		if (since && (int32_t)(mrp->generation - since) <= 0)
+			continue;
+
+		ids[i] = mrp->id;
+		mrp_fill_status(mrp, &status[i++]);
 	}
 
 	*count = i;
+	*total = n;
+
+	return 0;
+}
+
+uint32_t mrp_get_generation(void)
+{
+	return __atomic_load_n(&mrp_generation, __ATOMIC_RELAXED);
+}
+
+int mrp_get_stats(uint32_t br_ifindex, uint32_t ring_nr,
+		  struct mrp_stats *stats)
+{
+	struct mrp_port *ports[3];
+	struct mrp *mrp;
+	int i;
+
+	mrp = mrp_find(br_ifindex, ring_nr);
+	if (!mrp)
+		return -EINVAL;
+
+	memset(stats, 0, sizeof(*stats));
+
+	stats->mrp = mrp->cnt;
+
+	ports[0] = mrp->p_port;
+	ports[1] = mrp->s_port;
+	ports[2] = mrp->i_port;
+	for (i = 0; i < COUNT_OF(ports); i++) {
+		if (!ports[i])
+			continue;
+
+		stats->port[i] = ports[i]->ifindex;
+		stats->port_cnt[i] = ports[i]->cnt;
+	}
+
+	for (i = 0; i < COUNT_OF(mrp->ring_rtt); i++)
+		mrp_rtt_get(&mrp->ring_rtt[i], &stats->rtt[i]);
+
+	return 0;
+}
+
+int mrp_get_flight(uint32_t br_ifindex, uint32_t ring_nr, int *count,
+		   struct mrp_flight_entry *entries)
+{
+	struct mrp *mrp;
+
+	mrp = mrp_find(br_ifindex, ring_nr);
+	if (!mrp)
+		return -EINVAL;
+
+	*count = mrp_flight_get(&mrp->flight, entries);
 
 	return 0;
 }
@@ -2791,6 +2440,7 @@ static void mrp_start_cfm(struct mrp *mrp, uint32_t cfm_instance,
 	memset(maid.data, 0, sizeof(maid));
 	memcpy(maid.data, cfm_maid, strlen(cfm_maid));
 
+	pthread_mutex_lock(&mrp_driver_lock);
 	cfm_offload_mep_create(mrp->ifindex, mrp->cfm_instance,
 			       BR_CFM_PORT, BR_CFM_MEP_DIRECTION_DOWN,
 			       mrp->i_port->ifindex);
@@ -2804,6 +2454,7 @@ static void mrp_start_cfm(struct mrp *mrp, uint32_t cfm_instance,
 	/* Start the transmision of the frames */
 	cfm_offload_cc_ccm_tx(mrp->ifindex, mrp->cfm_instance, &dmac, 1,
 			      mrp->cfm_ccm_period, 1, 100, 1, 200);
+	pthread_mutex_unlock(&mrp_driver_lock);
 	mrp_cfm_ccm_start(mrp, mrp->cfm_ccm_period);
 }
 
@@ -2813,7 +2464,8 @@ int mrp_add(uint32_t br_ifindex, uint32_t ring_nr, uint32_t pport,
 	    uint32_t in_role, uint16_t in_id, uint32_t iport,
 	    uint32_t in_mode, uint8_t in_recv, uint32_t cfm_instance,
 	    uint32_t cfm_level, uint32_t cfm_mepid, uint32_t cfm_peer_mepid,
-	    char *cfm_maid, char *cfm_dmac)
+	    char *cfm_maid, char *cfm_dmac,
+	    struct mrp_recovery_custom *recv_custom)
 {
 	struct mrp *mrp;
 	int err;
@@ -2823,6 +2475,10 @@ int mrp_add(uint32_t br_ifindex, uint32_t ring_nr, uint32_t pport,
 	if (mrp)
 		return -EINVAL;
 
+	err = mrp_check_recovery(recv_custom);
+	if (err)
+		return err;
+
 	/* Create the mrp instance */
 	err = mrp_create(br_ifindex, ring_nr, in_id);
 	if (err < 0)
@@ -2830,38 +2486,30 @@ int mrp_add(uint32_t br_ifindex, uint32_t ring_nr, uint32_t pport,
 
 	mrp = mrp_find(br_ifindex, ring_nr);
 
-	pthread_mutex_lock(&mrp->lock);
-
 	mrp->ifindex = br_ifindex;
-	if_indextoname(mrp->ifindex, mrp->ifname);
+	linkcache_get_name(mrp->ifindex, mrp->ifname);
 	BUG_ON(!mrp->ifname);
 	mrp->prio = prio;
 	mrp->ring_prio = prio;
-	mrp_update_recovery(mrp, ring_recv, in_recv);
+	mrp_update_recovery(mrp, ring_recv, in_recv, recv_custom);
 	mrp->react_on_link_change = react_on_link_change;
 	mrp->in_mode = in_mode;
 
-	if_get_mac(mrp->ifindex, mrp->macaddr);
+	linkcache_get_mac(mrp->ifindex, mrp->macaddr);
 
 	/* Initialize the ports */
 	err = mrp_port_init(pport, mrp, BR_MRP_PORT_ROLE_PRIMARY);
-	if (err < 0) {
-		pthread_mutex_unlock(&mrp->lock);
+	if (err < 0)
 		goto delete_mrp;
-	}
 
 	err = mrp_port_init(sport, mrp, BR_MRP_PORT_ROLE_SECONDARY);
-	if (err < 0) {
-		pthread_mutex_unlock(&mrp->lock);
+	if (err < 0)
 		goto delete_port;
-	}
 
 	if (iport > 0) {
 		err = mrp_port_init(iport, mrp, BR_MRP_PORT_ROLE_INTER);
-		if (err < 0) {
-			pthread_mutex_unlock(&mrp->lock);
+		if (err < 0)
 			goto delete_ports;
-		}
 	}
 
 	if (mrp->in_mode != MRP_IN_MODE_RC)
@@ -2879,8 +2527,6 @@ int mrp_add(uint32_t br_ifindex, uint32_t ring_nr, uint32_t pport,
 	if (in_role == BR_MRP_IN_ROLE_MIC)
 		err = mrp_set_mic_role(mrp);
 
-	pthread_mutex_unlock(&mrp->lock);
-
 	if (err)
 		goto clear;
 
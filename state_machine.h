@@ -19,6 +19,9 @@
 #include "list.h"
 #include "linux.h"
 #include "utils.h"
+#include "metrics.h"
+#include "flight.h"
+#include "rtt.h"
 
 extern unsigned int time_factor;
 
@@ -27,6 +30,37 @@ extern const uint8_t mrp_control_dmac[ETH_ALEN];
 extern const uint8_t mrp_itest_dmac[ETH_ALEN];
 extern const uint8_t mrp_icontrol_dmac[ETH_ALEN];
 
+/* CLOCK_REALTIME (ns) of the event the frames being sent respond to */
+extern __thread uint64_t mrp_tx_origin;
+
+/* CLOCK_REALTIME (ns) the MRP_Test frames being sent are due, 0 if now */
+extern __thread uint64_t mrp_tx_launch;
+
+/* Per frame decisions of an instance, see mrp_decide_build() */
+#define MRP_DECIDE_DROP		(1 << 0)
+#define MRP_DECIDE_PROCESS	(1 << 1)
+
+/* Forwarding ports */
+#define MRP_FWD_P		(1 << 0)
+#define MRP_FWD_S		(1 << 1)
+#define MRP_FWD_I		(1 << 2)
+
+/* Frame keys of the interconnection frames */
+#define MRP_KEY_IN_ID		(1 << 0)	/* the in_id is ours */
+#define MRP_KEY_OWN_SA		(1 << 1)	/* the SA is ours */
+#define MRP_KEY_MAX		4
+
+struct mrp_decision {
+	uint8_t				flags;
+	uint8_t				fwd;
+};
+
+/* Token bucket, the credit is in millionths of a frame */
+struct mrp_bucket {
+	uint64_t			ts;	/* us */
+	uint64_t			credit;
+};
+
 struct mrp_port {
 	struct mrp			*mrp;
 	enum br_mrp_port_state_type	state;
@@ -35,14 +69,38 @@ struct mrp_port {
 	char				ifname[IF_NAMESIZE];
 	uint8_t				macaddr[ETH_ALEN];
 	uint8_t				operstate;
+
+	/* Egress qdiscs in place, see tc.h. The MRP_Test frames are sent
+	 * with a launch time if txtime.
+	 */
+	bool				tc;
+	bool				txtime;
+
+	/* ingress rate limiting, by class */
+	struct mrp_bucket		rl[MRP_RL_MAX];
+
+	struct mrp_port_counters	cnt;
+};
+
+#define MRP_DEDUP_LEN		16
+#define MRP_DEDUP_AGE_US	1000000
+
+struct mrp_dedup {
+	uint64_t			ts;	/* us, 0 if unused */
+	uint8_t				sa[ETH_ALEN];
+	uint8_t				type;
+	uint16_t			seq_id;
 };
 
 struct mrp {
 	/* list of mrp instances */
 	struct list_head		list;
 
-	/* lock for each MRP instance */
-	pthread_mutex_t			lock;
+	/* unique instance id (used as cursor by paged status queries) and
+	 * generation number of the last state change
+	 */
+	uint32_t			id;
+	uint32_t			generation;
 
 	/* ifindex and ifname of the bridge */
 	uint32_t			ifindex;
@@ -53,6 +111,18 @@ struct mrp {
 	struct mrp_port			*s_port;
 	struct mrp_port			*i_port;
 
+	/* drop, process and forward decisions by receiving port (primary,
+	 * secondary, interconnection), TLV type and frame key
+	 */
+	struct mrp_decision		decide[3][MRP_TLV_IDX_MAX][MRP_KEY_MAX];
+	bool				decide_valid;
+
+	/* recently processed topology and link changes, the repeated and
+	 * the counter rotating copies are not processed again
+	 */
+	struct mrp_dedup		dedup[MRP_DEDUP_LEN];
+	uint8_t				dedup_head;
+
 	/* mac address of the ring MRM */
 	uint16_t			ring_prio;
 	uint8_t				ring_mac[ETH_ALEN];
@@ -75,9 +145,31 @@ struct mrp {
 	bool				add_test;
 	bool				no_tc;
 
+	/* The packet socket is busy polled for the instance */
+	bool				busy_poll;
+
 	uint16_t			ring_transitions;
 	uint16_t			in_transitions;
 
+	struct mrp_counters		cnt;
+
+	/* expected expiration time of the test timers, used to measure their
+	 * lateness
+	 */
+	ev_tstamp			ring_test_deadline;
+	ev_tstamp			in_test_deadline;
+	struct mrp_hist			test_lateness;
+
+	/* reception time of the last own test frames (ns) */
+	uint64_t			ring_test_rx_ts;
+	uint64_t			in_test_rx_ts;
+	struct mrp_flight		flight;
+
+	/* round trip of the test frames sent on the primary and on the
+	 * secondary port
+	 */
+	struct mrp_rtt			ring_rtt[2];
+
 	uint16_t			seq_id;
 	uint16_t			prio;
 	uint8_t				domain[MRP_DOMAIN_UUID_LENGTH];
@@ -142,8 +234,45 @@ struct mrp {
 	uint8_t				cfm_ccm_dmac[ETH_ALEN];
 };
 
+static inline bool mrp_is_ring_port(const struct mrp_port *p)
+{
+	return p->role == BR_MRP_PORT_ROLE_PRIMARY ||
+	       p->role == BR_MRP_PORT_ROLE_SECONDARY;
+}
+
+static inline bool mrp_is_in_port(const struct mrp_port *p)
+{
+	return p->role == BR_MRP_PORT_ROLE_INTER;
+}
+
+/* Determins if a port is part of a MRP instance */
+static inline bool mrp_is_mrp_port(const struct mrp_port *p)
+{
+	if (!p->mrp)
+		return false;
+
+	return true;
+}
+
+/* Returns the index of the TLV type into the counters arrays */
+static inline int mrp_tlv_idx(uint8_t type)
+{
+	if (likely(type <= BR_MRP_TLV_HEADER_IN_LINK_STATUS))
+		return type;
+	if (type == BR_MRP_TLV_HEADER_OPTION)
+		return MRP_TLV_IDX_OPTION;
+
+	return MRP_TLV_IDX_UNKNOWN;
+}
+
+struct mrp_frame;
+
+/* decide.c */
+const struct mrp_decision *mrp_decide(struct mrp_port *p,
+				      const struct mrp_frame *f);
+
 int mrp_recv(unsigned char *buf, int buf_len, struct sockaddr_ll *sl,
-	     socklen_t salen);
+	     socklen_t salen, const struct timespec *ts);
 int mrp_port_set_state(struct mrp_port *p,
 			      enum br_mrp_port_state_type state);
 void mrp_port_link_change(struct mrp_port *p, bool up);
@@ -152,15 +281,20 @@ void mrp_mac_change(uint32_t ifindex, unsigned char *mac);
 void mrp_cfm_link_change(uint32_t br_ifindex, uint32_t peer_mepid,
 			 uint32_t defect);
 
-int mrp_get(int *count, struct mrp_status *status);
+int mrp_get(int max, int *count, struct mrp_status *status);
+int mrp_get_page(uint32_t cursor, uint32_t since, int *count, uint32_t *ids,
+		 uint32_t *last, int *total, struct mrp_status *status);
+uint32_t mrp_get_generation(void);
 int mrp_add(uint32_t br_ifindex, uint32_t ring_nr, uint32_t pport,
 	    uint32_t sport, uint32_t ring_role, uint16_t prio,
 	    uint8_t ring_recv, uint8_t react_on_link_change,
 	    uint32_t in_role, uint16_t in_id, uint32_t iport,
 	    uint32_t in_mode, uint8_t in_recv, uint32_t cfm_instance,
 	    uint32_t cfm_level, uint32_t cfm_mepid,
-	    uint32_t cfm_peer_mepid, char *cfm_maid, char *cfm_dmac);
+	    uint32_t cfm_peer_mepid, char *cfm_maid, char *cfm_dmac,
+	    struct mrp_recovery_custom *recv_custom);
 int mrp_del(uint32_t br_ifindex, uint32_t ring_nr);
+int mrp_check_recovery(struct mrp_recovery_custom *c);
 void mrp_uninit(void);
 
 int mrp_set_ring_role(struct mrp *mrp, enum br_mrp_ring_role_type role);
@@ -170,6 +304,12 @@ void mrp_set_mrc_init(struct mrp* mrp);
 
 struct mrp_port *mrp_get_port(uint32_t ifindex);
 struct mrp *mrp_find(uint32_t br_ifindex, uint32_t ring_nr);
+struct mrp *mrp_find_next(uint32_t id);
+int mrp_get_stats(uint32_t br_ifindex, uint32_t ring_nr,
+		  struct mrp_stats *stats);
+uint64_t mrp_rx_no_port(void);
+int mrp_get_flight(uint32_t br_ifindex, uint32_t ring_nr, int *count,
+		   struct mrp_flight_entry *entries);
 
 void mrp_ring_test_req(struct mrp *mrp, uint32_t interval);
 void mrp_ring_topo_req(struct mrp *mrp, uint32_t interval);
@@ -190,10 +330,24 @@ void mrp_set_mrc_state(struct mrp *mrp, enum mrp_mrc_state_type state);
 void mrp_set_mim_state(struct mrp *mrp, enum mrp_mim_state_type state);
 char *mrp_get_mim_state(enum mrp_mim_state_type state);
 void mrp_set_mic_state(struct mrp *mrp, enum mrp_mic_state_type state);
+void mrp_ring_transition(struct mrp *mrp);
+void mrp_in_transition(struct mrp *mrp);
 char *mrp_get_mic_state(enum mrp_mic_state_type state);
 
+/* state_table.c */
+void mrp_mrm_recv_ring_test(struct mrp *mrp);
+void mrp_mrc_recv_ring_topo(struct mrp_port *p, const struct mrp_frame *f);
+void mrp_mrm_port_link(struct mrp_port *p, bool up);
+void mrp_mrc_port_link(struct mrp_port *p, bool up);
+void mrp_mim_port_link(struct mrp_port *p, bool up);
+void mrp_mic_port_link(struct mrp_port *p, bool up);
+void mrp_mrm_ring_test_expired(struct mrp *mrp);
+void mrp_mim_in_test_expired(struct mrp *mrp);
+
 /* mrp_timer.c */
 void mrp_timer_init(struct mrp *mrp);
+void mrp_timer_calibrate(void);
+extern uint32_t mrp_timer_resolution;
 void mrp_timer_stop(struct mrp *mrp);
 
 void mrp_ring_open(struct mrp *mrp);
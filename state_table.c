@@ -0,0 +1,618 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// Copyright (c) 2020 Microchip Technology Inc. and its subsidiaries.
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+
+#include "state_machine.h"
+#include "pdu.h"
+#include "trace.h"
+
+/* The reaction of the state machines to a link change of one of their ports,
+ * to a received frame and to the expiration of a test timer is described by
+ * constant tables, indexed by the current state and by the event, which list
+ * the actions to run in order and the next state. The tables are the
+ * specification: mrp_sm_run() just interprets them.
+ */
+enum mrp_sm_event {
+	/* Ring ports, as seen before running the actions */
+	MRP_EV_UP_P = 0,
+	MRP_EV_UP_S,
+	MRP_EV_DOWN_P,
+	MRP_EV_DOWN_S,
+
+	/* Interconnection port, for each interconnection mode */
+	MRP_EV_UP_RC = 0,
+	MRP_EV_DOWN_RC,
+	MRP_EV_UP_LC,
+	MRP_EV_DOWN_LC,
+
+	/* MRM */
+	MRP_EV_TEST_RX = 4,
+	MRP_EV_TEST_EXP,
+	MRP_EV_TEST_EXP_MAX,		/* expired ring_test_curr_max times */
+
+	/* MRC */
+	MRP_EV_TOPO_RX = 4,
+
+	/* MIM */
+	MRP_EV_IN_TEST_EXP = 4,
+	MRP_EV_IN_TEST_EXP_MAX,
+
+	MRP_EV_MAX = 7,
+};
+
+enum mrp_sm_action {
+	MRP_ACT_END = 0,
+	MRP_ACT_SWAP,			/* swap the primary and secondary port */
+	MRP_ACT_P_FWD,
+	MRP_ACT_P_BLK,
+	MRP_ACT_S_FWD,
+	MRP_ACT_S_BLK,
+	MRP_ACT_I_FWD,
+	MRP_ACT_I_BLK,
+
+	MRP_ACT_TEST_REQ,
+	MRP_ACT_TEST_STOP,
+	MRP_ACT_TEST_CHK_RC,		/* restart counting the test frames */
+	MRP_ACT_TEST_RESET,		/* as above, without touching no_tc */
+	MRP_ACT_TEST_MISSED,
+	MRP_ACT_TEST_NO_ADD,
+	MRP_ACT_TC,			/* clear no_tc */
+	MRP_ACT_TOPO_REQ,
+	MRP_ACT_TOPO_REQ_REACT,		/* at once if react_on_link_change */
+	MRP_ACT_TOPO_REQ_TC,		/* only if no_tc is clear */
+	MRP_ACT_TRANSITION,
+	MRP_ACT_CLEAR_FDB,
+
+	MRP_ACT_LINK_RESET,
+	MRP_ACT_LINK_UP_START,
+	MRP_ACT_LINK_UP_STOP,
+	MRP_ACT_LINK_DOWN_START,
+	MRP_ACT_LINK_DOWN_STOP,
+	MRP_ACT_LINK_REQ,
+
+	MRP_ACT_IN_TEST_RESET,
+	MRP_ACT_IN_TEST_MISSED,
+	MRP_ACT_IN_TEST_REQ,
+	MRP_ACT_IN_TOPO_REQ,
+	MRP_ACT_IN_TRANSITION,
+	MRP_ACT_IN_LINK_STATUS_RESET,
+	MRP_ACT_IN_LINK_STATUS_REQ,
+	MRP_ACT_IN_LINK_STATUS_STOP,
+
+	MRP_ACT_IN_LINK_RESET,
+	MRP_ACT_IN_LINK_UP_START,
+	MRP_ACT_IN_LINK_UP_STOP,
+	MRP_ACT_IN_LINK_DOWN_START,
+	MRP_ACT_IN_LINK_DOWN_STOP,
+	MRP_ACT_IN_LINK_REQ,
+};
+
+#define MRP_SM_MAX_ACTIONS	8
+#define MRP_SM_STAY		0xff	/* the state is not set again */
+
+struct mrp_sm_transition {
+	bool	valid;			/* otherwise the event is ignored */
+	uint8_t	next;
+	uint8_t	actions[MRP_SM_MAX_ACTIONS];
+};
+
+#define GOTO(_next, ...)						\
+	{ .valid = true, .next = (_next), .actions = { __VA_ARGS__ } }
+#define STAY(...)	GOTO(MRP_SM_STAY, __VA_ARGS__)
+
+static const struct mrp_sm_transition
+mrp_mrm_table[][MRP_EV_MAX] = {
+	[MRP_MRM_STATE_AC_STAT1] = {
+		[MRP_EV_UP_P] = GOTO(MRP_MRM_STATE_PRM_UP,
+				     MRP_ACT_P_FWD, MRP_ACT_TEST_REQ),
+		[MRP_EV_UP_S] = GOTO(MRP_MRM_STATE_PRM_UP,
+				     MRP_ACT_SWAP, MRP_ACT_P_FWD,
+				     MRP_ACT_TEST_REQ),
+	},
+	[MRP_MRM_STATE_PRM_UP] = {
+		[MRP_EV_DOWN_P] = GOTO(MRP_MRM_STATE_AC_STAT1,
+				       MRP_ACT_TEST_STOP, MRP_ACT_P_BLK),
+		[MRP_EV_UP_S] = GOTO(MRP_MRM_STATE_CHK_RC,
+				     MRP_ACT_TEST_CHK_RC, MRP_ACT_TEST_REQ),
+		[MRP_EV_TEST_RX] = GOTO(MRP_MRM_STATE_CHK_RC,
+					MRP_ACT_TEST_RESET, MRP_ACT_TC,
+					MRP_ACT_TEST_REQ),
+		[MRP_EV_TEST_EXP] = STAY(MRP_ACT_TEST_NO_ADD,
+					 MRP_ACT_TEST_REQ),
+		[MRP_EV_TEST_EXP_MAX] = STAY(MRP_ACT_TEST_NO_ADD,
+					     MRP_ACT_TEST_REQ),
+	},
+	[MRP_MRM_STATE_CHK_RO] = {
+		[MRP_EV_DOWN_P] = GOTO(MRP_MRM_STATE_PRM_UP,
+				       MRP_ACT_SWAP, MRP_ACT_S_BLK,
+				       MRP_ACT_TEST_REQ, MRP_ACT_TOPO_REQ),
+		[MRP_EV_DOWN_S] = GOTO(MRP_MRM_STATE_PRM_UP,
+				       MRP_ACT_S_BLK),
+		[MRP_EV_TEST_RX] = GOTO(MRP_MRM_STATE_CHK_RC,
+					MRP_ACT_S_BLK, MRP_ACT_TEST_RESET,
+					MRP_ACT_TC, MRP_ACT_TEST_REQ,
+					MRP_ACT_TOPO_REQ_REACT),
+		[MRP_EV_TEST_EXP] = STAY(MRP_ACT_TEST_NO_ADD,
+					 MRP_ACT_TEST_REQ),
+		[MRP_EV_TEST_EXP_MAX] = STAY(MRP_ACT_TEST_NO_ADD,
+					     MRP_ACT_TEST_REQ),
+	},
+	[MRP_MRM_STATE_CHK_RC] = {
+		[MRP_EV_DOWN_P] = GOTO(MRP_MRM_STATE_PRM_UP,
+				       MRP_ACT_SWAP, MRP_ACT_S_BLK,
+				       MRP_ACT_P_FWD, MRP_ACT_TEST_REQ,
+				       MRP_ACT_TOPO_REQ, MRP_ACT_TRANSITION),
+		[MRP_EV_DOWN_S] = GOTO(MRP_MRM_STATE_PRM_UP,
+				       MRP_ACT_TRANSITION),
+		[MRP_EV_TEST_RX] = STAY(MRP_ACT_TEST_RESET, MRP_ACT_TC),
+		[MRP_EV_TEST_EXP] = STAY(MRP_ACT_TEST_MISSED,
+					 MRP_ACT_TEST_NO_ADD,
+					 MRP_ACT_TEST_REQ),
+		[MRP_EV_TEST_EXP_MAX] = GOTO(MRP_MRM_STATE_CHK_RO,
+					     MRP_ACT_S_FWD, MRP_ACT_TEST_RESET,
+					     MRP_ACT_TEST_NO_ADD,
+					     MRP_ACT_TOPO_REQ_TC,
+					     MRP_ACT_TEST_REQ,
+					     MRP_ACT_TRANSITION),
+	},
+};
+
+static const struct mrp_sm_transition
+mrp_mrc_table[][MRP_EV_MAX] = {
+	[MRP_MRC_STATE_AC_STAT1] = {
+		[MRP_EV_UP_P] = GOTO(MRP_MRC_STATE_DE_IDLE,
+				     MRP_ACT_P_FWD),
+		[MRP_EV_UP_S] = GOTO(MRP_MRC_STATE_DE_IDLE,
+				     MRP_ACT_SWAP, MRP_ACT_P_FWD),
+	},
+	[MRP_MRC_STATE_DE_IDLE] = {
+		[MRP_EV_UP_S] = GOTO(MRP_MRC_STATE_PT,
+				     MRP_ACT_LINK_RESET, MRP_ACT_LINK_UP_START,
+				     MRP_ACT_LINK_REQ),
+		[MRP_EV_DOWN_P] = GOTO(MRP_MRC_STATE_AC_STAT1,
+				       MRP_ACT_P_BLK),
+		[MRP_EV_TOPO_RX] = STAY(MRP_ACT_CLEAR_FDB),
+	},
+	[MRP_MRC_STATE_PT] = {
+		[MRP_EV_DOWN_S] = GOTO(MRP_MRC_STATE_DE,
+				       MRP_ACT_LINK_RESET, MRP_ACT_LINK_UP_STOP,
+				       MRP_ACT_S_BLK, MRP_ACT_LINK_DOWN_START,
+				       MRP_ACT_LINK_REQ),
+		[MRP_EV_DOWN_P] = GOTO(MRP_MRC_STATE_DE,
+				       MRP_ACT_LINK_RESET, MRP_ACT_LINK_UP_STOP,
+				       MRP_ACT_SWAP, MRP_ACT_P_FWD,
+				       MRP_ACT_S_BLK, MRP_ACT_LINK_DOWN_START,
+				       MRP_ACT_LINK_REQ),
+		[MRP_EV_TOPO_RX] = GOTO(MRP_MRC_STATE_PT_IDLE,
+					MRP_ACT_LINK_RESET,
+					MRP_ACT_LINK_UP_STOP, MRP_ACT_S_FWD,
+					MRP_ACT_CLEAR_FDB),
+	},
+	[MRP_MRC_STATE_DE] = {
+		[MRP_EV_UP_S] = GOTO(MRP_MRC_STATE_PT,
+				     MRP_ACT_LINK_RESET, MRP_ACT_LINK_DOWN_STOP,
+				     MRP_ACT_LINK_UP_START, MRP_ACT_LINK_REQ),
+		[MRP_EV_DOWN_P] = GOTO(MRP_MRC_STATE_AC_STAT1,
+				       MRP_ACT_LINK_RESET, MRP_ACT_P_BLK,
+				       MRP_ACT_LINK_DOWN_STOP),
+		[MRP_EV_TOPO_RX] = GOTO(MRP_MRC_STATE_DE_IDLE,
+					MRP_ACT_LINK_RESET,
+					MRP_ACT_LINK_DOWN_STOP,
+					MRP_ACT_CLEAR_FDB),
+	},
+	[MRP_MRC_STATE_PT_IDLE] = {
+		[MRP_EV_DOWN_S] = GOTO(MRP_MRC_STATE_DE,
+				       MRP_ACT_LINK_RESET, MRP_ACT_S_BLK,
+				       MRP_ACT_LINK_DOWN_START,
+				       MRP_ACT_LINK_REQ),
+		[MRP_EV_DOWN_P] = GOTO(MRP_MRC_STATE_DE,
+				       MRP_ACT_LINK_RESET, MRP_ACT_SWAP,
+				       MRP_ACT_S_BLK, MRP_ACT_LINK_DOWN_START,
+				       MRP_ACT_LINK_REQ),
+		[MRP_EV_TOPO_RX] = STAY(MRP_ACT_CLEAR_FDB),
+	},
+};
+
+static const struct mrp_sm_transition
+mrp_mim_table[][MRP_EV_MAX] = {
+	[MRP_MIM_STATE_AC_STAT1] = {
+		[MRP_EV_UP_RC] = GOTO(MRP_MIM_STATE_CHK_IC,
+				      MRP_ACT_I_BLK, MRP_ACT_IN_TEST_RESET,
+				      MRP_ACT_IN_TEST_REQ),
+		[MRP_EV_UP_LC] = GOTO(MRP_MIM_STATE_CHK_IC,
+				      MRP_ACT_IN_LINK_STATUS_RESET,
+				      MRP_ACT_I_BLK,
+				      MRP_ACT_IN_LINK_STATUS_REQ),
+	},
+	[MRP_MIM_STATE_CHK_IO] = {
+		[MRP_EV_DOWN_RC] = GOTO(MRP_MIM_STATE_AC_STAT1,
+					MRP_ACT_I_BLK, MRP_ACT_IN_TOPO_REQ,
+					MRP_ACT_IN_TEST_REQ),
+		[MRP_EV_DOWN_LC] = GOTO(MRP_MIM_STATE_AC_STAT1,
+					MRP_ACT_I_BLK,
+					MRP_ACT_IN_LINK_STATUS_STOP),
+		[MRP_EV_IN_TEST_EXP] = STAY(MRP_ACT_IN_TEST_REQ),
+		[MRP_EV_IN_TEST_EXP_MAX] = STAY(MRP_ACT_IN_TEST_REQ),
+	},
+	[MRP_MIM_STATE_CHK_IC] = {
+		[MRP_EV_DOWN_RC] = GOTO(MRP_MIM_STATE_AC_STAT1,
+					MRP_ACT_I_BLK, MRP_ACT_IN_TOPO_REQ,
+					MRP_ACT_IN_TEST_REQ),
+		[MRP_EV_DOWN_LC] = GOTO(MRP_MIM_STATE_AC_STAT1,
+					MRP_ACT_I_BLK),
+		[MRP_EV_IN_TEST_EXP] = STAY(MRP_ACT_IN_TEST_MISSED,
+					    MRP_ACT_IN_TEST_REQ),
+		[MRP_EV_IN_TEST_EXP_MAX] = GOTO(MRP_MIM_STATE_CHK_IO,
+						MRP_ACT_I_FWD,
+						MRP_ACT_IN_TEST_RESET,
+						MRP_ACT_IN_TOPO_REQ,
+						MRP_ACT_IN_TEST_REQ,
+						MRP_ACT_IN_TRANSITION),
+	},
+};
+
+static const struct mrp_sm_transition
+mrp_mic_table[][MRP_EV_MAX] = {
+	[MRP_MIC_STATE_AC_STAT1] = {
+		[MRP_EV_UP_RC] = GOTO(MRP_MIC_STATE_PT,
+				      MRP_ACT_IN_LINK_RESET,
+				      MRP_ACT_IN_LINK_DOWN_STOP,
+				      MRP_ACT_IN_LINK_UP_START,
+				      MRP_ACT_IN_LINK_REQ),
+		[MRP_EV_UP_LC] = GOTO(MRP_MIC_STATE_PT,
+				      MRP_ACT_IN_LINK_RESET,
+				      MRP_ACT_IN_LINK_DOWN_STOP,
+				      MRP_ACT_IN_LINK_UP_START,
+				      MRP_ACT_IN_LINK_REQ),
+	},
+	[MRP_MIC_STATE_PT] = {
+		[MRP_EV_DOWN_RC] = GOTO(MRP_MIC_STATE_AC_STAT1,
+					MRP_ACT_IN_LINK_RESET,
+					MRP_ACT_IN_LINK_UP_STOP, MRP_ACT_I_BLK,
+					MRP_ACT_IN_LINK_DOWN_START,
+					MRP_ACT_IN_LINK_REQ),
+		[MRP_EV_DOWN_LC] = GOTO(MRP_MIC_STATE_AC_STAT1,
+					MRP_ACT_IN_LINK_RESET,
+					MRP_ACT_IN_LINK_UP_STOP, MRP_ACT_I_BLK,
+					MRP_ACT_IN_LINK_DOWN_START,
+					MRP_ACT_IN_LINK_REQ),
+	},
+	[MRP_MIC_STATE_IP_IDLE] = {
+		[MRP_EV_DOWN_RC] = GOTO(MRP_MIC_STATE_AC_STAT1,
+					MRP_ACT_IN_LINK_RESET, MRP_ACT_I_BLK,
+					MRP_ACT_IN_LINK_DOWN_START,
+					MRP_ACT_IN_LINK_REQ),
+		[MRP_EV_DOWN_LC] = GOTO(MRP_MIC_STATE_AC_STAT1,
+					MRP_ACT_IN_LINK_RESET,
+					MRP_ACT_IN_LINK_UP_STOP, MRP_ACT_I_BLK,
+					MRP_ACT_IN_LINK_DOWN_START,
+					MRP_ACT_IN_LINK_REQ),
+	},
+};
+
+#undef STAY
+#undef GOTO
+
+/* Parameters of the event being handled */
+struct mrp_sm_arg {
+	bool		up;		/* link changes */
+	uint32_t	interval;	/* received MRP_TopologyChange, us */
+};
+
+static void mrp_sm_action(struct mrp *mrp, const struct mrp_sm_arg *arg,
+			  uint8_t action)
+{
+	struct mrp_port *tmp;
+
+	switch (action) {
+	case MRP_ACT_SWAP:
+		tmp = mrp->p_port;
+		mrp->p_port = mrp->s_port;
+		mrp->s_port = tmp;
+		break;
+	case MRP_ACT_P_FWD:
+		mrp_port_set_state(mrp->p_port, BR_MRP_PORT_STATE_FORWARDING);
+		break;
+	case MRP_ACT_P_BLK:
+		mrp_port_set_state(mrp->p_port, BR_MRP_PORT_STATE_BLOCKED);
+		break;
+	case MRP_ACT_S_FWD:
+		mrp_port_set_state(mrp->s_port, BR_MRP_PORT_STATE_FORWARDING);
+		break;
+	case MRP_ACT_S_BLK:
+		mrp_port_set_state(mrp->s_port, BR_MRP_PORT_STATE_BLOCKED);
+		break;
+	case MRP_ACT_I_FWD:
+		mrp_port_set_state(mrp->i_port, BR_MRP_PORT_STATE_FORWARDING);
+		break;
+	case MRP_ACT_I_BLK:
+		mrp_port_set_state(mrp->i_port, BR_MRP_PORT_STATE_BLOCKED);
+		break;
+
+	case MRP_ACT_TEST_REQ:
+		mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+		break;
+	case MRP_ACT_TEST_STOP:
+		mrp_ring_test_stop(mrp);
+		break;
+	case MRP_ACT_TEST_CHK_RC:
+		mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
+		mrp->ring_test_curr = 0;
+		mrp->no_tc = true;
+		break;
+	case MRP_ACT_TEST_RESET:
+		mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
+		mrp->ring_test_curr = 0;
+		break;
+	case MRP_ACT_TEST_MISSED:
+		mrp->ring_test_curr++;
+		mrp->cnt.ring_test_missed++;
+		mrp_flight_record(&mrp->flight, MRP_FLIGHT_TIMER, 0,
+				  MRP_FLIGHT_TIMER_RING_TEST);
+		break;
+	case MRP_ACT_TEST_NO_ADD:
+		mrp->add_test = false;
+		break;
+	case MRP_ACT_TC:
+		mrp->no_tc = false;
+		break;
+	case MRP_ACT_TOPO_REQ:
+		mrp_ring_topo_req(mrp, mrp->ring_topo_conf_interval);
+		break;
+	case MRP_ACT_TOPO_REQ_REACT:
+		mrp_ring_topo_req(mrp, mrp->react_on_link_change ? 0 :
+				  mrp->ring_topo_conf_interval);
+		break;
+	case MRP_ACT_TOPO_REQ_TC:
+		if (!mrp->no_tc)
+			mrp_ring_topo_req(mrp, mrp->ring_topo_conf_interval);
+		break;
+	case MRP_ACT_TRANSITION:
+		mrp_ring_transition(mrp);
+		break;
+	case MRP_ACT_CLEAR_FDB:
+		mrp_clear_fdb_start(mrp, arg->interval);
+		break;
+
+	case MRP_ACT_LINK_RESET:
+		mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+		break;
+	case MRP_ACT_LINK_UP_START:
+		mrp_ring_link_up_start(mrp, mrp->ring_link_conf_interval);
+		break;
+	case MRP_ACT_LINK_UP_STOP:
+		mrp_ring_link_up_stop(mrp);
+		break;
+	case MRP_ACT_LINK_DOWN_START:
+		mrp_ring_link_down_start(mrp, mrp->ring_link_conf_interval);
+		break;
+	case MRP_ACT_LINK_DOWN_STOP:
+		mrp_ring_link_down_stop(mrp);
+		break;
+	case MRP_ACT_LINK_REQ:
+		mrp_ring_link_req(mrp->p_port, arg->up,
+				  mrp->ring_link_curr_max *
+				  mrp->ring_link_conf_interval);
+		break;
+
+	case MRP_ACT_IN_TEST_RESET:
+		mrp->in_test_curr_max = mrp->in_test_conf_max - 1;
+		mrp->in_test_curr = 0;
+		break;
+	case MRP_ACT_IN_TEST_MISSED:
+		mrp->in_test_curr++;
+		mrp->cnt.in_test_missed++;
+		mrp_flight_record(&mrp->flight, MRP_FLIGHT_TIMER, 0,
+				  MRP_FLIGHT_TIMER_IN_TEST);
+		break;
+	case MRP_ACT_IN_TEST_REQ:
+		mrp_in_test_req(mrp, mrp->in_test_conf_interval);
+		break;
+	case MRP_ACT_IN_TOPO_REQ:
+		mrp_in_topo_req(mrp, mrp->in_topo_conf_interval);
+		break;
+	case MRP_ACT_IN_TRANSITION:
+		mrp_in_transition(mrp);
+		break;
+	case MRP_ACT_IN_LINK_STATUS_RESET:
+		mrp->in_link_status_curr_max = mrp->in_link_status_conf_max;
+		break;
+	case MRP_ACT_IN_LINK_STATUS_REQ:
+		mrp_in_link_status_req(mrp, mrp->in_link_status_conf_interval);
+		break;
+	case MRP_ACT_IN_LINK_STATUS_STOP:
+		mrp_in_link_status_stop(mrp);
+		break;
+
+	case MRP_ACT_IN_LINK_RESET:
+		mrp->in_link_curr_max = mrp->in_link_conf_max;
+		break;
+	case MRP_ACT_IN_LINK_UP_START:
+		mrp_in_link_up_start(mrp, mrp->in_link_conf_interval);
+		break;
+	case MRP_ACT_IN_LINK_UP_STOP:
+		mrp_in_link_up_stop(mrp);
+		break;
+	case MRP_ACT_IN_LINK_DOWN_START:
+		mrp_in_link_down_start(mrp, mrp->in_link_conf_interval);
+		break;
+	case MRP_ACT_IN_LINK_DOWN_STOP:
+		mrp_in_link_down_stop(mrp);
+		break;
+	case MRP_ACT_IN_LINK_REQ:
+		mrp_in_link_req(mrp, arg->up, mrp->in_link_conf_max *
+				mrp->in_link_conf_interval);
+		break;
+	}
+}
+
+/* Runs the actions of the transition and returns true if the state must be
+ * changed to t->next.
+ */
+static bool mrp_sm_run(struct mrp *mrp, const struct mrp_sm_arg *arg,
+		       const struct mrp_sm_transition *t)
+{
+	int i;
+
+	if (!t->valid)
+		return false;
+
+	for (i = 0; i < MRP_SM_MAX_ACTIONS && t->actions[i]; i++)
+		mrp_sm_action(mrp, arg, t->actions[i]);
+
+	return t->next != MRP_SM_STAY;
+}
+
+static int mrp_ring_link_event(struct mrp_port *p, bool up)
+{
+	if (up)
+		return p == p->mrp->p_port ? MRP_EV_UP_P : MRP_EV_UP_S;
+	return p == p->mrp->p_port ? MRP_EV_DOWN_P : MRP_EV_DOWN_S;
+}
+
+static int mrp_in_link_event(struct mrp *mrp, bool up)
+{
+	if (mrp->in_mode == MRP_IN_MODE_RC)
+		return up ? MRP_EV_UP_RC : MRP_EV_DOWN_RC;
+	return up ? MRP_EV_UP_LC : MRP_EV_DOWN_LC;
+}
+
+/* Represents the state machine for when a MRP_Test frame was received on one
+ * of the MRP ports and the MRP instance has the role MRM.
+ */
+void mrp_mrm_recv_ring_test(struct mrp *mrp)
+{
+	const struct mrp_sm_transition *t;
+	struct mrp_sm_arg arg = { 0 };
+
+	mrp->ring_test_rx_ts = mrp_time_us() * 1000;
+
+	t = &mrp_mrm_table[mrp->mrm_state][MRP_EV_TEST_RX];
+	if (mrp_sm_run(mrp, &arg, t))
+		mrp_set_mrm_state(mrp, t->next);
+}
+
+/* Represents the state machine for when a MRP_TopologyChange frame was
+ * received on one of the MRP ports and the MRP instance has the role MRC
+ */
+void mrp_mrc_recv_ring_topo(struct mrp_port *p, const struct mrp_frame *f)
+{
+	struct mrp_sm_arg arg = { .interval = f->interval * 1000 };
+	struct mrp *mrp = p->mrp;
+	const struct mrp_sm_transition *t;
+
+	trace("port: %u, mrc state: %s", p->ifindex,
+	      mrp_get_mrc_state(mrp->mrc_state));
+
+	t = &mrp_mrc_table[mrp->mrc_state][MRP_EV_TOPO_RX];
+	if (mrp_sm_run(mrp, &arg, t))
+		mrp_set_mrc_state(mrp, t->next);
+}
+
+/* Represents the state machine for when MRP instance has the role MRM and the
+ * link of one of the MRP ports is changed.
+ */
+void mrp_mrm_port_link(struct mrp_port *p, bool up)
+{
+	struct mrp *mrp = p->mrp;
+	struct mrp_sm_arg arg = { .up = up };
+	const struct mrp_sm_transition *t;
+
+	pr_debug("port: %s, up: %d, mrm_state: %s",
+	        p->ifname, up, mrp_get_mrm_state(mrp->mrm_state));
+
+	t = &mrp_mrm_table[mrp->mrm_state][mrp_ring_link_event(p, up)];
+	if (mrp_sm_run(mrp, &arg, t))
+		mrp_set_mrm_state(mrp, t->next);
+}
+
+/* Represents the state machine for when MRP instance has the role MRC and the
+ * link of one of the MRP ports is changed.
+ */
+void mrp_mrc_port_link(struct mrp_port *p, bool up)
+{
+	struct mrp *mrp = p->mrp;
+	struct mrp_sm_arg arg = { .up = up };
+	const struct mrp_sm_transition *t;
+
+	pr_debug("port: %s up: %d, mrc_state: %s",
+	        p->ifname, up, mrp_get_mrc_state(mrp->mrc_state));
+
+	t = &mrp_mrc_table[mrp->mrc_state][mrp_ring_link_event(p, up)];
+	if (mrp_sm_run(mrp, &arg, t))
+		mrp_set_mrc_state(mrp, t->next);
+}
+
+/* Represents the state machine for when MRP instance has the role MIM and the
+ * link of one of the MRP ports is changed.
+ */
+void mrp_mim_port_link(struct mrp_port *p, bool up)
+{
+	struct mrp *mrp = p->mrp;
+	struct mrp_sm_arg arg = { .up = up };
+	const struct mrp_sm_transition *t;
+
+	pr_debug("up: %d, mim_state: %s",
+	        up, mrp_get_mim_state(mrp->mim_state));
+
+	t = &mrp_mim_table[mrp->mim_state][mrp_in_link_event(mrp, up)];
+	if (mrp_sm_run(mrp, &arg, t))
+		mrp_set_mim_state(mrp, t->next);
+
+	pr_debug("new mim_state: %s", mrp_get_mim_state(mrp->mim_state));
+}
+
+/* Represents the state machine for when MRP instance has the role MIC and the
+ * link of one of the MRP ports is changed.
+ */
+void mrp_mic_port_link(struct mrp_port *p, bool up)
+{
+	struct mrp *mrp = p->mrp;
+	struct mrp_sm_arg arg = { .up = up };
+	const struct mrp_sm_transition *t;
+
+	trace("up: %d, mic_state: %s",
+	      up, mrp_get_mic_state(mrp->mic_state));
+
+	t = &mrp_mic_table[mrp->mic_state][mrp_in_link_event(mrp, up)];
+	if (mrp_sm_run(mrp, &arg, t))
+		mrp_set_mic_state(mrp, t->next);
+
+	pr_debug("new mic_state: %s", mrp_get_mic_state(mrp->mic_state));
+}
+
+/* Represents the state machine for when the MRP_Test timer expired and the
+ * MRP instance has the role MRM.
+ */
+void mrp_mrm_ring_test_expired(struct mrp *mrp)
+{
+	const struct mrp_sm_transition *t;
+	struct mrp_sm_arg arg = { 0 };
+	int ev;
+
+	ev = mrp->ring_test_curr >= mrp->ring_test_curr_max ?
+	     MRP_EV_TEST_EXP_MAX : MRP_EV_TEST_EXP;
+
+	t = &mrp_mrm_table[mrp->mrm_state][ev];
+	if (mrp_sm_run(mrp, &arg, t))
+		mrp_set_mrm_state(mrp, t->next);
+}
+
+/* Represents the state machine for when the MRP_InTest timer expired and the
+ * MRP instance has the role MIM.
+ */
+void mrp_mim_in_test_expired(struct mrp *mrp)
+{
+	const struct mrp_sm_transition *t;
+	struct mrp_sm_arg arg = { 0 };
+	int ev;
+
+	ev = mrp->in_test_curr >= mrp->in_test_curr_max ?
+	     MRP_EV_IN_TEST_EXP_MAX : MRP_EV_IN_TEST_EXP;
+
+	t = &mrp_mim_table[mrp->mim_state][ev];
+	if (mrp_sm_run(mrp, &arg, t))
+		mrp_set_mim_state(mrp, t->next);
+}
@@ -0,0 +1,445 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_cls.h>
+#include <linux/gen_stats.h>
+
+#include "tc.h"
+#include "utils.h"
+#include "linux.h"
+#include "libnetlink.h"
+#include "list.h"
+#include "loop.h"
+
+/* The default bands of pfifo_fast, shifted past the launch time and the
+ * MRP bands
+ */
+#define TC_MRP_BANDS		5
+static const uint8_t tc_mrp_priomap[TC_PRIO_MAX + 1] = {
+	3, 4, 4, 4, 3, 4, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3
+};
+
+#define TC_MRP_FILTER_PRIO	1
+
+/* Used by the main loop only, the shards never wait for the kernel */
+static struct rtnl_handle rth = { .fd = -1 };
+static bool qos;
+
+/* The ports with the qdiscs in place, written by the main loop and read by
+ * the shards
+ */
+struct tc_port {
+	struct list_head	list;
+	int			ifindex;
+	int			refs;
+	bool			owned;		/* added by us */
+	bool			txtime;		/* with the ETF qdisc */
+};
+
+static LIST_HEAD(tc_ports);
+static pthread_mutex_t tc_ports_lock;
+
+struct tc_request {
+	struct nlmsghdr		n;
+	struct tcmsg		t;
+	char			buf[256];
+};
+
+/* The qdiscs and the filters of a port, as found by tc_dump() */
+struct tc_layout {
+	int			ifindex;
+	uint32_t		root;		/* handle, 0 if the default one */
+	char			root_kind[16];
+	bool			etf;		/* under TC_MRP_TXTIME_CLASS */
+	bool			filter;		/* to TC_MRP_CLASS */
+};
+
+static void tc_prepare(struct tc_request *req, int cmd, int flags,
+		       int ifindex, uint32_t parent, uint32_t handle,
+		       const char *kind)
+{
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST | flags;
+	req->n.nlmsg_type = cmd;
+	req->t.tcm_family = AF_UNSPEC;
+	req->t.tcm_ifindex = ifindex;
+	req->t.tcm_parent = parent;
+	req->t.tcm_handle = handle;
+
+	if (kind)
+		addattr_l(&req->n, sizeof(*req), TCA_KIND, kind,
+			  strlen(kind) + 1);
+}
+
+static int tc_dump_filter(struct nlmsghdr *n, void *arg)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_MAX + 1];
+	struct rtattr *opt[TCA_BASIC_MAX + 1];
+	struct tc_layout *l = arg;
+	const char *kind;
+
+	if (len < 0 || t->tcm_ifindex != l->ifindex)
+		return 0;
+
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	if (!tb[TCA_KIND])
+		return 0;
+	kind = rta_getattr_str(tb[TCA_KIND]);
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWQDISC:
+		if (t->tcm_parent == TC_H_ROOT) {
+			l->root = t->tcm_handle;
+			snprintf(l->root_kind, sizeof(l->root_kind), "%s",
+				 kind);
+		} else if (t->tcm_parent == TC_MRP_TXTIME_CLASS &&
+			   !strcmp(kind, "etf")) {
+			l->etf = true;
+		}
+		break;
+	case RTM_NEWTFILTER:
+		if (strcmp(kind, "basic") || !tb[TCA_OPTIONS] ||
+		    TC_H_MIN(t->tcm_info) != htons(ETH_P_MRP))
+			break;
+
+		parse_rtattr_nested(opt, TCA_BASIC_MAX, tb[TCA_OPTIONS]);
+		if (opt[TCA_BASIC_CLASSID] &&
+		    rta_getattr_u32(opt[TCA_BASIC_CLASSID]) == TC_MRP_CLASS)
+			l->filter = true;
+		break;
+	}
+
+	return 0;
+}
+
+/* Asks the kernel for one qdisc of the port, not for all of the host */
+static int tc_get_qdisc(struct tc_layout *l, uint32_t parent)
+{
+	struct tc_request req = { 0 };
+	struct nlmsghdr *answer;
+	int err;
+
+	tc_prepare(&req, RTM_GETQDISC, 0, l->ifindex, parent, 0, NULL);
+
+	err = rtnl_talk(&rth, &req.n, &answer);
+	if (err < 0)
+		return err;
+
+	tc_dump_filter(answer, l);
+	free(answer);
+
+	return 0;
+}
+
+static int tc_dump(struct tc_layout *l)
+{
+	struct tcmsg t = { .tcm_family = AF_UNSPEC };
+	int err;
+
+	err = tc_get_qdisc(l, TC_H_ROOT);
+	if (err < 0 || l->root != TC_MRP_HANDLE)
+		return err;
+
+	err = tc_get_qdisc(l, TC_MRP_TXTIME_CLASS);
+	if (err < 0)
+		return err;
+
+	/* The filters are dumped by device and parent */
+	t.tcm_ifindex = l->ifindex;
+	t.tcm_parent = TC_MRP_HANDLE;
+	err = rtnl_dump_request(&rth, RTM_GETTFILTER, &t, sizeof(t));
+	if (err < 0)
+		return err;
+
+	return rtnl_dump_filter(&rth, tc_dump_filter, l);
+}
+
+static bool tc_check(const struct tc_layout *l, uint32_t etf_delta_ns)
+{
+	return l->root == TC_MRP_HANDLE && !strcmp(l->root_kind, "prio") &&
+	       l->filter && (l->etf || !etf_delta_ns);
+}
+
+static int tc_add_prio(int ifindex)
+{
+	struct tc_prio_qopt opt = { .bands = TC_MRP_BANDS };
+	struct tc_request req = { 0 };
+
+	memcpy(opt.priomap, tc_mrp_priomap, sizeof(opt.priomap));
+
+	tc_prepare(&req, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL, ifindex,
+		   TC_H_ROOT, TC_MRP_HANDLE, "prio");
+	addattr_l(&req.n, sizeof(req), TCA_OPTIONS, &opt, sizeof(opt));
+
+	return rtnl_talk(&rth, &req.n, NULL);
+}
+
+/* Matches all the frames with the MRP EtherType */
+static int tc_add_filter(int ifindex)
+{
+	struct tc_request req = { 0 };
+	struct rtattr *tail;
+
+	tc_prepare(&req, RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_EXCL, ifindex,
+		   TC_MRP_HANDLE, 0, "basic");
+	req.t.tcm_info = TC_H_MAKE(TC_MRP_FILTER_PRIO << 16, htons(ETH_P_MRP));
+	tail = addattr_nest(&req.n, sizeof(req), TCA_OPTIONS);
+	addattr32(&req.n, sizeof(req), TCA_BASIC_CLASSID, TC_MRP_CLASS);
+	addattr_nest_end(&req.n, tail);
+
+	return rtnl_talk(&rth, &req.n, NULL);
+}
+
+/* Software mode: the frames are released delta_ns before their launch
+ * time, on CLOCK_TAI as the packet sockets.
+ */
+static int tc_add_etf(int ifindex, uint32_t delta_ns)
+{
+	struct tc_etf_qopt opt = {
+		.delta = delta_ns,
+		.clockid = CLOCK_TAI,
+	};
+	struct tc_request req = { 0 };
+	struct rtattr *tail;
+
+	tc_prepare(&req, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL, ifindex,
+		   TC_MRP_TXTIME_CLASS, 0, "etf");
+	tail = addattr_nest(&req.n, sizeof(req), TCA_OPTIONS);
+	addattr_l(&req.n, sizeof(req), TCA_ETF_PARMS, &opt, sizeof(opt));
+	addattr_nest_end(&req.n, tail);
+
+	return rtnl_talk(&rth, &req.n, NULL);
+}
+
+/* The kernel puts the default root qdisc back */
+static void tc_mrp_del(int ifindex)
+{
+	struct tc_request req = { 0 };
+
+	tc_prepare(&req, RTM_DELQDISC, 0, ifindex, TC_H_ROOT, TC_MRP_HANDLE,
+		   NULL);
+
+	if (rtnl_talk(&rth, &req.n, NULL) < 0)
+		pr_warn("cannot delete the qdisc of ifindex %d", ifindex);
+}
+
+/* A root qdisc set up by the administrator is never replaced, it is used
+ * only if it has the layout described in tc.h. Once added, the layout is
+ * read back from the kernel. Returns 1 if the qdiscs have been added, 0 if
+ * they were already there.
+ */
+static int tc_mrp_add(int ifindex, uint32_t etf_delta_ns)
+{
+	struct tc_layout l = { .ifindex = ifindex };
+	int err;
+
+	err = tc_dump(&l);
+	if (err < 0)
+		return err;
+
+	if (tc_check(&l, etf_delta_ns))
+		return 0;
+	if (l.root)
+		return -EBUSY;
+
+	err = tc_add_prio(ifindex);
+	if (err < 0)
+		return err;
+
+	err = tc_add_filter(ifindex);
+	if (!err && etf_delta_ns)
+		err = tc_add_etf(ifindex, etf_delta_ns);
+
+	if (!err) {
+		memset(&l, 0, sizeof(l));
+		l.ifindex = ifindex;
+		err = tc_dump(&l);
+		if (!err && !tc_check(&l, etf_delta_ns))
+			err = -EIO;
+	}
+
+	if (err < 0) {
+		tc_mrp_del(ifindex);
+		return err;
+	}
+
+	return 1;
+}
+
+static int tc_stats_filter(struct nlmsghdr *n, void *arg)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_MAX + 1];
+	struct rtattr *stats[TCA_STATS_MAX + 1];
+	struct tc_mrp_stats *st = arg;
+	struct gnet_stats_queue queue;
+	uint32_t *drops;
+
+	if (n->nlmsg_type != RTM_NEWTCLASS || len < 0)
+		return 0;
+
+	if (t->tcm_handle == TC_MRP_CLASS)
+		drops = &st->mrp_drops;
+	else if (t->tcm_handle == TC_MRP_TXTIME_CLASS)
+		drops = &st->txtime_drops;
+	else
+		return 0;
+
+	parse_rtattr(tb, TCA_MAX, TCA_RTA(t), len);
+	if (!tb[TCA_STATS2])
+		return 0;
+
+	parse_rtattr_nested(stats, TCA_STATS_MAX, tb[TCA_STATS2]);
+	if (!stats[TCA_STATS_QUEUE] ||
+	    RTA_PAYLOAD(stats[TCA_STATS_QUEUE]) < sizeof(queue))
+		return 0;
+
+	memcpy(&queue, RTA_DATA(stats[TCA_STATS_QUEUE]), sizeof(queue));
+	*drops = queue.drops;
+
+	return 0;
+}
+
+/* The classes of the prio qdisc report the statistics of their qdiscs */
+int tc_mrp_stats(int ifindex, struct tc_mrp_stats *st)
+{
+	struct tcmsg t = {
+		.tcm_family = AF_UNSPEC,
+		.tcm_ifindex = ifindex,
+	};
+	int err;
+
+	memset(st, 0, sizeof(*st));
+
+	err = rtnl_dump_request(&rth, RTM_GETTCLASS, &t, sizeof(t));
+	if (err < 0)
+		return err;
+
+	return rtnl_dump_filter(&rth, tc_stats_filter, st);
+}
+
+static struct tc_port *tc_port_find(int ifindex)
+{
+	struct tc_port *tp;
+
+	list_for_each_entry(tp, &tc_ports, list) {
+		if (tp->ifindex == ifindex)
+			return tp;
+	}
+
+	return NULL;
+}
+
+int tc_port_get(int ifindex, uint32_t etf_delta_ns)
+{
+	struct tc_port *tp;
+	int err;
+
+	tp = tc_port_find(ifindex);
+	if (tp) {
+		tp->refs++;
+		return 0;
+	}
+
+	tp = calloc(1, sizeof(*tp));
+	if (!tp)
+		return -ENOMEM;
+
+	err = tc_mrp_add(ifindex, etf_delta_ns);
+	/* Without sch_etf the MRP band is still worth having */
+	if (err < 0 && etf_delta_ns && qos) {
+		pr_warn("ifindex %d: cannot set up the ETF qdisc", ifindex);
+		etf_delta_ns = 0;
+		err = tc_mrp_add(ifindex, 0);
+	}
+	if (err < 0) {
+		pr_warn("ifindex %d: cannot set up the MRP qdiscs", ifindex);
+		free(tp);
+		return err;
+	}
+
+	tp->ifindex = ifindex;
+	tp->refs = 1;
+	tp->owned = err > 0;
+	tp->txtime = etf_delta_ns != 0;
+
+	pthread_mutex_lock(&tc_ports_lock);
+	list_add_tail(&tp->list, &tc_ports);
+	pthread_mutex_unlock(&tc_ports_lock);
+
+	return 0;
+}
+
+void tc_port_put(int ifindex)
+{
+	struct tc_port *tp;
+
+	tp = tc_port_find(ifindex);
+	if (!tp || --tp->refs > 0)
+		return;
+
+	pthread_mutex_lock(&tc_ports_lock);
+	list_del(&tp->list);
+	pthread_mutex_unlock(&tc_ports_lock);
+
+	if (tp->owned)
+		tc_mrp_del(ifindex);
+	free(tp);
+}
+
+bool tc_port_lookup(int ifindex, bool *txtime)
+{
+	struct tc_port *tp;
+
+	pthread_mutex_lock(&tc_ports_lock);
+	tp = tc_port_find(ifindex);
+	if (tp)
+		*txtime = tp->txtime;
+	pthread_mutex_unlock(&tc_ports_lock);
+
+	return tp != NULL;
+}
+
+bool tc_qos_enabled(void)
+{
+	return qos;
+}
+
+int tc_init(bool on)
+{
+	if (rtnl_open(&rth, 0) < 0) {
+		pr_err("Cannot open rtnetlink");
+		return -1;
+	}
+	mrp_mutex_init(&tc_ports_lock);
+	qos = on;
+
+	return 0;
+}
+
+/* Called once the shard threads are stopped */
+void tc_cleanup(void)
+{
+	struct tc_port *tp, *tmp;
+
+	list_for_each_entry_safe(tp, tmp, &tc_ports, list) {
+		if (tp->owned)
+			tc_mrp_del(tp->ifindex);
+		list_del(&tp->list);
+		free(tp);
+	}
+
+	rtnl_close(&rth);
+	qos = false;
+}
@@ -0,0 +1,55 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef TC_H
+#define TC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/pkt_sched.h>
+
+/*
+ * Egress qdiscs of the MRP ports
+ *
+ * The root qdisc is a prio one with the TC_MRP_HANDLE handle:
+ * - its first band holds the ETF qdisc enforcing the launch time of the
+ *   MRP_Test frames, which reach it by setting their priority to
+ *   TC_MRP_TXTIME_CLASS;
+ * - the second one holds the MRP frames, steered there by a filter on
+ *   their EtherType, so they never queue behind the data;
+ * - all the other traffic is mapped to the following bands as pfifo_fast
+ *   does.
+ */
+
+#define TC_MRP_HANDLE		TC_H_MAKE(0x88e3U << 16, 0)
+#define TC_MRP_TXTIME_CLASS	TC_H_MAKE(TC_MRP_HANDLE, 1)
+#define TC_MRP_CLASS		TC_H_MAKE(TC_MRP_HANDLE, 2)
+
+/* Frames dropped by the qdiscs of the bands */
+struct tc_mrp_stats {
+	uint32_t		mrp_drops;
+	uint32_t		txtime_drops;
+};
+
+/* The qdiscs are set up and removed by the main loop, so that the shards
+ * never wait for the kernel:
+ * - tc_port_get() adds them, with the ETF one only if etf_delta_ns is not 0,
+ *   and takes a reference on them. With QoS enabled the MRP band is kept
+ *   when the ETF qdisc cannot be added;
+ * - tc_port_put() drops it, the qdiscs we added go with the last one;
+ * - tc_port_lookup() tells the shards if they are in place.
+ */
+int tc_port_get(int ifindex, uint32_t etf_delta_ns);
+void tc_port_put(int ifindex);
+bool tc_port_lookup(int ifindex, bool *txtime);
+
+/* Called on the main loop only */
+int tc_mrp_stats(int ifindex, struct tc_mrp_stats *st);
+
+/* True if the MRP band must be set up also without the ETF qdisc */
+bool tc_qos_enabled(void);
+
+int tc_init(bool qos);
+void tc_cleanup(void);
+
+#endif /* TC_H */
@@ -0,0 +1,428 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+/*
+ * Checks that the decision table returned by mrp_decide() matches, for every
+ * role, port state, receiving port, TLV type and frame key, the checks done
+ * on each received frame before the table. They are copied below from
+ * state_machine.c as they were, only the forwarding returns the ports
+ * instead of sending the frame.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "state_machine.h"
+#include "pdu.h"
+
+int __debug_level;
+
+static const uint8_t own_sa[ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t other_sa[ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+
+#define OWN_IN_ID	0x1234
+
+static bool ref_is_ring_port(const struct mrp_port *p)
+{
+	return p->role == BR_MRP_PORT_ROLE_PRIMARY ||
+	       p->role == BR_MRP_PORT_ROLE_SECONDARY;
+}
+
+static bool ref_is_in_port(const struct mrp_port *p)
+{
+	return p->role == BR_MRP_PORT_ROLE_INTER;
+}
+
+/* Determins if a port is part of a MRP instance */
+static bool ref_is_mrp_port(const struct mrp_port *p)
+{
+	if (!p->mrp)
+		return false;
+
+	return true;
+}
+
+/* Check if the MRP frame needs to be dropped */
+static bool ref_should_drop(const struct mrp_port *p,
+			    const struct mrp_frame *f)
+{
+	enum br_mrp_tlv_header_type type = f->type;
+
+	/* All frames should be dropped if the state of the port is disabled */
+	if (p->state == BR_MRP_PORT_STATE_DISABLED)
+		return true;
+
+	/* If receiving a MRP frame on a port which is not in MRP ring
+	 * then the frame should be drop
+	 */
+	if (!ref_is_mrp_port(p))
+		return true;
+
+	/* In case the port is in blocked state then the kernel
+	 * will drop all NON-MRP frames and it would send all
+	 * MRP frames to the upper layer. So here is needed to drop MRP frames
+	 * if the port is in blocked state.
+	 */
+	if (ref_is_ring_port(p) && p->state == BR_MRP_PORT_STATE_BLOCKED &&
+	    type != BR_MRP_TLV_HEADER_RING_TOPO &&
+	    type != BR_MRP_TLV_HEADER_RING_TEST &&
+	    type != BR_MRP_TLV_HEADER_RING_LINK_UP &&
+	    type != BR_MRP_TLV_HEADER_RING_LINK_DOWN &&
+	    type != BR_MRP_TLV_HEADER_IN_TOPO &&
+	    type != BR_MRP_TLV_HEADER_IN_LINK_UP &&
+	    type != BR_MRP_TLV_HEADER_IN_LINK_DOWN &&
+	    type != BR_MRP_TLV_HEADER_OPTION)
+		return true;
+
+	if (ref_is_in_port(p) && p->state == BR_MRP_PORT_STATE_BLOCKED &&
+	    type != BR_MRP_TLV_HEADER_IN_TEST &&
+	    type != BR_MRP_TLV_HEADER_IN_LINK_UP &&
+	    type != BR_MRP_TLV_HEADER_IN_LINK_DOWN &&
+	    type != BR_MRP_TLV_HEADER_IN_TOPO)
+		return true;
+
+	return false;
+}
+
+/* Check if the MRP frame needs to be process. It depends of the MRP instance
+ * role and the frame type if the frame needs to be processed or not.
+ */
+static bool ref_should_process(const struct mrp_port *p,
+			       const struct mrp_frame *f)
+{
+	struct mrp *mrp = p->mrp;
+
+	switch (f->type) {
+	case BR_MRP_TLV_HEADER_RING_TEST:
+		if (mrp->ring_role == BR_MRP_RING_ROLE_MRM ||
+		    (mrp->ring_role == BR_MRP_RING_ROLE_MRC && mrp->mra_support))
+			return true;
+		break;
+	case BR_MRP_TLV_HEADER_RING_LINK_DOWN:
+	case BR_MRP_TLV_HEADER_RING_LINK_UP:
+		if (mrp->ring_role == BR_MRP_RING_ROLE_MRM)
+			return true;
+		break;
+	case BR_MRP_TLV_HEADER_RING_TOPO:
+		if (mrp->ring_role == BR_MRP_RING_ROLE_MRC ||
+		    (mrp->ring_role == BR_MRP_RING_ROLE_MRM && mrp->mra_support))
+			return true;
+		break;
+	case BR_MRP_TLV_HEADER_OPTION:
+		if (mrp->mra_support)
+			return true;
+	case BR_MRP_TLV_HEADER_IN_TEST:
+		if (mrp->in_role == BR_MRP_IN_ROLE_MIM)
+			return true;
+		break;
+	case BR_MRP_TLV_HEADER_IN_TOPO:
+		if (mrp->in_role == BR_MRP_IN_ROLE_MIC ||
+		    mrp->in_role == BR_MRP_IN_ROLE_MIM ||
+		    mrp->ring_role == BR_MRP_RING_ROLE_MRM)
+			return true;
+		break;
+	case BR_MRP_TLV_HEADER_IN_LINK_UP:
+	case BR_MRP_TLV_HEADER_IN_LINK_DOWN:
+		if (mrp->in_role == BR_MRP_IN_ROLE_MIM)
+			return true;
+		break;
+	default:
+		break;
+	}
+
+	return false;
+}
+
+static bool ref_is_ring_frame(enum br_mrp_tlv_header_type type)
+{
+        if (type == BR_MRP_TLV_HEADER_RING_TEST ||
+            type == BR_MRP_TLV_HEADER_RING_TOPO ||
+            type == BR_MRP_TLV_HEADER_RING_LINK_DOWN ||
+            type == BR_MRP_TLV_HEADER_RING_LINK_UP ||
+            type == BR_MRP_TLV_HEADER_OPTION)
+                return true;
+
+        return false;
+}
+
+static bool ref_is_in_frame(enum br_mrp_tlv_header_type type)
+{
+        if (type == BR_MRP_TLV_HEADER_IN_TEST ||
+            type == BR_MRP_TLV_HEADER_IN_TOPO ||
+            type == BR_MRP_TLV_HEADER_IN_LINK_DOWN ||
+            type == BR_MRP_TLV_HEADER_IN_LINK_UP ||
+            type == BR_MRP_TLV_HEADER_IN_LINK_STATUS)
+                return true;
+
+        return false;
+}
+
+/* Check if the MRP frame needs to be forwarded and, if so, forward the frame.
+ *
+ * It depends of the MRP instance role and the frame type if the frame needs to
+ * be forwarded or not.
+ */
+static uint8_t ref_check_and_forward(const struct mrp_port *p,
+				     const struct mrp_frame *f)
+{
+	enum br_mrp_tlv_header_type type = f->type;
+	struct mrp *mrp = p->mrp;
+	struct mrp_port *forward_p_port = NULL;
+	struct mrp_port *forward_s_port = NULL;
+	struct mrp_port *forward_i_port = NULL;
+
+	/* Set the possible forwarding ways according to the receiving port */
+	if (p == mrp->p_port) {
+		forward_s_port = mrp->s_port;
+		forward_i_port = mrp->i_port;
+	} else if (p == mrp->s_port) {
+		forward_p_port = mrp->p_port;
+		forward_i_port = mrp->i_port;
+	} else if (p == mrp->i_port) {
+		forward_p_port = mrp->p_port;
+		forward_s_port = mrp->s_port;
+	}
+
+        if (ref_is_ring_frame(type)) {
+		/* We should not forward ring frames received from the
+		 * interconnection port.
+		 */
+		if (p == mrp->i_port)
+			return 0;
+
+		/* If the frame is a ring frame then it should not be forwarded
+		 * to the interconnection port.
+		 */
+		forward_i_port = NULL;
+
+		switch (mrp->ring_role) {
+		case BR_MRP_RING_ROLE_MRM:
+			/* If the role is MRM then don't forward the frames */
+			return 0;
+
+		case BR_MRP_RING_ROLE_MRC:
+			/* If the role is MRC and MRA support is not enabled
+			 * then don't forward Header Option frames.
+			 */
+			if (type == BR_MRP_TLV_HEADER_OPTION &&
+			    !mrp->mra_support)
+				return 0;
+			goto forward;
+
+		default:
+			break;
+		}
+	}
+
+        if (ref_is_in_frame(type)) {
+		switch (mrp->ring_role) {
+		case BR_MRP_RING_ROLE_MRM:
+			/* Nodes that behaves as MRM needs to stop forwarding
+			 * the frames in case the ring is closed, otherwise will			 * be a loop.
+			 * In this case the frame is no forward between the
+			 * ring ports, but the frame may still have a chance to
+			 * go to through the interconnection port!
+			 */
+			if ((mrp->p_port->state !=
+					BR_MRP_PORT_STATE_FORWARDING ||
+			     mrp->s_port->state !=
+					BR_MRP_PORT_STATE_FORWARDING) &&
+			    ref_is_ring_port(p)) {
+				forward_p_port = NULL;
+				forward_s_port = NULL;
+			}
+			break;
+
+		case BR_MRP_RING_ROLE_MRC:
+			/* A node that behaves as MRC should not forward
+			 * interconnect frames between its ring ports if
+			 * it has an interconnection roles (MIM or MIC)
+			 * that matches the frame interconnection ID.
+			 */
+			if ((mrp->in_role != BR_MRP_IN_ROLE_DISABLED) &&
+			    (mrp->in_id == f->in_id) &&
+			    ref_is_ring_port(p)) {
+				forward_p_port = NULL;
+				forward_s_port = NULL;
+			}
+			break;
+
+		default:
+			break;
+		}
+
+		switch (mrp->in_role) {
+		case BR_MRP_IN_ROLE_MIM:
+			if (type == BR_MRP_TLV_HEADER_IN_TEST) {
+                                /* MIM should not forward it's own InTest
+                                 * frames between its ports, but it should
+				 * forward others InTest frames between its
+				 * ring ports if they are not from the
+				 * interconnection port.
+                                 */
+				if (ether_addr_equal(f->sa, mrp->macaddr))
+					return 0;
+				else {
+	                                if (ref_is_in_port(p))
+	                                        return 0;
+					else
+	                                        forward_i_port = NULL;
+				}
+			} else {
+                                /* MIM should forward IntLinkChange/Status and
+                                 * IntTopoChange between ring ports, but MIM
+                                 * should not forward IntLinkChange/Status and
+                                 * IntTopoChange if the frame was received at
+                                 * the interconnect port
+                                 */
+                                if (ref_is_ring_port(p))
+                                        forward_i_port = NULL;
+
+                                if (ref_is_in_port(p))
+                                        return 0;
+			}
+			break;
+
+		case BR_MRP_IN_ROLE_MIC:
+                        /* MIC should forward InTest frames on all ports
+                         * regardless of the received port
+                         */
+			if (type == BR_MRP_TLV_HEADER_IN_TEST)
+                                goto forward;
+
+                        /* MIC should forward IntLinkChange frames only if they
+                         * are received on ring ports to all the ports
+                         */
+			if ((type == BR_MRP_TLV_HEADER_IN_LINK_UP ||
+			     type == BR_MRP_TLV_HEADER_IN_LINK_DOWN) &&
+			    ref_is_ring_port(p))
+				goto forward;
+
+                        /* MIC should forward IntLinkStatus frames only to
+                         * interconnect port if it was received on a ring port.
+                         * If it is received on interconnect port then, it
+                         * should be forward on both ring ports
+                         */
+			if (type == BR_MRP_TLV_HEADER_IN_LINK_STATUS &&
+			    ref_is_ring_port(p)) {
+				forward_p_port = NULL;
+				forward_s_port = NULL;
+				goto forward;
+			}
+
+                        /* Should forward the InTopo frames only between the
+                         * ring ports
+                         */
+			if (type == BR_MRP_TLV_HEADER_IN_TOPO) {
+				forward_i_port = NULL;
+				goto forward;
+			}
+
+			/* Otherwise don't forward the frames */
+			return 0;
+
+		default:
+			break;
+		}
+	}
+
+forward:
+	return (forward_p_port ? MRP_FWD_P : 0) |
+	       (forward_s_port ? MRP_FWD_S : 0) |
+	       (forward_i_port ? MRP_FWD_I : 0);
+}
+
+static struct mrp mrp;
+static struct mrp_port ports[3];
+static unsigned long checks, errors;
+
+static void check(struct mrp_port *p, int type, bool in_id, bool sa)
+{
+	const struct mrp_decision *d;
+	struct mrp_frame f = { .type = type };
+	uint8_t flags = 0, fwd = 0;
+
+	f.in_id = in_id ? OWN_IN_ID : OWN_IN_ID + 1;
+	memcpy(f.sa, sa ? own_sa : other_sa, ETH_ALEN);
+
+	if (ref_should_drop(p, &f)) {
+		flags = MRP_DECIDE_DROP;
+	} else {
+		if (ref_should_process(p, &f))
+			flags = MRP_DECIDE_PROCESS;
+		fwd = ref_check_and_forward(p, &f);
+	}
+
+	d = mrp_decide(p, &f);
+	checks++;
+	if (d->flags == flags && d->fwd == fwd)
+		return;
+
+	errors++;
+	fprintf(stderr, "ring_role %d mra %d in_role %d states %d/%d/%d "
+		"port %ld type %#x in_id %d sa %d: got %#x/%#x expected %#x/%#x\n",
+		mrp.ring_role, mrp.mra_support, mrp.in_role,
+		ports[0].state, ports[1].state, ports[2].state, p - ports,
+		type, in_id, sa, d->flags, d->fwd, flags, fwd);
+}
+
+static void check_ports(void)
+{
+	int i, type, in_id, sa;
+
+	mrp.decide_valid = false;
+
+	for (i = 0; i < 3; i++) {
+		if (i == 2 && !mrp.i_port)
+			continue;
+
+		for (type = 0; type < 256; type++)
+			for (in_id = 0; in_id < 2; in_id++)
+				for (sa = 0; sa < 2; sa++)
+					check(&ports[i], type, in_id, sa);
+	}
+}
+
+int main(void)
+{
+	int ring_role, mra, in_role, inter, p, s, i;
+
+	mrp.in_id = OWN_IN_ID;
+	memcpy(mrp.macaddr, own_sa, ETH_ALEN);
+
+	ports[0].role = BR_MRP_PORT_ROLE_PRIMARY;
+	ports[1].role = BR_MRP_PORT_ROLE_SECONDARY;
+	ports[2].role = BR_MRP_PORT_ROLE_INTER;
+	for (i = 0; i < 3; i++)
+		ports[i].mrp = &mrp;
+
+	mrp.p_port = &ports[0];
+	mrp.s_port = &ports[1];
+
+	for (ring_role = BR_MRP_RING_ROLE_DISABLED;
+	     ring_role <= BR_MRP_RING_ROLE_MRA; ring_role++)
+	for (mra = 0; mra < 2; mra++)
+	for (in_role = BR_MRP_IN_ROLE_DISABLED;
+	     in_role <= BR_MRP_IN_ROLE_MIM; in_role++)
+	for (inter = 0; inter < 2; inter++)
+	for (p = BR_MRP_PORT_STATE_DISABLED;
+	     p <= BR_MRP_PORT_STATE_NOT_CONNECTED; p++)
+	for (s = BR_MRP_PORT_STATE_DISABLED;
+	     s <= BR_MRP_PORT_STATE_NOT_CONNECTED; s++)
+	for (i = BR_MRP_PORT_STATE_DISABLED;
+	     i <= BR_MRP_PORT_STATE_NOT_CONNECTED; i++) {
+		mrp.ring_role = ring_role;
+		mrp.mra_support = mra;
+		mrp.in_role = in_role;
+		mrp.i_port = inter ? &ports[2] : NULL;
+		ports[0].state = p;
+		ports[1].state = s;
+		ports[2].state = i;
+
+		check_ports();
+	}
+
+	printf("%lu checks, %lu errors\n", checks, errors);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,1001 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+/*
+ * Drives each state and event of the tables of state_table.c and checks that
+ * the calls made and the resulting instance match the ones of the handlers
+ * the tables replaced. Those are copied below from state_machine.c and
+ * timer.c as they were. The calls are recorded instead of being run.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "state_machine.h"
+#include "pdu.h"
+#include "trace.h"
+
+int __debug_level;
+bool trace_enabled;
+
+void __trace(const struct trace_point *tp, const uint64_t *args)
+{
+}
+
+enum {
+	CALL_PORT_STATE,
+	CALL_RING_TEST_REQ,
+	CALL_RING_TEST_STOP,
+	CALL_RING_TOPO_REQ,
+	CALL_RING_TRANSITION,
+	CALL_CLEAR_FDB,
+	CALL_RING_LINK_UP_START,
+	CALL_RING_LINK_UP_STOP,
+	CALL_RING_LINK_DOWN_START,
+	CALL_RING_LINK_DOWN_STOP,
+	CALL_RING_LINK_REQ,
+	CALL_IN_TEST_REQ,
+	CALL_IN_TOPO_REQ,
+	CALL_IN_TRANSITION,
+	CALL_IN_LINK_STATUS_REQ,
+	CALL_IN_LINK_STATUS_STOP,
+	CALL_IN_LINK_UP_START,
+	CALL_IN_LINK_UP_STOP,
+	CALL_IN_LINK_DOWN_START,
+	CALL_IN_LINK_DOWN_STOP,
+	CALL_IN_LINK_REQ,
+	CALL_MRM_STATE,
+	CALL_MRC_STATE,
+	CALL_MIM_STATE,
+	CALL_MIC_STATE,
+};
+
+struct call {
+	int			fn;
+	long			a;
+	long			b;
+	long			c;
+};
+
+#define MAX_CALLS		16
+
+/* A run of a handler: the instance it changed and the calls it made */
+struct run {
+	struct mrp		mrp;
+	struct call		calls[MAX_CALLS];
+	int			ncalls;
+};
+
+static struct mrp_port ports[3];
+static struct run *cur;
+
+static void record(int fn, long a, long b, long c)
+{
+	if (cur->ncalls < MAX_CALLS)
+		cur->calls[cur->ncalls] = (struct call){ fn, a, b, c };
+	cur->ncalls++;
+}
+
+static long port_nr(const struct mrp_port *p)
+{
+	return p ? p - ports : -1;
+}
+
+int mrp_port_set_state(struct mrp_port *p, enum br_mrp_port_state_type state)
+{
+	record(CALL_PORT_STATE, port_nr(p), state, 0);
+	return 0;
+}
+
+void mrp_ring_test_req(struct mrp *mrp, uint32_t interval)
+{
+	record(CALL_RING_TEST_REQ, interval, 0, 0);
+}
+
+void mrp_ring_test_stop(struct mrp *mrp)
+{
+	record(CALL_RING_TEST_STOP, 0, 0, 0);
+}
+
+void mrp_ring_topo_req(struct mrp *mrp, uint32_t time)
+{
+	record(CALL_RING_TOPO_REQ, time, 0, 0);
+}
+
+void mrp_ring_transition(struct mrp *mrp)
+{
+	record(CALL_RING_TRANSITION, 0, 0, 0);
+}
+
+void mrp_clear_fdb_start(struct mrp *mrp, uint32_t interval)
+{
+	record(CALL_CLEAR_FDB, interval, 0, 0);
+}
+
+void mrp_ring_link_up_start(struct mrp *mrp, uint32_t interval)
+{
+	record(CALL_RING_LINK_UP_START, interval, 0, 0);
+}
+
+void mrp_ring_link_up_stop(struct mrp *mrp)
+{
+	record(CALL_RING_LINK_UP_STOP, 0, 0, 0);
+}
+
+void mrp_ring_link_down_start(struct mrp *mrp, uint32_t interval)
+{
+	record(CALL_RING_LINK_DOWN_START, interval, 0, 0);
+}
+
+void mrp_ring_link_down_stop(struct mrp *mrp)
+{
+	record(CALL_RING_LINK_DOWN_STOP, 0, 0, 0);
+}
+
+void mrp_ring_link_req(struct mrp_port *p, bool up, uint32_t interval)
+{
+	record(CALL_RING_LINK_REQ, port_nr(p), up, interval);
+}
+
+void mrp_in_test_req(struct mrp *mrp, uint32_t interval)
+{
+	record(CALL_IN_TEST_REQ, interval, 0, 0);
+}
+
+void mrp_in_topo_req(struct mrp *mrp, uint32_t interval)
+{
+	record(CALL_IN_TOPO_REQ, interval, 0, 0);
+}
+
+void mrp_in_transition(struct mrp *mrp)
+{
+	record(CALL_IN_TRANSITION, 0, 0, 0);
+}
+
+void mrp_in_link_status_req(struct mrp *mrp, uint32_t interval)
+{
+	record(CALL_IN_LINK_STATUS_REQ, interval, 0, 0);
+}
+
+void mrp_in_link_status_stop(struct mrp *mrp)
+{
+	record(CALL_IN_LINK_STATUS_STOP, 0, 0, 0);
+}
+
+void mrp_in_link_up_start(struct mrp *mrp, uint32_t interval)
+{
+	record(CALL_IN_LINK_UP_START, interval, 0, 0);
+}
+
+void mrp_in_link_up_stop(struct mrp *mrp)
+{
+	record(CALL_IN_LINK_UP_STOP, 0, 0, 0);
+}
+
+void mrp_in_link_down_start(struct mrp *mrp, uint32_t interval)
+{
+	record(CALL_IN_LINK_DOWN_START, interval, 0, 0);
+}
+
+void mrp_in_link_down_stop(struct mrp *mrp)
+{
+	record(CALL_IN_LINK_DOWN_STOP, 0, 0, 0);
+}
+
+void mrp_in_link_req(struct mrp *mrp, bool up, uint32_t interval)
+{
+	record(CALL_IN_LINK_REQ, up, interval, 0);
+}
+
+void mrp_set_mrm_state(struct mrp *mrp, enum mrp_mrm_state_type state)
+{
+	record(CALL_MRM_STATE, state, 0, 0);
+	mrp->mrm_state = state;
+}
+
+void mrp_set_mrc_state(struct mrp *mrp, enum mrp_mrc_state_type state)
+{
+	record(CALL_MRC_STATE, state, 0, 0);
+	mrp->mrc_state = state;
+}
+
+void mrp_set_mim_state(struct mrp *mrp, enum mrp_mim_state_type state)
+{
+	record(CALL_MIM_STATE, state, 0, 0);
+	mrp->mim_state = state;
+}
+
+void mrp_set_mic_state(struct mrp *mrp, enum mrp_mic_state_type state)
+{
+	record(CALL_MIC_STATE, state, 0, 0);
+	mrp->mic_state = state;
+}
+
+char *mrp_get_mrm_state(enum mrp_mrm_state_type state)
+{
+	return "";
+}
+
+char *mrp_get_mrc_state(enum mrp_mrc_state_type state)
+{
+	return "";
+}
+
+char *mrp_get_mim_state(enum mrp_mim_state_type state)
+{
+	return "";
+}
+
+char *mrp_get_mic_state(enum mrp_mic_state_type state)
+{
+	return "";
+}
+
+/* Represents the state machine for when a MRP_Test frame was received on one
+ * of the MRP ports and the MRP instance has the role MRM.
+ */
+static void ref_mrm_recv_ring_test(struct mrp *mrp)
+{
+	uint32_t topo_interval = mrp->ring_topo_conf_interval;
+
+	mrp->ring_test_rx_ts = mrp_time_us() * 1000;
+
+	switch (mrp->mrm_state) {
+	case MRP_MRM_STATE_AC_STAT1:
+		/* Ignore */
+		break;
+	case MRP_MRM_STATE_PRM_UP:
+		mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
+		mrp->ring_test_curr = 0;
+		mrp->no_tc = false;
+
+		mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+
+		mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RC);
+		break;
+	case MRP_MRM_STATE_CHK_RO:
+		mrp_port_set_state(mrp->s_port,
+					   BR_MRP_PORT_STATE_BLOCKED);
+
+		mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
+		mrp->ring_test_curr = 0;
+		mrp->no_tc = false;
+
+		mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+
+		topo_interval = mrp->react_on_link_change ? 0 : topo_interval;
+		mrp_ring_topo_req(mrp, topo_interval);
+
+		mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RC);
+		break;
+	case MRP_MRM_STATE_CHK_RC:
+		mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
+		mrp->ring_test_curr = 0;
+		mrp->no_tc = false;
+
+		break;
+	}
+}
+
+/* Represents the state machine for when a MRP_TopologyChange frame was
+ * received on one of the MRP ports and the MRP instance has the role MRC
+ */
+static void ref_mrc_recv_ring_topo(struct mrp_port *p,
+				   const struct mrp_frame *f)
+{
+	struct mrp *mrp = p->mrp;
+
+	trace("port: %u, mrc state: %s", p->ifindex,
+	      mrp_get_mrc_state(mrp->mrc_state));
+
+	switch (mrp->mrc_state) {
+	case MRP_MRC_STATE_AC_STAT1:
+		/* Ignore */
+		break;
+	case MRP_MRC_STATE_DE_IDLE:
+		mrp_clear_fdb_start(mrp, f->interval * 1000);
+		break;
+	case MRP_MRC_STATE_PT:
+		mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+		mrp_ring_link_up_stop(mrp);
+		mrp_port_set_state(mrp->s_port,
+					   BR_MRP_PORT_STATE_FORWARDING);
+		mrp_clear_fdb_start(mrp, f->interval * 1000);
+		mrp_set_mrc_state(mrp, MRP_MRC_STATE_PT_IDLE);
+		break;
+	case MRP_MRC_STATE_DE:
+		mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+		mrp_ring_link_down_stop(mrp);
+		mrp_clear_fdb_start(mrp, f->interval * 1000);
+		mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE_IDLE);
+		break;
+	case MRP_MRC_STATE_PT_IDLE:
+		mrp_clear_fdb_start(mrp, f->interval * 1000);
+		break;
+	}
+}
+
+/* Represents the state machine for when MRP instance has the role MRM and the
+ * link of one of the MRP ports is changed.
+ */
+static void ref_mrm_port_link(struct mrp_port *p, bool up)
+{
+	struct mrp *mrp = p->mrp;
+	uint32_t topo_interval = mrp->ring_topo_conf_interval;
+
+	pr_debug("port: %s, up: %d, mrm_state: %s",
+	        p->ifname, up, mrp_get_mrm_state(mrp->mrm_state));
+
+	switch (mrp->mrm_state) {
+	case MRP_MRM_STATE_AC_STAT1:
+		if (up && p == mrp->p_port) {
+			mrp_port_set_state(mrp->p_port,
+						   BR_MRP_PORT_STATE_FORWARDING);
+			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
+		}
+		if (up && p != mrp->p_port) {
+			mrp->s_port = mrp->p_port;
+			mrp->p_port = p;
+			mrp_port_set_state(mrp->p_port,
+						   BR_MRP_PORT_STATE_FORWARDING);
+			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
+		}
+		break;
+	case MRP_MRM_STATE_PRM_UP:
+		if (!up && p == mrp->p_port) {
+			mrp_ring_test_stop(mrp);
+			mrp_port_set_state(mrp->p_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_set_mrm_state(mrp, MRP_MRM_STATE_AC_STAT1);
+		}
+		if (up && p != mrp->p_port) {
+			mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
+			mrp->ring_test_curr = 0;
+			mrp->no_tc = true;
+			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+			mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RC);
+		}
+		break;
+	case MRP_MRM_STATE_CHK_RO:
+		if (!up && p == mrp->p_port) {
+			mrp->p_port = mrp->s_port;
+			mrp->s_port = p;
+			mrp_port_set_state(mrp->s_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+			mrp_ring_topo_req(mrp, topo_interval);
+			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
+			break;
+		}
+		if (!up && p != mrp->p_port) {
+			mrp_port_set_state(mrp->s_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
+		}
+		break;
+	case MRP_MRM_STATE_CHK_RC:
+		if (!up && p == mrp->p_port) {
+			mrp->p_port = mrp->s_port;
+			mrp->s_port = p;
+			mrp_port_set_state(mrp->s_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_port_set_state(mrp->p_port,
+						   BR_MRP_PORT_STATE_FORWARDING);
+			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+			mrp_ring_topo_req(mrp, topo_interval);
+			mrp_ring_transition(mrp);
+			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
+			break;
+		}
+		if (!up && p != mrp->p_port) {
+			mrp_ring_transition(mrp);
+			mrp_set_mrm_state(mrp, MRP_MRM_STATE_PRM_UP);
+			break;
+		}
+
+		break;
+	}
+}
+
+/* Represents the state machine for when MRP instance has the role MRC and the
+ * link of one of the MRP ports is changed.
+ */
+static void ref_mrc_port_link(struct mrp_port *p, bool up)
+{
+	struct mrp *mrp = p->mrp;
+
+	pr_debug("port: %s up: %d, mrc_state: %s",
+	        p->ifname, up, mrp_get_mrc_state(mrp->mrc_state));
+
+	switch (mrp->mrc_state) {
+	case MRP_MRC_STATE_AC_STAT1:
+		if (up && p == mrp->p_port) {
+			mrp_port_set_state(mrp->p_port,
+						   BR_MRP_PORT_STATE_FORWARDING);
+			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE_IDLE);
+		}
+		if (up && p != mrp->p_port) {
+			mrp->s_port = mrp->p_port;
+			mrp->p_port = p;
+			mrp_port_set_state(mrp->p_port,
+						   BR_MRP_PORT_STATE_FORWARDING);
+			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE_IDLE);
+		}
+		break;
+	case MRP_MRC_STATE_DE_IDLE:
+		if (up && p != mrp->p_port) {
+			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+			mrp_ring_link_up_start(mrp,
+					       mrp->ring_link_conf_interval);
+			mrp_ring_link_req(mrp->p_port, up,
+					  mrp->ring_link_curr_max *
+					  mrp->ring_link_conf_interval);
+			mrp_set_mrc_state(mrp, MRP_MRC_STATE_PT);
+		}
+		if (!up && p == mrp->p_port) {
+			mrp_port_set_state(mrp->p_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_set_mrc_state(mrp, MRP_MRC_STATE_AC_STAT1);
+		}
+		break;
+	case MRP_MRC_STATE_PT:
+		if (!up && p != mrp->p_port) {
+			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+			mrp_ring_link_up_stop(mrp);
+			mrp_port_set_state(mrp->s_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_ring_link_down_start(mrp,
+						 mrp->ring_link_conf_interval);
+			mrp_ring_link_req(mrp->p_port, up,
+					  mrp->ring_link_curr_max *
+					  mrp->ring_link_conf_interval);
+			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE);
+			break;
+		}
+		if (!up && p == mrp->p_port) {
+			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+			mrp_ring_link_up_stop(mrp);
+			mrp->p_port = mrp->s_port;
+			mrp->s_port = p;
+			mrp_port_set_state(mrp->p_port,
+						   BR_MRP_PORT_STATE_FORWARDING);
+			mrp_port_set_state(mrp->s_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_ring_link_down_start(mrp,
+						 mrp->ring_link_conf_interval);
+			mrp_ring_link_req(mrp->p_port, up,
+					  mrp->ring_link_curr_max *
+					  mrp->ring_link_conf_interval);
+			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE);
+		}
+		break;
+	case MRP_MRC_STATE_DE:
+		if (up && p != mrp->p_port) {
+			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+			mrp_ring_link_down_stop(mrp);
+			mrp_ring_link_up_start(mrp,
+					       mrp->ring_link_conf_interval);
+			mrp_ring_link_req(mrp->p_port, up,
+					  mrp->ring_link_curr_max *
+					  mrp->ring_link_conf_interval);
+			mrp_set_mrc_state(mrp, MRP_MRC_STATE_PT);
+		}
+		if (!up && p == mrp->p_port) {
+			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+			mrp_port_set_state(mrp->p_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_ring_link_down_stop(mrp);
+			mrp_set_mrc_state(mrp, MRP_MRC_STATE_AC_STAT1);
+		}
+		break;
+	case MRP_MRC_STATE_PT_IDLE:
+		if (!up && p != mrp->p_port) {
+			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+			mrp_port_set_state(mrp->s_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_ring_link_down_start(mrp,
+						 mrp->ring_link_conf_interval);
+			mrp_ring_link_req(mrp->p_port, up,
+					  mrp->ring_link_curr_max *
+					  mrp->ring_link_conf_interval);
+			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE);
+		}
+		if (!up && p == mrp->p_port) {
+			mrp->ring_link_curr_max = mrp->ring_link_conf_max;
+			mrp->p_port = mrp->s_port;
+			mrp->s_port = p;
+			mrp_port_set_state(mrp->s_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_ring_link_down_start(mrp,
+						 mrp->ring_link_conf_interval);
+			mrp_ring_link_req(mrp->p_port, up,
+					  mrp->ring_link_curr_max *
+					  mrp->ring_link_conf_interval);
+			mrp_set_mrc_state(mrp, MRP_MRC_STATE_DE);
+		}
+		break;
+	}
+}
+
+/* Represents the state machine for when MRP instance has the role MIM and the
+ * link of one of the MRP ports is changed.
+ */
+static void ref_mim_port_link(struct mrp_port *p, bool up)
+{
+	struct mrp *mrp = p->mrp;
+
+	pr_debug("up: %d, mim_state: %s",
+	        up, mrp_get_mim_state(mrp->mim_state));
+
+	if (up && mrp->in_mode == MRP_IN_MODE_RC) {
+		switch (mrp->mim_state) {
+		case MRP_MIM_STATE_AC_STAT1:
+			mrp_port_set_state(mrp->i_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp->in_test_curr_max = mrp->in_test_conf_max - 1;
+			mrp->in_test_curr = 0;
+			mrp_in_test_req(mrp, mrp->in_test_conf_interval);
+			mrp_set_mim_state(mrp, MRP_MIM_STATE_CHK_IC);
+			break;
+		case MRP_MIM_STATE_CHK_IO:
+			/* Ignore */
+			break;
+		case MRP_MIM_STATE_CHK_IC:
+			/* Ignore */
+			break;
+		}
+	}
+
+	if (!up && mrp->in_mode == MRP_IN_MODE_RC) {
+		switch (mrp->mim_state) {
+		case MRP_MIM_STATE_AC_STAT1:
+			/* Ignore */
+			break;
+		case MRP_MIM_STATE_CHK_IO: /* fallthrough */
+		case MRP_MIM_STATE_CHK_IC:
+			mrp_port_set_state(mrp->i_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_in_topo_req(mrp, mrp->in_topo_conf_interval);
+			mrp_in_test_req(mrp, mrp->in_test_conf_interval);
+			mrp_set_mim_state(mrp, MRP_MIM_STATE_AC_STAT1);
+			break;
+		}
+	}
+
+	if (up && mrp->in_mode == MRP_IN_MODE_LC) {
+		switch (mrp->mim_state) {
+		case MRP_MIM_STATE_AC_STAT1:
+			mrp->in_link_status_curr_max = mrp->in_link_status_conf_max;
+			mrp_port_set_state(mrp->i_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_in_link_status_req(mrp,
+					       mrp->in_link_status_conf_interval);
+			mrp_set_mim_state(mrp, MRP_MIM_STATE_CHK_IC);
+			break;
+		case MRP_MIM_STATE_CHK_IO:
+			/* Ignore */
+			break;
+		case MRP_MIM_STATE_CHK_IC:
+			/* Ignore */
+			break;
+		}
+	}
+
+	if (!up && mrp->in_mode == MRP_IN_MODE_LC) {
+		switch (mrp->mim_state) {
+		case MRP_MIM_STATE_AC_STAT1:
+			/* Ignore */
+			break;
+		case MRP_MIM_STATE_CHK_IO:
+			mrp_port_set_state(mrp->i_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_in_link_status_stop(mrp);
+			mrp_set_mim_state(mrp, MRP_MIM_STATE_AC_STAT1);
+			break;
+		case MRP_MIM_STATE_CHK_IC:
+			mrp_port_set_state(mrp->i_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_set_mim_state(mrp, MRP_MIM_STATE_AC_STAT1);
+			break;
+		}
+	}
+
+
+	pr_debug("new mim_state: %s", mrp_get_mim_state(mrp->mim_state));
+}
+
+/* Represents the state machine for when MRP instance has the role MIC and the
+ * link of one of the MRP ports is changed.
+ */
+static void ref_mic_port_link(struct mrp_port *p, bool up)
+{
+	struct mrp *mrp = p->mrp;
+
+	trace("up: %d, mic_state: %s",
+	      up, mrp_get_mic_state(mrp->mic_state));
+
+	if (up && mrp->in_mode == MRP_IN_MODE_RC) {
+		switch (mrp->mic_state) {
+		case MRP_MIC_STATE_AC_STAT1:
+			mrp->in_link_curr_max = mrp->in_link_conf_max;
+			mrp_in_link_down_stop(mrp);
+			mrp_in_link_up_start(mrp, mrp->in_link_conf_interval);
+			mrp_in_link_req(mrp, up, mrp->in_link_conf_max *
+					mrp->in_link_conf_interval);
+			mrp_set_mic_state(mrp, MRP_MIC_STATE_PT);
+			break;
+		case MRP_MIC_STATE_PT: /* Fallthrough */
+		case MRP_MIC_STATE_IP_IDLE:
+			/* Ignore */
+			break;
+		}
+	}
+
+	if (!up && mrp->in_mode == MRP_IN_MODE_RC) {
+		switch (mrp->mic_state) {
+		case MRP_MIC_STATE_AC_STAT1:
+			/* Ignore */
+			break;
+		case MRP_MIC_STATE_PT:
+			mrp->in_link_curr_max = mrp->in_link_conf_max;
+			mrp_in_link_up_stop(mrp);
+			mrp_port_set_state(mrp->i_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_in_link_down_start(mrp, mrp->in_link_conf_interval);
+			mrp_in_link_req(mrp, up, mrp->in_link_conf_max *
+					mrp->in_link_conf_interval);
+			mrp_set_mic_state(mrp, MRP_MIC_STATE_AC_STAT1);
+			break;
+		case MRP_MIC_STATE_IP_IDLE:
+			mrp->in_link_curr_max = mrp->in_link_conf_max;
+			mrp_port_set_state(mrp->i_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_in_link_down_start(mrp, mrp->in_link_conf_interval);
+			mrp_in_link_req(mrp, up, mrp->in_link_conf_max *
+					mrp->in_link_conf_interval);
+			mrp_set_mic_state(mrp, MRP_MIC_STATE_AC_STAT1);
+			break;
+		}
+	}
+
+	if (up && mrp->in_mode == MRP_IN_MODE_LC) {
+		switch (mrp->mic_state) {
+		case MRP_MIC_STATE_AC_STAT1:
+			mrp->in_link_curr_max = mrp->in_link_conf_max;
+			mrp_in_link_down_stop(mrp);
+			mrp_in_link_up_start(mrp, mrp->in_link_conf_interval);
+			mrp_in_link_req(mrp, up,
+					mrp->in_link_conf_max *
+					mrp->in_link_conf_interval);
+			mrp_set_mic_state(mrp, MRP_MIC_STATE_PT);
+			break;
+		case MRP_MIC_STATE_PT: /* Fallthrough */
+		case MRP_MIC_STATE_IP_IDLE:
+			/* Ignore */
+			break;
+		}
+	}
+
+	if (!up && mrp->in_mode == MRP_IN_MODE_LC) {
+		switch (mrp->mic_state) {
+		case MRP_MIC_STATE_AC_STAT1:
+			/* Ignore */
+			break;
+		case MRP_MIC_STATE_PT: /* Fallthrough */
+		case MRP_MIC_STATE_IP_IDLE:
+			mrp->in_link_curr_max = mrp->in_link_conf_max;
+			mrp_in_link_up_stop(mrp);
+			mrp_port_set_state(mrp->i_port,
+						   BR_MRP_PORT_STATE_BLOCKED);
+			mrp_in_link_down_start(mrp,
+					       mrp->in_link_conf_interval);
+			mrp_in_link_req(mrp, up,
+					mrp->in_link_conf_max *
+					mrp->in_link_conf_interval);
+			mrp_set_mic_state(mrp, MRP_MIC_STATE_AC_STAT1);
+			break;
+		}
+	}
+
+	pr_debug("new mic_state: %s", mrp_get_mic_state(mrp->mic_state));
+}
+
+/* From timer.c */
+static void ref_mrm_ring_test_expired(struct mrp *mrp)
+{
+        switch (mrp->mrm_state) {
+        case MRP_MRM_STATE_AC_STAT1:
+                /* Ignore */
+                break;
+        case MRP_MRM_STATE_PRM_UP:
+        case MRP_MRM_STATE_CHK_RO:
+		mrp->add_test = false;
+		mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+		break;
+	case MRP_MRM_STATE_CHK_RC:
+		if (mrp->ring_test_curr >= mrp->ring_test_curr_max) {
+			mrp_port_set_state(mrp->s_port,
+                                           BR_MRP_PORT_STATE_FORWARDING);
+			mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
+			mrp->ring_test_curr = 0;
+			mrp->add_test = false;
+			if (!mrp->no_tc)
+				mrp_ring_topo_req(mrp,
+						mrp->ring_topo_conf_interval);
+			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+
+			mrp_ring_transition(mrp);
+			mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RO);
+		} else {
+			mrp->ring_test_curr++;
+			mrp->cnt.ring_test_missed++;
+			mrp_flight_record(&mrp->flight, MRP_FLIGHT_TIMER, 0,
+					  MRP_FLIGHT_TIMER_RING_TEST);
+			mrp->add_test = false;
+			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
+		}
+                break;
+        }
+}
+
+/* The MIM part of mrp_in_test_expired() in timer.c */
+static void ref_mim_in_test_expired(struct mrp *mrp)
+{
+        switch (mrp->mim_state) {
+        case MRP_MIM_STATE_AC_STAT1:
+                /* Ignore */
+                break;
+        case MRP_MIM_STATE_CHK_IO:
+		mrp_in_test_req(mrp, mrp->in_test_conf_interval);
+		break;
+	case MRP_MIM_STATE_CHK_IC:
+		if (mrp->in_test_curr >= mrp->in_test_curr_max) {
+			mrp_port_set_state(mrp->i_port,
+                                           BR_MRP_PORT_STATE_FORWARDING);
+			mrp->in_test_curr_max = mrp->in_test_conf_max - 1;
+			mrp->in_test_curr = 0;
+			mrp_in_topo_req(mrp, mrp->in_topo_conf_interval);
+			mrp_in_test_req(mrp, mrp->in_test_conf_interval);
+
+			mrp_in_transition(mrp);
+			mrp_set_mim_state(mrp, MRP_MIM_STATE_CHK_IO);
+		} else {
+			mrp->in_test_curr++;
+			mrp->cnt.in_test_missed++;
+			mrp_flight_record(&mrp->flight, MRP_FLIGHT_TIMER, 0,
+					  MRP_FLIGHT_TIMER_IN_TEST);
+			mrp_in_test_req(mrp, mrp->in_test_conf_interval);
+		}
+                break;
+        }
+}
+
+enum {
+	ROLE_MRM,
+	ROLE_MRC,
+	ROLE_MIM,
+	ROLE_MIC,
+	ROLE_MAX,
+};
+
+static const char *role_names[ROLE_MAX] = { "MRM", "MRC", "MIM", "MIC" };
+static const int role_states[ROLE_MAX] = { 4, 5, 3, 3 };
+
+enum {
+	EV_UP_P,
+	EV_UP_S,
+	EV_DOWN_P,
+	EV_DOWN_S,
+	EV_UP_I,
+	EV_DOWN_I,
+	EV_TEST_RX,
+	EV_TEST_EXP,
+	EV_TEST_EXP_MAX,
+	EV_TOPO_RX,
+	EV_IN_TEST_EXP,
+	EV_IN_TEST_EXP_MAX,
+	EV_MAX,
+};
+
+static const char *ev_names[EV_MAX] = {
+	"up_p", "up_s", "down_p", "down_s", "up_i", "down_i", "test_rx",
+	"test_exp", "test_exp_max", "topo_rx", "in_test_exp",
+	"in_test_exp_max",
+};
+
+static bool role_has_event(int role, int ev)
+{
+	switch (ev) {
+	case EV_UP_P:
+	case EV_UP_S:
+	case EV_DOWN_P:
+	case EV_DOWN_S:
+		return role == ROLE_MRM || role == ROLE_MRC;
+	case EV_UP_I:
+	case EV_DOWN_I:
+		return role == ROLE_MIM || role == ROLE_MIC;
+	case EV_TEST_RX:
+	case EV_TEST_EXP:
+	case EV_TEST_EXP_MAX:
+		return role == ROLE_MRM;
+	case EV_TOPO_RX:
+		return role == ROLE_MRC;
+	default:
+		return role == ROLE_MIM;
+	}
+}
+
+/* The instance each run starts from */
+static struct mrp init;
+static struct run ref, tab;
+static unsigned long checks, errors;
+
+static void setup(int role, int state, int ev, int var)
+{
+	memset(&init, 0, sizeof(init));
+
+	init.p_port = &ports[0];
+	init.s_port = &ports[1];
+	init.i_port = &ports[2];
+
+	init.ring_test_conf_interval = 20000;
+	init.ring_test_conf_max = 3;
+	init.ring_test_curr_max = 2;
+	init.ring_test_curr = ev == EV_TEST_EXP_MAX ? 2 : 1;
+	init.ring_topo_conf_interval = 10000;
+	init.ring_link_conf_interval = 20;
+	init.ring_link_conf_max = 4;
+	init.ring_link_curr_max = 1;
+	init.in_test_conf_interval = 30000;
+	init.in_test_conf_max = 8;
+	init.in_test_curr_max = 7;
+	init.in_test_curr = ev == EV_IN_TEST_EXP_MAX ? 7 : 5;
+	init.in_topo_conf_interval = 40000;
+	init.in_link_conf_interval = 50000;
+	init.in_link_conf_max = 5;
+	init.in_link_curr_max = 2;
+	init.in_link_status_conf_interval = 60000;
+	init.in_link_status_conf_max = 6;
+	init.in_link_status_curr_max = 3;
+
+	init.no_tc = var & 1;
+	init.add_test = var & 2;
+	init.react_on_link_change = !!(var & 4);
+	init.in_mode = var & 1 ? MRP_IN_MODE_LC : MRP_IN_MODE_RC;
+
+	switch (role) {
+	case ROLE_MRM:
+		init.mrm_state = state;
+		break;
+	case ROLE_MRC:
+		init.mrc_state = state;
+		break;
+	case ROLE_MIM:
+		init.mim_state = state;
+		break;
+	case ROLE_MIC:
+		init.mic_state = state;
+		break;
+	}
+}
+
+static void run(struct run *r, int role, int ev, bool table)
+{
+	struct mrp_frame f = { .interval = 30 };
+	struct mrp *mrp = &r->mrp;
+	struct mrp_port *p;
+	bool up;
+	int i;
+
+	memcpy(mrp, &init, sizeof(init));
+	r->ncalls = 0;
+	for (i = 0; i < 3; i++)
+		ports[i].mrp = mrp;
+	cur = r;
+
+	p = ev == EV_UP_S || ev == EV_DOWN_S ? &ports[1] :
+	    ev == EV_UP_I || ev == EV_DOWN_I ? &ports[2] : &ports[0];
+	up = ev == EV_UP_P || ev == EV_UP_S || ev == EV_UP_I;
+
+	switch (ev) {
+	case EV_TEST_RX:
+		if (table)
+			mrp_mrm_recv_ring_test(mrp);
+		else
+			ref_mrm_recv_ring_test(mrp);
+		break;
+	case EV_TEST_EXP:
+	case EV_TEST_EXP_MAX:
+		if (table)
+			mrp_mrm_ring_test_expired(mrp);
+		else
+			ref_mrm_ring_test_expired(mrp);
+		break;
+	case EV_TOPO_RX:
+		if (table)
+			mrp_mrc_recv_ring_topo(p, &f);
+		else
+			ref_mrc_recv_ring_topo(p, &f);
+		break;
+	case EV_IN_TEST_EXP:
+	case EV_IN_TEST_EXP_MAX:
+		if (table)
+			mrp_mim_in_test_expired(mrp);
+		else
+			ref_mim_in_test_expired(mrp);
+		break;
+	default:
+		if (role == ROLE_MRM)
+			table ? mrp_mrm_port_link(p, up) :
+				ref_mrm_port_link(p, up);
+		else if (role == ROLE_MRC)
+			table ? mrp_mrc_port_link(p, up) :
+				ref_mrc_port_link(p, up);
+		else if (role == ROLE_MIM)
+			table ? mrp_mim_port_link(p, up) :
+				ref_mim_port_link(p, up);
+		else
+			table ? mrp_mic_port_link(p, up) :
+				ref_mic_port_link(p, up);
+		break;
+	}
+
+	/* Only the clock may differ between the runs */
+	mrp->ring_test_rx_ts = 0;
+	for (i = 0; i < MRP_FLIGHT_LEN; i++)
+		mrp->flight.entries[i].ts = 0;
+}
+
+static void dump(const char *name, const struct run *r)
+{
+	int i;
+
+	fprintf(stderr, "  %s:", name);
+	for (i = 0; i < r->ncalls && i < MAX_CALLS; i++)
+		fprintf(stderr, " %d(%ld,%ld,%ld)", r->calls[i].fn,
+			r->calls[i].a, r->calls[i].b, r->calls[i].c);
+	fprintf(stderr, "\n");
+}
+
+static void check(int role, int state, int ev, int var)
+{
+	setup(role, state, ev, var);
+	run(&ref, role, ev, false);
+	run(&tab, role, ev, true);
+
+	checks++;
+	if (ref.ncalls == tab.ncalls &&
+	    !memcmp(ref.calls, tab.calls, sizeof(ref.calls)) &&
+	    !memcmp(&ref.mrp, &tab.mrp, sizeof(ref.mrp)))
+		return;
+
+	errors++;
+	fprintf(stderr, "%s state %d event %s variant %d: %s differ\n",
+		role_names[role], state, ev_names[ev], var,
+		ref.ncalls == tab.ncalls &&
+		!memcmp(ref.calls, tab.calls, sizeof(ref.calls)) ?
+		"instances" : "calls");
+	dump("expected", &ref);
+	dump("got", &tab);
+}
+
+int main(void)
+{
+	int role, state, ev, var;
+
+	for (role = 0; role < ROLE_MAX; role++)
+		for (state = 0; state < role_states[role]; state++)
+			for (ev = 0; ev < EV_MAX; ev++) {
+				if (!role_has_event(role, ev))
+					continue;
+
+				for (var = 0; var < 8; var++)
+					check(role, state, ev, var);
+			}
+
+	printf("%lu checks, %lu errors\n", checks, errors);
+
+	return errors ? 1 : 0;
+}
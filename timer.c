@@ -3,54 +3,38 @@
 // SPDX-License-Identifier: (GPL-2.0)
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 
 #include "ifdriver.h"
 #include "state_machine.h"
 #include "cfm_netlink.h"
+#include "trace.h"
+#include "loop.h"
+
+/* Accounts how late a test timer expired. The timer is a repeating one so
+ * the next deadline is set here as well, in case it is not restarted.
+ */
+static void mrp_test_lateness(struct mrp *mrp, ev_tstamp *deadline,
+			      ev_timer *w)
+{
+	ev_tstamp late = ev_time() - *deadline;
+
+	mrp_hist_add(&mrp->test_lateness, late > 0 ? late * 1000000 : 0);
+	*deadline += w->repeat;
+}
 
 static void mrp_clear_fdb_expired(struct ev_loop *loop,
 				  ev_timer *w, int revents)
 {
 	struct mrp *mrp = container_of(w, struct mrp, clear_fdb_work);
 
-	ifdriver_flush(mrp);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_TIMER, 0,
+			  MRP_FLIGHT_TIMER_CLEAR_FDB);
 
-	mrp_clear_fdb_stop(mrp);
-}
+	IFDRIVER_TIMED(MRP_IFDRIVER_FLUSH, ifdriver_flush(mrp));
 
-static void mrp_mrm_ring_test_expired(struct mrp *mrp)
-{
-        switch (mrp->mrm_state) {
-        case MRP_MRM_STATE_AC_STAT1:
-                /* Ignore */
-                break;
-        case MRP_MRM_STATE_PRM_UP:
-        case MRP_MRM_STATE_CHK_RO:
-		mrp->add_test = false;
-		mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-		break;
-	case MRP_MRM_STATE_CHK_RC:
-		if (mrp->ring_test_curr >= mrp->ring_test_curr_max) {
-			mrp_port_set_state(mrp->s_port,
-                                           BR_MRP_PORT_STATE_FORWARDING);
-			mrp->ring_test_curr_max = mrp->ring_test_conf_max - 1;
-			mrp->ring_test_curr = 0;
-			mrp->add_test = false;
-			if (!mrp->no_tc)
-				mrp_ring_topo_req(mrp,
-						mrp->ring_topo_conf_interval);
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-
-			mrp->ring_transitions++;
-			mrp_set_mrm_state(mrp, MRP_MRM_STATE_CHK_RO);
-		} else {
-			mrp->ring_test_curr++;
-			mrp->add_test = false;
-			mrp_ring_test_req(mrp, mrp->ring_test_conf_interval);
-		}
-                break;
-        }
+	mrp_clear_fdb_stop(mrp);
 }
 
 static void mrp_mrc_ring_test_expired(struct mrp *mrp)
@@ -89,14 +73,18 @@ static void mrp_ring_test_expired(struct ev_loop *loop,
 {
 	struct mrp *mrp = container_of(w, struct mrp, ring_test_work);
 
-	pthread_mutex_lock(&mrp->lock);
+	/* The deadline is on ev_time(), which is CLOCK_REALTIME */
+	mrp_tx_launch = mrp->ring_test_deadline * 1000000000;
+	mrp_test_lateness(mrp, &mrp->ring_test_deadline, w);
+	mrp_tx_origin = mrp_time_real_ns();
 
 	if (mrp->mra_support && mrp->ring_role == BR_MRP_RING_ROLE_MRC)
 		mrp_mrc_ring_test_expired(mrp);
 	else if (mrp->ring_role == BR_MRP_RING_ROLE_MRM)
 		mrp_mrm_ring_test_expired(mrp);
 
-	pthread_mutex_unlock(&mrp->lock);
+	mrp_tx_origin = 0;
+	mrp_tx_launch = 0;
 }
 
 static void mrp_ring_topo_expired(struct ev_loop *loop,
@@ -104,9 +92,10 @@ static void mrp_ring_topo_expired(struct ev_loop *loop,
 {
 	struct mrp *mrp = container_of(w, struct mrp, ring_topo_work);
 
-	pr_debug_v("ring_topo_curr_max: %d", mrp->ring_topo_curr_max);
+	trace("ring_topo_curr_max: %u", mrp->ring_topo_curr_max);
 
-	pthread_mutex_lock(&mrp->lock);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_TIMER, 0,
+			  MRP_FLIGHT_TIMER_RING_TOPO);
 
 	if (mrp->ring_topo_curr_max > 0) {
 		mrp_ring_topo_send(mrp, mrp->ring_topo_curr_max *
@@ -116,13 +105,11 @@ static void mrp_ring_topo_expired(struct ev_loop *loop,
 	} else {
 		mrp->ring_topo_curr_max = mrp->ring_topo_conf_max - 1;
 
-		ifdriver_flush(mrp);
+		IFDRIVER_TIMED(MRP_IFDRIVER_FLUSH, ifdriver_flush(mrp));
 		mrp_ring_topo_send(mrp, 0);
 
 		mrp_ring_topo_stop(mrp);
 	}
-
-	pthread_mutex_unlock(&mrp->lock);
 }
 
 static void mrp_ring_link_up_expired(struct ev_loop *loop,
@@ -132,9 +119,10 @@ static void mrp_ring_link_up_expired(struct ev_loop *loop,
 	uint32_t interval;
 	uint32_t delay;
 
-	pr_debug_v("ring_link_curr_max: %d", mrp->ring_link_curr_max);
+	trace("ring_link_curr_max: %u", mrp->ring_link_curr_max);
 
-	pthread_mutex_lock(&mrp->lock);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_TIMER, 0,
+			  MRP_FLIGHT_TIMER_RING_LINK_UP);
 
 	delay = mrp->ring_link_conf_interval;
 
@@ -154,8 +142,6 @@ static void mrp_ring_link_up_expired(struct ev_loop *loop,
 
 		mrp_ring_link_up_stop(mrp);
 	}
-
-	pthread_mutex_unlock(&mrp->lock);
 }
 
 static void mrp_ring_link_down_expired(struct ev_loop *loop,
@@ -165,9 +151,10 @@ static void mrp_ring_link_down_expired(struct ev_loop *loop,
 	uint32_t interval;
 	uint32_t delay;
 
-	pr_debug_v("ring_link_curr_max: %d", mrp->ring_link_curr_max);
+	trace("ring_link_curr_max: %u", mrp->ring_link_curr_max);
 
-	pthread_mutex_lock(&mrp->lock);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_TIMER, 0,
+			  MRP_FLIGHT_TIMER_RING_LINK_DOWN);
 
 	delay = mrp->ring_link_conf_interval;
 
@@ -186,8 +173,6 @@ static void mrp_ring_link_down_expired(struct ev_loop *loop,
 
 		mrp_ring_link_down_stop(mrp);
 	}
-
-	pthread_mutex_unlock(&mrp->lock);
 }
 
 static void mrp_in_test_expired(struct ev_loop *loop,
@@ -195,34 +180,12 @@ static void mrp_in_test_expired(struct ev_loop *loop,
 {
 	struct mrp *mrp = container_of(w, struct mrp, in_test_work);
 
-	pthread_mutex_lock(&mrp->lock);
-
-        switch (mrp->mim_state) {
-        case MRP_MIM_STATE_AC_STAT1:
-                /* Ignore */
-                break;
-        case MRP_MIM_STATE_CHK_IO:
-		mrp_in_test_req(mrp, mrp->in_test_conf_interval);
-		break;
-	case MRP_MIM_STATE_CHK_IC:
-		if (mrp->in_test_curr >= mrp->in_test_curr_max) {
-			mrp_port_set_state(mrp->i_port,
-                                           BR_MRP_PORT_STATE_FORWARDING);
-			mrp->in_test_curr_max = mrp->in_test_conf_max - 1;
-			mrp->in_test_curr = 0;
-			mrp_in_topo_req(mrp, mrp->in_topo_conf_interval);
-			mrp_in_test_req(mrp, mrp->in_test_conf_interval);
-
-			mrp->in_transitions++;
-			mrp_set_mim_state(mrp, MRP_MIM_STATE_CHK_IO);
-		} else {
-			mrp->in_test_curr++;
-			mrp_in_test_req(mrp, mrp->in_test_conf_interval);
-		}
-                break;
-        }
+	mrp_test_lateness(mrp, &mrp->in_test_deadline, w);
+	mrp_tx_origin = mrp_time_real_ns();
+
+	mrp_mim_in_test_expired(mrp);
 
-	pthread_mutex_unlock(&mrp->lock);
+	mrp_tx_origin = 0;
 }
 
 static void mrp_in_topo_expired(struct ev_loop *loop,
@@ -230,9 +193,10 @@ static void mrp_in_topo_expired(struct ev_loop *loop,
 {
 	struct mrp *mrp = container_of(w, struct mrp, in_topo_work);
 
-	pr_debug_v("in_topo_curr_max: %d", mrp->in_topo_curr_max);
+	trace("in_topo_curr_max: %u", mrp->in_topo_curr_max);
 
-	pthread_mutex_lock(&mrp->lock);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_TIMER, 0,
+			  MRP_FLIGHT_TIMER_IN_TOPO);
 
 	if (mrp->in_topo_curr_max > 0) {
 		mrp_in_topo_send(mrp, mrp->in_topo_curr_max *
@@ -242,13 +206,11 @@ static void mrp_in_topo_expired(struct ev_loop *loop,
 	} else {
 		mrp->in_topo_curr_max = mrp->in_topo_conf_max - 1;
 
-		ifdriver_flush(mrp);
+		IFDRIVER_TIMED(MRP_IFDRIVER_FLUSH, ifdriver_flush(mrp));
 		mrp_in_topo_send(mrp, 0);
 
 		mrp_in_topo_stop(mrp);
 	}
-
-	pthread_mutex_unlock(&mrp->lock);
 }
 
 static void mrp_in_link_up_expired(struct ev_loop *loop,
@@ -258,9 +220,10 @@ static void mrp_in_link_up_expired(struct ev_loop *loop,
 	uint32_t interval;
 	uint32_t delay;
 
-	pr_debug_v("in_link_curr_max: %d", mrp->in_link_curr_max);
+	trace("in_link_curr_max: %u", mrp->in_link_curr_max);
 
-	pthread_mutex_lock(&mrp->lock);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_TIMER, 0,
+			  MRP_FLIGHT_TIMER_IN_LINK_UP);
 
 	delay = mrp->in_link_conf_interval;
 
@@ -280,8 +243,6 @@ static void mrp_in_link_up_expired(struct ev_loop *loop,
 
 		mrp_in_link_up_stop(mrp);
 	}
-
-	pthread_mutex_unlock(&mrp->lock);
 }
 
 static void mrp_in_link_down_expired(struct ev_loop *loop,
@@ -291,9 +252,10 @@ static void mrp_in_link_down_expired(struct ev_loop *loop,
 	uint32_t interval;
 	uint32_t delay;
 
-	pr_debug_v("in_link_curr_max: %d", mrp->in_link_curr_max);
+	trace("in_link_curr_max: %u", mrp->in_link_curr_max);
 
-	pthread_mutex_lock(&mrp->lock);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_TIMER, 0,
+			  MRP_FLIGHT_TIMER_IN_LINK_DOWN);
 
 	delay = mrp->in_link_conf_interval;
 
@@ -310,8 +272,6 @@ static void mrp_in_link_down_expired(struct ev_loop *loop,
 
 		mrp_in_link_down_stop(mrp);
 	}
-
-	pthread_mutex_unlock(&mrp->lock);
 }
 
 static void mrp_in_link_status_expired(struct ev_loop *loop,
@@ -321,9 +281,10 @@ static void mrp_in_link_status_expired(struct ev_loop *loop,
 	uint32_t interval;
 	uint32_t delay;
 
-	pr_debug_v("in_link_status_curr_max: %d", mrp->in_link_status_curr_max);
+	trace("in_link_status_curr_max: %u", mrp->in_link_status_curr_max);
 
-	pthread_mutex_lock(&mrp->lock);
+	mrp_flight_record(&mrp->flight, MRP_FLIGHT_TIMER, 0,
+			  MRP_FLIGHT_TIMER_IN_LINK_STATUS);
 
 	delay = mrp->in_link_status_conf_interval;
 
@@ -338,8 +299,6 @@ static void mrp_in_link_status_expired(struct ev_loop *loop,
 
 		mrp_in_link_status_stop(mrp);
 	}
-
-	pthread_mutex_unlock(&mrp->lock);
 }
 
 static void mrp_cfm_ccm_expired(struct ev_loop *loop,
@@ -351,137 +310,143 @@ static void mrp_cfm_ccm_expired(struct ev_loop *loop,
 	memcpy(dmac.addr, mrp->cfm_ccm_dmac, ETH_ALEN);
 
 	mrp->cfm_ccm_work.repeat = (ev_tstamp)mrp->cfm_ccm_period / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->cfm_ccm_work);
+	ev_timer_again(mrp_loop, &mrp->cfm_ccm_work);
 
+	pthread_mutex_lock(&mrp_driver_lock);
 	cfm_offload_cc_ccm_tx(mrp->ifindex, mrp->cfm_instance, &dmac, 1,
 			      mrp->cfm_ccm_period, 1, 100, 1, 200);
+	pthread_mutex_unlock(&mrp_driver_lock);
 }
 
 int mrp_ring_test_start(struct mrp *mrp, uint32_t interval)
 {
 	mrp->ring_test_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->ring_test_work);
+	ev_timer_again(mrp_loop, &mrp->ring_test_work);
+	mrp->ring_test_deadline = ev_now(mrp_loop) +
+				  mrp->ring_test_work.repeat;
 	return 0;
 }
 
 void mrp_ring_test_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->ring_test_work);
+	ev_timer_stop(mrp_loop, &mrp->ring_test_work);
 }
 
 void mrp_ring_topo_start(struct mrp *mrp, uint32_t interval)
 {
 	mrp->ring_topo_running = true;
 	mrp->ring_topo_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->ring_topo_work);
+	ev_timer_again(mrp_loop, &mrp->ring_topo_work);
 }
 
 void mrp_ring_topo_stop(struct mrp *mrp)
 {
 	mrp->ring_topo_running = false;
-	ev_timer_stop(EV_DEFAULT, &mrp->ring_topo_work);
+	ev_timer_stop(mrp_loop, &mrp->ring_topo_work);
 }
 
 void mrp_ring_link_up_start(struct mrp *mrp, uint32_t interval)
 {
 	mrp->ring_link_up_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->ring_link_up_work);
+	ev_timer_again(mrp_loop, &mrp->ring_link_up_work);
 }
 
 void mrp_ring_link_up_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->ring_link_up_work);
+	ev_timer_stop(mrp_loop, &mrp->ring_link_up_work);
 }
 
 void mrp_ring_link_down_start(struct mrp *mrp, uint32_t interval)
 {
 	mrp->ring_link_down_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->ring_link_down_work);
+	ev_timer_again(mrp_loop, &mrp->ring_link_down_work);
 }
 
 void mrp_ring_link_down_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->ring_link_down_work);
+	ev_timer_stop(mrp_loop, &mrp->ring_link_down_work);
 }
 
 int mrp_in_test_start(struct mrp *mrp, uint32_t interval)
 {
 	mrp->in_test_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->in_test_work);
+	ev_timer_again(mrp_loop, &mrp->in_test_work);
+	mrp->in_test_deadline = ev_now(mrp_loop) +
+				mrp->in_test_work.repeat;
 	return 0;
 }
 
 void mrp_in_test_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->in_test_work);
+	ev_timer_stop(mrp_loop, &mrp->in_test_work);
 }
 
 void mrp_in_topo_start(struct mrp *mrp, uint32_t interval)
 {
 	mrp->in_topo_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->in_topo_work);
+	ev_timer_again(mrp_loop, &mrp->in_topo_work);
 }
 
 void mrp_in_topo_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->in_topo_work);
+	ev_timer_stop(mrp_loop, &mrp->in_topo_work);
 }
 
 void mrp_in_link_up_start(struct mrp *mrp, uint32_t interval)
 {
 	mrp->in_link_up_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->in_link_up_work);
+	ev_timer_again(mrp_loop, &mrp->in_link_up_work);
 }
 
 void mrp_in_link_up_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->in_link_up_work);
+	ev_timer_stop(mrp_loop, &mrp->in_link_up_work);
 }
 
 void mrp_in_link_down_start(struct mrp *mrp, uint32_t interval)
 {
 	mrp->in_link_down_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->in_link_down_work);
+	ev_timer_again(mrp_loop, &mrp->in_link_down_work);
 }
 
 void mrp_in_link_down_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->in_link_down_work);
+	ev_timer_stop(mrp_loop, &mrp->in_link_down_work);
 }
 
 void mrp_in_link_status_start(struct mrp *mrp, uint32_t interval)
 {
 	mrp->in_link_status_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->in_link_status_work);
+	ev_timer_again(mrp_loop, &mrp->in_link_status_work);
 }
 
 void mrp_in_link_status_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->in_link_status_work);
+	ev_timer_stop(mrp_loop, &mrp->in_link_status_work);
 }
 
 void mrp_clear_fdb_start(struct mrp *mrp, uint32_t interval)
 {
 	mrp->clear_fdb_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->clear_fdb_work);
+	ev_timer_again(mrp_loop, &mrp->clear_fdb_work);
 	if (interval == 0)
-		ifdriver_flush(mrp);
+		IFDRIVER_TIMED(MRP_IFDRIVER_FLUSH, ifdriver_flush(mrp));
 }
 
 void mrp_clear_fdb_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->clear_fdb_work);
+	ev_timer_stop(mrp_loop, &mrp->clear_fdb_work);
 }
 
 void mrp_cfm_ccm_start(struct mrp *mrp, uint32_t interval)
 {
 	mrp->cfm_ccm_work.repeat = (ev_tstamp)interval / 1000000;
-	ev_timer_again(EV_DEFAULT, &mrp->cfm_ccm_work);
+	ev_timer_again(mrp_loop, &mrp->cfm_ccm_work);
 }
 
 void mrp_cfm_ccm_stop(struct mrp *mrp)
 {
-	ev_timer_stop(EV_DEFAULT, &mrp->cfm_ccm_work);
+	ev_timer_stop(mrp_loop, &mrp->cfm_ccm_work);
 }
 
 /* Stops all the timers */
@@ -507,6 +472,69 @@ void mrp_timer_stop(struct mrp *mrp)
 	}
 }
 
+#define MRP_TIMER_PROBES	15
+#define MRP_TIMER_PROBE		100e-6	/* s */
+
+uint32_t mrp_timer_resolution = 1;	/* us */
+
+static void mrp_timer_probe(struct ev_loop *loop, ev_timer *w, int revents)
+{
+}
+
+static int mrp_timer_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Measures how late the loop of the running shard fires a short timer, the
+ * median of a few runs is taken.
+ */
+static int mrp_timer_calibrate_shard(void *arg)
+{
+	double late[MRP_TIMER_PROBES], t0;
+	uint32_t *resolution = arg;
+	ev_timer probe;
+	uint32_t res;
+	int i;
+
+	ev_timer_init(&probe, mrp_timer_probe, MRP_TIMER_PROBE, 0.);
+	for (i = 0; i < MRP_TIMER_PROBES; i++) {
+		ev_now_update(mrp_loop);
+		t0 = ev_time();
+		ev_timer_set(&probe, MRP_TIMER_PROBE, 0.);
+		ev_timer_start(mrp_loop, &probe);
+		while (ev_is_active(&probe))
+			ev_run(mrp_loop, EVRUN_ONCE);
+		late[i] = ev_time() - t0 - MRP_TIMER_PROBE;
+	}
+
+	qsort(late, MRP_TIMER_PROBES, sizeof(late[0]), mrp_timer_cmp);
+	res = late[MRP_TIMER_PROBES / 2] * 1e6 + 1;
+	if (res > *resolution)
+		*resolution = res;
+
+	return 0;
+}
+
+/* The resolution of the protocol timers is the worst one of the shard
+ * loops, each measured on its own thread. It has to be called once the
+ * shards are started and before any instance is added.
+ */
+void mrp_timer_calibrate(void)
+{
+	uint32_t resolution = 1;
+	int i;
+
+	for (i = 0; i < mrp_nr_shards; i++)
+		mrp_shard_call(&mrp_shards[i], mrp_timer_calibrate_shard,
+			       &resolution);
+	mrp_timer_resolution = resolution;
+
+	pr_debug("timer resolution: %uus", mrp_timer_resolution);
+}
+
 void mrp_timer_init(struct mrp *mrp)
 {
 	ev_init(&mrp->clear_fdb_work, mrp_clear_fdb_expired);
@@ -0,0 +1,163 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+struct trace_rec {
+	const struct trace_point	*tp;	/* NULL while being written */
+	uint64_t			ts;	/* ns */
+	uint64_t			args[TRACE_MAX_ARGS];
+};
+
+bool trace_enabled;
+
+static struct trace_rec *ring;
+static uint32_t ring_len;	/* power of 2 */
+static uint64_t ring_head;
+
+void __trace(const struct trace_point *tp, const uint64_t *args)
+{
+	struct trace_rec *r;
+	struct timespec t;
+	uint64_t idx;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	/* Writers never wait, the oldest records are overwritten */
+	idx = __atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED);
+	r = &ring[idx & (ring_len - 1)];
+
+	__atomic_store_n(&r->tp, NULL, __ATOMIC_RELAXED);
+	r->ts = (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+	memcpy(r->args, args, sizeof(r->args));
+	__atomic_store_n(&r->tp, tp, __ATOMIC_RELEASE);
+}
+
+/* Formats a record. Each conversion of the format takes one argument, the
+ * length modifiers are replaced according to the conversion type.
+ */
+static void trace_print(FILE *stream, struct trace_rec *r,
+			const struct trace_point *tp)
+{
+	const char *p = tp->fmt;
+	char spec[32];
+	int n = 0, i;
+
+	fprintf(stream, "%llu.%09llu [%s@%d] ",
+		(unsigned long long)r->ts / 1000000000,
+		(unsigned long long)r->ts % 1000000000, tp->func, tp->line);
+
+	while (*p) {
+		if (*p != '%') {
+			fputc(*p++, stream);
+			continue;
+		}
+		if (p[1] == '%') {
+			fputc('%', stream);
+			p += 2;
+			continue;
+		}
+
+		/* Copy flags, width and precision, skip the length */
+		i = 0;
+		spec[i++] = *p++;
+		while (*p && strchr("#0- +.123456789", *p) &&
+		       i < sizeof(spec) - 4)
+			spec[i++] = *p++;
+		while (*p && strchr("hlLqjzt", *p))
+			p++;
+		if (!*p)
+			break;
+
+		if (n >= TRACE_MAX_ARGS) {
+			fputs("<?>", stream);
+			p++;
+			continue;
+		}
+
+		switch (*p) {
+		case 's':
+		case 'p':
+			spec[i++] = *p;
+			spec[i] = '\0';
+			fprintf(stream, spec, (void *)(uintptr_t)r->args[n++]);
+			break;
+		case 'c':
+		case 'd':
+		case 'i':
+			spec[i++] = 'l';
+			spec[i++] = 'l';
+			spec[i++] = *p == 'c' ? 'd' : *p;
+			spec[i] = '\0';
+			fprintf(stream, spec, (long long)r->args[n++]);
+			break;
+		default:
+			spec[i++] = 'l';
+			spec[i++] = 'l';
+			spec[i++] = *p;
+			spec[i] = '\0';
+			fprintf(stream, spec,
+				(unsigned long long)r->args[n++]);
+			break;
+		}
+		p++;
+	}
+
+	fputc('\n', stream);
+}
+
+void trace_dump(FILE *stream)
+{
+	const struct trace_point *tp;
+	uint64_t head, idx;
+	struct trace_rec *r;
+
+	if (!ring)
+		return;
+
+	head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+	idx = head > ring_len ? head - ring_len : 0;
+
+	fprintf(stream, "--- trace dump: %llu records ---\n",
+		(unsigned long long)(head - idx));
+	for (; idx < head; idx++) {
+		r = &ring[idx & (ring_len - 1)];
+
+		tp = __atomic_load_n(&r->tp, __ATOMIC_ACQUIRE);
+		if (!tp)
+			continue;
+
+		trace_print(stream, r, tp);
+	}
+	fprintf(stream, "--- end of trace dump ---\n");
+	fflush(stream);
+}
+
+int trace_init(unsigned int len)
+{
+	/* Round up to a power of 2 */
+	ring_len = 1;
+	while (ring_len < len)
+		ring_len <<= 1;
+
+	ring = calloc(ring_len, sizeof(*ring));
+	if (!ring) {
+		pr_err("cannot allocate the trace buffer");
+		return -1;
+	}
+
+	trace_enabled = true;
+
+	return 0;
+}
+
+void trace_cleanup(void)
+{
+	trace_enabled = false;
+	free(ring);
+	ring = NULL;
+}
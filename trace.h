@@ -0,0 +1,68 @@
+// Copyright (c) 2023 Rodolfo Giometti <giometti@enneenne.com>
+// SPDX-License-Identifier: (GPL-2.0)
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "utils.h"
+
+/*
+ * Binary trace buffer
+ *
+ * Each trace point records into a ring buffer its static descriptor, a
+ * monotonic timestamp and up to TRACE_MAX_ARGS arguments, without any
+ * formatting. The records are formatted only when the buffer is dumped.
+ *
+ * The arguments are stored as integers, so they must be integers or
+ * pointers; the %s conversion is allowed only for strings with static
+ * storage (i.e. string literals).
+ */
+
+#define TRACE_MAX_ARGS		4
+#define TRACE_DEFAULT_LEN	16384	/* records */
+
+struct trace_point {
+	const char	*fmt;
+	const char	*func;
+	int		line;
+};
+
+extern bool trace_enabled;
+
+void __trace(const struct trace_point *tp, const uint64_t *args);
+
+#define __TRACE_NARGS(...)	__TRACE_N(_, ## __VA_ARGS__, 4, 3, 2, 1, 0)
+#define __TRACE_N(_, a, b, c, d, n, ...) n
+#define __TRACE_ARG(a)		((uint64_t)(uintptr_t)(a))
+#define __TRACE_ARGS_0()
+#define __TRACE_ARGS_1(a)	__TRACE_ARG(a)
+#define __TRACE_ARGS_2(a, b)	__TRACE_ARG(a), __TRACE_ARG(b)
+#define __TRACE_ARGS_3(a, b, c)	__TRACE_ARGS_2(a, b), __TRACE_ARG(c)
+#define __TRACE_ARGS_4(a, b, c, d) __TRACE_ARGS_3(a, b, c), __TRACE_ARG(d)
+#define __TRACE_ARGS__(n, args...) __TRACE_ARGS_ ## n(args)
+#define __TRACE_ARGS_(n, args...) __TRACE_ARGS__(n, args)
+
+/* Disabled trace points cost just a (well predicted) branch */
+#define trace(_fmt, args...) do {					\
+	static const struct trace_point __tp = {			\
+		.fmt = _fmt,						\
+		.func = __func__,					\
+		.line = __LINE__,					\
+	};								\
+	if (unlikely(trace_enabled)) {					\
+		const uint64_t __a[TRACE_MAX_ARGS + 1] = {		\
+			0, __TRACE_ARGS_(__TRACE_NARGS(args), args)	\
+		};							\
+		__trace(&__tp, __a + 1);				\
+	}								\
+} while (0)
+
+int trace_init(unsigned int len);
+void trace_dump(FILE *stream);
+void trace_cleanup(void);
+
+#endif /* TRACE_H */
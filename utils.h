@@ -52,7 +52,6 @@ extern int __debug_level;
 #define __message(stream, layout, fmt, args...)                         \
         do {                                                            \
                 struct timespec t;                                      \
-                clock_gettime(CLOCK_MONOTONIC, &t);			\
                 switch (layout) {                                       \
                 case 0:                                                 \
                         fprintf(stream, "[%s] " fmt "\n", NAME, ## args);\
@@ -61,6 +60,7 @@ extern int __debug_level;
                 case 2:                                                 \
                         if (likely(__debug_level < layout))		\
 				break;					\
+			clock_gettime(CLOCK_MONOTONIC, &t);		\
 			fprintf(stream, "%ld.%09ld ", t.tv_sec, t.tv_nsec);   \
 			fprintf(stream, "[%s] %s: " fmt "\n",		\
 				NAME, __func__, ## args);		\
@@ -68,6 +68,7 @@ extern int __debug_level;
                 default:                                                \
                         if (likely(__debug_level >= layout))		\
 				break;					\
+			clock_gettime(CLOCK_MONOTONIC, &t);		\
 			fprintf(stream, "%ld.%09ld ",t.tv_sec, t.tv_nsec);   \
 			fprintf(stream, "[%s](%s@%d) %s: " fmt "\n",	\
 				NAME, __FILE__, __LINE__, __func__, ## args);\
@@ -128,11 +129,13 @@ enum mrp_ring_recovery_type {
 	MRP_RING_RECOVERY_200,
 	MRP_RING_RECOVERY_30,
 	MRP_RING_RECOVERY_10,
+	MRP_RING_RECOVERY_CUSTOM,
 };
 
 enum mrp_in_recovery_type {
 	MRP_IN_RECOVERY_500,
 	MRP_IN_RECOVERY_200,
+	MRP_IN_RECOVERY_CUSTOM,
 };
 
 enum mrp_mrm_state_type {
@@ -239,6 +242,133 @@ struct mrp_status {
 	int in_recv;
 };
 
+/* Protocol counters. Frames are counted per TLV type, types from COMMON to
+ * IN_LINK_STATUS use their own value as index, OPTION and unknown types have
+ * their own entries.
+ */
+#define MRP_TLV_IDX_OPTION	0xb
+#define MRP_TLV_IDX_UNKNOWN	0xc
+#define MRP_TLV_IDX_MAX		0xd
+
+static inline const char *tlv_idx_str(int idx)
+{
+	static const char *names[MRP_TLV_IDX_MAX] = {
+		"end", "common", "ring_test", "ring_topo", "ring_link_down",
+		"ring_link_up", "in_test", "in_topo", "in_link_down",
+		"in_link_up", "in_link_status", "option", "unknown",
+	};
+
+	return names[idx];
+}
+
+/* Ingress rate limiting classes: test frames, topology and link changes,
+ * everything else
+ */
+#define MRP_RL_TEST		0
+#define MRP_RL_CTRL		1
+#define MRP_RL_OTHER		2
+#define MRP_RL_MAX		3
+
+struct mrp_port_counters {
+	uint64_t rx[MRP_TLV_IDX_MAX];
+	uint64_t tx[MRP_TLV_IDX_MAX];
+	uint64_t rx_dropped;	/* dropped by mrp_should_drop() */
+	uint64_t rx_malformed;	/* rejected by mrp_parse_frame() */
+	uint64_t rx_duplicate;	/* forwarded but not processed again */
+	uint64_t rx_limited[MRP_RL_MAX]; /* over the ingress rate */
+	uint64_t forwarded;	/* frames forwarded on this port */
+	uint64_t link_suppressed; /* link notifications coalesced */
+};
+
+struct mrp_counters {
+	uint64_t ring_test_missed;
+	uint64_t in_test_missed;
+	uint64_t processed;
+};
+
+struct mrp_socket_stats {
+	uint64_t packet_rx;	/* frames received by the packet socket */
+	uint64_t packet_drops;	/* frames dropped by the kernel */
+	uint64_t rx_no_port;	/* frames received on a non MRP port */
+	uint64_t netlink_enobufs;
+	uint64_t netlink_resyncs;	/* link dumps after lost notifications */
+};
+
+/* Round trip of the MRP_Test frames sent by the MRM on a ring port */
+struct mrp_rtt_stats {
+	uint64_t sent;
+	uint64_t received;
+	uint64_t lost;
+	uint64_t reordered;
+	uint32_t min;		/* us */
+	uint32_t avg;		/* us */
+	uint32_t p99;		/* us, over the last received frames */
+	uint32_t max;		/* us */
+};
+
+struct mrp_stats {
+	struct mrp_counters mrp;
+	int port[3];		/* primary, secondary and interconnect port */
+	struct mrp_port_counters port_cnt[3];
+	struct mrp_rtt_stats rtt[2];	/* sent on primary, on secondary */
+	struct mrp_socket_stats sock;
+};
+
+/* Flight recorder: each MRP instance keeps the last MRP_FLIGHT_LEN state
+ * transitions, port state changes, received topology/link changes and timer
+ * expirations.
+ */
+#define MRP_FLIGHT_LEN		256
+
+enum mrp_flight_type {
+	MRP_FLIGHT_MRM_STATE,		/* value: new state */
+	MRP_FLIGHT_MRC_STATE,
+	MRP_FLIGHT_MIM_STATE,
+	MRP_FLIGHT_MIC_STATE,
+	MRP_FLIGHT_PORT_STATE,		/* port: ifindex, value: new state */
+	MRP_FLIGHT_RX_TOPO,		/* port: ifindex, value: interval ms */
+	MRP_FLIGHT_RX_LINK,		/* port: ifindex, value: TLV type */
+	MRP_FLIGHT_RX_IN_TOPO,
+	MRP_FLIGHT_RX_IN_LINK,
+	MRP_FLIGHT_TIMER,		/* value: enum mrp_flight_timer */
+};
+
+/* The test timers are recorded only when the test frame was missed */
+enum mrp_flight_timer {
+	MRP_FLIGHT_TIMER_CLEAR_FDB,
+	MRP_FLIGHT_TIMER_RING_TEST,
+	MRP_FLIGHT_TIMER_RING_TOPO,
+	MRP_FLIGHT_TIMER_RING_LINK_UP,
+	MRP_FLIGHT_TIMER_RING_LINK_DOWN,
+	MRP_FLIGHT_TIMER_IN_TEST,
+	MRP_FLIGHT_TIMER_IN_TOPO,
+	MRP_FLIGHT_TIMER_IN_LINK_UP,
+	MRP_FLIGHT_TIMER_IN_LINK_DOWN,
+	MRP_FLIGHT_TIMER_IN_LINK_STATUS,
+};
+
+struct mrp_flight_entry {
+	uint64_t ts;		/* CLOCK_MONOTONIC ns */
+	uint32_t port;
+	uint16_t type;
+	uint16_t value;
+};
+
+/* Timings overriding the ones of the recovery profiles, 0 keeps the value
+ * of the profile. The intervals are in microseconds.
+ */
+struct mrp_recovery_custom {
+	uint32_t test_interval;
+	uint32_t test_short;
+	uint32_t test_max;
+	uint32_t test_ext_max;
+	uint32_t topo_interval;
+	uint32_t topo_max;
+	uint32_t link_interval;
+	uint32_t link_max;
+	uint32_t in_test_interval;
+};
+
 #define CTL_DECLARE(name) \
 int CTL_ ## name name ## _ARGS
 
@@ -248,7 +378,7 @@ int CTL_ ## name name ## _ARGS
 		     int in_role, uint16_t in_id, int iport, int in_mode,            \
 		     uint8_t in_recv, int cfm_instance, int cfm_level,               \
 		     int cfm_mepid, int cfm_peer_mepid, char *cfm_maid,              \
-		     char *cfm_dmac)
+		     char *cfm_dmac, struct mrp_recovery_custom *recv_custom)
 struct addmrp_IN
 {
 	int br;
@@ -270,6 +400,7 @@ struct addmrp_IN
 	int cfm_peer_mepid;
 	char cfm_maid[CFM_MAID_LENGTH];
 	char cfm_dmac[ETH_ALEN];
+	struct mrp_recovery_custom recv_custom;
 };
 struct addmrp_OUT
 {
@@ -295,6 +426,7 @@ struct addmrp_OUT
      in->cfm_peer_mepid = cfm_peer_mepid;                        \
      memcpy(in->cfm_maid, cfm_maid, CFM_MAID_LENGTH);           \
      memcpy(in->cfm_dmac, cfm_dmac, ETH_ALEN);                  \
+     in->recv_custom = *recv_custom;                             \
      })
 #define addmrp_COPY_OUT ({ (void)0; })
 #define addmrp_CALL (in->br, in->ring_nr, in->pport, in->sport, in->ring_role,\
@@ -302,7 +434,7 @@ struct addmrp_OUT
 		     in->in_role, in->in_id, in->iport, in->in_mode,\
 		     in->in_recv, in->cfm_instance, in->cfm_level, \
 		     in->cfm_mepid, in->cfm_peer_mepid, in->cfm_maid, \
-		     in->cfm_dmac)
+		     in->cfm_dmac, &in->recv_custom)
 CTL_DECLARE(addmrp);
 
 #define CMD_CODE_delmrp    102
@@ -340,6 +472,167 @@ struct getmrp_OUT
 #define getmrp_CALL (&out->count, out->status)
 CTL_DECLARE(getmrp);
 
+/* Paged version of getmrp: returns at most MRP_STATUS_PAGE_LEN instances
+ * whose id is greater than cursor. If since is not zero only the instances
+ * changed after generation since are returned.
+ */
+#define MRP_STATUS_PAGE_LEN 32
+#define CMD_CODE_listmrp   104
+#define listmrp_ARGS (uint32_t cursor, uint32_t since, int *count,           \
+		      uint32_t *next, uint32_t *generation, int *total,      \
+		      struct mrp_status *status)
+struct listmrp_IN
+{
+	uint32_t cursor;
+	uint32_t since;
+};
+struct listmrp_OUT
+{
+	int count;
+	int total;
+	uint32_t next;
+	uint32_t generation;
+	struct mrp_status status[MRP_STATUS_PAGE_LEN];
+};
+#define listmrp_COPY_IN                                          \
+    ({                                                           \
+     in->cursor = cursor;                                        \
+     in->since = since;                                          \
+     })
+#define listmrp_COPY_OUT ({ *count = out->count;                 \
+    *next = out->next; *generation = out->generation;            \
+    *total = out->total;                                         \
+    memcpy(status, out->status, sizeof(struct mrp_status) * (*count)); })
+#define listmrp_CALL (in->cursor, in->since, &out->count, &out->next,    \
+		      &out->generation, &out->total, out->status)
+CTL_DECLARE(listmrp);
+
+/* Event subscription: once subscribed the client receives a message with
+ * cmd set to CMD_CODE_event and a struct mrp_event as payload for each
+ * event. The events are queued per subscriber in bounded queues, if a
+ * subscriber is too slow the newest events are dropped and counted.
+ */
+enum mrp_event_type {
+	MRP_EVENT_PORT_STATE,
+	MRP_EVENT_MRM_STATE,
+	MRP_EVENT_MRC_STATE,
+	MRP_EVENT_MIM_STATE,
+	MRP_EVENT_MIC_STATE,
+	MRP_EVENT_RING_TRANSITION,
+	MRP_EVENT_IN_TRANSITION,
+	MRP_EVENT_TOPO_CHANGE,
+	MRP_EVENT_IN_TOPO_CHANGE,
+};
+
+struct mrp_event {
+	uint64_t ts;		/* CLOCK_MONOTONIC time in ns */
+	uint32_t type;
+	uint32_t br;
+	uint32_t ring_nr;
+	uint32_t port;		/* ifindex of the port (if any) */
+	uint32_t value;		/* new state, transitions or interval in us */
+	uint32_t dropped;	/* events dropped for this subscriber so far */
+};
+
+#define CMD_CODE_subscribe   105
+#define subscribe_ARGS (void)
+struct subscribe_IN
+{
+};
+struct subscribe_OUT
+{
+};
+#define subscribe_COPY_IN ({ (void)0; })
+#define subscribe_COPY_OUT ({ (void)0; })
+CTL_DECLARE(subscribe);
+
+#define CMD_CODE_unsubscribe 106
+#define unsubscribe_ARGS (void)
+struct unsubscribe_IN
+{
+};
+struct unsubscribe_OUT
+{
+};
+#define unsubscribe_COPY_IN ({ (void)0; })
+#define unsubscribe_COPY_OUT ({ (void)0; })
+CTL_DECLARE(unsubscribe);
+
+#define CMD_CODE_event       107
+
+#define CMD_CODE_getstats  108
+#define getstats_ARGS (int br, int ring_nr, struct mrp_stats *stats)
+struct getstats_IN
+{
+	int br;
+	int ring_nr;
+};
+struct getstats_OUT
+{
+	struct mrp_stats stats;
+};
+#define getstats_COPY_IN                                         \
+    ({                                                           \
+     in->br = br;                                                \
+     in->ring_nr = ring_nr;                                      \
+     })
+#define getstats_COPY_OUT ({ *stats = out->stats; })
+#define getstats_CALL (in->br, in->ring_nr, &out->stats)
+CTL_DECLARE(getstats);
+
+#define CMD_CODE_getflight 109
+#define getflight_ARGS (int br, int ring_nr, int *count,                    \
+			struct mrp_flight_entry *entries)
+struct getflight_IN
+{
+	int br;
+	int ring_nr;
+};
+struct getflight_OUT
+{
+	int count;
+	struct mrp_flight_entry entries[MRP_FLIGHT_LEN];
+};
+#define getflight_COPY_IN                                        \
+    ({                                                           \
+     in->br = br;                                                \
+     in->ring_nr = ring_nr;                                      \
+     })
+#define getflight_COPY_OUT ({ *count = out->count;               \
+    memcpy(entries, out->entries,                                \
+	   sizeof(struct mrp_flight_entry) * (*count)); })
+#define getflight_CALL (in->br, in->ring_nr, &out->count, out->entries)
+CTL_DECLARE(getflight);
+
+/* Batch version of addmrp: all the instances are validated before adding
+ * any of them, and if one cannot be added the ones already added are
+ * deleted. The result is returned into err, and failed holds the index of
+ * the entry that caused it.
+ */
+#define MRP_BATCH_LEN 64
+#define CMD_CODE_addmrps   110
+#define addmrps_ARGS (int count, struct addmrp_IN *entries, int *err,       \
+		      int *failed)
+struct addmrps_IN
+{
+	int count;
+	struct addmrp_IN entries[MRP_BATCH_LEN];
+};
+struct addmrps_OUT
+{
+	int err;
+	int failed;
+};
+#define addmrps_COPY_IN                                          \
+    ({                                                           \
+     in->count = count;                                          \
+     memcpy(in->entries, entries,                                \
+	    sizeof(struct addmrp_IN) * count);                   \
+     })
+#define addmrps_COPY_OUT ({ *err = out->err; *failed = out->failed; })
+#define addmrps_CALL (in->count, in->entries, &out->err, &out->failed)
+CTL_DECLARE(addmrps);
+
 #define CLIENT_SIDE_FUNCTION(name)                               \
 CTL_DECLARE(name)                                                \
 {                                                                \